@@ -602,6 +602,7 @@ extern const char	*cupsHashString(const unsigned char *hash, size_t hashsize, ch
 
 /* New in CUPS 2.3 */
 extern int		cupsAddDestMediaOptions(http_t *http, cups_dest_t *dest, cups_dinfo_t *dinfo, unsigned flags, cups_size_t *size, int num_options, cups_option_t **options) _CUPS_API_2_3;
+extern int		cupsDoRequests(http_t *http, int num_requests, ipp_t **requests, const char *resource, ipp_t **responses) _CUPS_API_2_3;
 extern ipp_attribute_t	*cupsEncodeOption(ipp_t *ipp, ipp_tag_t group_tag, const char *name, const char *value) _CUPS_API_2_3;
 
 #  ifdef __cplusplus
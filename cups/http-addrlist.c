@@ -25,6 +25,92 @@
 #endif /* _WIN32 */
 
 
+/*
+ * '_httpAddrConnectStart()' - Start a non-blocking connection to an address.
+ *
+ * The new socket is left in non-blocking mode.  When 0 is returned, the
+ * connection is complete once the socket becomes writable and SO_ERROR is 0.
+ */
+
+int					/* O - 1 if connected, 0 if in progress, -1 on error */
+_httpAddrConnectStart(
+    http_addrlist_t *addr,		/* I - Address */
+    int             *sock)		/* O - Socket */
+{
+  int	val;				/* Socket option value */
+#ifdef O_NONBLOCK
+  int	flags;				/* Socket flags */
+#endif /* O_NONBLOCK */
+
+
+  if ((*sock = (int)socket(httpAddrFamily(&(addr->addr)), SOCK_STREAM, 0)) < 0)
+    return (-1);
+
+ /*
+  * Set options...
+  */
+
+  val = 1;
+  setsockopt(*sock, SOL_SOCKET, SO_REUSEADDR, CUPS_SOCAST &val, sizeof(val));
+
+#ifdef SO_REUSEPORT
+  val = 1;
+  setsockopt(*sock, SOL_SOCKET, SO_REUSEPORT, CUPS_SOCAST &val, sizeof(val));
+#endif /* SO_REUSEPORT */
+
+#ifdef SO_NOSIGPIPE
+  val = 1;
+  setsockopt(*sock, SOL_SOCKET, SO_NOSIGPIPE, CUPS_SOCAST &val, sizeof(val));
+#endif /* SO_NOSIGPIPE */
+
+ /*
+  * Using TCP_NODELAY improves responsiveness, especially on systems
+  * with a slow loopback interface...
+  */
+
+  val = 1;
+  setsockopt(*sock, IPPROTO_TCP, TCP_NODELAY, CUPS_SOCAST &val, sizeof(val));
+
+#ifdef FD_CLOEXEC
+ /*
+  * Close this socket when starting another process...
+  */
+
+  fcntl(*sock, F_SETFD, FD_CLOEXEC);
+#endif /* FD_CLOEXEC */
+
+#ifdef O_NONBLOCK
+ /*
+  * Do an asynchronous connect by setting the socket non-blocking...
+  */
+
+  flags = fcntl(*sock, F_GETFL, 0);
+  fcntl(*sock, F_SETFL, flags | O_NONBLOCK);
+#endif /* O_NONBLOCK */
+
+ /*
+  * Then connect...
+  */
+
+  if (!connect(*sock, &(addr->addr.addr), (socklen_t)httpAddrLength(&(addr->addr))))
+    return (1);
+
+#ifdef _WIN32
+  if (WSAGetLastError() == WSAEINPROGRESS || WSAGetLastError() == WSAEWOULDBLOCK)
+#else
+  if (errno == EINPROGRESS || errno == EWOULDBLOCK)
+#endif /* _WIN32 */
+    return (0);
+
+  val = errno;
+  httpAddrClose(NULL, *sock);
+  *sock = -1;
+  errno = val;
+
+  return (-1);
+}
+
+
 /*
  * 'httpAddrConnect()' - Connect to any of the addresses in the list.
  *
@@ -56,12 +142,11 @@ httpAddrConnect2(
     int             msec,		/* I - Timeout in milliseconds */
     int             *cancel)		/* I - Pointer to "cancel" variable */
 {
-  int			val;		/* Socket option value */
 #ifndef _WIN32
   int			i, j,		/* Looping vars */
-			flags,		/* Socket flags */
-			result;		/* Result from select() or poll() */
+			flags;		/* Socket flags */
 #endif /* !_WIN32 */
+  int			result;		/* Result from connect, select() or poll() */
   int			remaining;	/* Remaining timeout */
   int			nfds,		/* Number of file descriptors */
 			fds[100];	/* Socket file descriptors */
@@ -126,12 +211,12 @@ httpAddrConnect2(
     if (addrlist && nfds < (int)(sizeof(fds) / sizeof(fds[0])))
     {
      /*
-      * Create the socket...
+      * Create the socket and start connecting...
       */
 
       DEBUG_printf(("2httpAddrConnect2: Trying %s:%d...", httpAddrString(&(addrlist->addr), temp, sizeof(temp)), httpAddrPort(&(addrlist->addr))));
 
-      if ((fds[nfds] = (int)socket(httpAddrFamily(&(addrlist->addr)), SOCK_STREAM, 0)) < 0)
+      if ((result = _httpAddrConnectStart(addrlist, fds + nfds)) < 0)
       {
        /*
 	* Don't abort yet, as this could just be an issue with the local
@@ -140,66 +225,20 @@ httpAddrConnect2(
 	* Just skip this address...
 	*/
 
+	DEBUG_printf(("1httpAddrConnect2: Unable to connect to %s:%d: %s", httpAddrString(&(addrlist->addr), temp, sizeof(temp)), httpAddrPort(&(addrlist->addr)), strerror(errno)));
         addrlist = addrlist->next;
 	continue;
       }
 
-     /*
-      * Set options...
-      */
-
-      val = 1;
-      setsockopt(fds[nfds], SOL_SOCKET, SO_REUSEADDR, CUPS_SOCAST &val, sizeof(val));
-
-#ifdef SO_REUSEPORT
-      val = 1;
-      setsockopt(fds[nfds], SOL_SOCKET, SO_REUSEPORT, CUPS_SOCAST &val, sizeof(val));
-#endif /* SO_REUSEPORT */
-
-#ifdef SO_NOSIGPIPE
-      val = 1;
-      setsockopt(fds[nfds], SOL_SOCKET, SO_NOSIGPIPE, CUPS_SOCAST &val, sizeof(val));
-#endif /* SO_NOSIGPIPE */
-
-     /*
-      * Using TCP_NODELAY improves responsiveness, especially on systems
-      * with a slow loopback interface...
-      */
-
-      val = 1;
-      setsockopt(fds[nfds], IPPROTO_TCP, TCP_NODELAY, CUPS_SOCAST &val, sizeof(val));
-
-#ifdef FD_CLOEXEC
-     /*
-      * Close this socket when starting another process...
-      */
-
-      fcntl(fds[nfds], F_SETFD, FD_CLOEXEC);
-#endif /* FD_CLOEXEC */
-
 #ifdef O_NONBLOCK
-     /*
-      * Do an asynchronous connect by setting the socket non-blocking...
-      */
-
-      DEBUG_printf(("httpAddrConnect2: Setting non-blocking connect()"));
-
       flags = fcntl(fds[nfds], F_GETFL, 0);
-      fcntl(fds[nfds], F_SETFL, flags | O_NONBLOCK);
+      fcntl(fds[nfds], F_SETFL, flags & ~O_NONBLOCK);
 #endif /* O_NONBLOCK */
 
-     /*
-      * Then connect...
-      */
-
-      if (!connect(fds[nfds], &(addrlist->addr.addr), (socklen_t)httpAddrLength(&(addrlist->addr))))
+      if (result > 0)
       {
 	DEBUG_printf(("1httpAddrConnect2: Connected to %s:%d...", httpAddrString(&(addrlist->addr), temp, sizeof(temp)), httpAddrPort(&(addrlist->addr))));
 
-#ifdef O_NONBLOCK
-	fcntl(fds[nfds], F_SETFL, flags);
-#endif /* O_NONBLOCK */
-
 	*sock = fds[nfds];
 
 	while (nfds > 0)
@@ -211,22 +250,6 @@ httpAddrConnect2(
 	return (addrlist);
       }
 
-#ifdef _WIN32
-      if (WSAGetLastError() != WSAEINPROGRESS && WSAGetLastError() != WSAEWOULDBLOCK)
-#else
-      if (errno != EINPROGRESS && errno != EWOULDBLOCK)
-#endif /* _WIN32 */
-      {
-	DEBUG_printf(("1httpAddrConnect2: Unable to connect to %s:%d: %s", httpAddrString(&(addrlist->addr), temp, sizeof(temp)), httpAddrPort(&(addrlist->addr)), strerror(errno)));
-	httpAddrClose(NULL, fds[nfds]);
-	addrlist = addrlist->next;
-	continue;
-      }
-
-#ifndef _WIN32
-      fcntl(fds[nfds], F_SETFL, flags);
-#endif /* !_WIN32 */
-
 #ifndef HAVE_POLL
       if (fds[nfds] > max_fd)
 	max_fd = fds[nfds];
@@ -116,6 +116,7 @@ extern "C" {
  * Constants...
  */
 
+#  define _HTTP_MAX_FBUFFER	8192	/* Size of field value arena */
 #  define _HTTP_MAX_SBUFFER	65536	/* Size of (de)compression buffer */
 #  define _HTTP_RESOLVE_DEFAULT	0	/* Just resolve with default options */
 #  define _HTTP_RESOLVE_STDERR	1	/* Log resolve progress to stderr */
@@ -135,6 +136,9 @@ extern "C" {
 #  define _HTTP_TLS_1_3		4	/* Min/max version is TLS/1.3 */
 #  define _HTTP_TLS_MAX		5	/* Highest known TLS version */
 
+#  define _HTTP_TLS_CACHE_MAX	1024	/* Maximum number of cached TLS sessions */
+#  define _HTTP_TLS_TICKET_LIFE	3600	/* Seconds before session ticket key is rotated */
+
 
 /*
  * Types and functions for SSL support...
@@ -201,6 +205,14 @@ typedef enum _http_coding_e		/**** HTTP content coding enumeration ****/
   _HTTP_CODING_INFLATE			/* LZ77+zlib decompression */
 } _http_coding_t;
 
+typedef struct _http_tls_stats_s	/**** TLS session resumption statistics ****/
+{
+  unsigned		client_hits,	/* Client sessions resumed */
+			client_misses,	/* Client sessions with a full handshake */
+			server_hits,	/* Server sessions resumed */
+			server_misses;	/* Server sessions with a full handshake */
+} _http_tls_stats_t;
+
 typedef enum _http_mode_e		/**** HTTP mode enumeration ****/
 {
   _HTTP_MODE_CLIENT,			/* Client connected to server */
@@ -219,10 +231,8 @@ struct _http_s				/**** HTTP connection structure ****/
   http_version_t	version;	/* Protocol version */
   http_keepalive_t	keep_alive;	/* Keep-alive supported? */
   struct sockaddr_in	_hostaddr;	/* Address of connected host (deprecated) */
-  char			hostname[HTTP_MAX_HOST],
+  char			hostname[HTTP_MAX_HOST];
   					/* Name of connected host */
-			_fields[HTTP_FIELD_ACCEPT_ENCODING][HTTP_MAX_VALUE];
-					/* Field values up to Accept-Encoding (deprecated) */
   char			*data;		/* Pointer to data buffer */
   http_encoding_t	data_encoding;	/* Chunked or not */
   int			_data_remaining;/* Number of bytes left (deprecated) */
@@ -302,6 +312,13 @@ struct _http_s				/**** HTTP connection structure ****/
 					/* Allocated field values */
   			*default_fields[HTTP_FIELD_MAX];
 					/* Default field values, if any */
+  char			fbuffer[_HTTP_MAX_FBUFFER];
+					/* Arena for field values */
+  size_t		fused;		/* Bytes used in field arena */
+  http_connect_state_t	connect_state;	/* Asynchronous connection state */
+  http_addrlist_t	*connect_addr;	/* Address being connected */
+  http_connect_cb_t	connect_cb;	/* Asynchronous connection callback */
+  void			*connect_data;	/* Callback data */
 };
 #  endif /* !_HTTP_NO_PRIVATE */
 
@@ -320,6 +337,7 @@ extern const char *_cups_hstrerror(int error);
  * Prototypes...
  */
 
+extern int		_httpAddrConnectStart(http_addrlist_t *addr, int *sock) _CUPS_PRIVATE;
 extern void		_httpAddrSetPort(http_addr_t *addr, int port) _CUPS_PRIVATE;
 extern http_tls_credentials_t
 			_httpCreateCredentials(cups_array_t *credentials) _CUPS_PRIVATE;
@@ -337,6 +355,8 @@ extern int		_httpSetDigestAuthString(http_t *http, const char *nonce, const char
 extern const char	*_httpStatus(cups_lang_t *lang, http_status_t status) _CUPS_PRIVATE;
 extern void		_httpTLSInitialize(void) _CUPS_PRIVATE;
 extern size_t		_httpTLSPending(http_t *http) _CUPS_PRIVATE;
+extern void		_httpTLSGetStats(_http_tls_stats_t *stats) _CUPS_PRIVATE;
+extern int		_httpTLSHandshake(http_t *http, int *want_write) _CUPS_PRIVATE;
 extern int		_httpTLSRead(http_t *http, char *buf, int len) _CUPS_PRIVATE;
 extern void		_httpTLSSetOptions(int options, int min_version, int max_version) _CUPS_PRIVATE;
 extern int		_httpTLSStart(http_t *http) _CUPS_PRIVATE;
@@ -44,6 +44,7 @@ static void		http_content_coding_finish(http_t *http);
 static void		http_content_coding_start(http_t *http,
 						  const char *value);
 #endif /* HAVE_LIBZ */
+static http_connect_state_t http_connect_done(http_t *http, http_connect_state_t state);
 static http_t		*http_create(const char *host, int port,
 			             http_addrlist_t *addrlist, int family,
 				     http_encryption_t encryption,
@@ -52,9 +53,15 @@ static http_t		*http_create(const char *host, int port,
 static void		http_debug_hex(const char *prefix, const char *buffer,
 			               int bytes);
 #endif /* DEBUG */
+static void		http_end_content(http_t *http);
+static void		http_free_value(http_t *http, char *value);
 static ssize_t		http_read(http_t *http, char *buffer, size_t length);
 static ssize_t		http_read_buffered(http_t *http, char *buffer, size_t length);
 static ssize_t		http_read_chunk(http_t *http, char *buffer, size_t length);
+#ifdef HAVE_SPLICE
+static off_t		http_read_splice(http_t *http, int fd, int *use_splice);
+#endif /* HAVE_SPLICE */
+static void		http_reset(http_t *http);
 static int		http_send(http_t *http, http_state_t request,
 			          const char *uri);
 static ssize_t		http_write(http_t *http, const char *buffer,
@@ -64,6 +71,7 @@ static ssize_t		http_write_chunk(http_t *http, const char *buffer,
 static off_t		http_set_length(http_t *http);
 static void		http_set_timeout(int fd, double timeout);
 static void		http_set_wait(http_t *http);
+static int		http_write_fd(int fd, const char *buffer, size_t length);
 
 #ifdef HAVE_SSL
 static int		http_tls_upgrade(http_t *http);
@@ -295,16 +303,14 @@ httpClearFields(http_t *http)		/* I - HTTP connection */
 
   if (http)
   {
-    memset(http->_fields, 0, sizeof(http->fields));
-
     for (field = HTTP_FIELD_ACCEPT_LANGUAGE; field < HTTP_FIELD_MAX; field ++)
     {
-      if (http->fields[field] && http->fields[field] != http->_fields[field])
-        free(http->fields[field]);
-
+      http_free_value(http, http->fields[field]);
       http->fields[field] = NULL;
     }
 
+    http->fused = 0;
+
     if (http->mode == _HTTP_MODE_CLIENT)
     {
       if (http->hostname[0] == '/')
@@ -585,14 +591,145 @@ httpError(http_t *http)			/* I - HTTP connection */
 http_field_t				/* O - Field index */
 httpFieldValue(const char *name)	/* I - String name */
 {
-  int	i;				/* Looping var */
+  http_field_t	field;			/* Candidate field */
 
 
-  for (i = 0; i < HTTP_FIELD_MAX; i ++)
-    if (!_cups_strcasecmp(name, http_fields[i]))
-      return ((http_field_t)i);
+  if (!name)
+    return (HTTP_FIELD_UNKNOWN);
+
+ /*
+  * The length and one character of the name are enough to pick the only
+  * possible match, so just confirm that candidate rather than comparing
+  * against every field name...
+  */
+
+  switch (strlen(name))
+  {
+    case 4 :
+        switch (_cups_tolower(name[0]))
+	{
+	  case 'd' :
+	      field = HTTP_FIELD_DATE;
+	      break;
+	  case 'h' :
+	      field = HTTP_FIELD_HOST;
+	      break;
+	  case 'l' :
+	      field = HTTP_FIELD_LINK;
+	      break;
+	  default :
+	      return (HTTP_FIELD_UNKNOWN);
+	}
+        break;
+
+    case 5 :
+        field = _cups_tolower(name[0]) == 'a' ? HTTP_FIELD_ALLOW : HTTP_FIELD_RANGE;
+        break;
+
+    case 6 :
+        field = HTTP_FIELD_SERVER;
+        break;
+
+    case 7 :
+        field = _cups_tolower(name[0]) == 'u' ? HTTP_FIELD_UPGRADE : HTTP_FIELD_REFERER;
+        break;
+
+    case 8 :
+        field = HTTP_FIELD_LOCATION;
+        break;
+
+    case 10 :
+        switch (_cups_tolower(name[0]))
+	{
+	  case 'c' :
+	      field = HTTP_FIELD_CONNECTION;
+	      break;
+	  case 'k' :
+	      field = HTTP_FIELD_KEEP_ALIVE;
+	      break;
+	  case 'u' :
+	      field = HTTP_FIELD_USER_AGENT;
+	      break;
+	  default :
+	      return (HTTP_FIELD_UNKNOWN);
+	}
+        break;
+
+    case 11 :
+        field = _cups_tolower(name[0]) == 'r' ? HTTP_FIELD_RETRY_AFTER : HTTP_FIELD_CONTENT_MD5;
+        break;
+
+    case 12 :
+        field = HTTP_FIELD_CONTENT_TYPE;
+        break;
+
+    case 13 :
+        switch (_cups_tolower(name[0]))
+	{
+	  case 'a' :
+	      field = _cups_tolower(name[1]) == 'u' ? HTTP_FIELD_AUTHORIZATION : HTTP_FIELD_ACCEPT_RANGES;
+	      break;
+	  case 'c' :
+	      field = HTTP_FIELD_CONTENT_RANGE;
+	      break;
+	  case 'l' :
+	      field = HTTP_FIELD_LAST_MODIFIED;
+	      break;
+	  default :
+	      return (HTTP_FIELD_UNKNOWN);
+	}
+        break;
 
-  return (HTTP_FIELD_UNKNOWN);
+    case 14 :
+        field = HTTP_FIELD_CONTENT_LENGTH;
+        break;
+
+    case 15 :
+        if (_cups_tolower(name[0]) == 'c')
+	  field = HTTP_FIELD_CONTENT_VERSION;
+	else
+	  field = _cups_tolower(name[7]) == 'e' ? HTTP_FIELD_ACCEPT_ENCODING : HTTP_FIELD_ACCEPT_LANGUAGE;
+        break;
+
+    case 16 :
+        if (_cups_tolower(name[0]) == 'w')
+	{
+	  field = HTTP_FIELD_WWW_AUTHENTICATE;
+	  break;
+	}
+
+        switch (_cups_tolower(name[9]))
+	{
+	  case 'a' :
+	      field = HTTP_FIELD_CONTENT_LANGUAGE;
+	      break;
+	  case 'n' :
+	      field = HTTP_FIELD_CONTENT_ENCODING;
+	      break;
+	  case 'o' :
+	      field = HTTP_FIELD_CONTENT_LOCATION;
+	      break;
+	  default :
+	      return (HTTP_FIELD_UNKNOWN);
+	}
+        break;
+
+    case 17 :
+        field = _cups_tolower(name[0]) == 't' ? HTTP_FIELD_TRANSFER_ENCODING : HTTP_FIELD_IF_MODIFIED_SINCE;
+        break;
+
+    case 19 :
+        field = _cups_tolower(name[0]) == 'a' ? HTTP_FIELD_AUTHENTICATION_INFO : HTTP_FIELD_IF_UNMODIFIED_SINCE;
+        break;
+
+    default :
+        return (HTTP_FIELD_UNKNOWN);
+  }
+
+  if (_cups_strcasecmp(name, http_fields[field]))
+    return (HTTP_FIELD_UNKNOWN);
+
+  return (field);
 }
 
 
@@ -1158,9 +1295,13 @@ httpGets(char   *line,			/* I - Line to read into */
     while (http->used == 0)
     {
      /*
-      * No newline; see if there is more data to be read...
+      * No newline; send any pending (pipelined) output and see if there is
+      * more data to be read...
       */
 
+      if (http->wused && httpFlushWrite(http) < 0)
+        return (NULL);
+
       while (!_httpWait(http, http->wait_value, 1))
       {
 	if (http->timeout_cb && (*http->timeout_cb)(http, http->timeout_data))
@@ -2110,23 +2251,7 @@ httpRead2(http_t *http,			/* I - HTTP connection */
       ((http->data_remaining <= 0 &&
         http->data_encoding == HTTP_ENCODING_LENGTH) ||
        (http->data_encoding == HTTP_ENCODING_CHUNKED && bytes == 0)))
-  {
-#ifdef HAVE_LIBZ
-    if (http->coding >= _HTTP_CODING_GUNZIP)
-      http_content_coding_finish(http);
-#endif /* HAVE_LIBZ */
-
-    if (http->state == HTTP_STATE_POST_RECV)
-      http->state ++;
-    else if (http->state == HTTP_STATE_GET_SEND ||
-             http->state == HTTP_STATE_POST_SEND)
-      http->state = HTTP_STATE_WAITING;
-    else
-      http->state = HTTP_STATE_STATUS;
-
-    DEBUG_printf(("1httpRead2: End of content, set state to %s.",
-		  httpStateString(http->state)));
-  }
+    http_end_content(http);
 
   return (bytes);
 }
@@ -2294,6 +2419,100 @@ httpReadRequest(http_t *http,		/* I - HTTP connection */
 }
 
 
+/*
+ * 'httpReadToFd()' - Copy the remaining message body to a file descriptor.
+ *
+ * This function reads the rest of the current message body and writes it to
+ * the specified file descriptor.  When the body has a known length and no
+ * content or transfer coding is applied, the file is preallocated and the data
+ * is moved from the socket to the file without copying it through user space
+ * where the platform supports it.  Otherwise the data is copied using
+ * @link httpRead2@.
+ *
+ * -1 is returned on error.  If the message body could not be read,
+ * @link httpError@ returns the read error; otherwise the file could not be
+ * written and `errno` contains the write error.
+ *
+ * @since CUPS 2.3@
+ */
+
+off_t					/* O - Number of bytes copied or -1 on error */
+httpReadToFd(http_t *http,		/* I - HTTP connection */
+             int    fd)			/* I - File to write to */
+{
+  off_t		total = 0;		/* Total bytes copied */
+  ssize_t	bytes;			/* Bytes read */
+  char		buffer[32768];		/* Copy buffer */
+#ifdef HAVE_SPLICE
+  off_t		spliced;		/* Bytes spliced */
+  int		use_splice = 1;		/* Use splice()? */
+#endif /* HAVE_SPLICE */
+
+
+  DEBUG_printf(("httpReadToFd(http=%p, fd=%d) data_encoding=%d data_remaining=" CUPS_LLFMT, (void *)http, fd, http ? http->data_encoding : 0, CUPS_LLCAST (http ? http->data_remaining : 0)));
+
+  if (!http || fd < 0)
+    return (-1);
+
+  http->activity = time(NULL);
+  http->error    = 0;
+
+  if (http->data_encoding == HTTP_ENCODING_LENGTH && http->data_remaining > 0
+#ifdef HAVE_LIBZ
+      && http->coding == _HTTP_CODING_IDENTITY
+#endif /* HAVE_LIBZ */
+      )
+  {
+#ifdef HAVE_FALLOCATE
+   /*
+    * Reserve space for the message body up front so that the file does not get
+    * fragmented as it grows.  Errors are ignored since this is only a hint...
+    */
+
+    off_t	offset;			/* Current file offset */
+
+    if ((offset = lseek(fd, 0, SEEK_CUR)) >= 0)
+      fallocate(fd, FALLOC_FL_KEEP_SIZE, offset, http->data_remaining);
+#endif /* HAVE_FALLOCATE */
+
+#ifdef HAVE_SPLICE
+    if (!http->tls)
+    {
+      if ((spliced = http_read_splice(http, fd, &use_splice)) < 0)
+        return (-1);
+
+      total += spliced;
+
+      if (http->data_remaining <= 0)
+      {
+        http_end_content(http);
+        return (total);
+      }
+    }
+#endif /* HAVE_SPLICE */
+  }
+
+ /*
+  * Copy whatever is left using buffered reads...
+  */
+
+  while ((bytes = httpRead2(http, buffer, sizeof(buffer))) > 0)
+  {
+    if (http_write_fd(fd, buffer, (size_t)bytes) < 0)
+      return (-1);
+
+    total += bytes;
+  }
+
+  if (bytes < 0)
+    return (-1);
+
+  DEBUG_printf(("1httpReadToFd: Copied " CUPS_LLFMT " bytes.", CUPS_LLCAST total));
+
+  return (total);
+}
+
+
 /*
  * 'httpReconnect()' - Reconnect to a HTTP server.
  *
@@ -2337,41 +2556,9 @@ httpReconnect2(http_t *http,		/* I - HTTP connection */
     return (-1);
   }
 
-#ifdef HAVE_SSL
-  if (http->tls)
-  {
-    DEBUG_puts("2httpReconnect2: Shutting down SSL/TLS...");
-    _httpTLSStop(http);
-  }
-#endif /* HAVE_SSL */
+  http_reset(http);
 
- /*
-  * Close any previously open socket...
-  */
-
-  if (http->fd >= 0)
-  {
-    DEBUG_printf(("2httpReconnect2: Closing socket %d...", http->fd));
-
-    httpAddrClose(NULL, http->fd);
-
-    http->fd = -1;
-  }
-
- /*
-  * Reset all state (except fields, which may be reused)...
-  */
-
-  http->state           = HTTP_STATE_WAITING;
-  http->version         = HTTP_VERSION_1_1;
-  http->keep_alive      = HTTP_KEEPALIVE_OFF;
-  memset(&http->_hostaddr, 0, sizeof(http->_hostaddr));
-  http->data_encoding   = HTTP_ENCODING_FIELDS;
-  http->_data_remaining = 0;
-  http->used            = 0;
-  http->data_remaining  = 0;
-  http->hostaddr        = NULL;
-  http->wused           = 0;
+  http->connect_state = HTTP_CONNECT_STATE_CONNECTED;
 
  /*
   * Connect to the server...
@@ -2437,6 +2624,227 @@ httpReconnect2(http_t *http,		/* I - HTTP connection */
 }
 
 
+/*
+ * 'httpReconnectAsync()' - Start an asynchronous reconnection to a HTTP server.
+ *
+ * This function closes any existing connection and returns immediately.  The
+ * connection is then driven by calling @link httpReconnectStep@ whenever the
+ * socket returned by @link httpGetFd@ has the poll events it reports, so that
+ * a single thread can open many connections at once.
+ *
+ * Create the connection with @link httpConnect2@ using a "msec" value of 0 or
+ * with @link cupsConnectDest@ using the @code CUPS_DEST_FLAGS_UNCONNECTED@
+ * flag.  The callback, if any, is called once from @link httpReconnectStep@
+ * with @code HTTP_CONNECT_STATE_CONNECTED@ or @code HTTP_CONNECT_STATE_ERROR@.
+ *
+ * @since CUPS 2.3@
+ */
+
+int					/* O - 0 on success, -1 on error */
+httpReconnectAsync(
+    http_t            *http,		/* I - HTTP connection */
+    http_connect_cb_t cb,		/* I - Callback function or @code NULL@ */
+    void              *user_data)	/* I - User data pointer */
+{
+  DEBUG_printf(("httpReconnectAsync(http=%p, cb=%p, user_data=%p)", (void *)http, (void *)cb, user_data));
+
+  if (!http)
+  {
+    _cupsSetError(IPP_STATUS_ERROR_INTERNAL, strerror(EINVAL), 0);
+    return (-1);
+  }
+
+  http_reset(http);
+
+  http->connect_state = HTTP_CONNECT_STATE_CONNECTING;
+  http->connect_addr  = http->addrlist;
+  http->connect_cb    = cb;
+  http->connect_data  = user_data;
+
+  return (0);
+}
+
+
+/*
+ * 'httpReconnectStep()' - Continue an asynchronous reconnection.
+ *
+ * This function never blocks, except for the HTTP Upgrade exchange used with
+ * @code HTTP_ENCRYPTION_REQUIRED@.  While the connection is in progress the
+ * "events" argument is set to @code POLLIN@ or @code POLLOUT@ - wait for
+ * that event on @link httpGetFd@ and then call this function again.
+ *
+ * @since CUPS 2.3@
+ */
+
+http_connect_state_t			/* O - Connection state */
+httpReconnectStep(http_t *http,		/* I - HTTP connection */
+                  short  *events)	/* O - Poll events to wait for or 0 when done */
+{
+  int		result;			/* Result of connect or handshake */
+  int		sockerr;		/* Socket error */
+  socklen_t	len;			/* Length of socket error */
+#ifdef HAVE_POLL
+  struct pollfd	pfd;			/* Polled file descriptor */
+#else
+  fd_set	output_set;		/* select() output set */
+  struct timeval timeout;		/* Timeout */
+#endif /* HAVE_POLL */
+#ifdef HAVE_SSL
+  int		want_write;		/* Handshake needs a writable socket? */
+#endif /* HAVE_SSL */
+
+
+  DEBUG_printf(("httpReconnectStep(http=%p, events=%p)", (void *)http, (void *)events));
+
+  if (events)
+    *events = 0;
+
+  if (!http)
+  {
+    _cupsSetError(IPP_STATUS_ERROR_INTERNAL, strerror(EINVAL), 0);
+    return (HTTP_CONNECT_STATE_ERROR);
+  }
+
+  while (http->connect_state == HTTP_CONNECT_STATE_CONNECTING)
+  {
+    if (http->fd < 0)
+    {
+     /*
+      * Start connecting to the next address...
+      */
+
+      if (!http->connect_addr)
+      {
+#ifdef _WIN32
+	WSASetLastError(WSAEHOSTDOWN);
+#else
+	errno = EHOSTDOWN;
+#endif /* _WIN32 */
+
+        return (http_connect_done(http, HTTP_CONNECT_STATE_ERROR));
+      }
+
+      if ((result = _httpAddrConnectStart(http->connect_addr, &http->fd)) < 0)
+      {
+        http->connect_addr = http->connect_addr->next;
+        continue;
+      }
+    }
+    else
+    {
+     /*
+      * See if the pending connect has finished...
+      */
+
+#ifdef HAVE_POLL
+      pfd.fd     = http->fd;
+      pfd.events = POLLOUT;
+
+      result = poll(&pfd, 1, 0);
+#else
+      FD_ZERO(&output_set);
+      FD_SET(http->fd, &output_set);
+
+      timeout.tv_sec  = 0;
+      timeout.tv_usec = 0;
+
+      result = select(http->fd + 1, NULL, &output_set, NULL, &timeout);
+#endif /* HAVE_POLL */
+
+      if (result > 0)
+      {
+        len = sizeof(sockerr);
+
+        if (getsockopt(http->fd, SOL_SOCKET, SO_ERROR, CUPS_SOCAST &sockerr, &len))
+          sockerr = errno;
+
+        if (sockerr)
+        {
+	  DEBUG_printf(("2httpReconnectStep: Unable to connect: %s", strerror(sockerr)));
+
+	  httpAddrClose(NULL, http->fd);
+
+	  http->fd           = -1;
+	  http->connect_addr = http->connect_addr->next;
+	  errno              = sockerr;
+	  continue;
+        }
+      }
+      else
+        result = 0;
+    }
+
+    if (!result)
+    {
+      if (events)
+        *events = POLLOUT;
+
+      return (HTTP_CONNECT_STATE_CONNECTING);
+    }
+
+   /*
+    * Connected...
+    */
+
+    DEBUG_printf(("2httpReconnectStep: New socket=%d", http->fd));
+
+    if (http->timeout_value > 0)
+      http_set_timeout(http->fd, http->timeout_value);
+
+    http->hostaddr = &(http->connect_addr->addr);
+    http->error    = 0;
+
+#ifdef HAVE_SSL
+    if (http->encryption == HTTP_ENCRYPTION_ALWAYS)
+    {
+      http->connect_state = HTTP_CONNECT_STATE_HANDSHAKE;
+      break;
+    }
+#endif /* HAVE_SSL */
+
+#ifdef O_NONBLOCK
+    fcntl(http->fd, F_SETFL, fcntl(http->fd, F_GETFL, 0) & ~O_NONBLOCK);
+#endif /* O_NONBLOCK */
+
+#ifdef HAVE_SSL
+    if (http->encryption == HTTP_ENCRYPTION_REQUIRED && !http->tls_upgrade && http_tls_upgrade(http))
+      return (http_connect_done(http, HTTP_CONNECT_STATE_ERROR));
+#endif /* HAVE_SSL */
+
+    return (http_connect_done(http, HTTP_CONNECT_STATE_CONNECTED));
+  }
+
+#ifdef HAVE_SSL
+  if (http->connect_state == HTTP_CONNECT_STATE_HANDSHAKE)
+  {
+    if ((result = _httpTLSHandshake(http, &want_write)) == 0)
+    {
+      if (events)
+        *events = want_write ? POLLOUT : POLLIN;
+
+      return (HTTP_CONNECT_STATE_HANDSHAKE);
+    }
+    else if (result < 0)
+    {
+      httpAddrClose(NULL, http->fd);
+
+      http->fd = -1;
+
+      return (http_connect_done(http, HTTP_CONNECT_STATE_ERROR));
+    }
+
+#ifdef O_NONBLOCK
+    fcntl(http->fd, F_SETFL, fcntl(http->fd, F_GETFL, 0) & ~O_NONBLOCK);
+#endif /* O_NONBLOCK */
+
+    return (http_connect_done(http, HTTP_CONNECT_STATE_CONNECTED));
+  }
+#endif /* HAVE_SSL */
+
+  return (http->connect_state);
+}
+
+
 /*
  * 'httpSetAuthString()' - Set the current authorization string.
  *
@@ -2870,7 +3278,14 @@ _httpUpdate(http_t        *http,	/* I - HTTP connection */
     * Be tolerants of servers that send unknown attribute fields...
     */
 
-    if (!_cups_strcasecmp(line, "expect"))
+    if ((field = httpFieldValue(line)) != HTTP_FIELD_UNKNOWN)
+    {
+      http_add_field(http, field, value, 1);
+
+      if (field == HTTP_FIELD_AUTHENTICATION_INFO)
+        httpGetSubField2(http, HTTP_FIELD_AUTHENTICATION_INFO, "nextnonce", http->nextnonce, (int)sizeof(http->nextnonce));
+    }
+    else if (!_cups_strcasecmp(line, "expect"))
     {
      /*
       * "Expect: 100-continue" or similar...
@@ -2886,13 +3301,6 @@ _httpUpdate(http_t        *http,	/* I - HTTP connection */
 
       httpSetCookie(http, value);
     }
-    else if ((field = httpFieldValue(line)) != HTTP_FIELD_UNKNOWN)
-    {
-      http_add_field(http, field, value, 1);
-
-      if (field == HTTP_FIELD_AUTHENTICATION_INFO)
-        httpGetSubField2(http, HTTP_FIELD_AUTHENTICATION_INFO, "nextnonce", http->nextnonce, (int)sizeof(http->nextnonce));
-    }
 #ifdef DEBUG
     else
       DEBUG_printf(("1_httpUpdate: unknown field %s seen!", line));
@@ -3282,7 +3690,13 @@ httpWrite2(http_t     *http,		/* I - HTTP connection */
       http_content_coding_finish(http);
 #endif /* HAVE_LIBZ */
 
-    if (http->wused)
+   /*
+    * When serving pipelined requests, leave a complete (non-chunked) response
+    * in the write buffer if the next request has already been received - the
+    * buffer is flushed when it fills up or before we wait for more input...
+    */
+
+    if (http->wused && (http->data_encoding != HTTP_ENCODING_LENGTH || http->mode != _HTTP_MODE_SERVER || !httpGetReady(http)))
     {
       if (httpFlushWrite(http) < 0)
         return (-1);
@@ -3553,7 +3967,10 @@ http_add_field(http_t       *http,	/* I - HTTP connection */
                const char   *value,	/* I - Value string */
                int          append)	/* I - Append value? */
 {
-  char		temp[1024];		/* Temporary value string */
+  char		temp[1024],		/* Temporary value string */
+		*current,		/* Current value */
+		*previous,		/* Value to append to, if any */
+		*combined;		/* New value string */
   size_t	fieldlen,		/* Length of existing value */
 		valuelen,		/* Length of value string */
 		total;			/* Total length of string */
@@ -3598,25 +4015,24 @@ http_add_field(http_t       *http,	/* I - HTTP connection */
   if (append && field != HTTP_FIELD_ACCEPT_ENCODING && field != HTTP_FIELD_ACCEPT_LANGUAGE && field != HTTP_FIELD_ACCEPT_RANGES && field != HTTP_FIELD_ALLOW && field != HTTP_FIELD_LINK && field != HTTP_FIELD_TRANSFER_ENCODING && field != HTTP_FIELD_UPGRADE && field != HTTP_FIELD_WWW_AUTHENTICATE)
     append = 0;
 
-  if (!append && http->fields[field])
-  {
-    if (http->fields[field] != http->_fields[field])
-      free(http->fields[field]);
-
-    http->fields[field] = NULL;
-  }
-
+  current  = http->fields[field];
+  previous = append ? current : NULL;
   valuelen = strlen(value);
 
   if (!valuelen)
   {
-    http->_fields[field][0] = '\0';
+    if (!append)
+    {
+      http_free_value(http, current);
+      http->fields[field] = NULL;
+    }
+
     return;
   }
 
-  if (http->fields[field])
+  if (previous)
   {
-    fieldlen = strlen(http->fields[field]);
+    fieldlen = strlen(previous);
     total    = fieldlen + 2 + valuelen;
   }
   else
@@ -3625,67 +4041,103 @@ http_add_field(http_t       *http,	/* I - HTTP connection */
     total    = valuelen;
   }
 
-  if (total < HTTP_MAX_VALUE && field < HTTP_FIELD_ACCEPT_ENCODING)
+  if (previous && previous + fieldlen + 1 == http->fbuffer + http->fused && (http->fused + valuelen + 2) <= sizeof(http->fbuffer))
   {
    /*
-    * Copy short values to legacy char arrays (maintained for binary
-    * compatibility with CUPS 1.2.x and earlier applications...)
+    * Extend the last value in the field arena in place...
     */
 
-    if (fieldlen)
-    {
-      char	combined[HTTP_MAX_VALUE];
-					/* Combined value string */
+    combined = previous;
 
-      snprintf(combined, sizeof(combined), "%s, %s", http->_fields[field], value);
-      value = combined;
-    }
+    memmove(combined + fieldlen + 2, value, valuelen + 1);
+    combined[fieldlen]     = ',';
+    combined[fieldlen + 1] = ' ';
 
-    strlcpy(http->_fields[field], value, sizeof(http->_fields[field]));
-    http->fields[field] = http->_fields[field];
+    http->fused += valuelen + 2;
   }
-  else if (fieldlen)
+  else if ((http->fused + total + 1) <= sizeof(http->fbuffer))
   {
    /*
-    * Expand the field value...
+    * Copy the value to the field arena, which is reset by httpClearFields...
     */
 
-    char	*combined;		/* New value string */
+    combined = http->fbuffer + http->fused;
 
-    if (http->fields[field] == http->_fields[field])
-    {
-      if ((combined = malloc(total + 1)) != NULL)
-      {
-	http->fields[field] = combined;
-	snprintf(combined, total + 1, "%s, %s", http->_fields[field], value);
-      }
-    }
-    else if ((combined = realloc(http->fields[field], total + 1)) != NULL)
+    if (previous)
     {
-      http->fields[field] = combined;
-      strlcat(combined, ", ", total + 1);
-      strlcat(combined, value, total + 1);
+      memcpy(combined, previous, fieldlen);
+      combined[fieldlen]     = ',';
+      combined[fieldlen + 1] = ' ';
+      memcpy(combined + fieldlen + 2, value, valuelen + 1);
     }
+    else
+      memcpy(combined, value, valuelen + 1);
+
+    http->fused += total + 1;
   }
-  else
+  else if ((combined = malloc(total + 1)) != NULL)
   {
    /*
-    * Allocate the field value...
+    * Arena is full, allocate the field value...
     */
 
-    http->fields[field] = strdup(value);
+    if (previous)
+      snprintf(combined, total + 1, "%s, %s", previous, value);
+    else
+      memcpy(combined, value, valuelen + 1);
   }
+  else if (previous)
+    return;
+
+ /*
+  * Free the old value only after copying since "value" may point to it...
+  */
+
+  if (current != combined)
+    http_free_value(http, current);
+
+  http->fields[field] = combined;
 
 #ifdef HAVE_LIBZ
-  if (field == HTTP_FIELD_CONTENT_ENCODING && http->data_encoding != HTTP_ENCODING_FIELDS)
+  if (field == HTTP_FIELD_CONTENT_ENCODING && combined && http->data_encoding != HTTP_ENCODING_FIELDS)
   {
     DEBUG_puts("1httpSetField: Calling http_content_coding_start.");
-    http_content_coding_start(http, value);
+    http_content_coding_start(http, combined);
   }
 #endif /* HAVE_LIBZ */
 }
 
 
+/*
+ * 'http_connect_done()' - Finish an asynchronous connection and call the callback.
+ */
+
+static http_connect_state_t		/* O - Final connection state */
+http_connect_done(
+    http_t               *http,		/* I - HTTP connection */
+    http_connect_state_t state)		/* I - Final connection state */
+{
+  DEBUG_printf(("4http_connect_done(http=%p, state=%d)", (void *)http, state));
+
+  if (state == HTTP_CONNECT_STATE_ERROR)
+  {
+#ifdef _WIN32
+    http->error  = WSAGetLastError();
+#else
+    http->error  = errno;
+#endif /* _WIN32 */
+    http->status = HTTP_STATUS_ERROR;
+  }
+
+  http->connect_state = state;
+
+  if (http->connect_cb)
+    (*http->connect_cb)(http, state, http->connect_data);
+
+  return (state);
+}
+
+
 #ifdef HAVE_LIBZ
 /*
  * 'http_content_coding_finish()' - Finish doing any content encoding.
@@ -4064,6 +4516,44 @@ http_debug_hex(const char *prefix,	/* I - Prefix for line */
 #endif /* DEBUG */
 
 
+/*
+ * 'http_end_content()' - Update the connection state at the end of a message body.
+ */
+
+static void
+http_end_content(http_t *http)		/* I - HTTP connection */
+{
+#ifdef HAVE_LIBZ
+  if (http->coding >= _HTTP_CODING_GUNZIP)
+    http_content_coding_finish(http);
+#endif /* HAVE_LIBZ */
+
+  if (http->state == HTTP_STATE_POST_RECV)
+    http->state ++;
+  else if (http->state == HTTP_STATE_GET_SEND ||
+           http->state == HTTP_STATE_POST_SEND)
+    http->state = HTTP_STATE_WAITING;
+  else
+    http->state = HTTP_STATE_STATUS;
+
+  DEBUG_printf(("1http_end_content: End of content, set state to %s.",
+		httpStateString(http->state)));
+}
+
+
+/*
+ * 'http_free_value()' - Free a field value that is not in the field arena.
+ */
+
+static void
+http_free_value(http_t *http,		/* I - HTTP connection */
+                char   *value)		/* I - Field value */
+{
+  if (value && (value < http->fbuffer || value >= (http->fbuffer + sizeof(http->fbuffer))))
+    free(value);
+}
+
+
 /*
  * 'http_read()' - Read a buffer from a HTTP connection.
  *
@@ -4081,6 +4571,13 @@ http_read(http_t *http,			/* I - HTTP connection */
 
   DEBUG_printf(("http_read(http=%p, buffer=%p, length=" CUPS_LLFMT ")", (void *)http, (void *)buffer, CUPS_LLCAST length));
 
+ /*
+  * Send any pending (pipelined) output before blocking on the peer...
+  */
+
+  if (http->wused && httpFlushWrite(http) < 0)
+    return (-1);
+
   if (!http->blocking || http->timeout_value > 0.0)
   {
     while (!httpWait(http, http->wait_value))
@@ -4285,6 +4782,198 @@ http_read_chunk(http_t *http,		/* I - HTTP connection */
 }
 
 
+#ifdef HAVE_SPLICE
+/*
+ * 'http_read_splice()' - Splice a fixed-length message body to a file.
+ *
+ * Data that has already been buffered is written first, then the remainder is
+ * moved from the socket through a pipe to the file.  If the file does not
+ * support splicing, "use_splice" is cleared and the caller copies the rest of
+ * the message body.
+ */
+
+static off_t				/* O - Number of bytes copied or -1 on error */
+http_read_splice(http_t *http,		/* I - HTTP connection */
+                 int    fd,		/* I - File to write to */
+                 int    *use_splice)	/* IO - Use splice()? */
+{
+  off_t		total = 0;		/* Total bytes copied */
+  ssize_t	bytes,			/* Bytes spliced into pipe */
+		wbytes;			/* Bytes spliced out of pipe */
+  size_t	length;			/* Length of current splice */
+  int		pipefds[2];		/* Splice pipe */
+  char		buffer[32768];		/* Drain buffer */
+
+
+ /*
+  * Write any data we already have in the input buffer...
+  */
+
+  if (http->used > 0)
+  {
+    if ((bytes = http->used) > http->data_remaining)
+      bytes = (ssize_t)http->data_remaining;
+
+    if (http_write_fd(fd, http->buffer, (size_t)bytes) < 0)
+      return (-1);
+
+    http->used -= (int)bytes;
+    if (http->used > 0)
+      memmove(http->buffer, http->buffer + bytes, (size_t)http->used);
+
+    http->data_remaining -= bytes;
+    total                += bytes;
+  }
+
+  if (http->data_remaining <= 0 || pipe(pipefds))
+    return (total);
+
+  DEBUG_printf(("2http_read_splice: Splicing " CUPS_LLFMT " bytes.", CUPS_LLCAST http->data_remaining));
+
+  while (http->data_remaining > 0 && *use_splice)
+  {
+    if (!http->blocking || http->timeout_value > 0.0)
+    {
+      while (!httpWait(http, http->wait_value))
+      {
+	if (http->timeout_cb && (*http->timeout_cb)(http, http->timeout_data))
+	  continue;
+
+	DEBUG_puts("2http_read_splice: Timeout.");
+	http->error = ETIMEDOUT;
+	total       = -1;
+	goto done;
+      }
+    }
+
+    if (http->data_remaining > _HTTP_MAX_SBUFFER)
+      length = _HTTP_MAX_SBUFFER;
+    else
+      length = (size_t)http->data_remaining;
+
+    if ((bytes = splice(http->fd, NULL, pipefds[1], NULL, length, SPLICE_F_MOVE | SPLICE_F_MORE)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      if (errno == EINVAL || errno == ENOSYS)
+      {
+        DEBUG_puts("2http_read_splice: splice() not supported for socket.");
+        *use_splice = 0;
+        break;
+      }
+
+      http->error = errno;
+      total       = -1;
+      goto done;
+    }
+    else if (bytes == 0)
+    {
+     /*
+      * Peer closed the connection before sending the whole message body...
+      */
+
+      http->error = EPIPE;
+      break;
+    }
+
+    http->activity       = time(NULL);
+    http->data_remaining -= bytes;
+    total                += bytes;
+
+    while (bytes > 0)
+    {
+      if ((wbytes = splice(pipefds[0], NULL, fd, NULL, (size_t)bytes, SPLICE_F_MOVE)) < 0)
+      {
+        if (errno == EINTR || errno == EAGAIN)
+          continue;
+
+        if (errno != EINVAL && errno != ENOSYS)
+        {
+          total = -1;
+          goto done;
+	}
+
+       /*
+        * The file can't be spliced into, so drain the pipe using read/write and
+        * let the caller copy the rest...
+        */
+
+        DEBUG_puts("2http_read_splice: splice() not supported for file.");
+        *use_splice = 0;
+
+        while (bytes > 0 && (wbytes = read(pipefds[0], buffer, sizeof(buffer))) > 0)
+        {
+          if (http_write_fd(fd, buffer, (size_t)wbytes) < 0)
+          {
+            total = -1;
+            goto done;
+	  }
+
+          bytes -= wbytes;
+        }
+        break;
+      }
+
+      bytes -= wbytes;
+    }
+  }
+
+  done:
+
+  close(pipefds[0]);
+  close(pipefds[1]);
+
+  return (total);
+}
+#endif /* HAVE_SPLICE */
+
+
+/*
+ * 'http_reset()' - Close the socket and reset the connection state.
+ */
+
+static void
+http_reset(http_t *http)		/* I - HTTP connection */
+{
+#ifdef HAVE_SSL
+  if (http->tls)
+  {
+    DEBUG_puts("5http_reset: Shutting down SSL/TLS...");
+    _httpTLSStop(http);
+  }
+#endif /* HAVE_SSL */
+
+ /*
+  * Close any previously open socket...
+  */
+
+  if (http->fd >= 0)
+  {
+    DEBUG_printf(("5http_reset: Closing socket %d...", http->fd));
+
+    httpAddrClose(NULL, http->fd);
+
+    http->fd = -1;
+  }
+
+ /*
+  * Reset all state (except fields, which may be reused)...
+  */
+
+  http->state           = HTTP_STATE_WAITING;
+  http->version         = HTTP_VERSION_1_1;
+  http->keep_alive      = HTTP_KEEPALIVE_OFF;
+  memset(&http->_hostaddr, 0, sizeof(http->_hostaddr));
+  http->data_encoding   = HTTP_ENCODING_FIELDS;
+  http->_data_remaining = 0;
+  http->used            = 0;
+  http->data_remaining  = 0;
+  http->hostaddr        = NULL;
+  http->wused           = 0;
+}
+
+
 /*
  * 'http_send()' - Send a request with all fields and the trailing blank line.
  */
@@ -4624,8 +5313,9 @@ http_tls_upgrade(http_t *http)		/* I - HTTP connection */
   * Restore the HTTP request data...
   */
 
-  memcpy(http->_fields, myhttp._fields, sizeof(http->_fields));
   memcpy(http->fields, myhttp.fields, sizeof(http->fields));
+  memcpy(http->fbuffer, myhttp.fbuffer, myhttp.fused);
+  http->fused = myhttp.fused;
 
   http->data_encoding   = myhttp.data_encoding;
   http->data_remaining  = myhttp.data_remaining;
@@ -4846,3 +5536,33 @@ http_write_chunk(http_t     *http,	/* I - HTTP connection */
 
   return (bytes);
 }
+
+
+/*
+ * 'http_write_fd()' - Write a buffer to a file descriptor.
+ */
+
+static int				/* O - 0 on success, -1 on error */
+http_write_fd(int        fd,		/* I - File descriptor */
+              const char *buffer,	/* I - Buffer */
+              size_t     length)	/* I - Number of bytes to write */
+{
+  ssize_t	bytes;			/* Bytes written */
+
+
+  while (length > 0)
+  {
+    if ((bytes = write(fd, buffer, length)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      return (-1);
+    }
+
+    buffer += bytes;
+    length -= (size_t)bytes;
+  }
+
+  return (0);
+}
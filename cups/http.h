@@ -115,6 +115,14 @@ typedef enum http_auth_e		/**** HTTP authentication types @exclude all@ ****/
   HTTP_AUTH_NEGOTIATE			/* GSSAPI authentication in use @since CUPS 1.3/macOS 10.5@ */
 } http_auth_t;
 
+typedef enum http_connect_state_e	/**** Asynchronous connection states @since CUPS 2.3@ ****/
+{
+  HTTP_CONNECT_STATE_ERROR = -1,	/* Unable to connect */
+  HTTP_CONNECT_STATE_CONNECTED,		/* Connected */
+  HTTP_CONNECT_STATE_CONNECTING,	/* Waiting for the socket to connect */
+  HTTP_CONNECT_STATE_HANDSHAKE		/* Waiting for the TLS handshake */
+} http_connect_state_t;
+
 typedef enum http_encoding_e		/**** HTTP transfer encoding values ****/
 {
   HTTP_ENCODING_LENGTH,			/* Data is sent with Content-Length */
@@ -441,6 +449,9 @@ typedef struct http_credential_s	/**** HTTP credential data @since CUPS 1.5/macO
   size_t	datalen;		/* Credential length */
 } http_credential_t;
 
+typedef void (*http_connect_cb_t)(http_t *http, http_connect_state_t state, void *user_data);
+					/**** Asynchronous connection callback @since CUPS 2.3@ ****/
+
 typedef int (*http_timeout_cb_t)(http_t *http, void *user_data);
 					/**** HTTP timeout callback @since CUPS 1.5/macOS 10.7@ ****/
 
@@ -583,6 +594,11 @@ extern void		httpShutdown(http_t *http) _CUPS_API_2_0;
 extern const char	*httpStateString(http_state_t state) _CUPS_API_2_0;
 extern const char	*httpURIStatusString(http_uri_status_t status) _CUPS_API_2_0;
 
+/* New in CUPS 2.3 */
+extern off_t		httpReadToFd(http_t *http, int fd) _CUPS_API_2_3;
+extern int		httpReconnectAsync(http_t *http, http_connect_cb_t cb, void *user_data) _CUPS_API_2_3;
+extern http_connect_state_t httpReconnectStep(http_t *http, short *events) _CUPS_API_2_3;
+
 /*
  * C++ magic...
  */
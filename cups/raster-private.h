@@ -88,9 +88,11 @@ extern const char	*_cupsRasterColorSpaceString(cups_cspace_t cspace) _CUPS_PRIVA
 extern void		_cupsRasterDelete(cups_raster_t *r) _CUPS_PRIVATE;
 extern const char	*_cupsRasterErrorString(void) _CUPS_PRIVATE;
 extern int		_cupsRasterInitPWGHeader(cups_page_header2_t *h, pwg_media_t *media, const char *type, int xdpi, int ydpi, const char *sides, const char *sheet_back) _CUPS_PRIVATE;
+extern size_t		_cupsRasterLiteralLength(const unsigned char *ptr, const unsigned char *pend, unsigned bpp, size_t max) _CUPS_PRIVATE;
 extern cups_raster_t	*_cupsRasterNew(cups_raster_iocb_t iocb, void *ctx, cups_mode_t mode) _CUPS_PRIVATE;
 extern unsigned		_cupsRasterReadHeader(cups_raster_t *r) _CUPS_PRIVATE;
 extern unsigned		_cupsRasterReadPixels(cups_raster_t *r, unsigned char *p, unsigned len) _CUPS_PRIVATE;
+extern size_t		_cupsRasterRepeatLength(const unsigned char *ptr, const unsigned char *pend, unsigned bpp, size_t max) _CUPS_PRIVATE;
 extern unsigned		_cupsRasterWriteHeader(cups_raster_t *r) _CUPS_PRIVATE;
 extern unsigned		_cupsRasterWritePixels(cups_raster_t *r, unsigned char *p, unsigned len) _CUPS_PRIVATE;
 
@@ -19,13 +19,10 @@
 #ifdef HAVE_STDINT_H
 #  include <stdint.h>
 #endif /* HAVE_STDINT_H */
-
-
-/*
- * Private structures...
- */
-
-typedef void (*_cups_copyfunc_t)(void *dst, const void *src, size_t bytes);
+#if defined(__SSE2__) || defined(_M_X64)
+#  include <emmintrin.h>
+#  define _CUPS_RASTER_SSE2 1
+#endif /* __SSE2__ || _M_X64 */
 
 
 /*
@@ -420,6 +417,92 @@ _cupsRasterInitPWGHeader(
 }
 
 
+/*
+ * '_cupsRasterLiteralLength()' - Find the length of a run of non-repeating pixels.
+ *
+ * This function returns the number of pixels starting at "ptr" that precede
+ * the first pixel that is the same as the following pixel, up to "max"
+ * pixels.  Zero is returned when the first two pixels are the same.
+ */
+
+size_t					/* O - Number of pixels */
+_cupsRasterLiteralLength(
+    const unsigned char *ptr,		/* I - First pixel */
+    const unsigned char *pend,		/* I - End of pixels */
+    unsigned            bpp,		/* I - Bytes per pixel */
+    size_t              max)		/* I - Maximum number of pixels */
+{
+  size_t	i,			/* Current pixel */
+		num_pixels,		/* Number of pixels */
+		num_check;		/* Number of pixels to compare */
+
+
+  if ((num_pixels = (size_t)(pend - ptr) / bpp) == 0)
+    return (0);
+
+  if ((num_check = num_pixels - 1) > max)
+    num_check = max;
+
+  i = 0;
+
+  switch (bpp)
+  {
+    case 1 :
+#ifdef _CUPS_RASTER_SSE2
+        for (; (i + 16) <= num_check; i += 16)
+          if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(ptr + i)), _mm_loadu_si128((const __m128i *)(ptr + i + 1)))))
+            break;
+#endif /* _CUPS_RASTER_SSE2 */
+
+        for (; i < num_check; i ++)
+          if (ptr[i] == ptr[i + 1])
+            return (i);
+        break;
+
+    case 3 :
+#ifdef _CUPS_RASTER_SSE2
+       /*
+        * Compare 5 pixels (15 bytes) at a time - a pixel repeats when all 3
+        * of its bytes match the next pixel...
+        */
+
+        for (; (i + 6) <= num_check; i += 5)
+        {
+          int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(ptr + 3 * i)), _mm_loadu_si128((const __m128i *)(ptr + 3 * i + 3))));
+
+          if (mask & (mask >> 1) & (mask >> 2) & 0x1249)
+            break;
+        }
+#endif /* _CUPS_RASTER_SSE2 */
+
+        for (ptr += 3 * i; i < num_check; i ++, ptr += 3)
+          if (ptr[0] == ptr[3] && ptr[1] == ptr[4] && ptr[2] == ptr[5])
+            return (i);
+        break;
+
+    case 4 :
+#ifdef _CUPS_RASTER_SSE2
+        for (; (i + 4) <= num_check; i += 4)
+          if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(ptr + 4 * i)), _mm_loadu_si128((const __m128i *)(ptr + 4 * i + 4)))))
+            break;
+#endif /* _CUPS_RASTER_SSE2 */
+
+        for (ptr += 4 * i; i < num_check; i ++, ptr += 4)
+          if (ptr[0] == ptr[4] && ptr[1] == ptr[5] && ptr[2] == ptr[6] && ptr[3] == ptr[7])
+            return (i);
+        break;
+
+    default :
+        for (; i < num_check; i ++, ptr += bpp)
+          if (!memcmp(ptr, ptr + bpp, bpp))
+            return (i);
+        break;
+  }
+
+  return (num_pixels < max ? num_pixels : max);
+}
+
+
 /*
  * '_cupsRasterNew()' - Create a raster stream using a callback function.
  *
@@ -998,6 +1081,67 @@ _cupsRasterReadPixels(
 }
 
 
+/*
+ * '_cupsRasterRepeatLength()' - Find the length of a run of repeating pixels.
+ *
+ * This function returns the number of pixels starting at "ptr" that are the
+ * same as the first pixel, up to "max" pixels.  The pixels are compared a
+ * word at a time, so the pixel size does not matter until a difference is
+ * found.
+ */
+
+size_t					/* O - Number of pixels */
+_cupsRasterRepeatLength(
+    const unsigned char *ptr,		/* I - First pixel */
+    const unsigned char *pend,		/* I - End of pixels */
+    unsigned            bpp,		/* I - Bytes per pixel */
+    size_t              max)		/* I - Maximum number of pixels */
+{
+  size_t	i,			/* Current byte */
+		num_pixels,		/* Number of pixels */
+		num_bytes;		/* Number of bytes to compare */
+
+
+  if ((num_pixels = (size_t)(pend - ptr) / bpp) == 0)
+    return (0);
+
+  if (num_pixels > max)
+    num_pixels = max;
+
+ /*
+  * Pixel N is the same as pixel N + 1 when each byte matches the byte "bpp"
+  * bytes later, so the first mismatched byte marks the end of the run...
+  */
+
+  num_bytes = (num_pixels - 1) * bpp;
+  i         = 0;
+
+#ifdef _CUPS_RASTER_SSE2
+  for (; (i + 16) <= num_bytes; i += 16)
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(ptr + i)), _mm_loadu_si128((const __m128i *)(ptr + i + bpp)))) != 0xffff)
+      break;
+
+#elif defined(HAVE_STDINT_H)
+  for (; (i + 8) <= num_bytes; i += 8)
+  {
+    uint64_t	a, b;			/* Words to compare */
+
+    memcpy(&a, ptr + i, sizeof(a));
+    memcpy(&b, ptr + i + bpp, sizeof(b));
+
+    if (a != b)
+      break;
+  }
+#endif /* _CUPS_RASTER_SSE2 */
+
+  for (; i < num_bytes; i ++)
+    if (ptr[i] != ptr[i + bpp])
+      return (i / bpp + 1);
+
+  return (num_pixels);
+}
+
+
 /*
  * '_cupsRasterWriteHeader()' - Write a raster page header.
  */
@@ -1700,14 +1844,12 @@ cups_raster_write(
     cups_raster_t       *r,		/* I - Raster stream */
     const unsigned char *pixels)	/* I - Pixel data to write */
 {
-  const unsigned char	*start,		/* Start of sequence */
-			*ptr,		/* Current pointer in sequence */
-			*pend,		/* End of raster buffer */
-			*plast;		/* Pointer to last pixel */
+  const unsigned char	*ptr,		/* Current pointer in sequence */
+			*pend;		/* End of raster buffer */
   unsigned char		*wptr;		/* Pointer into write buffer */
   unsigned		bpp,		/* Bytes per pixel */
 			count;		/* Count */
-  _cups_copyfunc_t	cf;		/* Copy function */
+  int			swap;		/* Swap bytes? */
 
 
   DEBUG_printf(("3cups_raster_write(r=%p, pixels=%p)", (void *)r, (void *)pixels));
@@ -1716,13 +1858,10 @@ cups_raster_write(
   * Determine whether we need to swap bytes...
   */
 
-  if (r->swapped && (r->header.cupsBitsPerColor == 16 || r->header.cupsBitsPerPixel == 12 || r->header.cupsBitsPerPixel == 16))
+  if ((swap = r->swapped && (r->header.cupsBitsPerColor == 16 || r->header.cupsBitsPerPixel == 12 || r->header.cupsBitsPerPixel == 16)) != 0)
   {
     DEBUG_puts("4cups_raster_write: Swapping bytes when writing.");
-    cf = (_cups_copyfunc_t)cups_swap_copy;
   }
-  else
-    cf = (_cups_copyfunc_t)memcpy;
 
   /*
   * Allocate a write buffer as needed...
@@ -1755,7 +1894,6 @@ cups_raster_write(
 
   bpp     = r->bpp;
   pend    = pixels + r->header.cupsBytesPerLine;
-  plast   = pend - bpp;
   wptr    = r->buffer;
   *wptr++ = (unsigned char)(r->count - 1);
 
@@ -1763,57 +1901,39 @@ cups_raster_write(
   * Write using a modified PackBits compression...
   */
 
-  for (ptr = pixels; ptr < pend;)
+  for (ptr = pixels; ptr < pend; ptr += count * bpp)
   {
-    start = ptr;
-    ptr += bpp;
-
-    if (ptr == pend)
-    {
-     /*
-      * Encode a single pixel at the end...
-      */
-
-      *wptr++ = 0;
-      (*cf)(wptr, start, bpp);
-      wptr += bpp;
-    }
-    else if (!memcmp(start, ptr, bpp))
+    if ((count = (unsigned)_cupsRasterRepeatLength(ptr, pend, bpp, 128)) > 1)
     {
      /*
       * Encode a sequence of repeating pixels...
       */
 
-      for (count = 2; count < 128 && ptr < plast; count ++, ptr += bpp)
-        if (memcmp(ptr, ptr + bpp, bpp))
-	  break;
-
       *wptr++ = (unsigned char)(count - 1);
-      (*cf)(wptr, ptr, bpp);
+
+      if (swap)
+        cups_swap_copy(wptr, ptr, bpp);
+      else
+        memcpy(wptr, ptr, bpp);
+
       wptr += bpp;
-      ptr  += bpp;
     }
     else
     {
      /*
-      * Encode a sequence of non-repeating pixels...
+      * Encode a sequence of non-repeating pixels, including a single pixel at
+      * the end...
       */
 
-      for (count = 1; count < 128 && ptr < plast; count ++, ptr += bpp)
-        if (!memcmp(ptr, ptr + bpp, bpp))
-	  break;
-
-      if (ptr >= plast && count < 128)
-      {
-        count ++;
-	ptr += bpp;
-      }
-
+      count   = (unsigned)_cupsRasterLiteralLength(ptr, pend, bpp, 128);
       *wptr++ = (unsigned char)(257 - count);
 
-      count *= bpp;
-      (*cf)(wptr, start, count);
-      wptr += count;
+      if (swap)
+        cups_swap_copy(wptr, ptr, count * bpp);
+      else
+        memcpy(wptr, ptr, count * bpp);
+
+      wptr += count * bpp;
     }
   }
 
@@ -28,6 +28,20 @@
 #endif /* !MSG_DONTWAIT */
 
 
+/*
+ * Local constants...
+ */
+
+#define _CUPS_MAX_PIPELINE	16	/* Maximum number of outstanding pipelined requests */
+
+
+/*
+ * Local functions...
+ */
+
+static int	cups_send_pipelined(http_t *http, ipp_t *request, const char *resource);
+
+
 /*
  * 'cupsDoFileRequest()' - Do an IPP request with a file.
  *
@@ -292,6 +306,225 @@ cupsDoRequest(http_t     *http,		/* I - Connection to server or @code CUPS_HTTP_
 }
 
 
+/*
+ * 'cupsDoRequests()' - Do several IPP requests using HTTP/1.1 pipelining.
+ *
+ * This function sends the IPP requests to the specified server without
+ * waiting for each response, and then reads the responses in the same order
+ * into the "responses" array.  Requests whose pipelined response is an
+ * authentication or encryption challenge are re-sent one at a time with
+ * @link cupsDoRequest@, as are requests that had not been written when the
+ * connection failed.  Requests that were written but never answered are not
+ * re-sent since the server may have processed them - their responses have the
+ * status code @code IPP_STATUS_ERROR_SERVICE_UNAVAILABLE@ and are not included
+ * in the returned count, so the caller can decide whether to retry them.
+ * Responses that could not be read are set to @code NULL@.  The requests are
+ * freed with @link ippDelete@.
+ *
+ * Only requests without document data can be pipelined - use
+ * @link cupsDoFileRequest@ or @link cupsSendRequest@ for the others.
+ *
+ * @since CUPS 2.3@
+ */
+
+int					/* O - Number of responses received */
+cupsDoRequests(http_t     *http,	/* I - Connection to server or @code CUPS_HTTP_DEFAULT@ */
+               int        num_requests,	/* I - Number of requests */
+               ipp_t      **requests,	/* I - IPP requests */
+               const char *resource,	/* I - HTTP resource for POST */
+               ipp_t      **responses)	/* O - IPP responses */
+{
+  int		i,			/* Looping var */
+		sent,			/* Number of requests sent */
+		received,		/* Number of responses read */
+		count = 0,		/* Number of responses */
+		send_error,		/* Unable to send more requests? */
+		answered,		/* Did the failed request get an HTTP error? */
+		inflight;		/* Number of requests sent but not answered */
+  http_status_t	status;			/* HTTP status of response */
+
+
+  DEBUG_printf(("cupsDoRequests(http=%p, num_requests=%d, requests=%p, resource=\"%s\", responses=%p)", (void *)http, num_requests, (void *)requests, resource, (void *)responses));
+
+ /*
+  * Range check input...
+  */
+
+  if (num_requests <= 0 || !requests || !resource || !responses)
+  {
+    if (requests)
+    {
+      for (i = 0; i < num_requests; i ++)
+        ippDelete(requests[i]);
+    }
+
+    _cupsSetError(IPP_STATUS_ERROR_INTERNAL, strerror(EINVAL), 0);
+
+    return (0);
+  }
+
+  memset(responses, 0, (size_t)num_requests * sizeof(ipp_t *));
+
+ /*
+  * Get the default connection as needed...
+  */
+
+  if (!http && (http = _cupsConnect()) == NULL)
+  {
+    for (i = 0; i < num_requests; i ++)
+      ippDelete(requests[i]);
+
+    return (0);
+  }
+
+ /*
+  * Clear any "Local" authentication data since it is probably stale...
+  */
+
+  if (http->authstring && !strncmp(http->authstring, "Local ", 6))
+    httpSetAuthString(http, NULL, NULL);
+
+ /*
+  * Flush any prior response and reconnect as needed...
+  */
+
+  if (http->state == HTTP_STATE_GET_SEND || http->state == HTTP_STATE_POST_SEND)
+    httpFlush(http);
+
+  if (http->state != HTTP_STATE_WAITING || !_cups_strcasecmp(httpGetField(http, HTTP_FIELD_CONNECTION), "close"))
+  {
+    httpClearFields(http);
+
+    if (httpReconnect2(http, 30000, NULL))
+    {
+      for (i = 0; i < num_requests; i ++)
+        ippDelete(requests[i]);
+
+      return (0);
+    }
+  }
+
+ /*
+  * Keep up to _CUPS_MAX_PIPELINE requests in flight, reading the responses in
+  * order as they arrive...
+  */
+
+  for (sent = 0, received = 0, send_error = 0; received < num_requests; received ++)
+  {
+    while (!send_error && sent < num_requests && (sent - received) < _CUPS_MAX_PIPELINE)
+    {
+      if (cups_send_pipelined(http, requests[sent], resource))
+        send_error = 1;
+      else
+        sent ++;
+    }
+
+    if (sent == received)
+      break;
+
+    http->state = HTTP_STATE_POST_SEND;
+
+    responses[received] = cupsGetResponse(http, resource);
+    status              = httpGetStatus(http);
+
+    DEBUG_printf(("2cupsDoRequests: responses[%d]=%p, status=%d", received, (void *)responses[received], status));
+
+    if (!responses[received])
+      break;
+
+    if (http->state != HTTP_STATE_WAITING)
+      httpFlush(http);
+
+    ippDelete(requests[received]);
+    requests[received] = NULL;
+    count ++;
+
+    if (!_cups_strcasecmp(httpGetField(http, HTTP_FIELD_CONNECTION), "close"))
+    {
+     /*
+      * The server won't process the rest of the pipeline...
+      */
+
+      received ++;
+      break;
+    }
+  }
+
+  DEBUG_printf(("2cupsDoRequests: Got %d of %d pipelined responses.", count, num_requests));
+
+ /*
+  * Sort out anything that didn't make it through the pipeline.  Requests that
+  * were written but never answered may already have been processed by the
+  * server, so they fail with server-error-service-unavailable and are left to
+  * the caller to retry.  Only a request that was answered with an HTTP error
+  * (such as an authentication challenge) and requests that were never written
+  * are re-sent, one at a time...
+  */
+
+  status   = httpGetStatus(http);
+  answered = received < sent && status >= HTTP_STATUS_BAD_REQUEST;
+  inflight = sent - received - answered;
+
+  for (i = received + answered; i < sent; i ++)
+  {
+    if ((responses[i] = ippNewResponse(requests[i])) != NULL)
+    {
+      ippSetStatusCode(responses[i], IPP_STATUS_ERROR_SERVICE_UNAVAILABLE);
+      ippAddString(responses[i], IPP_TAG_OPERATION, IPP_TAG_TEXT, "status-message", NULL, _cupsLangString(cupsLangDefault(), _("Request may not have been processed.")));
+    }
+  }
+
+  if (inflight > 0)
+    _cupsSetError(IPP_STATUS_ERROR_SERVICE_UNAVAILABLE, _("Request may not have been processed."), 1);
+
+  if (status == HTTP_STATUS_CUPS_AUTHORIZATION_CANCELED || (!answered && sent == num_requests))
+    goto done;
+
+  if (status < HTTP_STATUS_BAD_REQUEST || inflight > 0)
+  {
+   /*
+    * The connection is gone or still has unread responses on it, so start
+    * over with a fresh one...
+    */
+
+    httpClearFields(http);
+
+    if (httpReconnect2(http, 30000, NULL))
+    {
+      _cupsSetHTTPError(HTTP_STATUS_ERROR);
+      goto done;
+    }
+  }
+
+  if (answered)
+  {
+    if ((responses[received] = cupsDoRequest(http, requests[received], resource)) != NULL)
+      count ++;
+
+    requests[received] = NULL;
+  }
+
+  for (i = sent; i < num_requests; i ++)
+  {
+    if ((responses[i] = cupsDoRequest(http, requests[i], resource)) != NULL)
+      count ++;
+
+    requests[i] = NULL;
+  }
+
+ /*
+  * Free any requests that were not sent...
+  */
+
+  done:
+
+  for (i = 0; i < num_requests; i ++)
+    ippDelete(requests[i]);
+
+  return (count);
+}
+
+
 /*
  * 'cupsGetResponse()' - Get a response to an IPP request.
  *
@@ -1177,3 +1410,78 @@ _cupsSetHTTPError(http_status_t status)	/* I - HTTP status code */
 	break;
   }
 }
+
+
+/*
+ * 'cups_send_pipelined()' - Send an IPP request without waiting for a response.
+ */
+
+static int				/* O - 0 on success, -1 on error */
+cups_send_pipelined(
+    http_t     *http,			/* I - Connection to server */
+    ipp_t      *request,		/* I - IPP request */
+    const char *resource)		/* I - HTTP resource for POST */
+{
+  char		date[256];		/* Date: header value */
+
+
+  DEBUG_printf(("4cups_send_pipelined(http=%p, request=%p(%s), resource=\"%s\")", (void *)http, (void *)request, request ? ippOpString(request->request.op.operation_id) : "?", resource));
+
+  if (!request)
+    return (-1);
+
+#ifdef HAVE_SSL
+ /*
+  * Requests with an auth-info attribute may need an encrypted connection,
+  * which cupsSendRequest takes care of...
+  */
+
+  if (ippFindAttribute(request, "auth-info", IPP_TAG_TEXT) &&
+      !httpAddrLocalhost(http->hostaddr) && !http->tls)
+  {
+    DEBUG_puts("5cups_send_pipelined: Request needs encryption.");
+    return (-1);
+  }
+#endif /* HAVE_SSL */
+
+ /*
+  * Setup the HTTP variables needed - no Expect: header since we aren't going
+  * to wait for the 100-continue...
+  */
+
+  httpClearFields(http);
+  httpSetField(http, HTTP_FIELD_CONTENT_TYPE, "application/ipp");
+  httpSetField(http, HTTP_FIELD_DATE, httpGetDateString2(time(NULL), date, (int)sizeof(date)));
+  httpSetLength(http, ippLength(request));
+
+  if (http->authstring && !strncmp(http->authstring, "Digest ", 7))
+    _httpSetDigestAuthString(http, http->nextnonce, "POST", resource);
+
+#ifdef HAVE_GSSAPI
+  if (http->authstring && !strncmp(http->authstring, "Negotiate", 9))
+    _cupsSetNegotiateAuthString(http, "POST", resource);
+#endif /* HAVE_GSSAPI */
+
+  httpSetField(http, HTTP_FIELD_AUTHORIZATION, http->authstring);
+
+ /*
+  * Send the POST and the IPP message...
+  */
+
+  if (httpPost(http, resource))
+  {
+    DEBUG_puts("5cups_send_pipelined: POST failed.");
+    return (-1);
+  }
+
+  request->state = IPP_STATE_IDLE;
+
+  if (ippWrite(http, request) != IPP_STATE_DATA)
+  {
+    DEBUG_puts("5cups_send_pipelined: Unable to send IPP request.");
+    http->status = HTTP_STATUS_ERROR;
+    return (-1);
+  }
+
+  return (0);
+}
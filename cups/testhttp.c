@@ -13,6 +13,9 @@
  */
 
 #include "cups-private.h"
+#ifdef HAVE_POLL
+#  include <poll.h>
+#endif /* HAVE_POLL */
 
 
 /*
@@ -206,6 +209,47 @@ static const char * const base64_tests[][2] =
 			  { "ABCDEF", "QUJDREVG" },
 			  /* 010000 010100 001001 000011 010001 000100 010101 000110 */
 			};
+static const struct
+{
+  const char	*name;			/* Field name */
+  http_field_t	field;			/* Expected field */
+}			field_tests[] =	/* httpFieldValue test data */
+			{
+			  { "Accept-Encoding", HTTP_FIELD_ACCEPT_ENCODING },
+			  { "accept-language", HTTP_FIELD_ACCEPT_LANGUAGE },
+			  { "AUTHORIZATION", HTTP_FIELD_AUTHORIZATION },
+			  { "Accept-Ranges", HTTP_FIELD_ACCEPT_RANGES },
+			  { "Authentication-Info", HTTP_FIELD_AUTHENTICATION_INFO },
+			  { "Content-Encoding", HTTP_FIELD_CONTENT_ENCODING },
+			  { "Content-Language", HTTP_FIELD_CONTENT_LANGUAGE },
+			  { "Content-Location", HTTP_FIELD_CONTENT_LOCATION },
+			  { "content-length", HTTP_FIELD_CONTENT_LENGTH },
+			  { "If-Unmodified-Since", HTTP_FIELD_IF_UNMODIFIED_SINCE },
+			  { "Transfer-Encoding", HTTP_FIELD_TRANSFER_ENCODING },
+			  { "WWW-Authenticate", HTTP_FIELD_WWW_AUTHENTICATE },
+			  { "Host", HTTP_FIELD_HOST },
+			  { "Cookie", HTTP_FIELD_UNKNOWN },
+			  { "Content-Lengths", HTTP_FIELD_UNKNOWN },
+			  { "Hose", HTTP_FIELD_UNKNOWN },
+			  { "X-Content-Type", HTTP_FIELD_UNKNOWN },
+			  { "", HTTP_FIELD_UNKNOWN }
+			};
+
+
+/*
+ * Local functions...
+ */
+
+static void	connect_cb(http_t *http, http_connect_state_t state, int *counts);
+static void	*serve_ipp(http_t *http);
+static void	*serve_ipp_close(void *lfd);
+static int	test_pipeline(void);
+static int	test_pipeline_close(void);
+static int	test_read_to_fd(int chunked);
+#ifdef HAVE_POLL
+static int	test_reconnect_async(void);
+#endif /* HAVE_POLL */
+static void	*write_body(http_t *http);
 
 
 /*
@@ -336,6 +380,80 @@ main(int  argc,				/* I - Number of command-line arguments */
     if (!j)
       puts("PASS");
 
+   /*
+    * httpFieldValue()
+    */
+
+    fputs("httpFieldValue(): ", stdout);
+
+    for (i = 0, j = 0; i < (int)(sizeof(field_tests) / sizeof(field_tests[0])); i ++)
+    {
+      http_field_t field = httpFieldValue(field_tests[i].name);
+					/* Field for name */
+
+      if (field != field_tests[i].field)
+      {
+        failures ++;
+
+        if (!j)
+	{
+	  puts("FAIL");
+	  j = 1;
+	}
+
+        printf("    httpFieldValue(\"%s\") returned %d, expected %d...\n",
+	       field_tests[i].name, field, field_tests[i].field);
+      }
+    }
+
+    if (!j)
+      puts("PASS");
+
+   /*
+    * httpSetField()/httpGetField()
+    */
+
+    fputs("httpSetField()/httpGetField(): ", stdout);
+
+    if ((http = httpConnect2("localhost", 631, NULL, AF_UNSPEC, HTTP_ENCRYPTION_IF_REQUESTED, 1, 0, NULL)) == NULL)
+    {
+      failures ++;
+      puts("FAIL (httpConnect2)");
+    }
+    else
+    {
+      memset(buffer, 'x', sizeof(buffer) - 1);
+      buffer[sizeof(buffer) - 1] = '\0';
+
+      for (i = 0, j = 0; i < 3 && !j; i ++)
+      {
+       /*
+        * The first pass fits the field arena, later passes overflow it...
+	*/
+
+	httpClearFields(http);
+	httpSetField(http, HTTP_FIELD_CONTENT_TYPE, "application/ipp");
+	httpSetField(http, HTTP_FIELD_USER_AGENT, buffer + sizeof(buffer) - 1 - (i + 1) * 2048);
+	httpSetField(http, HTTP_FIELD_CONTENT_TYPE, httpGetField(http, HTTP_FIELD_CONTENT_TYPE));
+	httpSetField(http, HTTP_FIELD_SERVER, buffer + sizeof(buffer) - 1 - (i + 1) * 2048);
+
+	if (strcmp(httpGetField(http, HTTP_FIELD_CONTENT_TYPE), "application/ipp") ||
+	    strlen(httpGetField(http, HTTP_FIELD_USER_AGENT)) != (size_t)(i + 1) * 2048 ||
+	    strcmp(httpGetField(http, HTTP_FIELD_USER_AGENT), httpGetField(http, HTTP_FIELD_SERVER)) ||
+	    strcmp(httpGetField(http, HTTP_FIELD_HOST), "localhost"))
+	{
+	  failures ++;
+	  printf("FAIL (%d bytes)\n", (i + 1) * 2048);
+	  j = 1;
+	}
+      }
+
+      if (!j)
+        puts("PASS");
+
+      httpClose(http);
+    }
+
 #if 0
    /*
     * _httpDigest()
@@ -547,6 +665,45 @@ main(int  argc,				/* I - Number of command-line arguments */
     else
       printf("PASS (%s)\n", buffer);
 
+   /*
+    * httpReadToFd
+    */
+
+    fputs("httpReadToFd(Content-Length): ", stdout);
+    fflush(stdout);
+    if (!test_read_to_fd(0))
+      failures ++;
+
+    fputs("httpReadToFd(chunked): ", stdout);
+    fflush(stdout);
+    if (!test_read_to_fd(1))
+      failures ++;
+
+   /*
+    * cupsDoRequests
+    */
+
+    fputs("cupsDoRequests: ", stdout);
+    fflush(stdout);
+    if (!test_pipeline())
+      failures ++;
+
+    fputs("cupsDoRequests(Connection: close): ", stdout);
+    fflush(stdout);
+    if (!test_pipeline_close())
+      failures ++;
+
+#ifdef HAVE_POLL
+   /*
+    * httpReconnectAsync()/httpReconnectStep()
+    */
+
+    fputs("httpReconnectAsync/Step: ", stdout);
+    fflush(stdout);
+    if (!test_reconnect_async())
+      failures ++;
+#endif /* HAVE_POLL */
+
    /*
     * Show a summary and return...
     */
@@ -943,3 +1100,624 @@ main(int  argc,				/* I - Number of command-line arguments */
 
   return (0);
 }
+
+
+/*
+ * 'connect_cb()' - Count completed connections for test_reconnect_async().
+ */
+
+static void
+connect_cb(http_t               *http,	/* I - HTTP connection */
+           http_connect_state_t state,	/* I - Final connection state */
+           int                  *counts)/* I - Connected and failed counts */
+{
+  (void)http;
+
+  if (state == HTTP_CONNECT_STATE_CONNECTED)
+    counts[0] ++;
+  else
+    counts[1] ++;
+}
+
+
+/*
+ * 'serve_ipp()' - Answer IPP requests for test_pipeline().
+ */
+
+static void *				/* O - Number of pipelined requests */
+serve_ipp(http_t *http)			/* I - Server connection */
+{
+  intptr_t	pipelined = 0;		/* Number of pipelined requests */
+  char		uri[1024];		/* Request URI */
+  http_status_t	status;			/* Request status */
+  ipp_t		*request,		/* IPP request */
+		*response;		/* IPP response */
+
+
+  while (httpReadRequest(http, uri, sizeof(uri)) == HTTP_STATE_POST)
+  {
+    while ((status = httpUpdate(http)) == HTTP_STATUS_CONTINUE);
+
+    if (status != HTTP_STATUS_OK)
+      break;
+
+    request = ippNew();
+
+    if (ippRead(http, request) != IPP_STATE_DATA)
+    {
+      ippDelete(request);
+      break;
+    }
+
+    if (httpGetReady(http))
+      pipelined ++;
+
+    response = ippNewResponse(request);
+    ippDelete(request);
+
+    httpClearFields(http);
+    httpSetField(http, HTTP_FIELD_CONTENT_TYPE, "application/ipp");
+    httpSetLength(http, ippLength(response));
+
+    if (httpWriteResponse(http, HTTP_STATUS_OK) || ippWrite(http, response) != IPP_STATE_DATA)
+    {
+      ippDelete(response);
+      break;
+    }
+
+    ippDelete(response);
+  }
+
+  httpFlushWrite(http);
+
+  return ((void *)pipelined);
+}
+
+
+/*
+ * 'serve_ipp_close()' - Answer the first IPP request with "Connection: close"
+ *                       and the rest on a new connection for
+ *                       test_pipeline_close().
+ */
+
+static void *				/* O - Number of pipelined requests */
+serve_ipp_close(void *lfd)		/* I - Listen socket */
+{
+  http_t	*http;			/* Server connection */
+  intptr_t	pipelined;		/* Number of pipelined requests */
+  char		uri[1024],		/* Request URI */
+		buffer[8192];		/* Drain buffer */
+  ipp_t		*request,		/* IPP request */
+		*response;		/* IPP response */
+
+
+  if ((http = httpAcceptConnection((int)(intptr_t)lfd, 1)) == NULL)
+    return (NULL);
+
+  if (httpReadRequest(http, uri, sizeof(uri)) == HTTP_STATE_POST && httpUpdate(http) == HTTP_STATUS_OK)
+  {
+    request = ippNew();
+
+    if (ippRead(http, request) == IPP_STATE_DATA)
+    {
+      response = ippNewResponse(request);
+
+      httpClearFields(http);
+      httpSetField(http, HTTP_FIELD_CONTENT_TYPE, "application/ipp");
+      httpSetField(http, HTTP_FIELD_CONNECTION, "close");
+      httpSetLength(http, ippLength(response));
+
+      if (!httpWriteResponse(http, HTTP_STATUS_OK))
+        ippWrite(http, response);
+
+      ippDelete(response);
+    }
+
+    ippDelete(request);
+  }
+
+ /*
+  * Discard the rest of the pipeline without answering it, then wait for the
+  * client to hang up...
+  */
+
+  httpFlushWrite(http);
+  shutdown(httpGetFd(http), SHUT_WR);
+
+  while (recv(httpGetFd(http), buffer, sizeof(buffer), 0) > 0);
+
+  httpClose(http);
+
+  if ((http = httpAcceptConnection((int)(intptr_t)lfd, 1)) == NULL)
+    return (NULL);
+
+  pipelined = (intptr_t)serve_ipp(http);
+
+  httpClose(http);
+
+  return ((void *)pipelined);
+}
+
+
+/*
+ * 'test_pipeline()' - Test pipelined IPP requests over loopback.
+ */
+
+static int				/* O - 1 on success, 0 on failure */
+test_pipeline(void)
+{
+  int			ret = 0;	/* Return value */
+  int			lfd;		/* Listen socket */
+  http_addr_t		addr;		/* Listen address */
+  socklen_t		addrlen;	/* Length of address */
+  http_t		*client = NULL,	/* Client connection */
+			*server = NULL;	/* Server connection */
+  _cups_thread_t	thread = 0;	/* Server thread */
+  int			i,		/* Looping var */
+			count;		/* Number of responses */
+  intptr_t		pipelined = 0;	/* Number of pipelined requests */
+  ipp_t			*requests[40],	/* IPP requests */
+			*responses[40];	/* IPP responses */
+
+
+  memset(&addr, 0, sizeof(addr));
+  addr.ipv4.sin_family      = AF_INET;
+  addr.ipv4.sin_addr.s_addr = htonl(0x7f000001);
+
+  if ((lfd = httpAddrListen(&addr, 0)) < 0)
+  {
+    printf("FAIL (httpAddrListen: %s)\n", cupsLastErrorString());
+    return (0);
+  }
+
+  addrlen = sizeof(addr);
+  getsockname(lfd, (struct sockaddr *)&addr, &addrlen);
+
+  if ((client = httpConnect2("127.0.0.1", httpAddrPort(&addr), NULL, AF_INET, HTTP_ENCRYPTION_NEVER, 1, 30000, NULL)) == NULL || (server = httpAcceptConnection(lfd, 1)) == NULL)
+  {
+    printf("FAIL (unable to connect: %s)\n", cupsLastErrorString());
+    goto done;
+  }
+
+  if ((thread = _cupsThreadCreate((_cups_thread_func_t)serve_ipp, server)) == 0)
+  {
+    puts("FAIL (unable to create server thread)");
+    goto done;
+  }
+
+  for (i = 0; i < (int)(sizeof(requests) / sizeof(requests[0])); i ++)
+  {
+    requests[i] = ippNewRequest(IPP_OP_GET_PRINTER_ATTRIBUTES);
+    ippSetRequestId(requests[i], i + 1);
+    ippAddString(requests[i], IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, "ipp://localhost/ipp/print");
+  }
+
+  count = cupsDoRequests(client, i, requests, "/ipp/print", responses);
+
+  httpClose(client);
+  client    = NULL;
+  pipelined = (intptr_t)_cupsThreadWait(thread);
+  thread    = 0;
+
+  for (i = 0; i < count; i ++)
+  {
+    if (!responses[i] || ippGetRequestId(responses[i]) != i + 1)
+      break;
+  }
+
+  if (count != (int)(sizeof(requests) / sizeof(requests[0])) || i < count)
+    printf("FAIL (got %d responses, response %d out of order)\n", count, i + 1);
+  else
+  {
+    printf("PASS (%d responses, %d pipelined)\n", count, (int)pipelined);
+    ret = 1;
+  }
+
+  for (i = 0; i < (int)(sizeof(responses) / sizeof(responses[0])); i ++)
+    ippDelete(responses[i]);
+
+  done:
+
+  if (thread)
+    _cupsThreadWait(thread);
+
+  httpClose(server);
+  httpClose(client);
+  httpAddrClose(NULL, lfd);
+
+  return (ret);
+}
+
+
+/*
+ * 'test_pipeline_close()' - Test pipelined IPP requests that are cut short by
+ *                           "Connection: close".
+ */
+
+static int				/* O - 1 on success, 0 on failure */
+test_pipeline_close(void)
+{
+  int			ret = 0;	/* Return value */
+  int			lfd;		/* Listen socket */
+  http_addr_t		addr;		/* Listen address */
+  socklen_t		addrlen;	/* Length of address */
+  http_t		*client = NULL;	/* Client connection */
+  _cups_thread_t	thread = 0;	/* Server thread */
+  int			i,		/* Looping var */
+			count,		/* Number of responses */
+			failed = 0,	/* Number of failed in-flight requests */
+			ok = 0;		/* Number of successful responses */
+  ipp_t			*requests[40],	/* IPP requests */
+			*responses[40];	/* IPP responses */
+
+
+  memset(&addr, 0, sizeof(addr));
+  addr.ipv4.sin_family      = AF_INET;
+  addr.ipv4.sin_addr.s_addr = htonl(0x7f000001);
+
+  if ((lfd = httpAddrListen(&addr, 0)) < 0)
+  {
+    printf("FAIL (httpAddrListen: %s)\n", cupsLastErrorString());
+    return (0);
+  }
+
+  addrlen = sizeof(addr);
+  getsockname(lfd, (struct sockaddr *)&addr, &addrlen);
+
+  if ((thread = _cupsThreadCreate((_cups_thread_func_t)serve_ipp_close, (void *)(intptr_t)lfd)) == 0)
+  {
+    puts("FAIL (unable to create server thread)");
+    goto done;
+  }
+
+  if ((client = httpConnect2("127.0.0.1", httpAddrPort(&addr), NULL, AF_INET, HTTP_ENCRYPTION_NEVER, 1, 30000, NULL)) == NULL)
+  {
+    printf("FAIL (unable to connect: %s)\n", cupsLastErrorString());
+    goto done;
+  }
+
+  for (i = 0; i < (int)(sizeof(requests) / sizeof(requests[0])); i ++)
+  {
+    requests[i] = ippNewRequest(IPP_OP_GET_PRINTER_ATTRIBUTES);
+    ippSetRequestId(requests[i], i + 1);
+    ippAddString(requests[i], IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, "ipp://localhost/ipp/print");
+  }
+
+  count = cupsDoRequests(client, i, requests, "/ipp/print", responses);
+
+  httpClose(client);
+  client = NULL;
+  _cupsThreadWait(thread);
+  thread = 0;
+
+ /*
+  * The requests that were in flight when the server closed the connection
+  * must fail without being re-sent, everything else must succeed...
+  */
+
+  for (i = 0; i < (int)(sizeof(responses) / sizeof(responses[0])); i ++)
+  {
+    if (!responses[i] || ippGetRequestId(responses[i]) != i + 1)
+      break;
+    else if (ippGetStatusCode(responses[i]) == IPP_STATUS_ERROR_SERVICE_UNAVAILABLE && ok == 1)
+      failed ++;
+    else if (ippGetStatusCode(responses[i]) == IPP_STATUS_OK && (ok == 0 || failed > 0))
+      ok ++;
+    else
+      break;
+  }
+
+  if (i < (int)(sizeof(responses) / sizeof(responses[0])))
+    printf("FAIL (response %d missing or out of order)\n", i + 1);
+  else if (failed == 0 || count != ok)
+    printf("FAIL (got %d responses, %d OK, %d failed)\n", count, ok, failed);
+  else
+  {
+    printf("PASS (%d responses, %d failed in flight)\n", count, failed);
+    ret = 1;
+  }
+
+  for (i = 0; i < (int)(sizeof(responses) / sizeof(responses[0])); i ++)
+    ippDelete(responses[i]);
+
+  done:
+
+  if (thread)
+  {
+    httpAddrClose(NULL, lfd);
+    lfd = -1;
+    _cupsThreadWait(thread);
+  }
+
+  httpClose(client);
+  httpAddrClose(NULL, lfd);
+
+  return (ret);
+}
+
+
+/*
+ * 'test_read_to_fd()' - Test copying a message body to a file over loopback.
+ */
+
+static int				/* O - 1 on success, 0 on failure */
+test_read_to_fd(int chunked)		/* I - Send a chunked message body? */
+{
+  int			ret = 0;	/* Return value */
+  int			lfd,		/* Listen socket */
+			fd = -1;	/* Temporary file */
+  http_addr_t		addr;		/* Listen address */
+  socklen_t		addrlen;	/* Length of address */
+  http_t		*client = NULL,	/* Client connection */
+			*server = NULL;	/* Server connection */
+  _cups_thread_t	writer = 0;	/* Writer thread */
+  char			uri[1024],	/* Request URI */
+			filename[1024],	/* Temporary filename */
+			buffer[8192];	/* Read buffer */
+  off_t			total,		/* Bytes copied */
+			offset;		/* Offset in file */
+  ssize_t		bytes,		/* Bytes read */
+			i;		/* Looping var */
+  http_status_t		status;		/* Request status */
+
+
+  memset(&addr, 0, sizeof(addr));
+  addr.ipv4.sin_family      = AF_INET;
+  addr.ipv4.sin_addr.s_addr = htonl(0x7f000001);
+
+  if ((lfd = httpAddrListen(&addr, 0)) < 0)
+  {
+    printf("FAIL (httpAddrListen: %s)\n", cupsLastErrorString());
+    return (0);
+  }
+
+  addrlen = sizeof(addr);
+  getsockname(lfd, (struct sockaddr *)&addr, &addrlen);
+
+  if ((client = httpConnect2("127.0.0.1", httpAddrPort(&addr), NULL, AF_INET, HTTP_ENCRYPTION_NEVER, 1, 30000, NULL)) == NULL || (server = httpAcceptConnection(lfd, 1)) == NULL)
+  {
+    printf("FAIL (unable to connect: %s)\n", cupsLastErrorString());
+    goto done;
+  }
+
+  httpClearFields(client);
+  httpSetField(client, HTTP_FIELD_HOST, "localhost");
+  httpSetField(client, HTTP_FIELD_CONTENT_TYPE, "application/octet-stream");
+  if (chunked)
+    httpSetField(client, HTTP_FIELD_TRANSFER_ENCODING, "chunked");
+  else
+    httpSetLength(client, 24 * sizeof(buffer) + 123);
+
+  if (httpPost(client, "/"))
+  {
+    printf("FAIL (httpPost: %s)\n", cupsLastErrorString());
+    goto done;
+  }
+
+  if ((writer = _cupsThreadCreate((_cups_thread_func_t)write_body, client)) == 0)
+  {
+    puts("FAIL (unable to create writer thread)");
+    goto done;
+  }
+
+  if (httpReadRequest(server, uri, sizeof(uri)) != HTTP_STATE_POST)
+  {
+    puts("FAIL (httpReadRequest)");
+    goto done;
+  }
+
+  while ((status = httpUpdate(server)) == HTTP_STATUS_CONTINUE);
+
+  if (status != HTTP_STATUS_OK)
+  {
+    printf("FAIL (httpUpdate returned %d)\n", status);
+    goto done;
+  }
+
+  if ((fd = cupsTempFd(filename, sizeof(filename))) < 0)
+  {
+    printf("FAIL (cupsTempFd: %s)\n", strerror(errno));
+    goto done;
+  }
+
+  if ((total = httpReadToFd(server, fd)) != (off_t)(24 * sizeof(buffer) + 123))
+  {
+    printf("FAIL (copied " CUPS_LLFMT " bytes, expected %d)\n", CUPS_LLCAST total, (int)(24 * sizeof(buffer) + 123));
+    goto done;
+  }
+
+  if (httpGetState(server) != HTTP_STATE_POST_SEND)
+  {
+    printf("FAIL (state is %s, expected HTTP_STATE_POST_SEND)\n", httpStateString(httpGetState(server)));
+    goto done;
+  }
+
+  lseek(fd, 0, SEEK_SET);
+
+  for (offset = 0; (bytes = read(fd, buffer, sizeof(buffer))) > 0; offset += bytes)
+  {
+    for (i = 0; i < bytes; i ++)
+    {
+      if (buffer[i] != (char)((offset + i) & 255))
+      {
+        printf("FAIL (byte " CUPS_LLFMT " differs)\n", CUPS_LLCAST (offset + i));
+        goto done;
+      }
+    }
+  }
+
+  if (offset != total)
+  {
+    printf("FAIL (file has " CUPS_LLFMT " bytes, expected " CUPS_LLFMT ")\n", CUPS_LLCAST offset, CUPS_LLCAST total);
+    goto done;
+  }
+
+  printf("PASS (" CUPS_LLFMT " bytes)\n", CUPS_LLCAST total);
+  ret = 1;
+
+  done:
+
+  if (writer)
+    _cupsThreadWait(writer);
+
+  if (fd >= 0)
+  {
+    close(fd);
+    unlink(filename);
+  }
+
+  httpClose(server);
+  httpClose(client);
+  httpAddrClose(NULL, lfd);
+
+  return (ret);
+}
+
+
+#ifdef HAVE_POLL
+/*
+ * 'test_reconnect_async()' - Open several connections from a single thread.
+ */
+
+static int				/* O - 1 on success, 0 on failure */
+test_reconnect_async(void)
+{
+  int			ret = 0;	/* Return value */
+  int			lfd,		/* Listen socket */
+			cfd,		/* Closed port socket */
+			sfds[8];	/* Accepted sockets */
+  http_addr_t		addr,		/* Listen address */
+			caddr;		/* Closed port address */
+  socklen_t		addrlen;	/* Length of address */
+  http_t		*clients[9] = { NULL };
+					/* Client connections */
+  struct pollfd		pfds[10];	/* Polled file descriptors */
+  int			i,		/* Looping var */
+			nfds,		/* Number of polled descriptors */
+			pending,	/* Number of pending connections */
+			accepted = 0,	/* Number of accepted connections */
+			counts[2] = { 0, 0 };
+					/* Connected and failed counts */
+  short			events;		/* Events to wait for */
+  time_t		end;		/* End time */
+
+
+  memset(&addr, 0, sizeof(addr));
+  addr.ipv4.sin_family      = AF_INET;
+  addr.ipv4.sin_addr.s_addr = htonl(0x7f000001);
+  caddr                     = addr;
+
+  if ((lfd = httpAddrListen(&addr, 0)) < 0 || (cfd = httpAddrListen(&caddr, 0)) < 0)
+  {
+    printf("FAIL (httpAddrListen: %s)\n", cupsLastErrorString());
+    return (0);
+  }
+
+  addrlen = sizeof(addr);
+  getsockname(lfd, (struct sockaddr *)&addr, &addrlen);
+  addrlen = sizeof(caddr);
+  getsockname(cfd, (struct sockaddr *)&caddr, &addrlen);
+  httpAddrClose(NULL, cfd);
+
+ /*
+  * Start 8 connections to the listener and one to a closed port...
+  */
+
+  for (i = 0; i < 9; i ++)
+  {
+    clients[i] = httpConnect2("127.0.0.1", httpAddrPort(i < 8 ? &addr : &caddr), NULL, AF_INET, HTTP_ENCRYPTION_NEVER, 1, 0, NULL);
+
+    if (!clients[i] || httpReconnectAsync(clients[i], (http_connect_cb_t)connect_cb, counts))
+    {
+      printf("FAIL (httpReconnectAsync: %s)\n", cupsLastErrorString());
+      goto done;
+    }
+  }
+
+ /*
+  * Drive everything from one poll() loop...
+  */
+
+  for (end = time(NULL) + 10; time(NULL) < end;)
+  {
+    for (i = 0, nfds = 0, pending = 0; i < 9; i ++)
+    {
+      if (httpReconnectStep(clients[i], &events) > HTTP_CONNECT_STATE_CONNECTED)
+      {
+        pfds[nfds].fd     = httpGetFd(clients[i]);
+        pfds[nfds].events = events;
+        nfds ++;
+        pending ++;
+      }
+    }
+
+    if (accepted < 8)
+    {
+      pfds[nfds].fd     = lfd;
+      pfds[nfds].events = POLLIN;
+      nfds ++;
+    }
+    else if (!pending)
+      break;
+
+    if (poll(pfds, (nfds_t)nfds, 1000) > 0 && accepted < 8 && (pfds[nfds - 1].revents & POLLIN))
+    {
+      addrlen = sizeof(caddr);
+      if ((sfds[accepted] = (int)accept(lfd, (struct sockaddr *)&caddr, &addrlen)) >= 0)
+        accepted ++;
+    }
+  }
+
+  if (counts[0] != 8 || counts[1] != 1 || accepted != 8)
+    printf("FAIL (%d connected, %d failed, %d accepted)\n", counts[0], counts[1], accepted);
+  else
+  {
+    puts("PASS");
+    ret = 1;
+  }
+
+  while (accepted > 0)
+    httpAddrClose(NULL, sfds[-- accepted]);
+
+  done:
+
+  for (i = 0; i < 9; i ++)
+    httpClose(clients[i]);
+
+  httpAddrClose(NULL, lfd);
+
+  return (ret);
+}
+#endif /* HAVE_POLL */
+
+
+/*
+ * 'write_body()' - Write a message body for test_read_to_fd().
+ */
+
+static void *				/* O - Thread exit status */
+write_body(http_t *http)		/* I - Client connection */
+{
+  int		i, j;			/* Looping vars */
+  off_t		offset = 0;		/* Offset in message body */
+  char		buffer[8192];		/* Write buffer */
+
+
+  for (i = 0; i < 25; i ++)
+  {
+    size_t length = i < 24 ? sizeof(buffer) : 123;
+					/* Length of this write */
+
+    for (j = 0; j < (int)length; j ++, offset ++)
+      buffer[j] = (char)(offset & 255);
+
+    httpWrite2(http, buffer, length);
+  }
+
+  if (httpIsChunked(http))
+    httpWrite2(http, "", 0);
+
+  httpFlushWrite(http);
+
+  return (NULL);
+}
@@ -1112,6 +1112,24 @@ httpSaveCredentials(
 }
 
 
+/*
+ * '_httpTLSHandshake()' - Continue an asynchronous TLS handshake.
+ *
+ * Secure Transport handshakes are done synchronously on a blocking socket.
+ */
+
+int					/* O - 1 when complete, 0 if pending, -1 on error */
+_httpTLSHandshake(http_t *http,		/* I - HTTP connection */
+                  int    *want_write)	/* O - 1 to wait for writable socket, 0 for readable */
+{
+  *want_write = 0;
+
+  fcntl(http->fd, F_SETFL, fcntl(http->fd, F_GETFL) & ~O_NONBLOCK);
+
+  return (_httpTLSStart(http) ? -1 : 1);
+}
+
+
 /*
  * '_httpTLSInitialize()' - Initialize the TLS stack.
  */
@@ -17,10 +17,43 @@
 #include <sys/stat.h>
 
 
+/*
+ * Local types...
+ */
+
+typedef struct _http_gnutls_session_s	/**** Cached TLS session ****/
+{
+  unsigned char		key[HTTP_MAX_HOST + 8];
+					/* Session ID or "hostname:port" */
+  size_t		keylen;		/* Length of key */
+  int			slot;		/* Slot in eviction ring */
+  gnutls_datum_t	data;		/* Session data */
+} _http_gnutls_session_t;
+
+typedef struct _http_gnutls_cache_s	/**** TLS session cache ****/
+{
+  cups_array_t		*sessions;	/* Sessions sorted by key */
+  _http_gnutls_session_t *ring[_HTTP_TLS_CACHE_MAX];
+					/* Sessions in the order they were added */
+  int			next;		/* Next slot in eviction ring */
+} _http_gnutls_cache_t;
+
+
 /*
  * Local globals...
  */
 
+static _http_gnutls_cache_t tls_client_cache,
+					/* Client sessions by hostname:port */
+			tls_server_cache;
+					/* Server sessions by session ID */
+static _cups_mutex_t	tls_cache_mutex = _CUPS_MUTEX_INITIALIZER;
+					/* Mutex for session caches, tickets, and statistics */
+static _http_tls_stats_t tls_stats;	/* Session resumption statistics */
+static gnutls_datum_t	tls_ticket_key;	/* Current session ticket key */
+static time_t		tls_ticket_time = 0;
+					/* Time session ticket key was generated */
+
 static int		tls_auto_create = 0;
 					/* Auto-create self-signed certs? */
 static char		*tls_common_name = NULL;
@@ -39,11 +72,21 @@ static int		tls_options = -1,/* Options for TLS connections */
  * Local functions...
  */
 
+static int		http_gnutls_cache_compare(_http_gnutls_session_t *a, _http_gnutls_session_t *b);
+static _http_gnutls_session_t *http_gnutls_cache_find(_http_gnutls_cache_t *cache, const void *key, size_t keylen);
+static void		http_gnutls_cache_remove(_http_gnutls_cache_t *cache, _http_gnutls_session_t *session);
+static int		http_gnutls_cache_store(_http_gnutls_cache_t *cache, const void *key, size_t keylen, const gnutls_datum_t *data);
 static gnutls_x509_crt_t http_gnutls_create_credential(http_credential_t *credential);
+static int		http_gnutls_db_remove(void *ptr, gnutls_datum_t key);
+static gnutls_datum_t	http_gnutls_db_retrieve(void *ptr, gnutls_datum_t key);
+static int		http_gnutls_db_store(void *ptr, gnutls_datum_t key, gnutls_datum_t data);
 static const char	*http_gnutls_default_path(char *buffer, size_t bufsize);
+static void		http_gnutls_handshake_done(http_t *http);
 static void		http_gnutls_load_crl(void);
 static const char	*http_gnutls_make_path(char *buffer, size_t bufsize, const char *dirname, const char *filename, const char *ext);
 static ssize_t		http_gnutls_read(gnutls_transport_ptr_t ptr, void *data, size_t length);
+static void		http_gnutls_save_session(http_t *http);
+static const char	*http_gnutls_session_name(http_t *http, char *buffer, size_t bufsize);
 static ssize_t		http_gnutls_write(gnutls_transport_ptr_t ptr, const void *data, size_t length);
 
 
@@ -888,6 +931,133 @@ httpSaveCredentials(
 }
 
 
+/*
+ * 'http_gnutls_cache_compare()' - Compare two cached sessions.
+ */
+
+static int				/* O - Result of comparison */
+http_gnutls_cache_compare(
+    _http_gnutls_session_t *a,		/* I - First session */
+    _http_gnutls_session_t *b)		/* I - Second session */
+{
+  if (a->keylen != b->keylen)
+    return ((int)a->keylen - (int)b->keylen);
+  else
+    return (memcmp(a->key, b->key, a->keylen));
+}
+
+
+/*
+ * 'http_gnutls_cache_find()' - Find a cached session.
+ *
+ * The cache mutex must be held by the caller.
+ */
+
+static _http_gnutls_session_t *		/* O - Session or `NULL` if not found */
+http_gnutls_cache_find(
+    _http_gnutls_cache_t *cache,	/* I - Session cache */
+    const void           *key,		/* I - Key */
+    size_t               keylen)	/* I - Length of key */
+{
+  _http_gnutls_session_t	search;	/* Search key */
+
+
+  if (!cache->sessions || keylen > sizeof(search.key))
+    return (NULL);
+
+  memcpy(search.key, key, keylen);
+  search.keylen = keylen;
+
+  return ((_http_gnutls_session_t *)cupsArrayFind(cache->sessions, &search));
+}
+
+
+/*
+ * 'http_gnutls_cache_remove()' - Remove a session from the cache.
+ *
+ * The cache mutex must be held by the caller.
+ */
+
+static void
+http_gnutls_cache_remove(
+    _http_gnutls_cache_t   *cache,	/* I - Session cache */
+    _http_gnutls_session_t *session)	/* I - Session */
+{
+  cupsArrayRemove(cache->sessions, session);
+
+  cache->ring[session->slot] = NULL;
+
+  free(session->data.data);
+  free(session);
+}
+
+
+/*
+ * 'http_gnutls_cache_store()' - Add or replace a session in the cache.
+ *
+ * When the cache is full, the oldest session is discarded.  The cache mutex
+ * must be held by the caller.
+ */
+
+static int				/* O - 0 on success, -1 on error */
+http_gnutls_cache_store(
+    _http_gnutls_cache_t *cache,	/* I - Session cache */
+    const void           *key,		/* I - Key */
+    size_t               keylen,	/* I - Length of key */
+    const gnutls_datum_t *data)		/* I - Session data */
+{
+  _http_gnutls_session_t *session;	/* Session */
+  unsigned char		*copy;		/* Copy of session data */
+
+
+  if (keylen > sizeof(session->key) || !data->data || !data->size)
+    return (-1);
+
+  if ((copy = malloc(data->size)) == NULL)
+    return (-1);
+
+  memcpy(copy, data->data, data->size);
+
+  if ((session = http_gnutls_cache_find(cache, key, keylen)) != NULL)
+  {
+   /*
+    * Replace the existing session data...
+    */
+
+    free(session->data.data);
+    session->data.data = copy;
+    session->data.size = data->size;
+
+    return (0);
+  }
+
+  if (!cache->sessions)
+    cache->sessions = cupsArrayNew((cups_array_func_t)http_gnutls_cache_compare, NULL);
+
+  if (cache->ring[cache->next])
+    http_gnutls_cache_remove(cache, cache->ring[cache->next]);
+
+  if ((session = calloc(1, sizeof(_http_gnutls_session_t))) == NULL)
+  {
+    free(copy);
+    return (-1);
+  }
+
+  memcpy(session->key, key, keylen);
+  session->keylen    = keylen;
+  session->slot      = cache->next;
+  session->data.data = copy;
+  session->data.size = data->size;
+
+  cupsArrayAdd(cache->sessions, session);
+
+  cache->ring[cache->next] = session;
+  cache->next              = (cache->next + 1) % _HTTP_TLS_CACHE_MAX;
+
+  return (0);
+}
+
+
 /*
  * 'http_gnutls_create_credential()' - Create a single credential in the internal format.
  */
@@ -927,6 +1097,80 @@ http_gnutls_create_credential(
 }
 
 
+/*
+ * 'http_gnutls_db_remove()' - Remove a session from the server session cache.
+ */
+
+static int				/* O - 0 on success, -1 on error */
+http_gnutls_db_remove(
+    void           *ptr,		/* I - Session cache */
+    gnutls_datum_t key)			/* I - Session ID */
+{
+  _http_gnutls_session_t *session;	/* Session */
+
+
+  _cupsMutexLock(&tls_cache_mutex);
+
+  if ((session = http_gnutls_cache_find((_http_gnutls_cache_t *)ptr, key.data, key.size)) != NULL)
+    http_gnutls_cache_remove((_http_gnutls_cache_t *)ptr, session);
+
+  _cupsMutexUnlock(&tls_cache_mutex);
+
+  return (session ? 0 : -1);
+}
+
+
+/*
+ * 'http_gnutls_db_retrieve()' - Retrieve a session from the server session cache.
+ */
+
+static gnutls_datum_t			/* O - Copy of session data */
+http_gnutls_db_retrieve(
+    void           *ptr,		/* I - Session cache */
+    gnutls_datum_t key)			/* I - Session ID */
+{
+  _http_gnutls_session_t *session;	/* Session */
+  gnutls_datum_t	data = { NULL, 0 };
+					/* Session data */
+
+
+  _cupsMutexLock(&tls_cache_mutex);
+
+  if ((session = http_gnutls_cache_find((_http_gnutls_cache_t *)ptr, key.data, key.size)) != NULL && (data.data = gnutls_malloc(session->data.size)) != NULL)
+  {
+    memcpy(data.data, session->data.data, session->data.size);
+    data.size = session->data.size;
+  }
+
+  _cupsMutexUnlock(&tls_cache_mutex);
+
+  DEBUG_printf(("4http_gnutls_db_retrieve: %s session.", data.data ? "Found" : "No"));
+
+  return (data);
+}
+
+
+/*
+ * 'http_gnutls_db_store()' - Add a session to the server session cache.
+ */
+
+static int				/* O - 0 on success, -1 on error */
+http_gnutls_db_store(
+    void           *ptr,		/* I - Session cache */
+    gnutls_datum_t key,			/* I - Session ID */
+    gnutls_datum_t data)		/* I - Session data */
+{
+  int	ret;				/* Return value */
+
+
+  _cupsMutexLock(&tls_cache_mutex);
+  ret = http_gnutls_cache_store((_http_gnutls_cache_t *)ptr, key.data, key.size, &data);
+  _cupsMutexUnlock(&tls_cache_mutex);
+
+  return (ret);
+}
+
+
 /*
  * 'http_gnutls_default_path()' - Get the default credential store path.
  */
@@ -972,6 +1216,40 @@ http_gnutls_default_path(char   *buffer,/* I - Path buffer */
 }
 
 
+/*
+ * 'http_gnutls_handshake_done()' - Update statistics and save the session after a handshake.
+ */
+
+static void
+http_gnutls_handshake_done(
+    http_t *http)			/* I - Connection to server */
+{
+ /*
+  * Update the resumption statistics and save the client session...
+  */
+
+  _cupsMutexLock(&tls_cache_mutex);
+
+  if (gnutls_session_is_resumed(http->tls))
+  {
+    if (http->mode == _HTTP_MODE_CLIENT)
+      tls_stats.client_hits ++;
+    else
+      tls_stats.server_hits ++;
+  }
+  else if (http->mode == _HTTP_MODE_CLIENT)
+    tls_stats.client_misses ++;
+  else
+    tls_stats.server_misses ++;
+
+  _cupsMutexUnlock(&tls_cache_mutex);
+
+  DEBUG_printf(("4http_gnutls_handshake_done: Session %s.", gnutls_session_is_resumed(http->tls) ? "resumed" : "not resumed"));
+
+  http_gnutls_save_session(http);
+}
+
+
 /*
  * 'http_gnutls_load_crl()' - Load the certificate revocation list, if any.
  */
@@ -1123,10 +1401,11 @@ http_gnutls_read(
 
   http = (http_t *)ptr;
 
-  if (!http->blocking || http->timeout_value > 0.0)
+  if ((!http->blocking || http->timeout_value > 0.0) && http->connect_state != HTTP_CONNECT_STATE_HANDSHAKE)
   {
    /*
-    * Make sure we have data before we read...
+    * Make sure we have data before we read (asynchronous handshakes use a
+    * non-blocking socket and retry when the caller sees more data)...
     */
 
     while (!_httpWait(http, http->wait_value, 0))
@@ -1145,6 +1424,47 @@ http_gnutls_read(
 }
 
 
+/*
+ * 'http_gnutls_save_session()' - Save client session data for later resumption.
+ */
+
+static void
+http_gnutls_save_session(http_t *http)	/* I - Connection to server */
+{
+  gnutls_datum_t	data;		/* Session data */
+  char			name[HTTP_MAX_HOST + 8];
+					/* hostname:port */
+
+
+  if (http->mode != _HTTP_MODE_CLIENT || gnutls_session_get_data2(http->tls, &data))
+    return;
+
+  http_gnutls_session_name(http, name, sizeof(name));
+
+  _cupsMutexLock(&tls_cache_mutex);
+  http_gnutls_cache_store(&tls_client_cache, name, strlen(name), &data);
+  _cupsMutexUnlock(&tls_cache_mutex);
+
+  gnutls_free(data.data);
+}
+
+
+/*
+ * 'http_gnutls_session_name()' - Get the client session cache key for a connection.
+ */
+
+static const char *			/* O - hostname:port */
+http_gnutls_session_name(
+    http_t *http,			/* I - Connection to server */
+    char   *buffer,			/* I - Name buffer */
+    size_t bufsize)			/* I - Size of name buffer */
+{
+  snprintf(buffer, bufsize, "%s:%d", http->hostname, httpAddrPort(http->hostaddr));
+
+  return (buffer);
+}
+
+
 /*
  * 'http_gnutls_write()' - Write function for the GNU TLS library.
  */
@@ -1167,6 +1487,71 @@ http_gnutls_write(
 }
 
 
+/*
+ * '_httpTLSGetStats()' - Get TLS session resumption statistics.
+ */
+
+void
+_httpTLSGetStats(
+    _http_tls_stats_t *stats)		/* O - Statistics */
+{
+  _cupsMutexLock(&tls_cache_mutex);
+  *stats = tls_stats;
+  _cupsMutexUnlock(&tls_cache_mutex);
+}
+
+
+/*
+ * '_httpTLSHandshake()' - Continue an asynchronous TLS handshake.
+ *
+ * The socket must be non-blocking and "http->connect_state" must be
+ * HTTP_CONNECT_STATE_HANDSHAKE.  When 0 is returned, call again once the
+ * socket is readable or, if "want_write" is set, writable.
+ */
+
+int					/* O - 1 when complete, 0 if pending, -1 on error */
+_httpTLSHandshake(http_t *http,		/* I - Connection to server */
+                  int    *want_write)	/* O - 1 to wait for writable socket, 0 for readable */
+{
+  int	status;				/* Status of handshake */
+
+
+  DEBUG_printf(("3_httpTLSHandshake(http=%p, want_write=%p)", (void *)http, (void *)want_write));
+
+  *want_write = 0;
+
+  if (!http->tls && _httpTLSStart(http))
+    return (-1);
+
+  if ((status = gnutls_handshake(http->tls)) == GNUTLS_E_SUCCESS)
+  {
+    http_gnutls_handshake_done(http);
+    return (1);
+  }
+
+  DEBUG_printf(("4_httpTLSHandshake: gnutls_handshake returned %d (%s)", status, gnutls_strerror(status)));
+
+  if (!gnutls_error_is_fatal(status))
+  {
+    *want_write = gnutls_record_get_direction(http->tls);
+    return (0);
+  }
+
+  http->error  = EIO;
+  http->status = HTTP_STATUS_ERROR;
+
+  _cupsSetError(IPP_STATUS_ERROR_CUPS_PKI, gnutls_strerror(status), 0);
+
+  gnutls_deinit(http->tls);
+  gnutls_certificate_free_credentials(*(http->tls_credentials));
+  free(http->tls_credentials);
+  http->tls             = NULL;
+  http->tls_credentials = NULL;
+
+  return (-1);
+}
+
+
 /*
  * '_httpTLSInitialize()' - Initialize the TLS stack.
  */
@@ -1207,6 +1592,14 @@ _httpTLSRead(http_t *http,		/* I - Connection to server */
 
   result = gnutls_record_recv(http->tls, buf, (size_t)len);
 
+ /*
+  * GNU TLS returns GNUTLS_E_AGAIN after processing a TLS/1.3 post-handshake
+  * message such as a session ticket, so retry as long as more data arrives...
+  */
+
+  while (result == GNUTLS_E_AGAIN && _httpWait(http, http->blocking ? http->wait_value : 0, 0))
+    result = gnutls_record_recv(http->tls, buf, (size_t)len);
+
   if (result < 0 && !errno)
   {
    /*
@@ -1597,6 +1990,64 @@ _httpTLSStart(http_t *http)		/* I - Connection to server */
   gnutls_priority_deinit(priority);
 #endif /* HAVE_GNUTLS_PRIORITY_SET_DIRECT */
 
+  if (http->mode == _HTTP_MODE_CLIENT)
+  {
+   /*
+    * Client: resume the last session with this server, if any...
+    */
+
+    char		name[HTTP_MAX_HOST + 8];
+					/* hostname:port */
+    _http_gnutls_session_t *session;	/* Cached session */
+
+    http_gnutls_session_name(http, name, sizeof(name));
+
+    _cupsMutexLock(&tls_cache_mutex);
+
+    if ((session = http_gnutls_cache_find(&tls_client_cache, name, strlen(name))) != NULL)
+    {
+      DEBUG_printf(("4_httpTLSStart: Resuming session for \"%s\".", name));
+      gnutls_session_set_data(http->tls, session->data.data, session->data.size);
+    }
+
+    _cupsMutexUnlock(&tls_cache_mutex);
+  }
+  else
+  {
+   /*
+    * Server: support resumption using the session cache and session tickets,
+    * rotating the ticket key periodically...
+    */
+
+    gnutls_db_set_retrieve_function(http->tls, http_gnutls_db_retrieve);
+    gnutls_db_set_remove_function(http->tls, http_gnutls_db_remove);
+    gnutls_db_set_store_function(http->tls, http_gnutls_db_store);
+    gnutls_db_set_ptr(http->tls, &tls_server_cache);
+
+    _cupsMutexLock(&tls_cache_mutex);
+
+    if (!tls_ticket_key.data || time(NULL) >= (tls_ticket_time + _HTTP_TLS_TICKET_LIFE))
+    {
+      DEBUG_puts("4_httpTLSStart: Generating new session ticket key.");
+
+      if (tls_ticket_key.data)
+      {
+        gnutls_memset(tls_ticket_key.data, 0, tls_ticket_key.size);
+        gnutls_free(tls_ticket_key.data);
+        tls_ticket_key.data = NULL;
+        tls_ticket_key.size = 0;
+      }
+
+      if (!gnutls_session_ticket_key_generate(&tls_ticket_key))
+        tls_ticket_time = time(NULL);
+    }
+
+    if (tls_ticket_key.data)
+      gnutls_session_ticket_enable_server(http->tls, &tls_ticket_key);
+
+    _cupsMutexUnlock(&tls_cache_mutex);
+  }
+
   gnutls_transport_set_ptr(http->tls, (gnutls_transport_ptr_t)http);
   gnutls_transport_set_pull_function(http->tls, http_gnutls_read);
 #ifdef HAVE_GNUTLS_TRANSPORT_SET_PULL_TIMEOUT_FUNCTION
@@ -1604,6 +2055,20 @@ _httpTLSStart(http_t *http)		/* I - Connection to server */
 #endif /* HAVE_GNUTLS_TRANSPORT_SET_PULL_TIMEOUT_FUNCTION */
   gnutls_transport_set_push_function(http->tls, http_gnutls_write);
 
+  if (http->connect_state == HTTP_CONNECT_STATE_HANDSHAKE)
+  {
+   /*
+    * Asynchronous connection, _httpTLSHandshake does the handshake and the
+    * caller handles any timeout...
+    */
+
+    gnutls_handshake_set_timeout(http->tls, GNUTLS_INDEFINITE_TIMEOUT);
+
+    http->tls_credentials = credentials;
+
+    return (0);
+  }
+
  /*
   * Enforce a minimum timeout of 10 seconds for the TLS handshake...
   */
@@ -1653,6 +2118,8 @@ _httpTLSStart(http_t *http)		/* I - Connection to server */
 
   http->tls_credentials = credentials;
 
+  http_gnutls_handshake_done(http);
+
   return (0);
 }
 
@@ -1667,6 +2134,13 @@ _httpTLSStop(http_t *http)		/* I - Connection to server */
   int	error;				/* Error code */
 
 
+ /*
+  * Save the client session again since TLS/1.3 session tickets arrive after
+  * the handshake...
+  */
+
+  http_gnutls_save_session(http);
+
   error = gnutls_bye(http->tls, http->mode == _HTTP_MODE_CLIENT ? GNUTLS_SHUT_RDWR : GNUTLS_SHUT_WR);
   if (error != GNUTLS_E_SUCCESS)
     _cupsSetError(IPP_STATUS_ERROR_INTERNAL, gnutls_strerror(errno), 0);
@@ -98,3 +98,19 @@ httpSaveCredentials(const char *path, cups_array_t *credentials, const char *com
   return (-1);
 }
 #endif /* HAVE_SSL */
+
+
+#ifndef HAVE_GNUTLS
+/*
+ * '_httpTLSGetStats()' - Get TLS session resumption statistics.
+ *
+ * Session caching is only implemented for GNU TLS, so all counters are 0.
+ */
+
+void
+_httpTLSGetStats(
+    _http_tls_stats_t *stats)		/* O - Statistics */
+{
+  memset(stats, 0, sizeof(_http_tls_stats_t));
+}
+#endif /* !HAVE_GNUTLS */
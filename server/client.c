@@ -11,6 +11,7 @@
 #include "ippserver.h"
 #include "printer-png.h"
 #include "printer3d-png.h"
+#include <cups/http-private.h>
 
 
 /*
@@ -28,6 +29,7 @@ static int		show_materials(server_client_t *client, server_printer_t *printer, c
 static int		show_media(server_client_t *client, server_printer_t *printer, const char *encoding);
 static int		show_status(server_client_t *client, server_printer_t *printer, const char *encoding);
 static int		show_supplies(server_client_t *client, server_printer_t *printer, const char *encoding);
+static void		start_client(server_client_t *client);
 
 
 /*
@@ -172,9 +174,29 @@ serverProcessClient(
   */
 
 #ifdef HAVE_SSL
-  int first_time = 1;			/* First time request? */
+  int first_time = !client->resumed;	/* First time request? */
 #endif /* HAVE_SSL */
 
+  if (client->waiter)
+  {
+   /*
+    * Complete a parked Get-Notifications request that the main loop has
+    * handed back to us...
+    */
+
+    if (!serverCompleteNotifications(client))
+    {
+      serverDeleteClient(client);
+      return (NULL);
+    }
+
+    if (client->waiter)
+    {
+      serverParkWaiter(client->waiter);
+      return (NULL);			/* Still streaming events */
+    }
+  }
+
   while (httpWait(client->http, 30000))
   {
 #ifdef HAVE_SSL
@@ -206,6 +228,17 @@ serverProcessClient(
 
     if (!serverProcessHTTP(client))
       break;
+
+    if (client->waiter)
+    {
+     /*
+      * Hand the connection to the main loop until the parked Get-Notifications
+      * request is completed...
+      */
+
+      serverParkWaiter(client->waiter);
+      return (NULL);
+    }
   }
 
  /*
@@ -330,8 +363,9 @@ serverProcessHTTP(
   * Process the request...
   */
 
-  client->start     = time(NULL);
-  client->operation = httpGetState(client->http);
+  client->start       = time(NULL);
+  client->operation   = httpGetState(client->http);
+  client->retry_after = 0;
 
  /*
   * Parse incoming parameters until the status changes...
@@ -737,6 +771,14 @@ serverRespondHTTP(
     httpSetField(client->http, HTTP_FIELD_WWW_AUTHENTICATE, www_auth);
   }
 
+  if (client->retry_after > 0)
+  {
+    char retry_after[32];		/* Retry-After header value */
+
+    snprintf(retry_after, sizeof(retry_after), "%d", client->retry_after);
+    httpSetField(client->http, HTTP_FIELD_RETRY_AFTER, retry_after);
+  }
+
   if (type)
   {
     if (!strcmp(type, "text/html"))
@@ -803,13 +845,30 @@ serverRespondHTTP(
       client->fetch_file = -1;
     }
 
-    if (length == 0)
+   /*
+    * Finish a chunked response; streamed Get-Notifications responses stay open
+    * until the main loop sends the last message...
+    */
+
+    if (length == 0 && !client->waiter)
     {
       serverLogClient(SERVER_LOGLEVEL_DEBUG, client, "serverRespondHTTP: Sending 0-length chunk.");
       httpWrite2(client->http, "", 0);
     }
   }
 
+ /*
+  * If the client has pipelined another request, hold the response in the
+  * write buffer so it goes out together with the next one; httpWait flushes
+  * it otherwise...
+  */
+
+  if (httpGetReady(client->http))
+  {
+    serverLogClient(SERVER_LOGLEVEL_DEBUG, client, "serverRespondHTTP: Next request already buffered, deferring flush.");
+    return (1);
+  }
+
   serverLogClient(SERVER_LOGLEVEL_DEBUG, client, "serverRespondHTTP: Flushing write buffer.");
   httpFlushWrite(client->http);
 
@@ -832,12 +891,39 @@ serverRun(void)
   struct timeval	timeout;	/* Timeout for poll() */
   server_listener_t	*lis;		/* Listener */
   server_client_t	*client;	/* New client */
-  time_t                next_clean = 0; /* Next time to clean old jobs */
+  server_waiter_t	*waiter;	/* Parked Get-Notifications request */
+  char			wakeup[256];	/* Wakeup bytes from notification pipe */
+  time_t                next_clean = 0, /* Next time to clean old jobs */
+			next_expire = 0;/* Next time a parked request expires */
+#ifdef HAVE_SSL
+  _http_tls_stats_t	tls_stats,	/* TLS session resumption statistics */
+			last_tls_stats;	/* Last logged statistics */
+#endif /* HAVE_SSL */
 
 
   serverLog(SERVER_LOGLEVEL_DEBUG, "serverRun: %d printers configured.", cupsArrayCount(Printers));
   serverLog(SERVER_LOGLEVEL_DEBUG, "serverRun: %d listeners configured.", cupsArrayCount(Listeners));
 
+#ifdef HAVE_SSL
+  memset(&last_tls_stats, 0, sizeof(last_tls_stats));
+#endif /* HAVE_SSL */
+
+ /*
+  * Create the pipe used to wake up the main loop for parked Get-Notifications
+  * requests...
+  */
+
+  if (pipe(NotificationPipe))
+  {
+    serverLog(SERVER_LOGLEVEL_ERROR, "Unable to create notification pipe: %s", strerror(errno));
+    return;
+  }
+
+  fcntl(NotificationPipe[0], F_SETFD, FD_CLOEXEC);
+  fcntl(NotificationPipe[0], F_SETFL, fcntl(NotificationPipe[0], F_GETFL) | O_NONBLOCK);
+  fcntl(NotificationPipe[1], F_SETFD, FD_CLOEXEC);
+  fcntl(NotificationPipe[1], F_SETFL, fcntl(NotificationPipe[1], F_GETFL) | O_NONBLOCK);
+
  /*
   * Loop until we are killed or have a hard error...
   */
@@ -849,7 +935,8 @@ serverRun(void)
     */
 
     FD_ZERO(&input);
-    max_fd = 0;
+    FD_SET(NotificationPipe[0], &input);
+    max_fd = NotificationPipe[0];
 
     for (lis = (server_listener_t *)cupsArrayFirst(Listeners); lis; lis = (server_listener_t *)cupsArrayNext(Listeners))
     {
@@ -868,7 +955,12 @@ serverRun(void)
     }
 #endif /* HAVE_DNSSD */
 
-    timeout.tv_sec  = 86400;
+    max_fd = serverWatchWaiters(&input, max_fd);
+
+    if (next_expire)
+      timeout.tv_sec = next_expire > time(NULL) ? next_expire - time(NULL) : 0;
+    else
+      timeout.tv_sec = 86400;
     timeout.tv_usec = 0;
 
     if (select(max_fd + 1, &input, NULL, NULL, &timeout) < 0 && errno != EINTR)
@@ -884,22 +976,40 @@ serverRun(void)
         serverLog(SERVER_LOGLEVEL_DEBUG, "serverRun: Incoming connection on listener %s:%d.", lis->host, lis->port);
 
         if ((client = serverCreateClient(lis->fd)) != NULL)
-        {
-          _cups_thread_t t = _cupsThreadCreate((_cups_thread_func_t)serverProcessClient, client);
-
-          if (t)
-          {
-            _cupsThreadDetach(t);
-          }
-          else
-          {
-            serverLog(SERVER_LOGLEVEL_ERROR, "Unable to create client thread (%s)", strerror(errno));
-            serverDeleteClient(client);
-          }
-        }
+          start_client(client);
       }
     }
 
+   /*
+    * Hand back any parked Get-Notifications requests that have new events,
+    * have timed out, or whose client has hung up...
+    */
+
+    if (FD_ISSET(NotificationPipe[0], &input))
+    {
+      while (read(NotificationPipe[0], wakeup, sizeof(wakeup)) > 0);
+    }
+
+    serverFlushProgressEvents();
+
+    while ((waiter = serverUnparkWaiter(&input, &next_expire)) != NULL)
+    {
+     /*
+      * Writing the response can block, so leave that to a client thread...
+      */
+
+      client          = waiter->client;
+      client->resumed = 1;
+
+      start_client(client);
+    }
+
+   /*
+    * Clear "spool-area-full" once deleted jobs have freed enough space...
+    */
+
+    serverCheckFreedSpool();
+
 #ifdef HAVE_DNSSD
     if (DNSSDEnabled && FD_ISSET(DNSServiceRefSockFD(DNSSDMaster), &input))
     {
@@ -911,6 +1021,19 @@ serverRun(void)
     if (time(NULL) >= next_clean)
     {
       serverCleanAllJobs();
+      serverCompactJobs();
+      serverCompactSubscriptions();
+
+#ifdef HAVE_SSL
+      _httpTLSGetStats(&tls_stats);
+
+      if (memcmp(&tls_stats, &last_tls_stats, sizeof(tls_stats)))
+      {
+        serverLog(SERVER_LOGLEVEL_INFO, "TLS sessions: %u resumed, %u full handshakes.", tls_stats.server_hits, tls_stats.server_misses);
+
+        last_tls_stats = tls_stats;
+      }
+#endif /* HAVE_SSL */
 
       next_clean = time(NULL) + 30;
     }
@@ -2262,3 +2385,32 @@ show_supplies(
 
   return (1);
 }
+
+
+/*
+ * 'start_client()' - Start a thread to process requests from a client.
+ */
+
+static void
+start_client(server_client_t *client)	/* I - Client */
+{
+  _cups_thread_t t = _cupsThreadCreate((_cups_thread_func_t)serverProcessClient, client);
+					/* Client thread */
+
+  if (t)
+  {
+    _cupsThreadDetach(t);
+  }
+  else
+  {
+    serverLog(SERVER_LOGLEVEL_ERROR, "Unable to create client thread (%s)", strerror(errno));
+
+    if (client->waiter)
+    {
+      client->waiter->hangup = 1;
+      serverCompleteNotifications(client);	/* Free the parked request */
+    }
+
+    serverDeleteClient(client);
+  }
+}
@@ -119,7 +119,10 @@ serverCleanAllJobs(void)
   _cupsRWLockRead(&PrintersRWLock);
 
   for (printer = (server_printer_t *)cupsArrayFirst(Printers); printer; printer = (server_printer_t *)cupsArrayNext(Printers))
+  {
     serverCleanJobs(printer);
+    serverCheckSpool(printer, 0);	/* Update spool-area-full */
+  }
 
   _cupsRWUnlock(&PrintersRWLock);
 }
@@ -340,6 +343,13 @@ serverCreateSystem(
     DefaultPrinter = NULL;
   }
 
+ /*
+  * Restore any saved jobs and subscriptions now that the printers exist...
+  */
+
+  serverLoadJobs();
+  serverLoadSubscriptions();
+
   return (1);
 }
 
@@ -2294,15 +2304,23 @@ load_system(const char *conf)		/* I - Configuration file */
     "MakeAndModel",
     "MaxCompletedJobs",
     "MaxJobs",
+    "MaxSubscriptionEvents",
     "Name",
     "OwnerEmail",
     "OwnerLocation",
     "OwnerName",
     "OwnerPhone",
+    "SpoolClientRate",
     "SpoolDir",
+    "SpoolHighWater",
+    "SpoolLowWater",
     "StateDir",
     "SubscriptionPrivacyAttributes",
     "SubscriptionPrivacyScope",
+    "TransformAhead",
+    "TransformCacheSize",
+    "TransformWorkerJobs",
+    "TransformWorkers",
     "UUID"
   };
 
@@ -2703,6 +2721,28 @@ load_system(const char *conf)		/* I - Configuration file */
 
       MaxJobs = atoi(value);
     }
+    else if (!_cups_strcasecmp(line, "MaxSubscriptionEvents"))
+    {
+      if (!isdigit(*value & 255) || atoi(value) < 1)
+      {
+        fprintf(stderr, "ippserver: Bad MaxSubscriptionEvents value \"%s\" on line %d of \"%s\".\n", value, linenum, conf);
+        status = 0;
+        break;
+      }
+
+      MaxSubscriptionEvents = atoi(value);
+    }
+    else if (!_cups_strcasecmp(line, "SpoolClientRate"))
+    {
+      if (!isdigit(*value & 255))
+      {
+        fprintf(stderr, "ippserver: Bad SpoolClientRate value \"%s\" on line %d of \"%s\".\n", value, linenum, conf);
+        status = 0;
+        break;
+      }
+
+      SpoolClientRate = atoi(value);
+    }
     else if (!_cups_strcasecmp(line, "SpoolDir"))
     {
       if (access(value, R_OK))
@@ -2714,6 +2754,28 @@ load_system(const char *conf)		/* I - Configuration file */
 
       SpoolDirectory = strdup(value);
     }
+    else if (!_cups_strcasecmp(line, "SpoolHighWater"))
+    {
+      if (!isdigit(*value & 255))
+      {
+        fprintf(stderr, "ippserver: Bad SpoolHighWater value \"%s\" on line %d of \"%s\".\n", value, linenum, conf);
+        status = 0;
+        break;
+      }
+
+      SpoolHighWater = atoi(value);
+    }
+    else if (!_cups_strcasecmp(line, "SpoolLowWater"))
+    {
+      if (!isdigit(*value & 255))
+      {
+        fprintf(stderr, "ippserver: Bad SpoolLowWater value \"%s\" on line %d of \"%s\".\n", value, linenum, conf);
+        status = 0;
+        break;
+      }
+
+      SpoolLowWater = atoi(value);
+    }
     else if (!_cups_strcasecmp(line, "StateDir"))
     {
       if (access(value, R_OK) && mkdir(value, 0700))
@@ -2747,6 +2809,43 @@ load_system(const char *conf)		/* I - Configuration file */
 
       SubscriptionPrivacyScope = strdup(value);
     }
+    else if (!_cups_strcasecmp(line, "TransformAhead"))
+    {
+      TransformAhead = !_cups_strcasecmp(value, "yes") || !_cups_strcasecmp(value, "true") || !_cups_strcasecmp(value, "on");
+    }
+    else if (!_cups_strcasecmp(line, "TransformCacheSize"))
+    {
+      if (!isdigit(*value & 255))
+      {
+        fprintf(stderr, "ippserver: Bad TransformCacheSize value \"%s\" on line %d of \"%s\".\n", value, linenum, conf);
+        status = 0;
+        break;
+      }
+
+      TransformCacheSize = atoi(value);
+    }
+    else if (!_cups_strcasecmp(line, "TransformWorkerJobs"))
+    {
+      if (!isdigit(*value & 255))
+      {
+        fprintf(stderr, "ippserver: Bad TransformWorkerJobs value \"%s\" on line %d of \"%s\".\n", value, linenum, conf);
+        status = 0;
+        break;
+      }
+
+      TransformWorkerJobs = atoi(value);
+    }
+    else if (!_cups_strcasecmp(line, "TransformWorkers"))
+    {
+      if (!isdigit(*value & 255))
+      {
+        fprintf(stderr, "ippserver: Bad TransformWorkers value \"%s\" on line %d of \"%s\".\n", value, linenum, conf);
+        status = 0;
+        break;
+      }
+
+      TransformWorkers = atoi(value);
+    }
   }
 
   cupsFileClose(fp);
@@ -3389,6 +3488,12 @@ save_printer(
     for (device = (server_device_t *)cupsArrayFirst(printer->pinfo.devices); device; device = (server_device_t *)cupsArrayNext(printer->pinfo.devices))
       cupsFilePutConf(fp, "OutputDevice", device->uuid);
 
+    if (printer->pinfo.spool_high)
+      cupsFilePrintf(fp, "SpoolHighWater %d\n", printer->pinfo.spool_high);
+    if (printer->pinfo.spool_low)
+      cupsFilePrintf(fp, "SpoolLowWater %d\n", printer->pinfo.spool_low);
+
+    cupsFilePutConf(fp, "StreamJobs", printer->pinfo.stream_jobs ? "Yes" : "No");
     cupsFilePutConf(fp, "WebForms", printer->pinfo.web_forms ? "Yes" : "No");
 
     for (attr = ippFirstAttribute(printer->pinfo.attrs); attr; attr = ippNextAttribute(printer->pinfo.attrs))
@@ -3642,6 +3747,26 @@ token_cb(_ipp_file_t    *f,		/* I - IPP file data */
 
     serverLog(SERVER_LOGLEVEL_DEBUG, "Added ICC profile \"%s\".", filename);
   }
+  else if (!_cups_strcasecmp(token, "SpoolHighWater"))
+  {
+    if (!_ippFileReadToken(f, temp, sizeof(temp)))
+    {
+      serverLog(SERVER_LOGLEVEL_ERROR, "Missing SpoolHighWater value on line %d of \"%s\".", f->linenum, f->filename);
+      return (0);
+    }
+
+    pinfo->spool_high = atoi(temp);
+  }
+  else if (!_cups_strcasecmp(token, "SpoolLowWater"))
+  {
+    if (!_ippFileReadToken(f, temp, sizeof(temp)))
+    {
+      serverLog(SERVER_LOGLEVEL_ERROR, "Missing SpoolLowWater value on line %d of \"%s\".", f->linenum, f->filename);
+      return (0);
+    }
+
+    pinfo->spool_low = atoi(temp);
+  }
   else if (!_cups_strcasecmp(token, "Strings"))
   {
     server_lang_t lang;			/* New localization */
@@ -3674,6 +3799,16 @@ token_cb(_ipp_file_t    *f,		/* I - IPP file data */
 
     serverLog(SERVER_LOGLEVEL_DEBUG, "Added strings file \"%s\" for language \"%s\".", stringsfile, value);
   }
+  else if (!_cups_strcasecmp(token, "StreamJobs"))
+  {
+    if (!_ippFileReadToken(f, temp, sizeof(temp)))
+    {
+      serverLog(SERVER_LOGLEVEL_ERROR, "Missing StreamJobs value on line %d of \"%s\".", f->linenum, f->filename);
+      return (0);
+    }
+
+    pinfo->stream_jobs = !_cups_strcasecmp(temp, "yes") || !_cups_strcasecmp(temp, "on") || !_cups_strcasecmp(temp, "true");
+  }
   else if (!_cups_strcasecmp(token, "WebForms"))
   {
     if (!_ippFileReadToken(f, temp, sizeof(temp)))
@@ -41,9 +41,11 @@ static inline int	check_attribute(const char *name, cups_array_t *ra, cups_array
 {
   return ((!pa || !cupsArrayFind(pa, (void *)name)) && (!ra || cupsArrayFind(ra, (void *)name)));
 }
+static int		check_spool(server_client_t *client);
 static void		copy_doc_attributes(server_client_t *client, server_job_t *job, cups_array_t *ra, cups_array_t *pa);
 static int		copy_document_uri(server_client_t *client, server_job_t *job, const char *uri);
 static void		copy_job_attributes(server_client_t *client, server_job_t *job, cups_array_t *ra, cups_array_t *pa);
+static int		copy_notifications(server_client_t *client, ipp_attribute_t *sub_ids, ipp_attribute_t *seq_nums, server_waiter_t *waiter);
 static void		copy_printer_attributes(server_client_t *client, server_printer_t *printer, cups_array_t *ra);
 static void		copy_printer_state(ipp_t *ipp, server_printer_t *printer, cups_array_t *ra);
 static void		copy_resource_attributes(server_client_t *client, server_resource_t *resource, cups_array_t *ra);
@@ -125,6 +127,7 @@ static void		ipp_update_job_status(server_client_t *client);
 static void		ipp_update_output_device_attributes(server_client_t *client);
 static void		ipp_validate_document(server_client_t *client);
 static void		ipp_validate_job(server_client_t *client);
+static off_t		read_document(server_client_t *client, int fd);
 static void		respond_unsettable(server_client_t *client, ipp_attribute_t *attr);
 static int		valid_doc_attributes(server_client_t *client);
 static int		valid_filename(const char *filename);
@@ -420,6 +423,133 @@ static server_value_t	printer_values[] =	/* Value tags for printer create/set at
 };
 
 
+/*
+ * 'serverCompleteNotifications()' - Complete a parked Get-Notifications request.
+ *
+ * Called on the client's thread once the main loop has unparked the request's
+ * waiter, so a slow client only holds up its own thread.  For a streamed
+ * request the new events are written as another IPP message in the chunked
+ * response and "client->waiter" is left set so that the request is parked
+ * again.
+ */
+
+int					/* O - 1 on success, 0 on failure */
+serverCompleteNotifications(
+    server_client_t *client)		/* I - Client */
+{
+  server_waiter_t	*waiter = client->waiter;
+					/* Waiter for new events */
+  ipp_attribute_t	*sub_ids,	/* notify-subscription-ids */
+			*seq_nums;	/* notify-sequence-numbers */
+  int			i,		/* Looping var */
+			count;		/* Number of IDs */
+  struct pollfd		pfd;		/* Socket write status */
+
+
+  sub_ids  = ippFindAttribute(client->request, "notify-subscription-ids", IPP_TAG_INTEGER);
+  seq_nums = ippFindAttribute(client->request, "notify-sequence-numbers", IPP_TAG_INTEGER);
+  count    = ippGetCount(sub_ids);
+
+  if (waiter->hangup)
+  {
+    serverLogClient(SERVER_LOGLEVEL_DEBUG, client, "Client closed connection while waiting for events.");
+    goto stop_waiting;
+  }
+
+  if (waiter->stream)
+  {
+   /*
+    * Give up on clients that stop reading the stream rather than tying up
+    * this thread...
+    */
+
+    pfd.fd     = httpGetFd(client->http);
+    pfd.events = POLLOUT;
+
+    if (poll(&pfd, 1, 30000) <= 0 || (pfd.revents & (POLLERR | POLLHUP)))
+    {
+      serverLogClient(SERVER_LOGLEVEL_ERROR, client, "Client is not reading streamed events, closing connection.");
+      goto stop_waiting;
+    }
+
+   /*
+    * Clear the notification before copying events so that an event added
+    * while we copy wakes up the stream again...
+    */
+
+    _cupsMutexLock(&NotificationMutex);
+    waiter->notified = 0;
+    waiter->expire   = time(NULL) + 30;
+    _cupsMutexUnlock(&NotificationMutex);
+
+    ippDelete(client->response);
+    client->response = ippNewResponse(client->request);
+
+    if (copy_notifications(client, sub_ids, seq_nums, waiter) < 0)
+    {
+     /*
+      * Subscription was canceled or expired, send the error and end the
+      * stream...
+      */
+
+      for (i = 0; i < count; i ++)
+	serverRemoveWaiter(ippGetInteger(sub_ids, i), waiter);
+
+      free(waiter);
+      client->waiter = NULL;
+
+      serverLogClient(SERVER_LOGLEVEL_DEBUG, client, "Done streaming events.");
+    }
+
+    serverLogAttributes(client, "Response:", client->response, 2);
+
+    ippSetState(client->response, IPP_STATE_IDLE);
+
+    if (ippWrite(client->http, client->response) != IPP_STATE_DATA)
+    {
+      serverLogClient(SERVER_LOGLEVEL_ERROR, client, "Unable to write streamed events.");
+      goto stop_waiting;
+    }
+
+    if (!client->waiter)
+      httpWrite2(client->http, "", 0);	/* End of stream */
+
+    return (httpFlushWrite(client->http) >= 0);
+  }
+
+  for (i = 0; i < count; i ++)
+    serverRemoveWaiter(ippGetInteger(sub_ids, i), waiter);
+
+  free(waiter);
+  client->waiter = NULL;
+
+  serverLogClient(SERVER_LOGLEVEL_DEBUG, client, "Done waiting for events.");
+
+  copy_notifications(client, sub_ids, seq_nums, NULL);
+
+  serverLogAttributes(client, "Response:", client->response, 2);
+
+  return (serverRespondHTTP(client, HTTP_STATUS_OK, NULL, "application/ipp", ippLength(client->response)));
+
+ /*
+  * If we get here the client connection is no longer usable...
+  */
+
+  stop_waiting:
+
+  if (client->waiter)
+  {
+    for (i = 0; i < count; i ++)
+      serverRemoveWaiter(ippGetInteger(sub_ids, i), waiter);
+
+    free(waiter);
+    client->waiter = NULL;
+  }
+
+  return (0);
+}
+
+
 /*
  * 'serverCopyAttributes()' - Copy attributes from one request to another.
  */
@@ -522,6 +652,42 @@ apply_template_attributes(
 }
 
 
+/*
+ * 'check_spool()' - Check that the spool can accept the document for a request.
+ *
+ * The document data is not read when the spool is full - the connection is
+ * closed after the response instead.
+ */
+
+static int				/* O - 1 if the document can be spooled, 0 otherwise */
+check_spool(server_client_t *client)	/* I - Client */
+{
+  off_t		bytes = 0;		/* Size of document data */
+  ipp_status_t	status;			/* Spool status */
+
+
+  if (httpGetState(client->http) == HTTP_STATE_POST_RECV && !httpIsChunked(client->http))
+    bytes = (off_t)httpGetRemaining(client->http);
+
+  if ((status = serverCheckSpool(client->printer, bytes)) == IPP_STATUS_OK)
+    return (1);
+
+  if (status == IPP_STATUS_ERROR_BUSY)
+  {
+    client->retry_after = SERVER_SPOOL_RETRY;
+
+    serverRespondIPP(client, status, "Spool area is full, try again in %d seconds.", SERVER_SPOOL_RETRY);
+  }
+  else
+    serverRespondIPP(client, status, "Document is too large for the spool area.");
+
+  if (httpGetState(client->http) == HTTP_STATE_POST_RECV)
+    httpSetKeepAlive(client->http, HTTP_KEEPALIVE_OFF);
+
+  return (0);
+}
+
+
 /*
  * 'copy_doc_attrs()' - Copy document attributes to the response.
  */
@@ -673,6 +839,7 @@ copy_document_uri(
   char			filename[1024],	/* Filename buffer */
 			buffer[16384];	/* Copy buffer */
   ssize_t		bytes;		/* Bytes read */
+  struct stat		fileinfo;	/* File information */
 
 
  /*
@@ -732,6 +899,15 @@ copy_document_uri(
       return (0);
     }
 
+#ifdef HAVE_FALLOCATE
+   /*
+    * Reserve space for the copy since we know how big it will be...
+    */
+
+    if (!fstat(infile, &fileinfo) && fileinfo.st_size > 0)
+      fallocate(job->fd, FALLOC_FL_KEEP_SIZE, 0, fileinfo.st_size);
+#endif /* HAVE_FALLOCATE */
+
    /*
     * Copy the file...
     */
@@ -888,23 +1064,24 @@ copy_document_uri(
       return (0);
     }
 
-    while ((bytes = httpRead2(http, buffer, sizeof(buffer))) > 0)
+    if (httpReadToFd(http, job->fd) < 0)
     {
-      if (write(job->fd, buffer, (size_t)bytes) < bytes)
-      {
-	int error = errno;		/* Write error */
+      int error = errno;		/* Write error */
 
-	job->state = IPP_JSTATE_ABORTED;
+      job->state = IPP_JSTATE_ABORTED;
 
-	close(job->fd);
-	job->fd = -1;
+      close(job->fd);
+      job->fd = -1;
 
-	unlink(filename);
-	httpClose(http);
+      unlink(filename);
 
+      if (httpError(http))
+	serverRespondIPP(client, IPP_STATUS_ERROR_DOCUMENT_ACCESS, "Unable to read URI: %s", strerror(httpError(http)));
+      else
 	serverRespondIPP(client, IPP_STATUS_ERROR_INTERNAL, "Unable to write print file: %s", strerror(error));
-	return (0);
-      }
+
+      httpClose(http);
+      return (0);
     }
 
     httpClose(http);
@@ -917,6 +1094,9 @@ copy_document_uri(
 
   finalize_copy:
 
+  if (!fstat(job->fd, &fileinfo))
+    serverAddSpoolBytes(job, fileinfo.st_size);
+
   if (close(job->fd))
   {
     serverRespondIPP(client, IPP_STATUS_ERROR_INTERNAL, "Unable to write print file: %s", strerror(errno));
@@ -1049,6 +1229,84 @@ copy_job_attributes(
 }
 
 
+/*
+ * 'copy_notifications()' - Copy pending events for a Get-Notifications request.
+ *
+ * If "waiter" is not NULL, it is registered with each subscription before its
+ * events are checked so that no event is missed.  Streamed requests also
+ * advance "seq_nums" past the copied events.
+ */
+
+static int				/* O - Number of events or -1 on error */
+copy_notifications(
+    server_client_t *client,		/* I - Client */
+    ipp_attribute_t *sub_ids,		/* I - notify-subscription-ids */
+    ipp_attribute_t *seq_nums,		/* I - notify-sequence-numbers, if any */
+    server_waiter_t *waiter)		/* I - Waiter, if any */
+{
+  int			i, j,		/* Looping vars */
+			count,		/* Number of IDs */
+			seq_num;	/* Sequence number */
+  server_subscription_t	*sub;		/* Current subscription */
+  server_notification_t	**events;	/* Events for subscription */
+  int			count_events,	/* Number of events for subscription */
+			num_events = 0;	/* Number of events returned */
+
+
+  for (i = 0, count = ippGetCount(sub_ids); i < count; i ++)
+  {
+    if ((sub = serverFindSubscription(client, ippGetInteger(sub_ids, i))) == NULL)
+    {
+      serverRespondIPP(client, IPP_STATUS_ERROR_NOT_FOUND, "Subscription #%d was not found.", ippGetInteger(sub_ids, i));
+      ippAddInteger(client->response, IPP_TAG_UNSUPPORTED_GROUP, IPP_TAG_INTEGER, "notify-subscription-ids", ippGetInteger(sub_ids, i));
+      return (-1);
+    }
+
+    if (!serverAuthorizeUser(client, sub->username, SERVER_GROUP_NONE, SubscriptionPrivacyScope))
+    {
+      serverRespondIPP(client, IPP_STATUS_ERROR_NOT_AUTHORIZED, "You do not have access to subscription #%d.", ippGetInteger(sub_ids, i));
+      ippAddInteger(client->response, IPP_TAG_UNSUPPORTED_GROUP, IPP_TAG_INTEGER, "notify-subscription-ids", ippGetInteger(sub_ids, i));
+      return (-1);
+    }
+
+    if (waiter)
+      serverAddWaiter(sub, waiter);
+
+    _cupsRWLockRead(&sub->rwlock);
+
+    count_events = serverCopySubscriptionEvents(sub, ippGetInteger(seq_nums, i), &seq_num, &events);
+
+    for (j = 0; j < count_events; j ++, seq_num ++)
+    {
+      if (num_events == 0)
+      {
+	serverRespondIPP(client, IPP_STATUS_OK, NULL);
+	ippAddInteger(client->response, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "notify-get-interval", 30);
+	if (client->printer)
+	  ippAddInteger(client->response, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "printer-up-time", (int)(time(NULL) - client->printer->start_time));
+	else
+	  ippAddInteger(client->response, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "system-up-time", (int)(time(NULL) - SystemStartTime));
+      }
+      else
+	ippAddSeparator(client->response);
+
+      serverCopyNotification(client->response, sub, events[j], seq_num);
+      num_events ++;
+    }
+
+    if (count_events > 0)
+      serverFreeSubscriptionEvents(count_events, events);
+
+    _cupsRWUnlock(&sub->rwlock);
+
+    if (waiter && waiter->stream)
+      ippSetInteger(client->request, &seq_nums, i, seq_num);
+  }
+
+  return (num_events);
+}
+
+
 /*
  * 'copy_printer_attributes()' - Copy all printer attributes.
  */
@@ -1615,6 +1873,8 @@ ipp_acknowledge_job(
 
   job->state_reasons &= (server_jreason_t)~SERVER_JREASON_JOB_FETCHABLE;
 
+  serverStopPrerender(job, device);
+
   serverAddEventNoLock(client->printer, job, NULL, SERVER_EVENT_JOB_STATE_CHANGED, "Job acknowledged.");
 
   serverRespondIPP(client, IPP_STATUS_OK, NULL);
@@ -1778,6 +2038,8 @@ ipp_cancel_current_job(
   {
     job->state     = IPP_JSTATE_CANCELED;
     job->completed = time(NULL);
+
+    serverStopPrerender(job, NULL);
   }
 
   _cupsRWUnlock(&(client->printer->rwlock));
@@ -1876,6 +2138,8 @@ ipp_cancel_document(
 	{
 	  job->state     = IPP_JSTATE_CANCELED;
 	  job->completed = time(NULL);
+
+	  serverStopPrerender(job, NULL);
 	}
 
 	_cupsRWUnlock(&(client->printer->rwlock));
@@ -1961,6 +2225,8 @@ ipp_cancel_job(server_client_t *client)	/* I - Client */
 	{
 	  job->state     = IPP_JSTATE_CANCELED;
 	  job->completed = time(NULL);
+
+	  serverStopPrerender(job, NULL);
 	}
 
 	_cupsRWUnlock(&(client->printer->rwlock));
@@ -2142,6 +2408,8 @@ ipp_cancel_jobs(
       {
 	job->state     = IPP_JSTATE_CANCELED;
 	job->completed = time(NULL);
+
+	serverStopPrerender(job, NULL);
       }
 
       serverAddEventNoLock(client->printer, job, NULL, SERVER_EVENT_JOB_COMPLETED, NULL);
@@ -2273,7 +2541,6 @@ ipp_cancel_subscription(
   }
 
   _cupsRWLockWrite(&SubscriptionsRWLock);
-  cupsArrayRemove(Subscriptions, sub);
   serverDeleteSubscription(sub);
   _cupsRWUnlock(&SubscriptionsRWLock);
   serverRespondIPP(client, IPP_STATUS_OK, NULL);
@@ -3305,15 +3572,20 @@ ipp_delete_printer(
   * Mark all subscriptions for this printer to expire in 30 seconds...
   */
 
-  _cupsRWLockRead(&SubscriptionsRWLock);
+  _cupsRWLockWrite(&SubscriptionsRWLock);
 
   for (sub = (server_subscription_t *)cupsArrayFirst(Subscriptions); sub; sub = (server_subscription_t *)cupsArrayNext(Subscriptions))
   {
     if (sub->printer == client->printer || (sub->job && sub->job->printer == client->printer))
     {
+      serverJournalSubscription(sub, 1);
+      serverUnindexSubscriptionNoLock(sub);
+
       sub->printer = NULL;
       sub->job     = NULL;
       sub->expire  = time(NULL) + 30;
+
+      serverIndexSubscriptionNoLock(sub);
     }
   }
 
@@ -4147,13 +4419,11 @@ ipp_get_notifications(
 {
   ipp_attribute_t	*sub_ids,	/* notify-subscription-ids */
 			*seq_nums;	/* notify-sequence-numbers */
-  int			notify_wait;	/* Wait for events? */
-  int			i,		/* Looping vars */
+  int			i,		/* Looping var */
 			count,		/* Number of IDs */
-			seq_num;	/* Sequence number */
-  server_subscription_t	*sub;		/* Current subscription */
-  ipp_t			*event;		/* Current event */
-  int			num_events = 0;	/* Number of events returned */
+			num_events,	/* Number of events returned */
+			stream;		/* Stream events? */
+  server_waiter_t	*waiter = NULL;	/* Waiter for new events */
 
 
   if (Authentication && !client->username[0])
@@ -4172,9 +4442,8 @@ ipp_get_notifications(
     return;
   }
 
-  count       = ippGetCount(sub_ids);
-  seq_nums    = ippFindAttribute(client->request, "notify-sequence-numbers", IPP_TAG_INTEGER);
-  notify_wait = ippGetBoolean(ippFindAttribute(client->request, "notify-wait", IPP_TAG_BOOLEAN), 0);
+  count    = ippGetCount(sub_ids);
+  seq_nums = ippFindAttribute(client->request, "notify-sequence-numbers", IPP_TAG_INTEGER);
 
   if (seq_nums && count != ippGetCount(seq_nums))
   {
@@ -4182,90 +4451,70 @@ ipp_get_notifications(
     return;
   }
 
-  do
+  stream = ippGetBoolean(ippFindAttribute(client->request, "notify-stream", IPP_TAG_BOOLEAN), 0) && httpGetVersion(client->http) >= HTTP_VERSION_1_1;
+
+  if (stream || ippGetBoolean(ippFindAttribute(client->request, "notify-wait", IPP_TAG_BOOLEAN), 0))
   {
-    for (i = 0; i < count; i ++)
+    if ((waiter = calloc(1, sizeof(server_waiter_t))) == NULL)
     {
-      if ((sub = serverFindSubscription(client, ippGetInteger(sub_ids, i))) == NULL)
-      {
-        serverRespondIPP(client, IPP_STATUS_ERROR_NOT_FOUND, "Subscription #%d was not found.", ippGetInteger(sub_ids, i));
-        ippAddInteger(client->response, IPP_TAG_UNSUPPORTED_GROUP, IPP_TAG_INTEGER, "notify-subscription-ids", ippGetInteger(sub_ids, i));
-	break;
-      }
+      serverRespondIPP(client, IPP_STATUS_ERROR_INTERNAL, "Unable to allocate memory for waiter.");
+      return;
+    }
 
-      if (!serverAuthorizeUser(client, sub->username, SERVER_GROUP_NONE, SubscriptionPrivacyScope))
-      {
-        serverRespondIPP(client, IPP_STATUS_ERROR_NOT_AUTHORIZED, "You do not have access to subscription #%d.", ippGetInteger(sub_ids, i));
-        ippAddInteger(client->response, IPP_TAG_UNSUPPORTED_GROUP, IPP_TAG_INTEGER, "notify-subscription-ids", ippGetInteger(sub_ids, i));
-	break;
-      }
+    waiter->client = client;
+    waiter->expire = time(NULL) + 30;
+    waiter->stream = stream;
 
-      _cupsRWLockRead(&sub->rwlock);
+    if (stream && !seq_nums)
+      seq_nums = ippAddIntegers(client->request, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "notify-sequence-numbers", count, NULL);
+  }
 
-      seq_num = ippGetInteger(seq_nums, i);
-      if (seq_num < sub->first_sequence)
-	seq_num = sub->first_sequence;
+  if ((num_events = copy_notifications(client, sub_ids, seq_nums, waiter)) >= 0 && stream)
+  {
+   /*
+    * Send the current events as the first message of a chunked response and
+    * park the request - another message is written each time new events
+    * arrive, and every 30 seconds to keep the connection alive...
+    */
 
-      if (seq_num > sub->last_sequence)
-      {
-        _cupsRWUnlock(&sub->rwlock);
-	continue;
-      }
+    serverLogClient(SERVER_LOGLEVEL_DEBUG, client, "Streaming events.");
 
-      for (event = (ipp_t *)cupsArrayIndex(sub->events, seq_num - sub->first_sequence);
-	   event;
-	   event = (ipp_t *)cupsArrayNext(sub->events))
-      {
-	if (num_events == 0)
-	{
-	  serverRespondIPP(client, IPP_STATUS_OK, NULL);
-	  ippAddInteger(client->response, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "notify-get-interval", 30);
-	  if (client->printer)
-	    ippAddInteger(client->response, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "printer-up-time", (int)(time(NULL) - client->printer->start_time));
-	  else
-	    ippAddInteger(client->response, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "system-up-time", (int)(time(NULL) - SystemStartTime));
-	}
-	else
-	  ippAddSeparator(client->response);
+    if (httpGetState(client->http) != HTTP_STATE_POST_SEND)
+      httpFlush(client->http);		/* Flush trailing (junk) data */
 
-	ippCopyAttributes(client->response, event, 0, NULL, NULL);
-	num_events ++;
-      }
+    client->waiter = waiter;
 
-      _cupsRWUnlock(&sub->rwlock);
-    }
+    serverLogAttributes(client, "Response:", client->response, 2);
 
-    if (i < count)
-      break;
-    else if (num_events == 0 && notify_wait)
-    {
-      if (notify_wait > 0)
-      {
-       /*
-	* Wait for more events...
-	*/
+    if (!serverRespondHTTP(client, HTTP_STATUS_OK, NULL, "application/ipp", 0) || httpFlushWrite(client->http) < 0)
+      waiter->hangup = 1;		/* Close the connection once parked */
 
-        serverLogClient(SERVER_LOGLEVEL_DEBUG, client, "Waiting for events.");
+    return;
+  }
+  else if (num_events == 0 && waiter)
+  {
+   /*
+    * Park the request without a response - serverProcessClient hands the
+    * connection to the main loop, which hands it back to a client thread to
+    * complete the request when an event arrives or the request times out...
+    */
 
-	_cupsMutexLock(&NotificationMutex);
-	_cupsCondWait(&NotificationCondition, &NotificationMutex, 30.0);
-	_cupsMutexUnlock(&NotificationMutex);
+    serverLogClient(SERVER_LOGLEVEL_DEBUG, client, "Waiting for events.");
 
-        serverLogClient(SERVER_LOGLEVEL_DEBUG, client, "Done waiting for events.");
+    if (httpGetState(client->http) != HTTP_STATE_POST_SEND)
+      httpFlush(client->http);		/* Flush trailing (junk) data */
 
-        notify_wait = -1;
-      }
-      else
-      {
-       /*
-        * Stop waiting for events...
-        */
+    client->waiter = waiter;
+    return;
+  }
 
-        notify_wait = 0;
-      }
-    }
+  if (waiter)
+  {
+    for (i = 0; i < count; i ++)
+      serverRemoveWaiter(ippGetInteger(sub_ids, i), waiter);
+
+    free(waiter);
   }
-  while (num_events == 0 && notify_wait);
 }
 
 
@@ -5471,12 +5720,12 @@ static void
 ipp_print_job(server_client_t *client)	/* I - Client */
 {
   server_job_t		*job;		/* New job */
-  char			filename[1024],	/* Filename buffer */
-			buffer[4096];	/* Copy buffer */
-  ssize_t		bytes;		/* Bytes read */
+  char			filename[1024];	/* Filename buffer */
   cups_array_t		*ra;		/* Attributes to send in response */
   ipp_attribute_t	*hold_until,	/* job-hold-until-xxx attribute, if any */
 			*doc_name;	/* document-name attribute, if any */
+  int			streaming;	/* Processing while receiving? */
+  off_t			bytes;		/* Bytes spooled */
 
 
   if (Authentication && !client->username[0])
@@ -5518,6 +5767,9 @@ ipp_print_job(server_client_t *client)	/* I - Client */
     return;
   }
 
+  if (!check_spool(client))
+    return;
+
  /*
   * Print the job...
   */
@@ -5561,60 +5813,83 @@ ipp_print_job(server_client_t *client)	/* I - Client */
     return;
   }
 
-  while ((bytes = httpRead2(client->http, buffer, sizeof(buffer))) > 0)
+  streaming = job->hold_until == 0 && serverStartJobStream(job, filename);
+
+  if ((bytes = read_document(client, job->fd)) < 0)
   {
-    if (write(job->fd, buffer, (size_t)bytes) < bytes)
-    {
-      int error = errno;		/* Write error */
+    int error = errno;			/* Write error */
 
+    if (streaming)
+      serverFinishJobStream(job, 0);
+    else
       job->state = IPP_JSTATE_ABORTED;
 
-      close(job->fd);
-      job->fd = -1;
+    close(job->fd);
+    job->fd = -1;
 
-      unlink(filename);
+    unlink(filename);
+
+    if (error == EFBIG)
+    {
+     /*
+      * Chunked document data exceeded the per-document limit, so abort this
+      * job and close the connection rather than reading the rest...
+      */
+
+      serverRespondIPP(client, IPP_STATUS_ERROR_REQUEST_ENTITY,
+                  "Document is too large for the spool area.");
+      httpSetKeepAlive(client->http, HTTP_KEEPALIVE_OFF);
+    }
+    else if (httpError(client->http))
+    {
+     /*
+      * Got an error while reading the print data, so abort this job.
+      */
 
       serverRespondIPP(client, IPP_STATUS_ERROR_INTERNAL,
-                  "Unable to write print file: %s", strerror(error));
-      return;
+                  "Unable to read print file.");
     }
+    else
+      serverRespondIPP(client, IPP_STATUS_ERROR_INTERNAL,
+                  "Unable to write print file: %s", strerror(error));
+    return;
   }
 
-  if (bytes < 0)
+  if (close(job->fd))
   {
-   /*
-    * Got an error while reading the print data, so abort this job.
-    */
+    int error = errno;		/* Write error */
 
-    job->state = IPP_JSTATE_ABORTED;
+    if (streaming)
+      serverFinishJobStream(job, 0);
+    else
+      job->state = IPP_JSTATE_ABORTED;
 
-    close(job->fd);
     job->fd = -1;
 
     unlink(filename);
 
     serverRespondIPP(client, IPP_STATUS_ERROR_INTERNAL,
-                "Unable to read print file.");
+                "Unable to write print file: %s", strerror(error));
     return;
   }
 
-  if (close(job->fd))
-  {
-    int error = errno;		/* Write error */
+  job->fd = -1;
 
-    job->state = IPP_JSTATE_ABORTED;
-    job->fd    = -1;
+  serverAddSpoolBytes(job, bytes);
 
-    unlink(filename);
-
-    serverRespondIPP(client, IPP_STATUS_ERROR_INTERNAL,
-                "Unable to write print file: %s", strerror(error));
-    return;
+  if (streaming)
+  {
+    serverFinishJobStream(job, 1);
+  }
+  else
+  {
+    job->filename = strdup(filename);
+    job->state    = IPP_JSTATE_PENDING;
   }
 
-  job->fd       = -1;
-  job->filename = strdup(filename);
-  job->state    = IPP_JSTATE_PENDING;
+  _cupsRWLockRead(&job->rwlock);
+  serverJournalJobNoLock(job, 1);
+  _cupsRWUnlock(&job->rwlock);
 
  /*
   * Process the job, if possible...
@@ -5708,6 +5983,9 @@ ipp_print_uri(server_client_t *client)	/* I - Client */
   if ((uri = get_document_uri(client)) == NULL)
     return;
 
+  if (!check_spool(client))
+    return;
+
  /*
   * Print the job...
   */
@@ -5737,6 +6015,10 @@ ipp_print_uri(server_client_t *client)	/* I - Client */
   if (copy_document_uri(client, job, uri) && job->hold_until == 0)
     job->state = IPP_JSTATE_PENDING;
 
+  _cupsRWLockRead(&job->rwlock);
+  serverJournalJobNoLock(job, 1);
+  _cupsRWUnlock(&job->rwlock);
+
  /*
   * Process the job...
   */
@@ -6069,6 +6351,8 @@ ipp_renew_subscription(
   else
     sub->expire = INT_MAX;
 
+  serverJournalSubscription(sub, 0);
+
   serverRespondIPP(client, IPP_STATUS_OK, NULL);
 
   ippAddInteger(client->response, IPP_TAG_SUBSCRIPTION, IPP_TAG_INTEGER, "notify-lease-duration", (int)(sub->expire - time(NULL)));
@@ -6235,11 +6519,11 @@ static void
 ipp_send_document(server_client_t *client)/* I - Client */
 {
   server_job_t		*job;		/* Job information */
-  char			filename[1024],	/* Filename buffer */
-			buffer[4096];	/* Copy buffer */
-  ssize_t		bytes;		/* Bytes read */
+  char			filename[1024];	/* Filename buffer */
   ipp_attribute_t	*attr;		/* Current attribute */
   cups_array_t		*ra;		/* Attributes to send in response */
+  int			streaming;	/* Processing while receiving? */
+  off_t			bytes;		/* Bytes spooled */
 
 
   if (Authentication && !client->username[0])
@@ -6316,6 +6600,9 @@ ipp_send_document(server_client_t *client)/* I - Client */
     return;
   }
 
+  if (!check_spool(client))
+    return;
+
   if (!job->doc_attrs)
     job->doc_attrs = ippNew();
 
@@ -6355,40 +6642,45 @@ ipp_send_document(server_client_t *client)/* I - Client */
     return;
   }
 
-  while ((bytes = httpRead2(client->http, buffer, sizeof(buffer))) > 0)
-  {
-    if (write(job->fd, buffer, (size_t)bytes) < bytes)
-    {
-      int error = errno;		/* Write error */
-
-      job->state = IPP_JSTATE_ABORTED;
-
-      close(job->fd);
-      job->fd = -1;
-
-      unlink(filename);
-
-      serverRespondIPP(client, IPP_STATUS_ERROR_INTERNAL,
-                  "Unable to write print file: %s", strerror(error));
-      return;
-    }
-  }
+  streaming = job->hold_until == 0 && serverStartJobStream(job, filename);
 
-  if (bytes < 0)
+  if ((bytes = read_document(client, job->fd)) < 0)
   {
-   /*
-    * Got an error while reading the print data, so abort this job.
-    */
+    int error = errno;			/* Write error */
 
-    job->state = IPP_JSTATE_ABORTED;
+    if (streaming)
+      serverFinishJobStream(job, 0);
+    else
+      job->state = IPP_JSTATE_ABORTED;
 
     close(job->fd);
     job->fd = -1;
 
     unlink(filename);
 
-    serverRespondIPP(client, IPP_STATUS_ERROR_INTERNAL,
-                "Unable to read print file.");
+    if (error == EFBIG)
+    {
+     /*
+      * Chunked document data exceeded the per-document limit, so abort this
+      * job and close the connection rather than reading the rest...
+      */
+
+      serverRespondIPP(client, IPP_STATUS_ERROR_REQUEST_ENTITY,
+                  "Document is too large for the spool area.");
+      httpSetKeepAlive(client->http, HTTP_KEEPALIVE_OFF);
+    }
+    else if (httpError(client->http))
+    {
+     /*
+      * Got an error while reading the print data, so abort this job.
+      */
+
+      serverRespondIPP(client, IPP_STATUS_ERROR_INTERNAL,
+                  "Unable to read print file.");
+    }
+    else
+      serverRespondIPP(client, IPP_STATUS_ERROR_INTERNAL,
+                  "Unable to write print file: %s", strerror(error));
     return;
   }
 
@@ -6396,8 +6688,12 @@ ipp_send_document(server_client_t *client)/* I - Client */
   {
     int error = errno;			/* Write error */
 
-    job->state = IPP_JSTATE_ABORTED;
-    job->fd    = -1;
+    if (streaming)
+      serverFinishJobStream(job, 0);
+    else
+      job->state = IPP_JSTATE_ABORTED;
+
+    job->fd = -1;
 
     unlink(filename);
 
@@ -6408,11 +6704,25 @@ ipp_send_document(server_client_t *client)/* I - Client */
 
   _cupsRWLockWrite(&(client->printer->rwlock));
 
-  job->fd       = -1;
-  job->filename = strdup(filename);
+  job->fd = -1;
 
-  if (job->hold_until == 0)
-    job->state = IPP_JSTATE_PENDING;
+  serverAddSpoolBytes(job, bytes);
+
+  if (streaming)
+  {
+    serverFinishJobStream(job, 1);
+  }
+  else
+  {
+    job->filename = strdup(filename);
+
+    if (job->hold_until == 0)
+      job->state = IPP_JSTATE_PENDING;
+  }
+
+  _cupsRWLockRead(&job->rwlock);
+  serverJournalJobNoLock(job, 1);
+  _cupsRWUnlock(&job->rwlock);
 
   _cupsRWUnlock(&(client->printer->rwlock));
 
@@ -6453,9 +6763,7 @@ ipp_send_resource_data(
   int			resource_id;	/* resource-id value */
   const char		*format;	/* resource-format value */
   ipp_attribute_t	*signature;	/* resource-signature value */
-  char			filename[1024],	/* Filename buffer */
-			buffer[4096];	/* Copy buffer */
-  ssize_t		bytes;		/* Bytes read */
+  char			filename[1024];	/* Filename buffer */
 
 
   if (Authentication)
@@ -6550,35 +6858,29 @@ ipp_send_resource_data(
     return;
   }
 
-  while ((bytes = httpRead2(client->http, buffer, sizeof(buffer))) > 0)
+  if (httpReadToFd(client->http, resource->fd) < 0)
   {
-    if (write(resource->fd, buffer, (size_t)bytes) < bytes)
-    {
-      int error = errno;		/* Write error */
+    int error = errno;			/* Write error */
 
-      close(resource->fd);
-      resource->fd = -1;
-      unlink(filename);
+    close(resource->fd);
+    resource->fd = -1;
+    unlink(filename);
+
+    if (httpError(client->http))
+    {
+     /*
+      * Got an error while reading the resource data, so abort this resource.
+      */
 
+      serverSetResourceState(resource, IPP_RSTATE_ABORTED, "Unable to read resource file.");
+      serverRespondIPP(client, IPP_STATUS_ERROR_INTERNAL, "Unable to read resource file.");
+    }
+    else
+    {
       serverSetResourceState(resource, IPP_RSTATE_ABORTED, "Unable to write resource file: %s", strerror(error));
       serverRespondIPP(client, IPP_STATUS_ERROR_INTERNAL, "Unable to write resource file: %s", strerror(error));
       httpFlush(client->http);
-      return;
     }
-  }
-
-  if (bytes < 0)
-  {
-   /*
-    * Got an error while reading the resource data, so abort this resource.
-    */
-
-    close(resource->fd);
-    resource->fd = -1;
-    unlink(filename);
-
-    serverSetResourceState(resource, IPP_RSTATE_ABORTED, "Unable to read resource file.");
-    serverRespondIPP(client, IPP_STATUS_ERROR_INTERNAL, "Unable to read resource file.");
     return;
   }
 
@@ -6712,6 +7014,9 @@ ipp_send_uri(server_client_t *client)	/* I - Client */
     return;
   }
 
+  if (!check_spool(client))
+    return;
+
   if (!job->doc_attrs)
     job->doc_attrs = ippNew();
 
@@ -6755,6 +7060,10 @@ ipp_send_uri(server_client_t *client)	/* I - Client */
   if (copy_document_uri(client, job, uri) && job->hold_until == 0)
     job->state = IPP_JSTATE_PENDING;
 
+  _cupsRWLockRead(&job->rwlock);
+  serverJournalJobNoLock(job, 1);
+  _cupsRWUnlock(&job->rwlock);
+
  /*
   * Process the job, if possible...
   */
@@ -6867,6 +7176,8 @@ ipp_set_document_attributes(
     ippCopyAttribute(job->doc_attrs, attr, 0);
   }
 
+  serverJournalJobNoLock(job, 1);
+
   _cupsRWUnlock(&job->rwlock);
 
   serverRespondIPP(client, IPP_STATUS_OK, NULL);
@@ -6977,6 +7288,10 @@ ipp_set_job_attributes(
     }
   }
 
+  _cupsRWLockRead(&job->rwlock);
+  serverJournalJobNoLock(job, 1);
+  _cupsRWUnlock(&job->rwlock);
+
   serverRespondIPP(client, IPP_STATUS_OK, NULL);
 }
 
@@ -8806,9 +9121,23 @@ serverProcessIPP(
 
   send_response:
 
-  if (httpGetState(client->http) != HTTP_STATE_WAITING)
+  if (client->waiter)
+    return (1);				/* Parked, main loop sends the response */
+  else if (httpGetState(client->http) != HTTP_STATE_WAITING)
   {
-    if (httpGetState(client->http) != HTTP_STATE_POST_SEND)
+    if (httpGetState(client->http) == HTTP_STATE_POST_RECV && httpGetKeepAlive(client->http) == HTTP_KEEPALIVE_OFF)
+    {
+     /*
+      * Document data was refused, so close the connection after the response
+      * rather than reading it...
+      */
+
+      serverLogAttributes(client, "Response:", client->response, 2);
+
+      serverRespondHTTP(client, HTTP_STATUS_OK, NULL, "application/ipp", ippLength(client->response));
+      return (0);
+    }
+    else if (httpGetState(client->http) != HTTP_STATE_POST_SEND)
       httpFlush(client->http);		/* Flush trailing (junk) data */
 
     serverLogAttributes(client, "Response:", client->response, 2);
@@ -8880,6 +9209,92 @@ serverRespondUnsupported(
 }
 
 
+/*
+ * 'read_document()' - Read document data from the client into a file.
+ *
+ * When SpoolClientRate is set, reads are paced so that a single large upload
+ * cannot use all of the spool bandwidth.
+ *
+ * The size of chunked document data isn't known when the spool is checked, so
+ * the per-document limit is enforced as the data is copied instead.  If the
+ * limit is exceeded -1 is returned with errno set to EFBIG.
+ */
+
+static off_t				/* O - Number of bytes read or -1 on error */
+read_document(server_client_t *client,	/* I - Client */
+              int             fd)	/* I - File to write to */
+{
+  off_t			total = 0,	/* Total bytes read */
+			limit = 0,	/* Maximum bytes to read */
+			high;		/* High watermark in bytes */
+  ssize_t		bytes,		/* Bytes read */
+			written;	/* Bytes written */
+  char			buffer[32768],	/* Copy buffer */
+			*bufptr;	/* Pointer into buffer */
+  struct timeval	start,		/* Start time */
+			curtime;	/* Current time */
+  double		elapsed,	/* Elapsed time in seconds */
+			expected;	/* Expected time in seconds */
+
+
+  if (httpIsChunked(client->http))
+  {
+    if ((high = (off_t)SpoolHighWater * 1048576) > 0)
+      limit = high;
+
+    if ((high = (off_t)client->printer->pinfo.spool_high * 1048576) > 0 && (!limit || high < limit))
+      limit = high;
+  }
+
+  if (SpoolClientRate <= 0 && !limit)
+    return (httpReadToFd(client->http, fd));
+
+  gettimeofday(&start, NULL);
+
+  while ((bytes = httpRead2(client->http, buffer, sizeof(buffer))) > 0)
+  {
+    for (bufptr = buffer; bytes > 0; bufptr += written, bytes -= written)
+    {
+      if ((written = write(fd, bufptr, (size_t)bytes)) < 0)
+      {
+        if (errno != EINTR && errno != EAGAIN)
+          return (-1);
+
+        written = 0;
+      }
+
+      total += written;
+    }
+
+    if (limit && total > limit)
+    {
+      errno = EFBIG;
+      return (-1);
+    }
+
+    if (SpoolClientRate <= 0)
+      continue;
+
+   /*
+    * Sleep until the average rate drops to SpoolClientRate...
+    */
+
+    gettimeofday(&curtime, NULL);
+
+    elapsed  = (double)(curtime.tv_sec - start.tv_sec) + 0.000001 * (curtime.tv_usec - start.tv_usec);
+    expected = (double)total / (1024.0 * SpoolClientRate);
+
+    if (expected > elapsed)
+      usleep((useconds_t)(1000000.0 * (expected - elapsed)));
+  }
+
+  if (bytes < 0)
+    return (-1);
+
+  return (total);
+}
+
+
 /*
  * 'respond_unsettable()' - Respond with an unsettable attribute.
  */
@@ -111,6 +111,16 @@ extern char **environ;
 /* ippget event lifetime is 5 minutes */
 #  define SERVER_IPPGET_EVENT_LIFE			300
 
+/* notify-sequence-numbers reserved per subscription journal record */
+#  define SERVER_NOTIFY_SEQUENCE_RESERVE		100
+
+/* Number of hashed job spool subdirectories per printer */
+#  define SERVER_SPOOL_DIRS				256
+/* Printed documents this large are dropped from the page cache */
+#  define SERVER_SPOOL_UNCACHE_SIZE			(16 * 1024 * 1024)
+/* Retry-After value in seconds when the spool area is full */
+#  define SERVER_SPOOL_RETRY				30
+
 /* URL schemes and DNS-SD types for IPP and web resources... */
 #  define SERVER_IPP_SCHEME "ipp"
 #  define SERVER_IPP_TYPE "_ipp._tcp"
@@ -201,6 +211,7 @@ enum server_event_e			/* notify-events bit values */
 typedef unsigned int server_event_t;	/* Bitfield for notify-events */
 #define SERVER_EVENT_DEFAULT SERVER_EVENT_JOB_COMPLETED
 #define SERVER_EVENT_DEFAULT_STRING "job-completed"
+#define SERVER_EVENT_NUM_BITS 31	/* Number of notify-events bits */
 VAR const char * const server_events[31]
 VALUE({					/* Strings for bits */
   /* "none" is implied for no bits set */
@@ -384,6 +395,7 @@ VALUE({					/* Strings for bits */
 typedef enum server_transform_e		/* Transform modes for server */
 {
   SERVER_TRANSFORM_COMMAND,		/* Run command for print job processing */
+  SERVER_TRANSFORM_TO_CACHE,		/* Send output to transform cache */
   SERVER_TRANSFORM_TO_CLIENT,		/* Send output to client */
   SERVER_TRANSFORM_TO_FILE		/* Send output to file */
 } server_transform_t;
@@ -469,9 +481,12 @@ typedef struct server_pinfo_s		/**** Printer information ****/
 		proxy_group;		/* Proxy group, if any */
   char		duplex,			/* Duplex mode */
 		pin,			/* PIN printing mode? */
+		stream_jobs,		/* Start commands while receiving documents? */
 		web_forms;		/* Enable web interface forms? */
   int		ppm,			/* Pages per minute for mono */
 		ppm_color;		/* Pages per minute for color */
+  int		spool_high,		/* Spool high watermark in megabytes */
+		spool_low;		/* Spool low watermark in megabytes */
   ipp_t		*attrs;			/* Printer attributes */
   cups_array_t	*strings;		/* Strings files */
   cups_array_t	*profiles;		/* ICC color profiles */
@@ -521,6 +536,8 @@ typedef struct server_printer_s		/**** Printer data ****/
 			*completed_jobs;/* Completed jobs */
   server_job_t		*processing_job;/* Current processing job */
   int			next_job_id;	/* Next job-id value */
+  off_t			spool_bytes;	/* Bytes of job data in spool */
+  char			spool_full;	/* Spool at high watermark? */
   server_identify_t	identify_actions;
 					/* identify-actions value, if any */
   char			*identify_message;
@@ -557,7 +574,18 @@ struct server_job_s			/**** Job data ****/
   int			cancel;		/* Non-zero when job canceled */
   char			*filename;	/* Print file name */
   int			fd;		/* Print file descriptor */
+  off_t			spool_bytes;	/* Bytes of job data in spool */
   int			transform_pid;	/* Transform process ID, if any */
+  struct server_worker_s *transform_worker;
+					/* Transform worker, if any */
+  int			prerendering,	/* Non-zero while transforming ahead of Fetch-Document */
+			prerender_pid;	/* Prerender process ID, if any */
+  struct server_worker_s *prerender_worker;
+					/* Prerender transform worker, if any */
+  const char		*prerender_format;
+					/* Format being prerendered, if any */
+  int			streaming,	/* Non-zero while document data is received and processed */
+			stream_aborted;	/* Non-zero if streamed document data was incomplete */
   server_printer_t	*printer;	/* Printer */
   int			num_resources,	/* Number of job resources */
 			resources[SERVER_RESOURCES_MAX];
@@ -579,6 +607,25 @@ struct server_resource_s		/**** Resource data ****/
 			cancel;		/* Cancel pending */
 };
 
+typedef struct server_waiter_s		/**** Parked Get-Notifications request ****/
+{
+  struct server_client_s *client;	/* Client connection */
+  time_t		expire;		/* Time when the request times out */
+  int			notified,	/* Non-zero when an event has been added */
+			stream,		/* Non-zero to stream events in a chunked response */
+			hangup,		/* Non-zero when the client has closed the connection */
+			input;		/* Non-zero when the client has sent more data */
+} server_waiter_t;
+
+typedef struct server_notification_s	/**** Event notification ****/
+{
+  _cups_mutex_t		mutex;		/* Reference count lock */
+  int			use;		/* Reference count */
+  server_event_t	event;		/* Event bit(s) */
+  int			job_id;		/* Job ID, if any */
+  ipp_t			*attrs;		/* Attributes shared by all subscriptions */
+} server_notification_t;
+
 typedef struct server_subscription_s	/**** Subscription data ****/
 {
   int			id;		/* notify-subscription-id */
@@ -598,10 +645,27 @@ typedef struct server_subscription_s	/**** Subscription data ****/
   time_t		expire;		/* Lease expiration time */
   int			first_sequence,	/* First notify-sequence-number in cache */
 			last_sequence;	/* Last notify-sequence-number used */
-  cups_array_t		*events;	/* Events (ipp_t *'s) */
+  _cups_mutex_t		events_mutex;	/* Event ring buffer lock */
+  int			max_events;	/* Size of event ring buffer */
+  server_notification_t	**events;	/* Event ring buffer, indexed by notify-sequence-number */
+  int			delivered_sequence;
+					/* Last notify-sequence-number returned by Get-Notifications */
+  server_notification_t	*progress;	/* job-progress event held for notify-time-interval */
+  time_t		progress_time;	/* Time of last job-progress event */
+  cups_array_t		*waiters;	/* Get-Notifications waiters (server_waiter_t *'s), protected by NotificationMutex */
   int			pending_delete;	/* Non-zero when the subscription is about to be deleted/canceled */
+  int			journaled,	/* Non-zero if saved in the subscription journal */
+			saved_sequence;	/* Last notify-sequence-number reserved in the journal */
 } server_subscription_t;
 
+typedef struct server_subindex_s	/**** Subscriptions for an object ****/
+{
+  void			*target;	/* Job, resource, or printer (NULL for system) */
+  int			num_subs;	/* Number of subscriptions */
+  cups_array_t		*subs[SERVER_EVENT_NUM_BITS];
+					/* Subscriptions by event bit */
+} server_subindex_t;
+
 typedef struct server_client_s		/**** Client data ****/
 {
   int			number;		/* Client number */
@@ -622,6 +686,9 @@ typedef struct server_client_s		/**** Client data ****/
   int			fetch_compression,
 					/* Compress file? */
 			fetch_file;	/* File to fetch */
+  server_waiter_t	*waiter;	/* Parked Get-Notifications request, if any */
+  int			resumed;	/* Resumed after a parked request? */
+  int			retry_after;	/* Retry-After value for response, if any */
 } server_client_t;
 
 typedef struct server_listener_s	/**** Listener data ****/
@@ -675,6 +742,11 @@ VAR server_printer_t	*DefaultPrinter	VALUE(NULL);
 VAR char		*DefaultSystemURI VALUE(NULL);
 VAR http_encryption_t	Encryption	VALUE(HTTP_ENCRYPTION_IF_REQUESTED);
 VAR cups_array_t	*FileDirectories VALUE(NULL);
+VAR _cups_mutex_t	JobJournalMutex	VALUE(_CUPS_MUTEX_INITIALIZER);
+VAR cups_file_t		*JobJournal	VALUE(NULL);
+VAR int			JobJournalCount	VALUE(0),
+			JobJournalDirty	VALUE(0);
+VAR time_t		JobJournalSyncTime VALUE(0);
 VAR int			KeepFiles	VALUE(0);
 #ifdef HAVE_SSL
 VAR char		*KeychainPath	VALUE(NULL);
@@ -684,13 +756,27 @@ VAR char		*LogFile	VALUE(NULL);
 VAR server_loglevel_t	LogLevel	VALUE(SERVER_LOGLEVEL_ERROR);
 VAR int			MaxJobs		VALUE(100),
                         MaxCompletedJobs VALUE(100),
+                        MaxSubscriptionEvents VALUE(100),
                         NextPrinterId	VALUE(1);
 VAR cups_array_t	*Printers	VALUE(NULL);
 VAR _cups_rwlock_t	PrintersRWLock	VALUE(_CUPS_RWLOCK_INITIALIZER);
 VAR int			RelaxedConformance VALUE(0);
 VAR char		*ServerName	VALUE(NULL);
+VAR off_t		SpoolBytes	VALUE(0);
+VAR int			SpoolClientRate	VALUE(0);
 VAR char		*SpoolDirectory	VALUE(NULL);
+VAR int			SpoolFreed	VALUE(0),
+					/* Data freed while the spool was full, protected by SpoolMutex */
+			SpoolFull	VALUE(0),
+			SpoolHighWater	VALUE(0),
+			SpoolLowWater	VALUE(0);
+VAR _cups_mutex_t	SpoolMutex	VALUE(_CUPS_MUTEX_INITIALIZER);
 VAR char		*StateDirectory	VALUE(NULL);
+VAR int			TransformAhead	VALUE(0);
+VAR _cups_mutex_t	TransformCacheMutex VALUE(_CUPS_MUTEX_INITIALIZER);
+VAR int			TransformCacheSize VALUE(100);
+VAR int			TransformWorkerJobs VALUE(100);
+VAR int			TransformWorkers VALUE(0);
 
 VAR int			DNSSDEnabled	VALUE(1);
 #ifdef HAVE_DNSSD
@@ -708,10 +794,17 @@ VAR cups_array_t	*ResourcesByPath VALUE(NULL);
 VAR int			NextResourceId 	VALUE(1);
 
 VAR _cups_mutex_t	NotificationMutex VALUE(_CUPS_MUTEX_INITIALIZER);
-VAR _cups_cond_t	NotificationCondition VALUE(_CUPS_COND_INITIALIZER);
+VAR int			NotificationPipe[2] VALUE({ -1, -1 });
+VAR cups_array_t	*ParkedWaiters	VALUE(NULL);
+VAR time_t		ProgressDue	VALUE(0);
+					/* Next time a held job-progress event is due, protected by NotificationMutex */
 VAR _cups_rwlock_t	SubscriptionsRWLock VALUE(_CUPS_RWLOCK_INITIALIZER);
 VAR cups_array_t	*Subscriptions	VALUE(NULL);
+VAR cups_array_t	*SubscriptionIndex VALUE(NULL);
 VAR int			NextSubscriptionId VALUE(1);
+VAR _cups_mutex_t	SubscriptionJournalMutex VALUE(_CUPS_MUTEX_INITIALIZER);
+VAR cups_file_t		*SubscriptionJournal VALUE(NULL);
+VAR int			SubscriptionJournalCount VALUE(0);
 
 
 /*
@@ -721,16 +814,25 @@ VAR int			NextSubscriptionId VALUE(1);
 extern void		serverAddEventNoLock(server_printer_t *printer, server_job_t *job, server_resource_t *res, server_event_t event, const char *message, ...) _CUPS_FORMAT(5, 6);
 extern void		serverAddPrinter(server_printer_t *printer);
 extern void		serverAddResourceFile(server_resource_t *res, const char *filename, const char *format);
+extern void		serverAddSpoolBytes(server_job_t *job, off_t bytes);
 extern void		serverAddStringsFile(server_printer_t *printer, const char *language, server_resource_t *resource);
+extern void		serverAddWaiter(server_subscription_t *sub, server_waiter_t *waiter);
 extern void		serverAllocatePrinterResource(server_printer_t *printer, server_resource_t *resource);
 extern http_status_t	serverAuthenticateClient(server_client_t *client);
 extern int		serverAuthorizeUser(server_client_t *client, const char *owner, gid_t group, const char *scope);
+extern void		serverCheckFreedSpool(void);
 extern void		serverCheckJobs(server_printer_t *printer);
+extern ipp_status_t	serverCheckSpool(server_printer_t *printer, off_t bytes);
 extern void             serverCleanAllJobs(void);
 extern void		serverCleanJobs(server_printer_t *printer);
+extern void		serverCompactJobs(void);
+extern void		serverCompactSubscriptions(void);
+extern int		serverCompleteNotifications(server_client_t *client);
 extern void		serverCopyAttributes(ipp_t *to, ipp_t *from, cups_array_t *ra, cups_array_t *pa, ipp_tag_t group_tag, int quickcopy);
 extern void		serverCopyJobStateReasons(ipp_t *ipp, ipp_tag_t group_tag, server_job_t *job);
+extern void		serverCopyNotification(ipp_t *ipp, server_subscription_t *sub, server_notification_t *n, int sequence);
 extern void		serverCopyPrinterStateReasons(ipp_t *ipp, ipp_tag_t group_tag, server_printer_t *printer);
+extern int		serverCopySubscriptionEvents(server_subscription_t *sub, int sequence, int *first, server_notification_t ***events);
 extern server_client_t	*serverCreateClient(int sock);
 extern server_device_t	*serverCreateDevice(server_client_t *client);
 extern server_device_t	*serverCreateDevicePinfo(server_pinfo_t *pinfo, const char *uuid);
@@ -758,25 +860,37 @@ extern server_resource_t *serverFindResourceById(int id);
 extern server_resource_t *serverFindResourceByPath(const char *resource);
 extern server_resource_t *serverFindResourceByFilename(const char *filename);
 extern server_subscription_t *serverFindSubscription(server_client_t *client, int sub_id);
+extern void		serverFinishJobStream(server_job_t *job, int complete);
+extern void		serverFlushProgressEvents(void);
+extern void		serverFreeSubscriptionEvents(int num_events, server_notification_t **events);
 extern server_jreason_t	serverGetJobStateReasonsBits(ipp_attribute_t *attr);
 extern server_event_t	serverGetNotifyEventsBits(ipp_attribute_t *attr);
 extern const char	*serverGetNotifySubscribedEvent(server_event_t event);
 extern server_preason_t	serverGetPrinterStateReasonsBits(ipp_attribute_t *attr);
 extern int		serverHoldJob(server_job_t *job, ipp_attribute_t *hold_until);
+extern void		serverIndexSubscriptionNoLock(server_subscription_t *sub);
+extern void		serverJournalJobNoLock(server_job_t *job, int full);
+extern void		serverJournalSubscription(server_subscription_t *sub, int canceled);
 extern int		serverLoadAttributes(const char *filename, server_pinfo_t *pinfo);
+extern void		serverLoadJobs(void);
+extern void		serverLoadSubscriptions(void);
 extern void		serverLog(server_loglevel_t level, const char *format, ...) _CUPS_FORMAT(2, 3);
 extern void		serverLogAttributes(server_client_t *client, const char *title, ipp_t *ipp, int type);
 extern void		serverLogClient(server_loglevel_t level, server_client_t *client, const char *format, ...) _CUPS_FORMAT(3, 4);
 extern void		serverLogJob(server_loglevel_t level, server_job_t *job, const char *format, ...) _CUPS_FORMAT(3, 4);
 extern void		serverLogPrinter(server_loglevel_t level, server_printer_t *printer, const char *format, ...) _CUPS_FORMAT(3, 4);
 extern char		*serverMakeVCARD(const char *user, const char *name, const char *location, const char *email, const char *phone, char *buffer, size_t bufsize);
+extern void		serverParkWaiter(server_waiter_t *waiter);
 extern void		serverPausePrinter(server_printer_t *printer, int immediately);
+extern void		serverPrerenderJob(server_job_t *job);
 extern void		*serverProcessClient(server_client_t *client);
 extern int		serverProcessHTTP(server_client_t *client);
 extern int		serverProcessIPP(server_client_t *client);
 extern void		*serverProcessJob(server_job_t *job);
+extern void		serverReapFile(const char *filename);
 extern int		serverRegisterPrinter(server_printer_t *printer);
 extern int		serverReleaseJob(server_job_t *job);
+extern void		serverRemoveWaiter(int sub_id, server_waiter_t *waiter);
 extern int		serverRespondHTTP(server_client_t *client, http_status_t code, const char *content_coding, const char *type, size_t length);
 extern void		serverRespondIPP(server_client_t *client, ipp_status_t status, const char *message, ...) _CUPS_FORMAT(3, 4);
 extern void		serverRespondUnsupported(server_client_t *client, ipp_attribute_t *attr);
@@ -785,9 +899,15 @@ extern void		serverResumePrinter(server_printer_t *printer);
 extern void		serverRun(void);
 extern void		serverSaveSystem(void);
 extern void		serverSetResourceState(server_resource_t *resource, ipp_rstate_t state, const char *message, ...) _CUPS_FORMAT(3, 4);
+extern int		serverStartJobStream(server_job_t *job, const char *filename);
 extern void		serverStopJob(server_job_t *job);
+extern void		serverStopPrerender(server_job_t *job, server_device_t *device);
 extern char		*serverTimeString(time_t tv, char *buffer, size_t bufsize);
 extern int		serverTransformJob(server_client_t *client, server_job_t *job, const char *command, const char *format, server_transform_t mode);
+extern void		serverUnindexSubscriptionNoLock(server_subscription_t *sub);
+extern server_waiter_t	*serverUnparkWaiter(fd_set *input, time_t *next_expire);
 extern void		serverUnregisterPrinter(server_printer_t *printer);
 extern void		serverUpdateDeviceAttributesNoLock(server_printer_t *printer);
 extern void		serverUpdateDeviceStateNoLock(server_printer_t *printer);
+extern void		serverWaitPrerender(server_job_t *job);
+extern int		serverWatchWaiters(fd_set *input, int max_fd);
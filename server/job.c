@@ -11,6 +11,99 @@
 #include "ippserver.h"
 
 
+/*
+ * Local globals...
+ */
+
+static cups_array_t	*reap_list = NULL;
+					/* Spool files waiting to be removed */
+static _cups_cond_t	reap_cond = _CUPS_COND_INITIALIZER;
+					/* Condition for reaper thread */
+static _cups_mutex_t	reap_mutex = _CUPS_MUTEX_INITIALIZER;
+					/* Mutex for reap_list */
+static int		reap_running = 0;
+					/* Is the reaper thread running? */
+
+
+/*
+ * Local functions...
+ */
+
+static void	compact_journal(void);
+static int	compare_records(ipp_t *a, ipp_t *b);
+static void	journal_job(server_job_t *job, ipp_op_t op);
+static void	journal_record(ipp_t *record);
+static void	read_journal(cups_array_t *records, const char *filename, off_t length);
+static void	*reap_files(void *data);
+static server_job_t *restore_job(ipp_t *record);
+static int	spool_state(off_t used, int high, int low, int full);
+static void	uncache_file(const char *filename);
+
+
+/*
+ * 'serverAddSpoolBytes()' - Account for job data added to or removed from the
+ *                           spool.
+ *
+ * Removing data from a full spool wakes up the main loop so that the
+ * "spool-area-full" state reason is re-evaluated by serverCheckFreedSpool -
+ * the caller may be holding the printer lock, so it can't be updated here.
+ */
+
+void
+serverAddSpoolBytes(server_job_t *job,	/* I - Job */
+                    off_t        bytes)	/* I - Bytes added (removed if negative) */
+{
+  int	wake = 0;			/* Wake up the main loop? */
+
+
+  _cupsMutexLock(&SpoolMutex);
+
+  job->spool_bytes          += bytes;
+  job->printer->spool_bytes += bytes;
+  SpoolBytes                += bytes;
+
+  if (bytes < 0 && (SpoolFull || job->printer->spool_full) && !SpoolFreed)
+    wake = SpoolFreed = 1;
+
+  _cupsMutexUnlock(&SpoolMutex);
+
+  if (wake && NotificationPipe[1] >= 0)
+  {
+    if (write(NotificationPipe[1], "", 1) < 0 && errno != EAGAIN)
+      serverLog(SERVER_LOGLEVEL_ERROR, "Unable to wake up main loop: %s", strerror(errno));
+  }
+}
+
+
+/*
+ * 'serverCheckFreedSpool()' - Update "spool-area-full" for all printers after
+ *                             data was removed from a full spool.
+ */
+
+void
+serverCheckFreedSpool(void)
+{
+  int			freed;		/* Was data freed? */
+  server_printer_t	*printer;	/* Current printer */
+
+
+  _cupsMutexLock(&SpoolMutex);
+  freed      = SpoolFreed;
+  SpoolFreed = 0;
+  _cupsMutexUnlock(&SpoolMutex);
+
+  if (!freed)
+    return;
+
+  _cupsRWLockRead(&PrintersRWLock);
+
+  for (printer = (server_printer_t *)cupsArrayFirst(Printers); printer; printer = (server_printer_t *)cupsArrayNext(Printers))
+    serverCheckSpool(printer, 0);
+
+  _cupsRWUnlock(&PrintersRWLock);
+}
+
+
 /*
  * 'serverCheckJobs()' - Check for new jobs to process.
  */
@@ -23,6 +116,8 @@ serverCheckJobs(server_printer_t *printer)	/* I - Printer */
 
   serverLogPrinter(SERVER_LOGLEVEL_DEBUG, printer, "Checking for new jobs to process.");
 
+  serverCheckSpool(printer, 0);		/* Update spool-area-full */
+
   if (printer->processing_job)
   {
     serverLogPrinter(SERVER_LOGLEVEL_DEBUG, printer, "Printer is already processing job %d.", printer->processing_job->id);
@@ -101,6 +196,77 @@ serverCheckJobs(server_printer_t *printer)	/* I - Printer */
 }
 
 
+/*
+ * 'serverCheckSpool()' - Check whether the spool can accept more job data.
+ *
+ * The system and printer spool usage is compared against the high and low
+ * watermarks.  Once usage reaches the high watermark the spool stays full
+ * until it drops below the low watermark, and the printer's
+ * "spool-area-full" state reason is updated to match.
+ *
+ * The "bytes" argument is the size of the incoming document, or 0 if unknown.
+ */
+
+ipp_status_t				/* O - IPP_STATUS_OK, IPP_STATUS_ERROR_BUSY, or IPP_STATUS_ERROR_REQUEST_ENTITY */
+serverCheckSpool(
+    server_printer_t *printer,		/* I - Printer */
+    off_t            bytes)		/* I - Incoming bytes or 0 if unknown */
+{
+  ipp_status_t	status = IPP_STATUS_OK;	/* Return status */
+  off_t		high;			/* High watermark in bytes */
+  int		full;			/* Is the spool full? */
+
+
+  _cupsMutexLock(&SpoolMutex);
+
+  SpoolFull            = spool_state(SpoolBytes, SpoolHighWater, SpoolLowWater, SpoolFull);
+  printer->spool_full  = (char)spool_state(printer->spool_bytes, printer->pinfo.spool_high, printer->pinfo.spool_low, printer->spool_full);
+  full                 = SpoolFull || printer->spool_full;
+
+  if ((high = (off_t)SpoolHighWater * 1048576) > 0)
+  {
+    if (bytes > high)
+      status = IPP_STATUS_ERROR_REQUEST_ENTITY;
+    else if (SpoolFull || SpoolBytes + bytes > high)
+      status = IPP_STATUS_ERROR_BUSY;
+  }
+
+  if (status == IPP_STATUS_OK && (high = (off_t)printer->pinfo.spool_high * 1048576) > 0)
+  {
+    if (bytes > high)
+      status = IPP_STATUS_ERROR_REQUEST_ENTITY;
+    else if (printer->spool_full || printer->spool_bytes + bytes > high)
+      status = IPP_STATUS_ERROR_BUSY;
+  }
+
+  _cupsMutexUnlock(&SpoolMutex);
+
+  if (full != ((printer->state_reasons & SERVER_PREASON_SPOOL_AREA_FULL) != 0))
+  {
+    _cupsRWLockWrite(&printer->rwlock);
+
+    if (full)
+    {
+      printer->state_reasons |= SERVER_PREASON_SPOOL_AREA_FULL;
+
+      serverLogPrinter(SERVER_LOGLEVEL_INFO, printer, "Spool area is full.");
+      serverAddEventNoLock(printer, NULL, NULL, SERVER_EVENT_PRINTER_STATE_CHANGED, "Spool area is full.");
+    }
+    else
+    {
+      printer->state_reasons &= (server_preason_t)~SERVER_PREASON_SPOOL_AREA_FULL;
+
+      serverLogPrinter(SERVER_LOGLEVEL_INFO, printer, "Spool area is no longer full.");
+      serverAddEventNoLock(printer, NULL, NULL, SERVER_EVENT_PRINTER_STATE_CHANGED, "Spool area is no longer full.");
+    }
+
+    _cupsRWUnlock(&printer->rwlock);
+  }
+
+  return (status);
+}
+
+
 /*
  * 'serverCleanJobs()' - Clean out old (completed) jobs.
  */
@@ -125,7 +291,7 @@ serverCleanJobs(server_printer_t *printer)	/* I - Printer */
   for (job = (server_job_t *)cupsArrayFirst(printer->completed_jobs);
        job;
        job = (server_job_t *)cupsArrayNext(printer->completed_jobs))
-    if (job->completed && job->completed < cleantime)
+    if (job->completed && job->completed < cleantime && !job->prerendering && !job->streaming)
     {
      /*
       * Grab the write lock to make sure there are no readers of the job
@@ -148,6 +314,55 @@ serverCleanJobs(server_printer_t *printer)	/* I - Printer */
 }
 
 
+/*
+ * 'serverCompactJobs()' - Sync and compact the job journal.
+ *
+ * Journal records written within a second of the last sync are synced here.
+ * The journal is folded into the job snapshot once enough records have been
+ * appended.
+ */
+
+void
+serverCompactJobs(void)
+{
+  int			count,		/* Number of journal records */
+			num_jobs = 0;	/* Number of jobs */
+  server_printer_t	*printer;	/* Current printer */
+
+
+  if (!JobJournal)
+    return;
+
+  _cupsMutexLock(&JobJournalMutex);
+
+  if (JobJournal && JobJournalDirty)
+  {
+    fsync(cupsFileNumber(JobJournal));
+
+    JobJournalDirty    = 0;
+    JobJournalSyncTime = time(NULL);
+  }
+
+  count = JobJournalCount;
+
+  _cupsMutexUnlock(&JobJournalMutex);
+
+  _cupsRWLockRead(&PrintersRWLock);
+
+  for (printer = (server_printer_t *)cupsArrayFirst(Printers); printer; printer = (server_printer_t *)cupsArrayNext(Printers))
+  {
+    _cupsRWLockRead(&printer->rwlock);
+    num_jobs += cupsArrayCount(printer->jobs);
+    _cupsRWUnlock(&printer->rwlock);
+  }
+
+  _cupsRWUnlock(&PrintersRWLock);
+
+  if (count > 100 && count > 2 * num_jobs)
+    compact_journal();
+}
+
+
 /*
  * 'serverCopyJobStateReasons()' - Copy printer-state-reasons values.
  */
@@ -293,6 +508,8 @@ serverCreateJob(
   cupsArrayAdd(client->printer->jobs, job);
   cupsArrayAdd(client->printer->active_jobs, job);
 
+  serverJournalJobNoLock(job, 1);
+
   _cupsRWUnlock(&(client->printer->rwlock));
 
   return (job);
@@ -310,7 +527,8 @@ void serverCreateJobFilename(
     size_t         fnamesize)		/* I - Size of filename buffer */
 {
   char			name[256],	/* "Safe" filename */
-			*nameptr;	/* Pointer into filename */
+			*nameptr,	/* Pointer into filename */
+			subdir[1024];	/* Spool subdirectory */
   const char		*ext,		/* Filename extension */
 			*job_name;	/* job-name value */
   ipp_attribute_t	*job_name_attr;	/* job-name attribute */
@@ -374,10 +592,17 @@ void serverCreateJobFilename(
     ext = "prn";
 
  /*
-  * Create a filename with the job-id, job-name, and document-format (extension)...
+  * Create a filename with the job-id, job-name, and document-format (extension)
+  * in one of the printer's hashed subdirectories so that no single directory
+  * gets too large...
   */
 
-  snprintf(fname, fnamesize, "%s/%s/%d-%s.%s", SpoolDirectory, job->printer->name, job->id, name, ext);
+  snprintf(subdir, sizeof(subdir), "%s/%s/%02x", SpoolDirectory, job->printer->name, job->id % SERVER_SPOOL_DIRS);
+
+  if (mkdir(subdir, 0755) && errno != EEXIST)
+    serverLogJob(SERVER_LOGLEVEL_ERROR, job, "Unable to create spool directory \"%s\": %s", subdir, strerror(errno));
+
+  snprintf(fname, fnamesize, "%s/%d-%s.%s", subdir, job->id, name, ext);
 }
 
 
@@ -393,17 +618,23 @@ serverDeleteJob(server_job_t *job)		/* I - Job */
 
   _cupsRWLockWrite(&job->rwlock);
 
+  if (JobJournal)
+    journal_job(job, IPP_OP_PURGE_JOBS);
+
   ippDelete(job->attrs);
   ippDelete(job->doc_attrs);
 
   if (job->filename)
   {
     if (!KeepFiles)
-      unlink(job->filename);
+      serverReapFile(job->filename);
 
     free(job->filename);
   }
 
+  if (job->spool_bytes)
+    serverAddSpoolBytes(job, -job->spool_bytes);
+
   _cupsRWDeinit(&job->rwlock);
 
   free(job);
@@ -621,6 +852,108 @@ serverHoldJob(
 }
 
 
+/*
+ * 'serverJournalJobNoLock()' - Record a change to a job in the job journal.
+ *
+ * If "full" is non-zero, the job and document attributes are recorded along
+ * with the job state.
+ *
+ * Note: The job must be locked or otherwise owned by the caller.
+ */
+
+void
+serverJournalJobNoLock(
+    server_job_t *job,			/* I - Job */
+    int          full)			/* I - Record job attributes too? */
+{
+  if (JobJournal)
+    journal_job(job, full ? IPP_OP_CREATE_JOB : IPP_OP_SET_JOB_ATTRIBUTES);
+}
+
+
+/*
+ * 'serverLoadJobs()' - Restore jobs from the job snapshot and journal.
+ *
+ * Jobs that were processing are queued again, and jobs whose print file is
+ * missing are aborted.  Jobs for printers that no longer exist are dropped.
+ * The journal is then compacted and kept open for new records.
+ *
+ * This must be called before serverLoadSubscriptions, which re-links job
+ * subscriptions to the restored jobs.
+ */
+
+void
+serverLoadJobs(void)
+{
+  char			filename[1024];	/* Journal filename */
+  cups_array_t		*records;	/* Folded journal records */
+  ipp_t			*record,	/* Current record */
+			*purge;		/* Purge record */
+  server_job_t		*job;		/* Restored job */
+  int			num_jobs = 0;	/* Number of restored jobs */
+  server_printer_t	*printer;	/* Current printer */
+
+
+  if (!StateDirectory)
+    return;
+
+  records = cupsArrayNew((cups_array_func_t)compare_records, NULL);
+
+  snprintf(filename, sizeof(filename), "%s/jobs.snapshot", StateDirectory);
+  read_journal(records, filename, -1);
+
+  snprintf(filename, sizeof(filename), "%s/jobs.journal", StateDirectory);
+  read_journal(records, filename, -1);
+
+  if ((JobJournal = cupsFileOpen(filename, "a")) == NULL)
+    serverLog(SERVER_LOGLEVEL_ERROR, "Unable to open job journal \"%s\": %s", filename, strerror(errno));
+
+  for (record = (ipp_t *)cupsArrayFirst(records); record; record = (ipp_t *)cupsArrayNext(records))
+  {
+    if ((job = restore_job(record)) != NULL)
+    {
+     /*
+      * Record any state that changed while restoring the job...
+      */
+
+      num_jobs ++;
+      serverJournalJobNoLock(job, 0);
+    }
+    else
+    {
+      purge = ippNew();
+
+      ippSetOperation(purge, IPP_OP_PURGE_JOBS);
+      ippSetRequestId(purge, 1);
+      ippCopyAttribute(purge, ippFindAttribute(record, "printer-uri", IPP_TAG_URI), 0);
+      ippCopyAttribute(purge, ippFindAttribute(record, "job-id", IPP_TAG_INTEGER), 0);
+
+      journal_record(purge);
+      ippDelete(purge);
+    }
+
+    ippDelete(record);
+  }
+
+  cupsArrayDelete(records);
+
+  if (JobJournal)
+    compact_journal();
+
+  if (num_jobs > 0)
+  {
+    serverLog(SERVER_LOGLEVEL_INFO, "Restored %d jobs.", num_jobs);
+
+    _cupsRWLockRead(&PrintersRWLock);
+
+    for (printer = (server_printer_t *)cupsArrayFirst(Printers); printer; printer = (server_printer_t *)cupsArrayNext(Printers))
+      serverCheckJobs(printer);
+
+    _cupsRWUnlock(&PrintersRWLock);
+  }
+}
+
+
 /*
  * 'serverProcessJob()' - Process a print job.
  */
@@ -659,6 +992,9 @@ serverProcessJob(server_job_t *job)	/* I - Job */
     */
 
     serverTransformJob(NULL, job, job->printer->pinfo.command, job->printer->pinfo.output_format, SERVER_TRANSFORM_COMMAND);
+
+    if (job->filename)
+      uncache_file(job->filename);
   }
   else if (job->printer->pinfo.proxy_group != SERVER_GROUP_NONE)
   {
@@ -674,6 +1010,8 @@ serverProcessJob(server_job_t *job)	/* I - Job */
     serverAddEventNoLock(job->printer, job, NULL, SERVER_EVENT_JOB_STATE_CHANGED | SERVER_EVENT_JOB_FETCHABLE, "Job fetchable.");
 
     _cupsRWUnlock(&job->rwlock);
+
+    serverPrerenderJob(job);
   }
   else
   {
@@ -688,6 +1026,8 @@ serverProcessJob(server_job_t *job)	/* I - Job */
 
   if (job->cancel)
     job->state = IPP_JSTATE_CANCELED;
+  else if (job->stream_aborted)
+    job->state = IPP_JSTATE_ABORTED;
   else if (job->state == IPP_JSTATE_PROCESSING)
     job->state = IPP_JSTATE_COMPLETED;
 
@@ -738,9 +1078,12 @@ serverProcessJob(server_job_t *job)	/* I - Job */
       {
 	server_job_t *tjob = (server_job_t *)cupsArrayFirst(job->printer->completed_jobs);
 
-	if (tjob == job)
+	while (tjob && (tjob == job || tjob->prerendering || tjob->streaming))
 	  tjob = (server_job_t *)cupsArrayNext(job->printer->completed_jobs);
 
+	if (!tjob)
+	  break;
+
 	cupsArrayRemove(job->printer->completed_jobs, tjob);
 	cupsArrayRemove(job->printer->jobs, tjob); /* Removing here calls serverDeleteJob */
       }
@@ -759,6 +1102,57 @@ serverProcessJob(server_job_t *job)	/* I - Job */
 }
 
 
+/*
+ * 'serverReapFile()' - Queue a spool file for removal.
+ *
+ * Files are removed by a background thread so that callers holding printer
+ * or job locks don't wait for the filesystem.
+ */
+
+void
+serverReapFile(const char *filename)	/* I - File to remove */
+{
+  char		*copy;			/* Copy of filename */
+  _cups_thread_t t;			/* Reaper thread */
+
+
+  _cupsMutexLock(&reap_mutex);
+
+  if (!reap_list)
+    reap_list = cupsArrayNew(NULL, NULL);
+
+  if (!reap_running)
+  {
+    if ((t = _cupsThreadCreate((_cups_thread_func_t)reap_files, NULL)) != 0)
+    {
+      _cupsThreadDetach(t);
+      reap_running = 1;
+    }
+  }
+
+  if (reap_running && (copy = strdup(filename)) != NULL)
+  {
+    if (cupsArrayAdd(reap_list, copy))
+    {
+      _cupsCondBroadcast(&reap_cond);
+      _cupsMutexUnlock(&reap_mutex);
+      return;
+    }
+
+    free(copy);
+  }
+
+  _cupsMutexUnlock(&reap_mutex);
+
+ /*
+  * Unable to queue the file, remove it now...
+  */
+
+  if (unlink(filename) && errno != ENOENT)
+    serverLog(SERVER_LOGLEVEL_ERROR, "Unable to remove spool file \"%s\": %s", filename, strerror(errno));
+}
+
+
 /*
  * 'serverReleaseJob()' - Release a held print job.
  */
@@ -789,3 +1183,619 @@ serverReleaseJob(server_job_t *job)	/* I - Job to release */
 
   return (1);
 }
+
+
+/*
+ * 'compact_journal()' - Fold the job journal into the job snapshot.
+ *
+ * The records that are in the journal now are folded into a new snapshot
+ * without holding the journal lock, then the journal is replaced by any
+ * records that were appended in the meantime.  Replaying a record that is
+ * already in the snapshot is harmless, so a crash at any point leaves a
+ * usable snapshot and journal.
+ */
+
+static void
+compact_journal(void)
+{
+  char		filename[1024],		/* Journal filename */
+		snapshot[1024],		/* Snapshot filename */
+		tempfile[1024],		/* Temporary filename */
+		buffer[8192];		/* Copy buffer */
+  cups_array_t	*records;		/* Folded journal records */
+  ipp_t		*record;		/* Current record */
+  cups_file_t	*fp,			/* New snapshot/journal file */
+		*journal;		/* Old journal file */
+  struct stat	fileinfo;		/* Journal file information */
+  off_t		length;			/* Length of journal to fold */
+  ssize_t	bytes;			/* Bytes read */
+  int		ok = 1;			/* Snapshot/journal written? */
+
+
+  snprintf(filename, sizeof(filename), "%s/jobs.journal", StateDirectory);
+  snprintf(snapshot, sizeof(snapshot), "%s/jobs.snapshot", StateDirectory);
+
+ /*
+  * Find the end of the records that have been written so far...
+  */
+
+  _cupsMutexLock(&JobJournalMutex);
+
+  if (!JobJournal || cupsFileFlush(JobJournal) || fstat(cupsFileNumber(JobJournal), &fileinfo))
+  {
+    _cupsMutexUnlock(&JobJournalMutex);
+    return;
+  }
+
+  length = fileinfo.st_size;
+
+  _cupsMutexUnlock(&JobJournalMutex);
+
+ /*
+  * Write a new snapshot with one record per job...
+  */
+
+  records = cupsArrayNew((cups_array_func_t)compare_records, NULL);
+
+  read_journal(records, snapshot, -1);
+  read_journal(records, filename, length);
+
+  snprintf(tempfile, sizeof(tempfile), "%s/jobs.snapshot.N", StateDirectory);
+
+  if ((fp = cupsFileOpen(tempfile, "w")) != NULL)
+  {
+    for (record = (ipp_t *)cupsArrayFirst(records); record && ok; record = (ipp_t *)cupsArrayNext(records))
+    {
+      ippSetState(record, IPP_STATE_IDLE);
+      ok = ippWriteIO(fp, (ipp_iocb_t)cupsFileWrite, 1, NULL, record) == IPP_STATE_DATA;
+    }
+
+    if (ok && (cupsFileFlush(fp) || fsync(cupsFileNumber(fp))))
+      ok = 0;
+
+    if (cupsFileClose(fp))
+      ok = 0;
+  }
+  else
+    ok = 0;
+
+  for (record = (ipp_t *)cupsArrayFirst(records); record; record = (ipp_t *)cupsArrayNext(records))
+    ippDelete(record);
+
+  cupsArrayDelete(records);
+
+  if (!ok || rename(tempfile, snapshot))
+  {
+    serverLog(SERVER_LOGLEVEL_ERROR, "Unable to write job snapshot \"%s\": %s", snapshot, strerror(errno));
+    unlink(tempfile);
+    return;
+  }
+
+ /*
+  * Then start a new journal with the records that were added while the
+  * snapshot was written...
+  */
+
+  snprintf(tempfile, sizeof(tempfile), "%s/jobs.journal.N", StateDirectory);
+
+  _cupsMutexLock(&JobJournalMutex);
+
+  if (cupsFileFlush(JobJournal) || (journal = cupsFileOpen(filename, "r")) == NULL)
+  {
+    serverLog(SERVER_LOGLEVEL_ERROR, "Unable to read job journal \"%s\": %s", filename, strerror(errno));
+    _cupsMutexUnlock(&JobJournalMutex);
+    return;
+  }
+
+  if ((fp = cupsFileOpen(tempfile, "w")) != NULL)
+  {
+    if (cupsFileSeek(journal, length) != length)
+      ok = 0;
+
+    while (ok && (bytes = cupsFileRead(journal, buffer, sizeof(buffer))) > 0)
+      ok = cupsFileWrite(fp, buffer, (size_t)bytes) == 0;
+
+    if (ok && (cupsFileFlush(fp) || fsync(cupsFileNumber(fp))))
+      ok = 0;
+
+    if (cupsFileClose(fp))
+      ok = 0;
+  }
+  else
+    ok = 0;
+
+  cupsFileClose(journal);
+
+  if (!ok || rename(tempfile, filename))
+  {
+    serverLog(SERVER_LOGLEVEL_ERROR, "Unable to write job journal \"%s\": %s", filename, strerror(errno));
+    unlink(tempfile);
+  }
+  else
+  {
+    serverLog(SERVER_LOGLEVEL_DEBUG, "Compacted job journal, %d records since last compaction.", JobJournalCount);
+
+    cupsFileClose(JobJournal);
+
+    if ((JobJournal = cupsFileOpen(filename, "a")) == NULL)
+      serverLog(SERVER_LOGLEVEL_ERROR, "Unable to open job journal \"%s\": %s", filename, strerror(errno));
+
+    JobJournalCount = 0;
+    JobJournalDirty = 0;
+  }
+
+  _cupsMutexUnlock(&JobJournalMutex);
+}
+
+
+/*
+ * 'compare_records()' - Compare two job journal records.
+ */
+
+static int				/* O - Result of comparison */
+compare_records(ipp_t *a,		/* I - First record */
+                ipp_t *b)		/* I - Second record */
+{
+  int	result;				/* Result of comparison */
+
+
+  if ((result = strcmp(ippGetString(ippFindAttribute(a, "printer-uri", IPP_TAG_URI), 0, NULL), ippGetString(ippFindAttribute(b, "printer-uri", IPP_TAG_URI), 0, NULL))) != 0)
+    return (result);
+
+  return (ippGetInteger(ippFindAttribute(a, "job-id", IPP_TAG_INTEGER), 0) - ippGetInteger(ippFindAttribute(b, "job-id", IPP_TAG_INTEGER), 0));
+}
+
+
+/*
+ * 'journal_job()' - Write a job record to the job journal.
+ *
+ * Create-Job records hold the job and document attributes along with the job
+ * state, Set-Job-Attributes records only hold the job state, and Purge-Jobs
+ * records remove the job.
+ *
+ * Note: The job must be locked or otherwise owned by the caller.
+ */
+
+static void
+journal_job(server_job_t *job,		/* I - Job */
+            ipp_op_t     op)		/* I - Record type */
+{
+  ipp_t			*record;	/* Journal record */
+  ipp_attribute_t	*attr;		/* Current attribute */
+  int			i,		/* Looping var */
+			num_reasons = 0;/* Number of reasons */
+  server_jreason_t	reason;		/* Current reason */
+  const char		*reasons[32];	/* Reason strings */
+
+
+  record = ippNew();
+
+  ippSetOperation(record, op);
+  ippSetRequestId(record, 1);
+
+  ippAddString(record, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, job->printer->default_uri);
+  ippAddInteger(record, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "job-id", job->id);
+
+  if (op != IPP_OP_PURGE_JOBS)
+  {
+    ippAddInteger(record, IPP_TAG_OPERATION, IPP_TAG_ENUM, "job-state", (int)job->state);
+
+    for (i = 0, reason = 1; i < (int)(sizeof(server_jreasons) / sizeof(server_jreasons[0])); i ++, reason <<= 1)
+    {
+      if (job->state_reasons & reason)
+        reasons[num_reasons ++] = server_jreasons[i];
+    }
+
+    if (num_reasons > 0)
+      ippAddStrings(record, IPP_TAG_OPERATION, IPP_CONST_TAG(IPP_TAG_KEYWORD), "job-state-reasons", num_reasons, NULL, reasons);
+
+    ippAddInteger(record, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "job-priority", job->priority);
+    ippAddInteger(record, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "job-impressions", job->impressions);
+    ippAddInteger(record, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "job-impressions-completed", job->impcompleted);
+
+    if (job->hold_until)
+      ippAddDate(record, IPP_TAG_OPERATION, "job-hold-until-time", ippTimeToDate(job->hold_until));
+    if (job->created)
+      ippAddDate(record, IPP_TAG_OPERATION, "date-time-at-creation", ippTimeToDate(job->created));
+    if (job->processing)
+      ippAddDate(record, IPP_TAG_OPERATION, "date-time-at-processing", ippTimeToDate(job->processing));
+    if (job->completed)
+      ippAddDate(record, IPP_TAG_OPERATION, "date-time-at-completed", ippTimeToDate(job->completed));
+
+    if (job->filename)
+      ippAddString(record, IPP_TAG_OPERATION, IPP_TAG_TEXT, "job-spool-file", NULL, job->filename);
+    if (job->dev_uuid)
+      ippAddString(record, IPP_TAG_OPERATION, IPP_TAG_URI, "output-device-uuid-assigned", NULL, job->dev_uuid);
+  }
+
+  if (op == IPP_OP_CREATE_JOB)
+  {
+    ippCopyAttributes(record, job->attrs, 0, NULL, NULL);
+
+    for (attr = ippFirstAttribute(job->doc_attrs); attr; attr = ippNextAttribute(job->doc_attrs))
+    {
+      ipp_attribute_t *docattr = ippCopyAttribute(record, attr, 0);
+					/* Copy of document attribute */
+
+      if (docattr)
+        ippSetGroupTag(record, &docattr, IPP_TAG_DOCUMENT);
+    }
+  }
+
+  journal_record(record);
+
+  ippDelete(record);
+}
+
+
+/*
+ * 'journal_record()' - Append a record to the job journal.
+ *
+ * Records are flushed as they are written, but the journal is only synced to
+ * disk once a second - records written in between are synced by the next
+ * record or by serverCompactJobs.
+ */
+
+static void
+journal_record(ipp_t *record)		/* I - Journal record */
+{
+  time_t	curtime = time(NULL);	/* Current time */
+
+
+  _cupsMutexLock(&JobJournalMutex);
+
+  if (JobJournal)
+  {
+    if (ippWriteIO(JobJournal, (ipp_iocb_t)cupsFileWrite, 1, NULL, record) == IPP_STATE_DATA && cupsFileFlush(JobJournal) == 0)
+    {
+      JobJournalCount ++;
+
+      if (curtime != JobJournalSyncTime)
+      {
+        fsync(cupsFileNumber(JobJournal));
+
+        JobJournalDirty    = 0;
+        JobJournalSyncTime = curtime;
+      }
+      else
+        JobJournalDirty = 1;
+    }
+    else
+      serverLog(SERVER_LOGLEVEL_ERROR, "Unable to write job journal: %s", strerror(errno));
+  }
+
+  _cupsMutexUnlock(&JobJournalMutex);
+}
+
+
+/*
+ * 'read_journal()' - Fold the records in a job journal or snapshot.
+ *
+ * Each job keeps its last Create-Job record, with the job state from any
+ * later Set-Job-Attributes record.  Purge-Jobs records remove the job.
+ */
+
+static void
+read_journal(
+    cups_array_t *records,		/* I - Folded journal records */
+    const char   *filename,		/* I - Journal or snapshot filename */
+    off_t        length)		/* I - Number of bytes to read or -1 for all */
+{
+  cups_file_t		*fp;		/* Journal file */
+  ipp_t			*record,	/* Current record */
+			*existing;	/* Existing record for job */
+  ipp_attribute_t	*attr;		/* Current attribute */
+  ipp_state_t		state;		/* Read state */
+  off_t			start;		/* Start of record */
+
+
+  if ((fp = cupsFileOpen(filename, "r")) == NULL)
+    return;
+
+  serverLog(SERVER_LOGLEVEL_DEBUG, "Reading job journal \"%s\".", filename);
+
+  while (length < 0 || cupsFileTell(fp) < length)
+  {
+    record = ippNew();
+    start  = cupsFileTell(fp);
+
+    while ((state = ippReadIO(fp, (ipp_iocb_t)cupsFileRead, 1, NULL, record)) != IPP_STATE_DATA)
+    {
+      if (state == IPP_STATE_ERROR)
+        break;
+    }
+
+    if (state == IPP_STATE_ERROR)
+    {
+     /*
+      * A partial record at the end is left over from a crash while it was
+      * being written...
+      */
+
+      if (cupsFileTell(fp) > start)
+        serverLog(SERVER_LOGLEVEL_ERROR, "Ignoring incomplete job journal record in \"%s\".", filename);
+
+      ippDelete(record);
+      break;
+    }
+
+    if (!ippFindAttribute(record, "printer-uri", IPP_TAG_URI) || !ippFindAttribute(record, "job-id", IPP_TAG_INTEGER))
+    {
+      ippDelete(record);
+      continue;
+    }
+
+    if ((existing = (ipp_t *)cupsArrayFind(records, record)) != NULL)
+    {
+      if (ippGetOperation(record) == IPP_OP_SET_JOB_ATTRIBUTES && ippGetOperation(existing) == IPP_OP_CREATE_JOB)
+      {
+       /*
+        * Keep the job and document attributes with the new job state...
+        */
+
+        for (attr = ippFirstAttribute(existing); attr; attr = ippNextAttribute(existing))
+        {
+          if (ippGetGroupTag(attr) != IPP_TAG_OPERATION)
+            ippCopyAttribute(record, attr, 0);
+        }
+
+        ippSetOperation(record, IPP_OP_CREATE_JOB);
+      }
+
+      cupsArrayRemove(records, existing);
+      ippDelete(existing);
+    }
+
+    if (ippGetOperation(record) == IPP_OP_PURGE_JOBS)
+      ippDelete(record);
+    else
+      cupsArrayAdd(records, record);
+  }
+
+  cupsFileClose(fp);
+}
+
+
+/*
+ * 'reap_files()' - Remove queued spool files.
+ */
+
+static void *				/* O - Thread exit status */
+reap_files(void *data)			/* I - Thread data (unused) */
+{
+  char	*filename;			/* File to remove */
+
+
+  (void)data;
+
+  _cupsMutexLock(&reap_mutex);
+
+  for (;;)
+  {
+    while ((filename = (char *)cupsArrayFirst(reap_list)) != NULL)
+    {
+      cupsArrayRemove(reap_list, filename);
+
+      _cupsMutexUnlock(&reap_mutex);
+
+      if (unlink(filename) && errno != ENOENT)
+        serverLog(SERVER_LOGLEVEL_ERROR, "Unable to remove spool file \"%s\": %s", filename, strerror(errno));
+
+      free(filename);
+
+      _cupsMutexLock(&reap_mutex);
+    }
+
+    _cupsCondWait(&reap_cond, &reap_mutex, 0.0);
+  }
+
+  return (NULL);
+}
+
+
+/*
+ * 'restore_job()' - Restore a job from a folded journal record.
+ */
+
+static server_job_t *			/* O - Job or `NULL` if not restored */
+restore_job(ipp_t *record)		/* I - Journal record */
+{
+  server_job_t		*job;		/* Job */
+  server_printer_t	*printer;	/* Printer */
+  ipp_attribute_t	*attr;		/* Current attribute */
+  const char		*uri;		/* printer-uri value */
+  char			scheme[32],	/* URI scheme */
+			userpass[256],	/* URI username:password */
+			host[256],	/* URI host */
+			resource[256];	/* URI resource path */
+  int			id,		/* job-id value */
+			port;		/* URI port */
+
+
+  id  = ippGetInteger(ippFindAttribute(record, "job-id", IPP_TAG_INTEGER), 0);
+  uri = ippGetString(ippFindAttribute(record, "printer-uri", IPP_TAG_URI), 0, NULL);
+
+  if (ippGetOperation(record) != IPP_OP_CREATE_JOB)
+  {
+    serverLog(SERVER_LOGLEVEL_INFO, "Dropping job #%d for \"%s\" without saved attributes.", id, uri);
+    return (NULL);
+  }
+
+  if (httpSeparateURI(HTTP_URI_CODING_ALL, uri, scheme, sizeof(scheme), userpass, sizeof(userpass), host, sizeof(host), &port, resource, sizeof(resource)) < HTTP_URI_STATUS_OK || !cupsArrayCount(Printers) || (printer = serverFindPrinter(resource)) == NULL)
+  {
+    serverLog(SERVER_LOGLEVEL_INFO, "Dropping job #%d for missing printer \"%s\".", id, uri);
+    return (NULL);
+  }
+
+  if ((job = calloc(1, sizeof(server_job_t))) == NULL)
+  {
+    perror("Unable to allocate memory for job");
+    return (NULL);
+  }
+
+  job->id       = id;
+  job->printer  = printer;
+  job->attrs    = ippNew();
+  job->fd       = -1;
+  job->state    = (ipp_jstate_t)ippGetInteger(ippFindAttribute(record, "job-state", IPP_TAG_ENUM), 0);
+  job->priority = ippGetInteger(ippFindAttribute(record, "job-priority", IPP_TAG_INTEGER), 0);
+
+  job->state_reasons = serverGetJobStateReasonsBits(ippFindAttribute(record, "job-state-reasons", IPP_TAG_KEYWORD));
+  job->impressions   = ippGetInteger(ippFindAttribute(record, "job-impressions", IPP_TAG_INTEGER), 0);
+  job->impcompleted  = ippGetInteger(ippFindAttribute(record, "job-impressions-completed", IPP_TAG_INTEGER), 0);
+
+  if ((attr = ippFindAttribute(record, "job-hold-until-time", IPP_TAG_DATE)) != NULL)
+    job->hold_until = ippDateToTime(ippGetDate(attr, 0));
+  if ((attr = ippFindAttribute(record, "date-time-at-creation", IPP_TAG_DATE)) != NULL)
+    job->created = ippDateToTime(ippGetDate(attr, 0));
+  if ((attr = ippFindAttribute(record, "date-time-at-processing", IPP_TAG_DATE)) != NULL)
+    job->processing = ippDateToTime(ippGetDate(attr, 0));
+  if ((attr = ippFindAttribute(record, "date-time-at-completed", IPP_TAG_DATE)) != NULL)
+    job->completed = ippDateToTime(ippGetDate(attr, 0));
+
+  if ((attr = ippFindAttribute(record, "job-spool-file", IPP_TAG_TEXT)) != NULL)
+  {
+    struct stat	fileinfo;		/* Spool file information */
+
+    job->filename = strdup(ippGetString(attr, 0, NULL));
+
+    if (!stat(job->filename, &fileinfo))
+      serverAddSpoolBytes(job, fileinfo.st_size);
+  }
+  if ((attr = ippFindAttribute(record, "output-device-uuid-assigned", IPP_TAG_URI)) != NULL)
+    job->dev_uuid = strdup(ippGetString(attr, 0, NULL));
+
+  for (attr = ippFirstAttribute(record); attr; attr = ippNextAttribute(record))
+  {
+    if (ippGetGroupTag(attr) == IPP_TAG_JOB)
+    {
+      ippCopyAttribute(job->attrs, attr, 0);
+    }
+    else if (ippGetGroupTag(attr) == IPP_TAG_DOCUMENT)
+    {
+      if (!job->doc_attrs)
+        job->doc_attrs = ippNew();
+
+      ippCopyAttribute(job->doc_attrs, attr, 0);
+    }
+  }
+
+  if ((attr = ippFindAttribute(job->attrs, "job-name", IPP_TAG_NAME)) != NULL)
+    job->name = ippGetString(attr, 0, NULL);
+
+  if ((attr = ippFindAttribute(job->attrs, "job-originating-user-name", IPP_TAG_NAME)) != NULL)
+    job->username = ippGetString(attr, 0, NULL);
+  else
+    job->username = "anonymous";
+
+  if ((attr = ippFindAttribute(job->attrs, "document-format-detected", IPP_TAG_MIMETYPE)) != NULL)
+    job->format = ippGetString(attr, 0, NULL);
+  else if ((attr = ippFindAttribute(job->attrs, "document-format-supplied", IPP_TAG_MIMETYPE)) != NULL)
+    job->format = ippGetString(attr, 0, NULL);
+  else
+    job->format = "application/octet-stream";
+
+ /*
+  * Jobs that were being processed are queued again, and jobs that can no
+  * longer be printed are aborted...
+  */
+
+  if (job->state == IPP_JSTATE_PROCESSING)
+  {
+    job->state         = IPP_JSTATE_PENDING;
+    job->state_reasons &= (server_jreason_t)~(SERVER_JREASON_JOB_PRINTING | SERVER_JREASON_JOB_TRANSFORMING);
+  }
+
+  if (job->state < IPP_JSTATE_CANCELED && (!job->filename || access(job->filename, R_OK)))
+  {
+    serverLog(SERVER_LOGLEVEL_INFO, "Aborting job #%d for \"%s\" because its print file is missing.", id, uri);
+
+    job->state         = IPP_JSTATE_ABORTED;
+    job->state_reasons |= SERVER_JREASON_ABORTED_BY_SYSTEM;
+    job->completed     = time(NULL);
+  }
+
+  _cupsRWInit(&job->rwlock);
+
+  _cupsRWLockWrite(&printer->rwlock);
+
+  cupsArrayAdd(printer->jobs, job);
+
+  if (job->state >= IPP_JSTATE_CANCELED)
+    cupsArrayAdd(printer->completed_jobs, job);
+  else
+    cupsArrayAdd(printer->active_jobs, job);
+
+  if (job->id >= printer->next_job_id)
+    printer->next_job_id = job->id + 1;
+
+  _cupsRWUnlock(&printer->rwlock);
+
+  serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Restored job, state %s.", ippEnumString("job-state", (int)job->state));
+
+  return (job);
+}
+
+
+/*
+ * 'spool_state()' - Compute the spool full state from the watermarks.
+ *
+ * The low watermark defaults to 90% of the high watermark.
+ */
+
+static int				/* O - 1 if full, 0 otherwise */
+spool_state(off_t used,			/* I - Bytes in use */
+            int   high,			/* I - High watermark in megabytes, 0 for none */
+            int   low,			/* I - Low watermark in megabytes, 0 for default */
+            int   full)			/* I - Current full state */
+{
+  off_t	hbytes,				/* High watermark in bytes */
+	lbytes;				/* Low watermark in bytes */
+
+
+  if (high <= 0)
+    return (0);
+
+  hbytes = (off_t)high * 1048576;
+
+  if (low > 0 && low < high)
+    lbytes = (off_t)low * 1048576;
+  else
+    lbytes = hbytes / 10 * 9;
+
+  if (used >= hbytes)
+    return (1);
+  else if (used <= lbytes)
+    return (0);
+  else
+    return (full);
+}
+
+
+/*
+ * 'uncache_file()' - Drop a large printed document from the page cache.
+ *
+ * Spool files are only read once by the print command, so there is no point
+ * keeping them cached until the job is cleaned.
+ */
+
+static void
+uncache_file(const char *filename)	/* I - Spool file */
+{
+#ifdef HAVE_POSIX_FADVISE
+  int		fd;			/* Spool file descriptor */
+  struct stat	fileinfo;		/* Spool file information */
+
+
+  if ((fd = open(filename, O_RDONLY | O_BINARY)) < 0)
+    return;
+
+  if (!fstat(fd, &fileinfo) && fileinfo.st_size >= SERVER_SPOOL_UNCACHE_SIZE)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+  close(fd);
+
+#else
+  (void)filename;
+#endif /* HAVE_POSIX_FADVISE */
+}
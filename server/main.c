@@ -310,6 +310,9 @@ main(int  argc,				/* I - Number of command-line args */
     printer->is_accepting = 1;
 
     serverAddPrinter(printer);
+
+    serverLoadJobs();
+    serverLoadSubscriptions();
   }
 
   if (StateDirectory)
@@ -1734,6 +1734,41 @@ serverDeletePrinter(
 {
   int			i;		/* Looping var */
   server_device_t	*device;	/* Current device */
+  server_job_t		*job;		/* Current job */
+  cups_array_t		*prerendering;	/* Jobs being prerendered */
+
+
+ /*
+  * Stop any transforms ahead of Fetch-Document and wait for them to finish
+  * before the jobs are freed...
+  */
+
+  prerendering = cupsArrayNew(NULL, NULL);
+
+  _cupsRWLockRead(&printer->rwlock);
+
+  for (job = (server_job_t *)cupsArrayFirst(printer->jobs); job; job = (server_job_t *)cupsArrayNext(printer->jobs))
+  {
+    _cupsRWLockWrite(&job->rwlock);
+
+    if (job->prerendering)
+    {
+      job->cancel = 1;
+      cupsArrayAdd(prerendering, job);
+    }
+
+    _cupsRWUnlock(&job->rwlock);
+  }
+
+  _cupsRWUnlock(&printer->rwlock);
+
+  for (job = (server_job_t *)cupsArrayFirst(prerendering); job; job = (server_job_t *)cupsArrayNext(prerendering))
+  {
+    serverStopPrerender(job, NULL);
+    serverWaitPrerender(job);
+  }
+
+  cupsArrayDelete(prerendering);
 
   _cupsRWLockWrite(&printer->rwlock);
 
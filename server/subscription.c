@@ -15,7 +15,21 @@
  * Local functions...
  */
 
+static void	add_event(server_subscription_t *sub, server_notification_t *n);
+static void	compact_journal(void);
+static int	compare_subindex(server_subindex_t *a, server_subindex_t *b);
 static int	compare_subscriptions(server_subscription_t *a, server_subscription_t *b);
+static server_notification_t *create_notification(server_printer_t *printer, server_job_t *job, server_resource_t *res, server_event_t event, const char *text);
+static int	filter_notification(server_subscription_t *sub, ipp_t *dst, ipp_attribute_t *attr);
+static void	journal_subscription(server_subscription_t *sub, int canceled);
+static void	load_subscription(ipp_t *record);
+static void	notify_waiters(server_subscription_t *sub);
+static void	release_notification(server_notification_t *n);
+static void	retain_notification(server_notification_t *n);
+static void	schedule_progress(time_t due);
+static server_notification_t *store_event(server_subscription_t *sub, server_notification_t *n);
+static void	wake_main_loop(void);
+static int	write_subscription(cups_file_t *fp, server_subscription_t *sub, int canceled);
 
 
 /*
@@ -33,9 +47,15 @@ serverAddEventNoLock(
     const char        *message,		/* I - Printf-style notify-text message */
     ...)				/* I - Additional printf arguments */
 {
+  int			i,		/* Looping var */
+			num_targets = 0;/* Number of targets */
+  void			*targets[4];	/* Objects with interested subscriptions */
+  server_subindex_t	key,		/* Search key */
+			*index;		/* Subscriptions for object */
+  int			bit;		/* Current event bit */
+  server_event_t	mask;		/* Mask for current event bit */
   server_subscription_t *sub;		/* Current subscription */
-  ipp_t			*n;		/* Notify event attributes */
-  ipp_attribute_t	*attr;		/* Event attribute */
+  server_notification_t	*n = NULL;	/* Event notification */
   char			text[1024];	/* notify-text value */
   va_list		ap;		/* Argument pointer */
 
@@ -51,76 +71,225 @@ serverAddEventNoLock(
 
   serverLog(SERVER_LOGLEVEL_DEBUG, "serverAddEventNoLock(printer=%p(%s), job=%p(%d), event=0x%x, message=\"%s\")", (void *)printer, printer ? printer->name : "(null)", (void *)job, job ? job->id : -1, event, text);
 
+ /*
+  * Job state changes are recorded in the job journal - progress events are
+  * not since the final impression count is recorded when the job completes...
+  */
+
+  if (job && (event & SERVER_EVENT_JOB_ALL & (server_event_t)~SERVER_EVENT_JOB_PROGRESS))
+    serverJournalJobNoLock(job, (event & SERVER_EVENT_JOB_CONFIG_CHANGED) != 0);
+
+ /*
+  * Subscriptions are indexed by the object they monitor (see
+  * serverIndexSubscriptionNoLock), so only look at the job, resource,
+  * printer, and system subscriptions that can match...
+  */
+
+  if (job)
+    targets[num_targets ++] = job;
+  if (res)
+    targets[num_targets ++] = res;
+  if (printer)
+    targets[num_targets ++] = printer;
+  targets[num_targets ++] = NULL;
+
   _cupsRWLockRead(&SubscriptionsRWLock);
 
-  for (sub = (server_subscription_t *)cupsArrayFirst(Subscriptions); sub; sub = (server_subscription_t *)cupsArrayNext(Subscriptions))
+  for (i = 0; i < num_targets; i ++)
   {
-    serverLog(SERVER_LOGLEVEL_DEBUG, "serverAddEvent: sub->id=%d, sub->mask=0x%x, sub->job=%p(%d)", sub->id, sub->mask, (void *)sub->job, sub->job ? sub->job->id : -1);
+    key.target = targets[i];
 
-    if (sub->mask & event && (!sub->job || job == sub->job) && (!sub->printer || printer == sub->printer) && (!sub->resource || res == sub->resource))
+    if ((index = (server_subindex_t *)cupsArrayFind(SubscriptionIndex, &key)) == NULL)
+      continue;
+
+    for (bit = 0, mask = 1; bit < SERVER_EVENT_NUM_BITS; bit ++, mask <<= 1)
     {
-      _cupsRWLockWrite(&sub->rwlock);
+      if (!(event & mask))
+        continue;
 
-      n = ippNew();
-      ippAddString(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_CHARSET, "notify-charset", NULL, sub->charset);
-      ippAddString(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_LANGUAGE, "notify-natural-language", NULL, sub->language);
-      if (printer)
-	ippAddString(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_URI, "notify-printer-uri", NULL, printer->default_uri);
-      else
-	ippAddString(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_URI, "notify-system-uri", NULL, DefaultSystemURI);
-
-      if (job)
-	ippAddInteger(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_INTEGER, "notify-job-id", job->id);
-      if (res)
-	ippAddInteger(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_INTEGER, "notify-resource-id", res->id);
-      ippAddInteger(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_INTEGER, "notify-subscription-id", sub->id);
-      ippAddString(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_URI, "notify-subscription-uuid", NULL, sub->uuid);
-      ippAddInteger(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_INTEGER, "notify-sequence-number", ++ sub->last_sequence);
-      ippAddString(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_KEYWORD, "notify-subscribed-event", NULL, serverGetNotifySubscribedEvent(event));
-      ippAddString(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_TEXT, "notify-text", NULL, text);
-      if (sub->userdata)
+      for (sub = (server_subscription_t *)cupsArrayFirst(index->subs[bit]); sub; sub = (server_subscription_t *)cupsArrayNext(index->subs[bit]))
       {
-        attr = ippCopyAttribute(n, sub->userdata, 0);
-        ippSetGroupTag(n, &attr, IPP_TAG_EVENT_NOTIFICATION);
-      }
-      if (job && (event & SERVER_EVENT_JOB_ALL))
-      {
-	ippAddInteger(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_ENUM, "job-state", (int)job->state);
-	serverCopyJobStateReasons(n, IPP_TAG_EVENT_NOTIFICATION, job);
-	if (event == SERVER_EVENT_JOB_CREATED)
+       /*
+        * Skip subscriptions that already got this event for a lower bit...
+        */
+
+        if (sub->mask & event & (mask - 1))
+          continue;
+
+	if ((!sub->job || job == sub->job) && (!sub->printer || printer == sub->printer) && (!sub->resource || res == sub->resource))
 	{
-	  ippAddString(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_NAME, "job-name", NULL, job->name);
-	  ippAddString(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_NAME, "job-originating-user-name", NULL, job->username);
+	 /*
+	  * Build the event attributes once and share them with every
+	  * subscription...
+	  */
+
+	  if (!n && (n = create_notification(printer, job, res, event, text)) == NULL)
+	    break;
+
+	  add_event(sub, n);
 	}
       }
-      if (!sub->job && printer && (event & SERVER_EVENT_PRINTER_ALL))
-      {
-	ippAddBoolean(n, IPP_TAG_EVENT_NOTIFICATION, "printer-is-accepting-jobs", printer->is_accepting);
-	ippAddInteger(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_ENUM, "printer-state", (int)printer->state);
-	serverCopyPrinterStateReasons(n, IPP_TAG_EVENT_NOTIFICATION, printer);
-      }
-      if (printer)
-	ippAddInteger(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_INTEGER, "printer-up-time", (int)(time(NULL) - printer->start_time));
-      else
-	ippAddInteger(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_INTEGER, "system-up-time", (int)(time(NULL) - SystemStartTime));
+    }
+  }
 
-      cupsArrayAdd(sub->events, n);
-      if (cupsArrayCount(sub->events) > 100)
-      {
-        n = (ipp_t *)cupsArrayFirst(sub->events);
-	cupsArrayRemove(sub->events, n);
-	ippDelete(n);
-	sub->first_sequence ++;
-      }
+  _cupsRWUnlock(&SubscriptionsRWLock);
+
+  if (n)
+    release_notification(n);
+}
+
+
+/*
+ * 'serverAddWaiter()' - Register a Get-Notifications waiter on a subscription.
+ *
+ * Register the waiter before looking at the subscription's events so that
+ * no event is missed.
+ */
+
+void
+serverAddWaiter(
+    server_subscription_t *sub,		/* I - Subscription */
+    server_waiter_t       *waiter)	/* I - Waiter */
+{
+  _cupsMutexLock(&NotificationMutex);
+
+  if (!sub->waiters)
+    sub->waiters = cupsArrayNew(NULL, NULL);
+
+  if (!cupsArrayFind(sub->waiters, waiter))
+    cupsArrayAdd(sub->waiters, waiter);
+
+  _cupsMutexUnlock(&NotificationMutex);
+}
+
+
+/*
+ * 'serverCompactSubscriptions()' - Compact the subscription journal.
+ *
+ * The journal is rewritten with one record per subscription once enough
+ * update records have been appended.
+ */
+
+void
+serverCompactSubscriptions(void)
+{
+  if (!SubscriptionJournal)
+    return;
+
+  _cupsRWLockRead(&SubscriptionsRWLock);
+
+  if (SubscriptionJournalCount > 100 && SubscriptionJournalCount > 2 * cupsArrayCount(Subscriptions))
+    compact_journal();
+
+  _cupsRWUnlock(&SubscriptionsRWLock);
+}
+
+
+/*
+ * 'serverCopyNotification()' - Copy an event notification for a subscription.
+ *
+ * The shared event attributes are combined with the subscription's
+ * notify-charset, notify-natural-language, notify-subscription-id,
+ * notify-subscription-uuid, notify-sequence-number, and notify-user-data.
+ *
+ * Note: The subscription must be read-locked.
+ */
+
+void
+serverCopyNotification(
+    ipp_t                 *ipp,		/* I - Destination message */
+    server_subscription_t *sub,		/* I - Subscription */
+    server_notification_t *n,		/* I - Event notification */
+    int                   sequence)	/* I - notify-sequence-number */
+{
+  ipp_attribute_t	*attr;		/* Event attribute */
 
-      _cupsRWUnlock(&sub->rwlock);
 
-      serverLog(SERVER_LOGLEVEL_DEBUG, "Broadcasting new event.");
-      _cupsCondBroadcast(&NotificationCondition);
+  ippAddString(ipp, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_CHARSET, "notify-charset", NULL, sub->charset);
+  ippAddString(ipp, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_LANGUAGE, "notify-natural-language", NULL, sub->language);
+  ippAddInteger(ipp, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_INTEGER, "notify-subscription-id", sub->id);
+  ippAddString(ipp, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_URI, "notify-subscription-uuid", NULL, sub->uuid);
+  ippAddInteger(ipp, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_INTEGER, "notify-sequence-number", sequence);
+
+  ippCopyAttributes(ipp, n->attrs, 0, (ipp_copycb_t)filter_notification, sub);
+
+  if (sub->userdata)
+  {
+    attr = ippCopyAttribute(ipp, sub->userdata, 0);
+    ippSetGroupTag(ipp, &attr, IPP_TAG_EVENT_NOTIFICATION);
+  }
+}
+
+
+/*
+ * 'serverCopySubscriptionEvents()' - Get references to a subscription's events.
+ *
+ * The event ring buffer is only locked while the references are taken so that
+ * new events can be added while the caller encodes the returned events.  Call
+ * serverFreeSubscriptionEvents to release the references.
+ *
+ * A job-progress event held for the subscription's notify-time-interval is
+ * added first if the interval has elapsed.
+ */
+
+int					/* O - Number of events */
+serverCopySubscriptionEvents(
+    server_subscription_t *sub,		/* I - Subscription */
+    int                   sequence,	/* I - First notify-sequence-number wanted */
+    int                   *first,	/* O - notify-sequence-number of first event */
+    server_notification_t ***events)	/* O - Events */
+{
+  int			i,		/* Looping var */
+			count;		/* Number of events */
+  server_notification_t	*n,		/* Current event */
+			*replaced = NULL;
+					/* Event replaced by held event */
+
+
+  *events = NULL;
+
+  _cupsMutexLock(&sub->events_mutex);
+
+  if (sub->progress && time(NULL) >= (sub->progress_time + sub->interval))
+  {
+   /*
+    * The notify-time-interval for a held job-progress event has elapsed...
+    */
+
+    replaced           = store_event(sub, sub->progress);
+    sub->progress      = NULL;
+    sub->progress_time = time(NULL);
+  }
+
+  if (sequence < sub->first_sequence)
+    sequence = sub->first_sequence;
+
+  *first = sequence;
+
+  if ((count = sub->last_sequence - sequence + 1) <= 0 || !sub->events || (*events = calloc((size_t)count, sizeof(server_notification_t *))) == NULL)
+  {
+    count = 0;
+  }
+  else
+  {
+    for (i = 0; i < count; i ++, sequence ++)
+    {
+      n = sub->events[sequence % sub->max_events];
+
+      retain_notification(n);
+
+      (*events)[i] = n;
     }
+
+    sub->delivered_sequence = sub->last_sequence;
   }
 
-  _cupsRWUnlock(&SubscriptionsRWLock);
+  _cupsMutexUnlock(&sub->events_mutex);
+
+  if (replaced)
+    release_notification(replaced);
+
+  return (count);
 }
 
 
@@ -171,6 +340,9 @@ serverCreateSubscription(
   sub->lease    = lease;
   sub->attrs    = ippNew();
 
+  sub->first_sequence = 1;
+  sub->max_events     = MaxSubscriptionEvents > 0 ? MaxSubscriptionEvents : 100;
+
   serverLog(SERVER_LOGLEVEL_DEBUG, "serverCreateSubscription: notify-subscription-id=%d, printer=%p(%s)", sub->id, (void *)client->printer, client->printer ? client->printer->name : "(null)");
 
   if (lease)
@@ -179,6 +351,7 @@ serverCreateSubscription(
     sub->expire = INT_MAX;
 
   _cupsRWInit(&(sub->rwlock));
+  _cupsMutexInit(&(sub->events_mutex));
 
  /*
   * Add subscription description attributes and add to the subscriptions
@@ -246,12 +419,23 @@ serverCreateSubscription(
   if (notify_user_data)
     sub->userdata = ippCopyAttribute(sub->attrs, notify_user_data, 0);
 
-  sub->events = cupsArrayNew3(NULL, NULL, NULL, 0, NULL, (cups_afree_func_t)ippDelete);
-
   if (!Subscriptions)
     Subscriptions = cupsArrayNew((cups_array_func_t)compare_subscriptions, NULL);
 
   cupsArrayAdd(Subscriptions, sub);
+  serverIndexSubscriptionNoLock(sub);
+
+  if (SubscriptionJournal && !sub->resource)
+  {
+   /*
+    * Save printer, system, and job subscriptions so they survive a restart -
+    * resource subscriptions go away with their object...
+    */
+
+    sub->journaled = 1;
+
+    serverJournalSubscription(sub, 0);
+  }
 
   _cupsRWUnlock(&SubscriptionsRWLock);
 
@@ -261,22 +445,46 @@ serverCreateSubscription(
 
 /*
  * 'serverDeleteSubscription()' - Delete a subscription.
+ *
+ * Note: SubscriptionsRWLock must be write-locked.
  */
 
 void
 serverDeleteSubscription(
     server_subscription_t *sub)		/* I - Subscription */
 {
+  cupsArrayRemove(Subscriptions, sub);
+  serverUnindexSubscriptionNoLock(sub);
+
+  serverJournalSubscription(sub, 1);
+
   sub->pending_delete = 1;
 
-  serverLog(SERVER_LOGLEVEL_DEBUG, "Broadcasting deleted subscription.");
-  _cupsCondBroadcast(&NotificationCondition);
+  notify_waiters(sub);
+
+  _cupsMutexLock(&NotificationMutex);
+  cupsArrayDelete(sub->waiters);
+  sub->waiters = NULL;
+  _cupsMutexUnlock(&NotificationMutex);
 
   _cupsRWLockWrite(&sub->rwlock);
 
   ippDelete(sub->attrs);
-  cupsArrayDelete(sub->events);
 
+  if (sub->events)
+  {
+    int	sequence;			/* Current sequence number */
+
+    for (sequence = sub->first_sequence; sequence <= sub->last_sequence; sequence ++)
+      release_notification(sub->events[sequence % sub->max_events]);
+
+    free(sub->events);
+  }
+
+  if (sub->progress)
+    release_notification(sub->progress);
+
+  _cupsMutexDeinit(&sub->events_mutex);
   _cupsRWDeinit(&sub->rwlock);
 
   free(sub);
@@ -317,6 +525,97 @@ serverFindSubscription(
 }
 
 
+/*
+ * 'serverFlushProgressEvents()' - Add held job-progress events whose
+ *                                 notify-time-interval has elapsed.
+ *
+ * Called from the main loop so that Get-Notifications requests waiting on a
+ * subscription see the coalesced event without polling again.
+ */
+
+void
+serverFlushProgressEvents(void)
+{
+  server_subscription_t	*sub;		/* Current subscription */
+  server_notification_t	*replaced;	/* Event replaced by held event */
+  time_t		curtime = time(NULL),
+					/* Current time */
+			next = 0;	/* Next time an event is due */
+
+
+  _cupsMutexLock(&NotificationMutex);
+
+  if (!ProgressDue || ProgressDue > curtime)
+  {
+    _cupsMutexUnlock(&NotificationMutex);
+    return;
+  }
+
+  ProgressDue = 0;
+
+  _cupsMutexUnlock(&NotificationMutex);
+
+  _cupsRWLockRead(&SubscriptionsRWLock);
+
+  for (sub = (server_subscription_t *)cupsArrayFirst(Subscriptions); sub; sub = (server_subscription_t *)cupsArrayNext(Subscriptions))
+  {
+    replaced = NULL;
+
+    _cupsMutexLock(&sub->events_mutex);
+
+    if (!sub->progress)
+    {
+      _cupsMutexUnlock(&sub->events_mutex);
+      continue;
+    }
+    else if (curtime < (sub->progress_time + sub->interval))
+    {
+      if (!next || (sub->progress_time + sub->interval) < next)
+        next = sub->progress_time + sub->interval;
+
+      _cupsMutexUnlock(&sub->events_mutex);
+      continue;
+    }
+
+    replaced           = store_event(sub, sub->progress);
+    sub->progress      = NULL;
+    sub->progress_time = curtime;
+
+    _cupsMutexUnlock(&sub->events_mutex);
+
+    if (replaced)
+      release_notification(replaced);
+
+    notify_waiters(sub);
+  }
+
+  _cupsRWUnlock(&SubscriptionsRWLock);
+
+  if (next)
+    schedule_progress(next);
+}
+
+
+/*
+ * 'serverFreeSubscriptionEvents()' - Release the events returned by
+ *                                    serverCopySubscriptionEvents.
+ */
+
+void
+serverFreeSubscriptionEvents(
+    int                   num_events,	/* I - Number of events */
+    server_notification_t **events)	/* I - Events */
+{
+  int	i;				/* Looping var */
+
+
+  for (i = 0; i < num_events; i ++)
+    release_notification(events[i]);
+
+  free(events);
+}
+
+
 /*
  * 'serverGetNotifyEventsBits()' - Get the bits associated with "notify-events" values.
  */
@@ -372,13 +671,997 @@ serverGetNotifySubscribedEvent(
 
 
 /*
- * 'compare_subscriptions()' - Compare two subscriptions.
+ * 'serverIndexSubscriptionNoLock()' - Add a subscription to the event index.
+ *
+ * Subscriptions are indexed by the most specific object they monitor - job,
+ * resource, printer, or the system - and then by event bit so that
+ * serverAddEventNoLock only looks at subscriptions that can match.
+ *
+ * Note: SubscriptionsRWLock must be write-locked.
  */
 
-static int				/* O - Result of comparison */
-compare_subscriptions(
-    server_subscription_t *a,		/* I - First subscription */
-    server_subscription_t *b)		/* I - Second subscription */
+void
+serverIndexSubscriptionNoLock(
+    server_subscription_t *sub)		/* I - Subscription */
 {
-  return (b->id - a->id);
+  server_subindex_t	key,		/* Search key */
+			*index;		/* Subscriptions for object */
+  int			bit;		/* Current event bit */
+
+
+  if (sub->job)
+    key.target = sub->job;
+  else if (sub->resource)
+    key.target = sub->resource;
+  else
+    key.target = sub->printer;
+
+  if (!SubscriptionIndex)
+    SubscriptionIndex = cupsArrayNew((cups_array_func_t)compare_subindex, NULL);
+
+  if ((index = (server_subindex_t *)cupsArrayFind(SubscriptionIndex, &key)) == NULL)
+  {
+    if ((index = calloc(1, sizeof(server_subindex_t))) == NULL)
+    {
+      serverLog(SERVER_LOGLEVEL_ERROR, "Unable to allocate memory for subscription index.");
+      return;
+    }
+
+    index->target = key.target;
+
+    cupsArrayAdd(SubscriptionIndex, index);
+  }
+
+  for (bit = 0; bit < SERVER_EVENT_NUM_BITS; bit ++)
+  {
+    if (sub->mask & (1U << bit))
+    {
+      if (!index->subs[bit])
+        index->subs[bit] = cupsArrayNew(NULL, NULL);
+
+      cupsArrayAdd(index->subs[bit], sub);
+    }
+  }
+
+  index->num_subs ++;
+}
+
+
+/*
+ * 'serverJournalSubscription()' - Record a change to a subscription in the
+ *                                 subscription journal.
+ *
+ * If "canceled" is non-zero, the subscription is removed from the journal
+ * and will not be restored when the server is restarted.
+ */
+
+void
+serverJournalSubscription(
+    server_subscription_t *sub,		/* I - Subscription */
+    int                   canceled)	/* I - Subscription is going away? */
+{
+  if (!sub->journaled)
+    return;
+
+  _cupsMutexLock(&sub->events_mutex);
+  journal_subscription(sub, canceled);
+  _cupsMutexUnlock(&sub->events_mutex);
+}
+
+
+/*
+ * 'serverLoadSubscriptions()' - Restore subscriptions from the subscription
+ *                               journal.
+ *
+ * Subscriptions whose lease has expired or whose printer no longer exists are
+ * dropped.  Job subscriptions are re-linked to their job, so this must be
+ * called after serverLoadJobs - subscriptions for jobs that were not restored
+ * are dropped as well.  Restored subscriptions keep their
+ * notify-subscription-id and continue numbering events after the last
+ * notify-sequence-number that was reserved in the journal.  The journal is
+ * then compacted and kept open for new records.
+ */
+
+void
+serverLoadSubscriptions(void)
+{
+  char			filename[1024];	/* Journal filename */
+  cups_file_t		*fp;		/* Journal file */
+  ipp_t			*record;	/* Journal record */
+  ipp_state_t		state;		/* Read state */
+  off_t			start;		/* Start of record */
+  server_subscription_t	*sub;		/* Current subscription */
+  time_t		curtime = time(NULL);
+					/* Current time */
+
+
+  if (!StateDirectory)
+    return;
+
+  snprintf(filename, sizeof(filename), "%s/subscriptions.journal", StateDirectory);
+
+  _cupsRWLockWrite(&SubscriptionsRWLock);
+
+  if ((fp = cupsFileOpen(filename, "r")) != NULL)
+  {
+    serverLog(SERVER_LOGLEVEL_INFO, "Loading subscriptions from \"%s\".", filename);
+
+    for (;;)
+    {
+      record = ippNew();
+      start  = cupsFileTell(fp);
+
+      while ((state = ippReadIO(fp, (ipp_iocb_t)cupsFileRead, 1, NULL, record)) != IPP_STATE_DATA)
+      {
+        if (state == IPP_STATE_ERROR)
+          break;
+      }
+
+      if (state == IPP_STATE_ERROR)
+      {
+       /*
+        * A partial record at the end is left over from a crash while it was
+        * being written...
+        */
+
+        if (cupsFileTell(fp) > start)
+          serverLog(SERVER_LOGLEVEL_ERROR, "Ignoring incomplete subscription journal record.");
+
+        ippDelete(record);
+        break;
+      }
+
+      load_subscription(record);
+      ippDelete(record);
+    }
+
+    cupsFileClose(fp);
+
+    for (sub = (server_subscription_t *)cupsArrayFirst(Subscriptions); sub; sub = (server_subscription_t *)cupsArrayNext(Subscriptions))
+    {
+      if (sub->expire <= curtime)
+      {
+        serverLog(SERVER_LOGLEVEL_INFO, "Subscription #%d has expired.", sub->id);
+        serverDeleteSubscription(sub);
+      }
+    }
+
+    serverLog(SERVER_LOGLEVEL_INFO, "Restored %d subscriptions.", cupsArrayCount(Subscriptions));
+  }
+
+  compact_journal();
+
+  _cupsRWUnlock(&SubscriptionsRWLock);
+}
+
+
+/*
+ * 'serverParkWaiter()' - Park a Get-Notifications request until an event
+ *                        arrives or it times out.
+ *
+ * The waiter must already be registered with its subscriptions.  Once parked,
+ * the client connection belongs to the main loop, which watches it for a
+ * hangup and hands it back to a client thread to complete the request (see
+ * serverUnparkWaiter).
+ */
+
+void
+serverParkWaiter(
+    server_waiter_t *waiter)		/* I - Waiter */
+{
+  _cupsMutexLock(&NotificationMutex);
+
+  if (!ParkedWaiters)
+    ParkedWaiters = cupsArrayNew(NULL, NULL);
+
+  cupsArrayAdd(ParkedWaiters, waiter);
+
+  if (waiter->notified || waiter->hangup || cupsArrayCount(ParkedWaiters) == 1)
+    wake_main_loop();			/* Complete or update main loop timeout */
+
+  _cupsMutexUnlock(&NotificationMutex);
+}
+
+
+/*
+ * 'serverRemoveWaiter()' - Stop waking up a Get-Notifications waiter.
+ */
+
+void
+serverRemoveWaiter(
+    int             sub_id,		/* I - Subscription ID */
+    server_waiter_t *waiter)		/* I - Waiter */
+{
+  server_subscription_t	key,		/* Search key */
+			*sub;		/* Matching subscription */
+
+
+ /*
+  * Look the subscription up again since it may have been deleted while we
+  * were waiting...
+  */
+
+  key.id = sub_id;
+
+  _cupsRWLockRead(&SubscriptionsRWLock);
+
+  if ((sub = (server_subscription_t *)cupsArrayFind(Subscriptions, &key)) != NULL)
+  {
+    _cupsMutexLock(&NotificationMutex);
+    cupsArrayRemove(sub->waiters, waiter);
+    _cupsMutexUnlock(&NotificationMutex);
+  }
+
+  _cupsRWUnlock(&SubscriptionsRWLock);
+}
+
+
+/*
+ * 'serverUnindexSubscriptionNoLock()' - Remove a subscription from the event
+ *                                       index.
+ *
+ * Note: SubscriptionsRWLock must be write-locked.
+ */
+
+void
+serverUnindexSubscriptionNoLock(
+    server_subscription_t *sub)		/* I - Subscription */
+{
+  server_subindex_t	key,		/* Search key */
+			*index;		/* Subscriptions for object */
+  int			bit;		/* Current event bit */
+
+
+  if (sub->job)
+    key.target = sub->job;
+  else if (sub->resource)
+    key.target = sub->resource;
+  else
+    key.target = sub->printer;
+
+  if ((index = (server_subindex_t *)cupsArrayFind(SubscriptionIndex, &key)) == NULL)
+    return;
+
+  for (bit = 0; bit < SERVER_EVENT_NUM_BITS; bit ++)
+  {
+    if (sub->mask & (1U << bit))
+      cupsArrayRemove(index->subs[bit], sub);
+  }
+
+  if (-- index->num_subs <= 0)
+  {
+   /*
+    * Free the index entry once the object has no more subscriptions...
+    */
+
+    cupsArrayRemove(SubscriptionIndex, index);
+
+    for (bit = 0; bit < SERVER_EVENT_NUM_BITS; bit ++)
+      cupsArrayDelete(index->subs[bit]);
+
+    free(index);
+  }
+}
+
+
+/*
+ * 'serverUnparkWaiter()' - Get the next parked Get-Notifications request that
+ *                          is ready or has timed out.
+ *
+ * A parked request is also ready when its connection shows up in "input" (see
+ * serverWatchWaiters) and the client has closed it, in which case
+ * "waiter->hangup" is set.
+ *
+ * Returns NULL when no parked request is ready, in which case "next_expire"
+ * holds the time when the next parked request times out or a held
+ * job-progress event is due (0 if none).
+ */
+
+server_waiter_t *			/* O - Waiter or NULL */
+serverUnparkWaiter(
+    fd_set *input,			/* I - Sockets with input */
+    time_t *next_expire)		/* O - Next expiration time */
+{
+  server_waiter_t	*waiter;	/* Current waiter */
+  int			fd;		/* Client socket */
+  char			buf[1];		/* Peeked byte */
+  time_t		curtime = time(NULL);
+					/* Current time */
+
+
+  *next_expire = 0;
+
+  _cupsMutexLock(&NotificationMutex);
+
+  if (ProgressDue)
+    *next_expire = ProgressDue;
+
+  for (waiter = (server_waiter_t *)cupsArrayFirst(ParkedWaiters); waiter; waiter = (server_waiter_t *)cupsArrayNext(ParkedWaiters))
+  {
+    fd = httpGetFd(waiter->client->http);
+
+    if (!waiter->input && fd < FD_SETSIZE && FD_ISSET(fd, input))
+    {
+     /*
+      * Input on a parked connection is either a hangup or the client sending
+      * another request early - the latter is left for the client thread...
+      */
+
+      FD_CLR(fd, input);
+
+      if (recv(fd, buf, 1, MSG_PEEK) > 0)
+        waiter->input = 1;
+      else
+        waiter->hangup = 1;
+    }
+
+    if (waiter->notified || waiter->hangup || waiter->expire <= curtime)
+    {
+      cupsArrayRemove(ParkedWaiters, waiter);
+      break;
+    }
+    else if (!*next_expire || waiter->expire < *next_expire)
+      *next_expire = waiter->expire;
+  }
+
+  _cupsMutexUnlock(&NotificationMutex);
+
+  return (waiter);
+}
+
+
+/*
+ * 'serverWatchWaiters()' - Add the parked Get-Notifications connections to a
+ *                          select() input set.
+ *
+ * Connections where the client has already sent more data are left out so
+ * they don't keep waking up the main loop.
+ */
+
+int					/* O - New maximum file descriptor */
+serverWatchWaiters(fd_set *input,	/* I - select() input set */
+                   int    max_fd)	/* I - Current maximum file descriptor */
+{
+  server_waiter_t	*waiter;	/* Current waiter */
+  int			fd;		/* Client socket */
+
+
+  _cupsMutexLock(&NotificationMutex);
+
+  for (waiter = (server_waiter_t *)cupsArrayFirst(ParkedWaiters); waiter; waiter = (server_waiter_t *)cupsArrayNext(ParkedWaiters))
+  {
+    fd = httpGetFd(waiter->client->http);
+
+    if (waiter->input || fd < 0 || fd >= FD_SETSIZE)
+      continue;
+
+    FD_SET(fd, input);
+    if (max_fd < fd)
+      max_fd = fd;
+  }
+
+  _cupsMutexUnlock(&NotificationMutex);
+
+  return (max_fd);
+}
+
+
+/*
+ * 'add_event()' - Add an event to a subscription.
+ *
+ * Events are stored in a fixed-size ring buffer indexed by
+ * notify-sequence-number, so the oldest event is replaced once the buffer is
+ * full.
+ *
+ * job-progress events are coalesced so they cannot push state changes out of
+ * the buffer: a job-progress event that has not been returned by
+ * Get-Notifications yet is replaced by a newer one for the same job, and
+ * when the subscription has a notify-time-interval only the latest job-progress
+ * event in the interval is kept.  The main loop adds the held event once the
+ * interval has elapsed (see serverFlushProgressEvents).  Any other event is
+ * always added.
+ */
+
+static void
+add_event(
+    server_subscription_t *sub,		/* I - Subscription */
+    server_notification_t *n)		/* I - Event notification */
+{
+  time_t		curtime = time(NULL);
+					/* Current time */
+  server_notification_t	**slot,		/* Newest ring buffer slot */
+			*old[2] = { NULL, NULL };
+					/* Events to release */
+  int			wake = 1;	/* Wake up waiters? */
+  time_t		due = 0;	/* Time when a held event is due */
+
+
+  _cupsMutexLock(&sub->events_mutex);
+
+  if (!sub->events && (sub->events = calloc((size_t)sub->max_events, sizeof(server_notification_t *))) == NULL)
+  {
+    _cupsMutexUnlock(&sub->events_mutex);
+    serverLog(SERVER_LOGLEVEL_ERROR, "Unable to allocate memory for subscription events.");
+    return;
+  }
+
+  retain_notification(n);
+
+  slot = sub->events + sub->last_sequence % sub->max_events;
+
+  if (n->event == SERVER_EVENT_JOB_PROGRESS)
+  {
+    if (sub->last_sequence >= sub->first_sequence && sub->last_sequence > sub->delivered_sequence && (*slot)->event == SERVER_EVENT_JOB_PROGRESS && (*slot)->job_id == n->job_id)
+    {
+     /*
+      * Replace the pending job-progress event with the latest value...
+      */
+
+      old[0] = *slot;
+      *slot  = n;
+    }
+    else if (sub->interval > 0 && curtime < (sub->progress_time + sub->interval))
+    {
+     /*
+      * Hold the event until the notify-time-interval has elapsed (see
+      * serverCopySubscriptionEvents and serverFlushProgressEvents)...
+      */
+
+      old[0]        = sub->progress;
+      sub->progress = n;
+      wake          = 0;
+      due           = sub->progress_time + sub->interval;
+    }
+    else
+    {
+      old[0]             = sub->progress;
+      old[1]             = store_event(sub, n);
+      sub->progress      = NULL;
+      sub->progress_time = curtime;
+    }
+  }
+  else
+  {
+    if (sub->progress)
+    {
+     /*
+      * Add the held job-progress event before this one...
+      */
+
+      old[0]             = store_event(sub, sub->progress);
+      sub->progress      = NULL;
+      sub->progress_time = curtime;
+    }
+
+    old[1] = store_event(sub, n);
+  }
+
+  _cupsMutexUnlock(&sub->events_mutex);
+
+  if (old[0])
+    release_notification(old[0]);
+  if (old[1])
+    release_notification(old[1]);
+
+  if (wake)
+    notify_waiters(sub);
+  else if (due)
+    schedule_progress(due);
+}
+
+
+/*
+ * 'compact_journal()' - Rewrite the subscription journal with the current
+ *                       subscriptions.
+ *
+ * Note: SubscriptionsRWLock must be locked.
+ */
+
+static void
+compact_journal(void)
+{
+  char			filename[1024],	/* Journal filename */
+			tempfile[1024];	/* Temporary journal filename */
+  cups_file_t		*fp;		/* New journal file */
+  server_subscription_t	*sub;		/* Current subscription */
+  int			ok = 1;		/* Journal written? */
+
+
+  snprintf(filename, sizeof(filename), "%s/subscriptions.journal", StateDirectory);
+  snprintf(tempfile, sizeof(tempfile), "%s/subscriptions.journal.N", StateDirectory);
+
+  _cupsMutexLock(&SubscriptionJournalMutex);
+
+  if ((fp = cupsFileOpen(tempfile, "w")) == NULL)
+  {
+    serverLog(SERVER_LOGLEVEL_ERROR, "Unable to create subscription journal \"%s\": %s", tempfile, strerror(errno));
+    _cupsMutexUnlock(&SubscriptionJournalMutex);
+    return;
+  }
+
+  for (sub = (server_subscription_t *)cupsArrayFirst(Subscriptions); sub && ok; sub = (server_subscription_t *)cupsArrayNext(Subscriptions))
+  {
+    if (sub->journaled)
+      ok = write_subscription(fp, sub, 0);
+  }
+
+  if (cupsFileClose(fp) || !ok || rename(tempfile, filename))
+  {
+    serverLog(SERVER_LOGLEVEL_ERROR, "Unable to write subscription journal \"%s\": %s", filename, strerror(errno));
+    unlink(tempfile);
+  }
+  else
+  {
+    serverLog(SERVER_LOGLEVEL_DEBUG, "Compacted subscription journal, %d records since last compaction.", SubscriptionJournalCount);
+
+    if (SubscriptionJournal)
+      cupsFileClose(SubscriptionJournal);
+
+    if ((SubscriptionJournal = cupsFileOpen(filename, "a")) == NULL)
+      serverLog(SERVER_LOGLEVEL_ERROR, "Unable to open subscription journal \"%s\": %s", filename, strerror(errno));
+
+    SubscriptionJournalCount = 0;
+  }
+
+  _cupsMutexUnlock(&SubscriptionJournalMutex);
+}
+
+
+/*
+ * 'compare_subindex()' - Compare two subscription index entries.
+ */
+
+static int				/* O - Result of comparison */
+compare_subindex(
+    server_subindex_t *a,		/* I - First index entry */
+    server_subindex_t *b)		/* I - Second index entry */
+{
+  if ((uintptr_t)a->target < (uintptr_t)b->target)
+    return (-1);
+  else if ((uintptr_t)a->target > (uintptr_t)b->target)
+    return (1);
+  else
+    return (0);
+}
+
+
+/*
+ * 'compare_subscriptions()' - Compare two subscriptions.
+ */
+
+static int				/* O - Result of comparison */
+compare_subscriptions(
+    server_subscription_t *a,		/* I - First subscription */
+    server_subscription_t *b)		/* I - Second subscription */
+{
+  return (b->id - a->id);
+}
+
+
+/*
+ * 'create_notification()' - Create the shared attributes for an event.
+ *
+ * The subscription-specific attributes are added by serverCopyNotification.
+ */
+
+static server_notification_t *		/* O - Event notification or NULL */
+create_notification(
+    server_printer_t  *printer,		/* I - Printer, if any */
+    server_job_t      *job,		/* I - Job, if any */
+    server_resource_t *res,		/* I - Resource, if any */
+    server_event_t    event,		/* I - Event */
+    const char        *text)		/* I - notify-text value */
+{
+  server_notification_t	*n;		/* Event notification */
+
+
+  if ((n = calloc(1, sizeof(server_notification_t))) == NULL)
+  {
+    serverLog(SERVER_LOGLEVEL_ERROR, "Unable to allocate memory for event notification.");
+    return (NULL);
+  }
+
+  _cupsMutexInit(&n->mutex);
+  n->use    = 1;
+  n->event  = event;
+  n->job_id = job ? job->id : 0;
+  n->attrs  = ippNew();
+
+  if (printer)
+    ippAddString(n->attrs, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_URI, "notify-printer-uri", NULL, printer->default_uri);
+  else
+    ippAddString(n->attrs, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_URI, "notify-system-uri", NULL, DefaultSystemURI);
+
+  if (job)
+    ippAddInteger(n->attrs, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_INTEGER, "notify-job-id", job->id);
+  if (res)
+    ippAddInteger(n->attrs, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_INTEGER, "notify-resource-id", res->id);
+  ippAddString(n->attrs, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_KEYWORD, "notify-subscribed-event", NULL, serverGetNotifySubscribedEvent(event));
+  ippAddString(n->attrs, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_TEXT, "notify-text", NULL, text);
+  if (job && (event & SERVER_EVENT_JOB_ALL))
+  {
+    ippAddInteger(n->attrs, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_ENUM, "job-state", (int)job->state);
+    serverCopyJobStateReasons(n->attrs, IPP_TAG_EVENT_NOTIFICATION, job);
+    if (event == SERVER_EVENT_JOB_CREATED)
+    {
+      ippAddString(n->attrs, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_NAME, "job-name", NULL, job->name);
+      ippAddString(n->attrs, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_NAME, "job-originating-user-name", NULL, job->username);
+    }
+  }
+  if (printer && (event & SERVER_EVENT_PRINTER_ALL))
+  {
+   /*
+    * Printer state is not reported to job subscriptions (see
+    * filter_notification)...
+    */
+
+    ippAddBoolean(n->attrs, IPP_TAG_EVENT_NOTIFICATION, "printer-is-accepting-jobs", printer->is_accepting);
+    ippAddInteger(n->attrs, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_ENUM, "printer-state", (int)printer->state);
+    serverCopyPrinterStateReasons(n->attrs, IPP_TAG_EVENT_NOTIFICATION, printer);
+  }
+  if (printer)
+    ippAddInteger(n->attrs, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_INTEGER, "printer-up-time", (int)(time(NULL) - printer->start_time));
+  else
+    ippAddInteger(n->attrs, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_INTEGER, "system-up-time", (int)(time(NULL) - SystemStartTime));
+
+  return (n);
+}
+
+
+/*
+ * 'filter_notification()' - Filter shared event attributes for a subscription.
+ */
+
+static int				/* O - 1 to copy, 0 to skip */
+filter_notification(
+    server_subscription_t *sub,		/* I - Subscription */
+    ipp_t                 *dst,		/* I - Destination (unused) */
+    ipp_attribute_t       *attr)	/* I - Source attribute */
+{
+  const char	*name = ippGetName(attr);
+					/* Attribute name */
+
+
+  (void)dst;
+
+  return (!sub->job || strncmp(name, "printer-", 8) || !strcmp(name, "printer-up-time"));
+}
+
+
+/*
+ * 'journal_subscription()' - Append a subscription record to the journal.
+ *
+ * Saved records reserve the next SERVER_NOTIFY_SEQUENCE_RESERVE
+ * notify-sequence-numbers so that a record is only needed every so many
+ * events while numbers are never reused after a restart.
+ *
+ * Note: sub->events_mutex must be held.
+ */
+
+static void
+journal_subscription(
+    server_subscription_t *sub,		/* I - Subscription */
+    int                   canceled)	/* I - Subscription is going away? */
+{
+  _cupsMutexLock(&SubscriptionJournalMutex);
+
+  if (!canceled && sub->last_sequence >= sub->saved_sequence)
+    sub->saved_sequence = sub->last_sequence + SERVER_NOTIFY_SEQUENCE_RESERVE;
+
+  if (SubscriptionJournal)
+  {
+    if (write_subscription(SubscriptionJournal, sub, canceled) && cupsFileFlush(SubscriptionJournal) == 0)
+      SubscriptionJournalCount ++;
+    else
+      serverLog(SERVER_LOGLEVEL_ERROR, "Unable to write subscription journal: %s", strerror(errno));
+  }
+
+  if (canceled)
+    sub->journaled = 0;
+
+  _cupsMutexUnlock(&SubscriptionJournalMutex);
+}
+
+
+/*
+ * 'load_subscription()' - Apply a subscription journal record.
+ *
+ * Note: SubscriptionsRWLock must be write-locked.
+ */
+
+static void
+load_subscription(ipp_t *record)	/* I - Journal record */
+{
+  server_subscription_t	key,		/* Search key */
+			*sub;		/* Subscription */
+  server_printer_t	*printer = NULL;/* Printer, if any */
+  server_job_t		jkey,		/* Job search key */
+			*job = NULL;	/* Job, if any */
+  ipp_attribute_t	*attr;		/* Current attribute */
+  const char		*uri;		/* printer-uri value */
+  char			scheme[32],	/* URI scheme */
+			userpass[256],	/* URI username:password */
+			host[256],	/* URI host */
+			resource[256];	/* URI resource path */
+  int			port;		/* URI port */
+  time_t		expire;		/* Lease expiration time */
+
+
+  if ((key.id = ippGetInteger(ippFindAttribute(record, "notify-subscription-id", IPP_TAG_INTEGER), 0)) <= 0)
+    return;
+
+  if (key.id >= NextSubscriptionId)
+    NextSubscriptionId = key.id + 1;
+
+  sub = (server_subscription_t *)cupsArrayFind(Subscriptions, &key);
+
+  if (ippGetOperation(record) == IPP_OP_CANCEL_SUBSCRIPTION)
+  {
+    if (sub)
+      serverDeleteSubscription(sub);
+    return;
+  }
+
+  if (!sub)
+  {
+   /*
+    * Create the subscription from the attributes that were saved...
+    */
+
+    if ((uri = ippGetString(ippFindAttribute(record, "printer-uri", IPP_TAG_URI), 0, NULL)) != NULL)
+    {
+      if (httpSeparateURI(HTTP_URI_CODING_ALL, uri, scheme, sizeof(scheme), userpass, sizeof(userpass), host, sizeof(host), &port, resource, sizeof(resource)) < HTTP_URI_STATUS_OK || !cupsArrayCount(Printers) || (printer = serverFindPrinter(resource)) == NULL)
+      {
+        serverLog(SERVER_LOGLEVEL_INFO, "Dropping subscription #%d for missing printer \"%s\".", key.id, uri);
+        return;
+      }
+    }
+
+    if (printer && (jkey.id = ippGetInteger(ippFindAttribute(record, "notify-job-id", IPP_TAG_INTEGER), 0)) > 0)
+    {
+      _cupsRWLockRead(&printer->rwlock);
+      job = (server_job_t *)cupsArrayFind(printer->jobs, &jkey);
+      _cupsRWUnlock(&printer->rwlock);
+
+      if (!job)
+      {
+        serverLog(SERVER_LOGLEVEL_INFO, "Dropping subscription #%d for missing job %d.", key.id, jkey.id);
+        return;
+      }
+    }
+
+    if ((sub = calloc(1, sizeof(server_subscription_t))) == NULL)
+    {
+      perror("Unable to allocate memory for subscription");
+      return;
+    }
+
+    sub->id         = key.id;
+    sub->printer    = printer;
+    sub->job        = job;
+    sub->attrs      = ippNew();
+    sub->max_events = MaxSubscriptionEvents > 0 ? MaxSubscriptionEvents : 100;
+    sub->journaled  = 1;
+
+    for (attr = ippFirstAttribute(record); attr; attr = ippNextAttribute(record))
+    {
+      if (ippGetGroupTag(attr) == IPP_TAG_SUBSCRIPTION)
+        ippCopyAttribute(sub->attrs, attr, 0);
+    }
+
+    if (printer && (attr = ippFindAttribute(sub->attrs, "notify-printer-uri", IPP_TAG_URI)) != NULL)
+      ippSetString(sub->attrs, &attr, 0, printer->default_uri);
+    else if (!printer && (attr = ippFindAttribute(sub->attrs, "notify-system-uri", IPP_TAG_URI)) != NULL)
+      ippSetString(sub->attrs, &attr, 0, DefaultSystemURI);
+
+    sub->uuid     = ippGetString(ippFindAttribute(sub->attrs, "notify-subscription-uuid", IPP_TAG_URI), 0, NULL);
+    sub->charset  = ippGetString(ippFindAttribute(sub->attrs, "notify-charset", IPP_TAG_CHARSET), 0, NULL);
+    sub->language = ippGetString(ippFindAttribute(sub->attrs, "notify-natural-language", IPP_TAG_LANGUAGE), 0, NULL);
+    sub->username = ippGetString(ippFindAttribute(sub->attrs, "notify-subscriber-user-name", IPP_TAG_NAME), 0, NULL);
+    sub->userdata = ippFindAttribute(sub->attrs, "notify-user-data", IPP_TAG_STRING);
+    sub->lease    = ippGetInteger(ippFindAttribute(sub->attrs, "notify-lease-duration", IPP_TAG_INTEGER), 0);
+    sub->mask     = serverGetNotifyEventsBits(ippFindAttribute(sub->attrs, "notify-events", IPP_TAG_KEYWORD));
+
+    _cupsRWInit(&(sub->rwlock));
+    _cupsMutexInit(&(sub->events_mutex));
+
+    if (!Subscriptions)
+      Subscriptions = cupsArrayNew((cups_array_func_t)compare_subscriptions, NULL);
+
+    cupsArrayAdd(Subscriptions, sub);
+    serverIndexSubscriptionNoLock(sub);
+  }
+
+ /*
+  * Update the lease and sequence numbers - no events are restored, so the
+  * next event uses the first sequence number after the reserved ones...
+  */
+
+  expire = (time_t)ippGetInteger(ippFindAttribute(record, "notify-lease-expiration-time", IPP_TAG_INTEGER), 0);
+
+  sub->expire         = expire ? expire : INT_MAX;
+  sub->interval       = ippGetInteger(ippFindAttribute(record, "notify-time-interval", IPP_TAG_INTEGER), 0);
+  sub->saved_sequence = ippGetInteger(ippFindAttribute(record, "notify-sequence-number", IPP_TAG_INTEGER), 0);
+  sub->last_sequence  = sub->saved_sequence;
+  sub->first_sequence = sub->saved_sequence + 1;
+}
+
+
+/*
+ * 'notify_waiters()' - Mark the Get-Notifications requests waiting on a
+ *                      subscription as ready.
+ */
+
+static void
+notify_waiters(
+    server_subscription_t *sub)		/* I - Subscription */
+{
+  server_waiter_t	*waiter;	/* Current waiter */
+
+
+  _cupsMutexLock(&NotificationMutex);
+
+  for (waiter = (server_waiter_t *)cupsArrayFirst(sub->waiters); waiter; waiter = (server_waiter_t *)cupsArrayNext(sub->waiters))
+  {
+    if (!waiter->notified)
+    {
+      waiter->notified = 1;
+      wake_main_loop();
+    }
+  }
+
+  _cupsMutexUnlock(&NotificationMutex);
+}
+
+
+/*
+ * 'release_notification()' - Release a reference to an event notification.
+ */
+
+static void
+release_notification(
+    server_notification_t *n)		/* I - Event notification */
+{
+  int	use;				/* Remaining references */
+
+
+  _cupsMutexLock(&n->mutex);
+  use = -- n->use;
+  _cupsMutexUnlock(&n->mutex);
+
+  if (use == 0)
+  {
+    ippDelete(n->attrs);
+    _cupsMutexDeinit(&n->mutex);
+    free(n);
+  }
+}
+
+
+/*
+ * 'retain_notification()' - Add a reference to an event notification.
+ */
+
+static void
+retain_notification(
+    server_notification_t *n)		/* I - Event notification */
+{
+  _cupsMutexLock(&n->mutex);
+  n->use ++;
+  _cupsMutexUnlock(&n->mutex);
+}
+
+
+/*
+ * 'schedule_progress()' - Schedule the main loop to add held job-progress
+ *                         events.
+ */
+
+static void
+schedule_progress(time_t due)		/* I - Time when the held event is due */
+{
+  _cupsMutexLock(&NotificationMutex);
+
+  if (!ProgressDue || due < ProgressDue)
+  {
+    ProgressDue = due;
+    wake_main_loop();			/* Update main loop timeout */
+  }
+
+  _cupsMutexUnlock(&NotificationMutex);
+}
+
+
+/*
+ * 'store_event()' - Store an event in a subscription's ring buffer.
+ *
+ * The ring buffer takes over the caller's reference to the event.
+ *
+ * Note: sub->events_mutex must be held.
+ */
+
+static server_notification_t *		/* O - Event that was replaced, if any */
+store_event(
+    server_subscription_t *sub,		/* I - Subscription */
+    server_notification_t *n)		/* I - Event notification */
+{
+  server_notification_t	**slot,		/* Ring buffer slot */
+			*old;		/* Event being replaced */
+
+
+  sub->last_sequence ++;
+
+  slot  = sub->events + sub->last_sequence % sub->max_events;
+  old   = *slot;
+  *slot = n;
+
+  if ((sub->last_sequence - sub->first_sequence) >= sub->max_events)
+    sub->first_sequence = sub->last_sequence - sub->max_events + 1;
+
+  if (sub->journaled && sub->last_sequence > sub->saved_sequence)
+    journal_subscription(sub, 0);	/* Reserve more sequence numbers */
+
+  return (old);
+}
+
+
+/*
+ * 'wake_main_loop()' - Wake up the main loop to complete parked requests.
+ *
+ * Note: NotificationMutex must be held.
+ */
+
+static void
+wake_main_loop(void)
+{
+  if (NotificationPipe[1] >= 0)
+  {
+    if (write(NotificationPipe[1], "", 1) < 0 && errno != EAGAIN)
+      serverLog(SERVER_LOGLEVEL_ERROR, "Unable to wake up main loop: %s", strerror(errno));
+  }
+}
+
+
+/*
+ * 'write_subscription()' - Write a subscription journal record.
+ *
+ * Note: SubscriptionJournalMutex must be held.
+ */
+
+static int				/* O - 1 on success, 0 on failure */
+write_subscription(
+    cups_file_t           *fp,		/* I - Journal file */
+    server_subscription_t *sub,		/* I - Subscription */
+    int                   canceled)	/* I - Subscription is going away? */
+{
+  ipp_t		*record;		/* Journal record */
+  int		ok;			/* Record written? */
+
+
+  record = ippNew();
+
+  ippSetOperation(record, canceled ? IPP_OP_CANCEL_SUBSCRIPTION : sub->job ? IPP_OP_CREATE_JOB_SUBSCRIPTIONS : sub->printer ? IPP_OP_CREATE_PRINTER_SUBSCRIPTIONS : IPP_OP_CREATE_SYSTEM_SUBSCRIPTIONS);
+  ippSetRequestId(record, 1);
+
+  ippAddInteger(record, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "notify-subscription-id", sub->id);
+
+  if (!canceled)
+  {
+    if (sub->printer)
+      ippAddString(record, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, sub->printer->default_uri);
+    if (sub->job)
+      ippAddInteger(record, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "notify-job-id", sub->job->id);
+
+    ippAddInteger(record, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "notify-lease-expiration-time", sub->expire == INT_MAX ? 0 : (int)sub->expire);
+    ippAddInteger(record, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "notify-time-interval", sub->interval);
+    ippAddInteger(record, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "notify-sequence-number", sub->saved_sequence);
+
+    ippCopyAttributes(record, sub->attrs, 0, NULL, NULL);
+  }
+
+  ok = ippWriteIO(fp, (ipp_iocb_t)cupsFileWrite, 1, NULL, record) == IPP_STATE_DATA;
+
+  ippDelete(record);
+
+  return (ok);
 }
@@ -9,25 +9,258 @@
  */
 
 #include "ippserver.h"
+#include <cups/dir.h>
 
 #ifdef _WIN32
 #  include <sys/timeb.h>
 #else
 #  include <signal.h>
 #  include <spawn.h>
+#  include <sys/socket.h>
+#  ifndef MSG_NOSIGNAL
+#    define MSG_NOSIGNAL 0
+#  endif /* !MSG_NOSIGNAL */
 #endif /* _WIN32 */
 
 
+#ifndef _WIN32
+/*
+ * Local types...
+ */
+
+typedef struct server_message_s		/**** Progress message being read ****/
+{
+  ipp_uchar_t	*ptr,			/* Current position in message */
+		*end;			/* End of message */
+} server_message_t;
+
+typedef struct server_render_s		/**** Transform cache output in progress ****/
+{
+  char		cachefile[1024],	/* Cache filename */
+		tempfile[1024];		/* Temporary filename */
+  size_t	written;		/* Bytes written so far */
+  int		status,			/* Exit status or -1 while running */
+		refs;			/* Number of users */
+} server_render_t;
+
+typedef struct server_stream_s		/**** Document data sent to a command ****/
+{
+  server_job_t	*job;			/* Job */
+  int		infd,			/* Print file */
+		outfd,			/* Command's standard input */
+		stop;			/* Non-zero to stop sending */
+} server_stream_t;
+
+typedef struct server_worker_s		/**** Transform worker process ****/
+{
+  char		*command;		/* Command */
+  int		pid,			/* Process ID */
+		fd,			/* Request socket */
+		cancelfd,		/* Cancel pipe for current job or -1 */
+		canceled,		/* Non-zero if current job was canceled */
+		jobs;			/* Number of jobs run */
+} server_worker_t;
+
+
+/*
+ * Local globals...
+ */
+
+static const char * const prerender_formats[3] =
+{					/* Prerendered output formats */
+  "image/urf",
+  "image/pwg-raster",
+  "application/vnd.hp-pcl"
+};
+static _cups_cond_t	prerender_cond = _CUPS_COND_INITIALIZER;
+					/* Prerender completion condition */
+static _cups_mutex_t	prerender_mutex = _CUPS_MUTEX_INITIALIZER;
+					/* Mutex for prerender threads */
+static _cups_cond_t	render_cond = _CUPS_COND_INITIALIZER;
+					/* Render progress condition */
+static cups_array_t	*renders = NULL;/* Renders in progress */
+static cups_array_t	*idle_workers = NULL;
+					/* Idle transform workers */
+static int		num_workers = 0;/* Number of transform workers */
+static _cups_cond_t	stream_cond = _CUPS_COND_INITIALIZER;
+					/* Streaming progress condition */
+static _cups_mutex_t	stream_mutex = _CUPS_MUTEX_INITIALIZER;
+					/* Mutex for streaming jobs */
+static _cups_mutex_t	workers_mutex = _CUPS_MUTEX_INITIALIZER;
+					/* Mutex for transform workers */
+#endif /* !_WIN32 */
+
+
 /*
  * Local functions...
  */
 
 #ifdef _WIN32
 static int	asprintf(char **s, const char *format, ...);
+#else
+static int	cache_filename(server_job_t *job, const char *format, char *filename, size_t filesize);
+static int	cache_follow(server_client_t *client, server_job_t *job, server_render_t *render, int fd, size_t *total);
+static ipp_t	*cache_read_attrs(const char *cachefile);
+static void	cache_trim(void);
+static int	cache_write_attrs(const char *cachefile, ipp_t *attrs);
+static int	compare_cache(cups_dentry_t *a, cups_dentry_t *b);
+static int	compare_renders(server_render_t *a, server_render_t *b);
+static int	prerender_format(ipp_attribute_t *supported, const char *format);
+static void	*prerender_job(server_job_t *job);
+static ssize_t	read_message(server_message_t *message, ipp_uchar_t *buffer, size_t bytes);
+static int	render_finish(server_render_t *render, int keep, ipp_t *attrs);
+static void	*stream_job(server_stream_t *stream);
 #endif /* _WIN32 */
-static void	process_attr_message(server_job_t *job, char *message, server_transform_t mode);
+static void	process_attr_message(server_job_t *job, char *message, server_transform_t mode, ipp_t *cacheattrs);
+static void	process_attrs(server_job_t *job, ipp_t *attrs, server_transform_t mode, ipp_t *cacheattrs);
+#ifndef _WIN32
+static int	process_progress(server_job_t *job, ipp_uchar_t *buffer, size_t *bufused, size_t bufsize, server_transform_t mode, ipp_t *cacheattrs);
+#endif /* !_WIN32 */
 static void	process_state_message(server_job_t *job, char *message);
 static double	time_seconds(void);
+#ifndef _WIN32
+static void	worker_cancel(server_worker_t *worker);
+static server_worker_t *worker_get(const char *command);
+static void	worker_put(server_worker_t *worker, int keep);
+static int	worker_send(server_worker_t *worker, const char *filename, char **envp, int outfd, int errfd, int progfd);
+static int	worker_status(server_worker_t *worker);
+#endif /* !_WIN32 */
+
+
+/*
+ * 'serverFinishJobStream()' - Mark the end of document data for a streaming
+ *                             job.
+ *
+ * When the document data is incomplete the job is aborted and the command
+ * that was reading it is stopped before it sees the end of the data.
+ */
+
+void
+serverFinishJobStream(
+    server_job_t *job,			/* I - Job */
+    int          complete)		/* I - 1 if all data was received, 0 on error */
+{
+#ifdef _WIN32
+  (void)job;
+  (void)complete;
+
+#else
+  _cupsMutexLock(&stream_mutex);
+
+  if (!complete)
+  {
+   /*
+    * Abort the job before marking the end of the data so that the streaming
+    * thread stops instead of sending the rest of the partial document...
+    */
+
+    _cupsRWLockWrite(&job->rwlock);
+
+    job->stream_aborted = 1;
+
+    if (job->state < IPP_JSTATE_CANCELED)
+      job->state = IPP_JSTATE_ABORTED;
+
+    if (job->transform_pid)
+      kill(job->transform_pid, SIGTERM);
+
+    _cupsRWUnlock(&job->rwlock);
+  }
+
+  job->streaming = 0;
+  _cupsCondBroadcast(&stream_cond);
+  _cupsMutexUnlock(&stream_mutex);
+#endif /* _WIN32 */
+}
+
+
+/*
+ * 'serverPrerenderJob()' - Start transforming a fetchable job ahead of time.
+ *
+ * The output for each format the registered devices accept is written to the
+ * transform cache so that Fetch-Document requests can be answered without
+ * waiting for the transform command to start.
+ */
+
+void
+serverPrerenderJob(server_job_t *job)	/* I - Job */
+{
+#ifdef _WIN32
+  (void)job;
+
+#else
+  _cups_thread_t	t;		/* Prerender thread */
+
+
+  if (!TransformAhead || TransformCacheSize <= 0)
+    return;
+
+  _cupsRWLockWrite(&job->rwlock);
+  job->prerendering = 1;
+  _cupsRWUnlock(&job->rwlock);
+
+  t = _cupsThreadCreate((_cups_thread_func_t)prerender_job, job);
+
+  if (t)
+  {
+    _cupsThreadDetach(t);
+  }
+  else
+  {
+    serverLogJob(SERVER_LOGLEVEL_ERROR, job, "Unable to create prerender thread: %s", strerror(errno));
+
+    _cupsRWLockWrite(&job->rwlock);
+    job->prerendering = 0;
+    _cupsRWUnlock(&job->rwlock);
+  }
+#endif /* _WIN32 */
+}
+
+
+/*
+ * 'serverStartJobStream()' - Start processing a job while its document data
+ *                            is still being received.
+ *
+ * Jobs are only streamed to printers with "StreamJobs" enabled and a command,
+ * and only for formats that can be read sequentially.  The command reads the
+ * document data from its standard input as it arrives.
+ */
+
+int					/* O - 1 if streaming, 0 otherwise */
+serverStartJobStream(
+    server_job_t *job,			/* I - Job */
+    const char   *filename)		/* I - Print file being written */
+{
+#ifdef _WIN32
+  (void)job;
+  (void)filename;
+
+  return (0);
+
+#else
+  server_printer_t	*printer = job->printer;
+					/* Printer */
+
+
+  if (!printer->pinfo.stream_jobs || !printer->pinfo.command || !job->format || (strcmp(job->format, "image/jpeg") && strcmp(job->format, "image/pwg-raster") && strcmp(job->format, "image/urf")))
+    return (0);
+
+  _cupsRWLockWrite(&job->rwlock);
+  job->filename = strdup(filename);
+  job->state    = IPP_JSTATE_PENDING;
+  _cupsRWUnlock(&job->rwlock);
+
+  _cupsMutexLock(&stream_mutex);
+  job->streaming = 1;
+  _cupsMutexUnlock(&stream_mutex);
+
+  serverLogJob(SERVER_LOGLEVEL_INFO, job, "Streaming \"%s\" document data to \"%s\".", job->format, printer->pinfo.command);
+
+  serverCheckJobs(printer);
+
+  return (1);
+#endif /* _WIN32 */
+}
 
 
 /*
@@ -48,6 +281,13 @@ serverStopJob(server_job_t *job)	/* I - Job to stop */
 #ifndef _WIN32 /* TODO: Figure out a way to kill a spawned process on Windows */
   if (job->transform_pid)
     kill(job->transform_pid, SIGTERM);
+  else if (job->transform_worker)
+    worker_cancel(job->transform_worker);
+
+  if (job->prerender_pid)
+    kill(job->prerender_pid, SIGTERM);
+  else if (job->prerender_worker)
+    worker_cancel(job->prerender_worker);
 #endif /* !_WIN32 */
   _cupsRWUnlock(&job->rwlock);
 
@@ -55,6 +295,50 @@ serverStopJob(server_job_t *job)	/* I - Job to stop */
 }
 
 
+/*
+ * 'serverStopPrerender()' - Stop transforming a job ahead of Fetch-Document.
+ *
+ * Called when a job is canceled or acknowledged.  When a device acknowledges
+ * the job, output in the format that device will fetch is left running.
+ */
+
+void
+serverStopPrerender(
+    server_job_t    *job,		/* I - Job */
+    server_device_t *device)		/* I - Device fetching the job or `NULL` */
+{
+#ifdef _WIN32
+  (void)job;
+  (void)device;
+
+#else
+  int	i = -1;				/* Format the device will fetch */
+
+
+  if (device)
+  {
+    _cupsRWLockRead(&device->rwlock);
+    i = prerender_format(ippFindAttribute(device->attrs, "document-format-supported", IPP_TAG_MIMETYPE), job->format);
+    _cupsRWUnlock(&device->rwlock);
+  }
+
+  _cupsRWLockWrite(&job->rwlock);
+
+  if ((job->prerender_pid || job->prerender_worker) && (i < 0 || strcmp(job->prerender_format, prerender_formats[i])))
+  {
+    serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Stopping transform to \"%s\" ahead of Fetch-Document.", job->prerender_format);
+
+    if (job->prerender_pid)
+      kill(job->prerender_pid, SIGTERM);
+    else
+      worker_cancel(job->prerender_worker);
+  }
+
+  _cupsRWUnlock(&job->rwlock);
+#endif /* _WIN32 */
+}
+
+
 /*
  * 'serverTransformJob()' - Generate printer-ready document data for a Job.
  */
@@ -74,23 +358,42 @@ serverTransformJob(
                 end;			/* End time */
   char		*myargv[3],		/* Command-line arguments */
 		*myenvp[400];		/* Environment variables */
-  int		myenvc;			/* Number of environment variables */
+  int		myenvc,			/* Number of environment variables */
+		myenvbase;		/* Number of inherited environment variables */
   ipp_attribute_t *attr;		/* Job attribute */
   char		val[1280],		/* IPP_NAME=value */
                 *valptr,		/* Pointer into string */
                 fullcommand[1024];	/* Full command path */
 #ifndef _WIN32
   posix_spawn_file_actions_t actions;	/* Spawn file actions */
-  int		mystdout[2] = {-1, -1},	/* Pipe for stdout */
-		mystderr[2] = {-1, -1};	/* Pipe for stderr */
-  struct pollfd	polldata[2];		/* Poll data */
+  int		mystdin[2] = {-1, -1},	/* Pipe for stdin */
+		mystdout[2] = {-1, -1},	/* Pipe for stdout */
+		mystderr[2] = {-1, -1},	/* Pipe for stderr */
+		myprogress[2] = {-1, -1};
+					/* Pipe for progress messages */
+  struct pollfd	polldata[3];		/* Poll data */
   int		pollcount;		/* Number of pipes to poll */
+  int		killed = 0,		/* Stopped the command? */
+		canceled = 0;		/* Worker job canceled? */
+  ipp_uchar_t	progress[8192];		/* Progress messages */
+  size_t	progused = 0;		/* Bytes in progress buffer */
+  int		progerror = 0;		/* Bad progress message? */
   char		data[32768],		/* Data from stdout */
 		line[2048],		/* Line from stderr */
                 *ptr,			/* Pointer into line */
                 *endptr;		/* End of line */
   ssize_t	bytes;			/* Bytes read */
   size_t	total = 0;		/* Total bytes read */
+  int		cachefd = -1;		/* Transform cache file */
+  char		cachefile[1024],	/* Transform cache filename */
+		tempfile[1024];		/* Temporary cache filename */
+  server_render_t *render = NULL;	/* Transform cache output in progress */
+  ipp_t		*cacheattrs = NULL;	/* Job attributes reported for the cache */
+  server_worker_t *worker = NULL;	/* Transform worker, if any */
+  int		streaming,		/* Stream document data to stdin? */
+		aborted;		/* Streamed document data incomplete? */
+  server_stream_t stream;		/* Document data stream */
+  _cups_thread_t streamthread = 0;	/* Document data thread */
 #endif /* !_WIN32 */
 
 
@@ -100,6 +403,164 @@ serverTransformJob(
     command = fullcommand;
   }
 
+#ifndef _WIN32
+  if ((mode == SERVER_TRANSFORM_TO_CACHE || mode == SERVER_TRANSFORM_TO_CLIENT) && cache_filename(job, format, cachefile, sizeof(cachefile)))
+  {
+    server_render_t	key,		/* Search key */
+			*follow;	/* Render in progress */
+
+    strlcpy(key.cachefile, cachefile, sizeof(key.cachefile));
+
+    _cupsMutexLock(&TransformCacheMutex);
+
+    if ((cachefd = open(cachefile, O_RDONLY | O_BINARY)) >= 0)
+    {
+     /*
+      * Replay the job attributes the command reported for this output...
+      */
+
+      cacheattrs = cache_read_attrs(cachefile);
+
+      _cupsMutexUnlock(&TransformCacheMutex);
+
+      if (cacheattrs)
+      {
+        process_attrs(job, cacheattrs, mode, NULL);
+        ippDelete(cacheattrs);
+      }
+
+      if (mode == SERVER_TRANSFORM_TO_CACHE)
+      {
+        close(cachefd);
+        return (0);
+      }
+
+     /*
+      * Send the output of an earlier transform, marking it as recently
+      * used...
+      */
+
+      serverLogJob(SERVER_LOGLEVEL_INFO, job, "Sending cached transform output \"%s\".", cachefile);
+
+      futimens(cachefd, NULL);
+
+      while ((bytes = read(cachefd, data, sizeof(data))) > 0)
+      {
+        if (httpWrite2(client->http, data, (size_t)bytes) < 0)
+          break;
+
+	total += (size_t)bytes;
+      }
+
+      close(cachefd);
+
+      serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Total cached output is %ld bytes.", (long)total);
+
+      return (0);
+    }
+    else if ((follow = (server_render_t *)cupsArrayFind(renders, &key)) != NULL && mode == SERVER_TRANSFORM_TO_CACHE)
+    {
+      _cupsMutexUnlock(&TransformCacheMutex);
+      return (0);
+    }
+    else if (follow && (cachefd = open(follow->tempfile, O_RDONLY | O_BINARY)) >= 0)
+    {
+     /*
+      * Another thread is already producing this output, so send it as it
+      * is written...
+      */
+
+      follow->refs ++;
+
+      _cupsMutexUnlock(&TransformCacheMutex);
+
+      serverLogJob(SERVER_LOGLEVEL_INFO, job, "Sending transform output in progress \"%s\".", follow->tempfile);
+
+      status = cache_follow(client, job, follow, cachefd, &total);
+
+      close(cachefd);
+      cachefd = -1;
+
+      serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Total followed output is %ld bytes.", (long)total);
+
+      if (!status)
+      {
+        _cupsMutexLock(&TransformCacheMutex);
+        cacheattrs = cache_read_attrs(cachefile);
+        _cupsMutexUnlock(&TransformCacheMutex);
+
+        if (cacheattrs)
+        {
+          process_attrs(job, cacheattrs, mode, NULL);
+          ippDelete(cacheattrs);
+        }
+
+        return (0);
+      }
+      else if (total > 0)
+        return (status);
+
+     /*
+      * The other transform failed before producing anything, so try again
+      * ourselves...
+      */
+
+      _cupsMutexLock(&TransformCacheMutex);
+    }
+
+   /*
+    * Otherwise save a copy of the output for the next request...
+    */
+
+    snprintf(tempfile, sizeof(tempfile), "%s.XXXXXX", cachefile);
+
+    if (cupsArrayFind(renders, &key))
+    {
+      serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Unable to follow transform output in progress, not caching.");
+    }
+    else if ((cachefd = mkstemp(tempfile)) < 0)
+    {
+      serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Unable to create transform cache file \"%s\": %s", tempfile, strerror(errno));
+    }
+    else if ((render = calloc(1, sizeof(server_render_t))) == NULL || (!renders && (renders = cupsArrayNew((cups_array_func_t)compare_renders, NULL)) == NULL) || (cacheattrs = ippNew()) == NULL)
+    {
+      free(render);
+      render = NULL;
+
+      close(cachefd);
+      unlink(tempfile);
+      cachefd = -1;
+    }
+    else
+    {
+      strlcpy(render->cachefile, cachefile, sizeof(render->cachefile));
+      strlcpy(render->tempfile, tempfile, sizeof(render->tempfile));
+      render->status = -1;
+      render->refs   = 1;
+
+      cupsArrayAdd(renders, render);
+    }
+
+    _cupsMutexUnlock(&TransformCacheMutex);
+  }
+
+  if (mode == SERVER_TRANSFORM_TO_CACHE && !render)
+    return (-1);
+
+  _cupsMutexLock(&stream_mutex);
+  streaming = mode == SERVER_TRANSFORM_COMMAND && job->streaming;
+  aborted   = mode == SERVER_TRANSFORM_COMMAND && job->stream_aborted;
+  _cupsMutexUnlock(&stream_mutex);
+
+  if (aborted)
+  {
+    serverLogJob(SERVER_LOGLEVEL_INFO, job, "Document data is incomplete, not running \"%s\".", command);
+    return (-1);
+  }
+
+  stream.infd = -1;
+#endif /* !_WIN32 */
+
   serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Running command \"%s %s\".", command, job->filename);
   start = time_seconds();
 
@@ -111,6 +572,11 @@ serverTransformJob(
   myargv[1] = job->filename;
   myargv[2] = NULL;
 
+#ifndef _WIN32
+  if (streaming)
+    myargv[1] = NULL;			/* Document data is sent on stdin */
+#endif /* !_WIN32 */
+
  /*
   * Copy the current environment, then add environment variables for every
   * Job attribute and select Printer attributes...
@@ -119,6 +585,8 @@ serverTransformJob(
   for (myenvc = 0; environ[myenvc] && myenvc < (int)(sizeof(myenvp) / sizeof(myenvp[0]) - 1); myenvc ++)
     myenvp[myenvc] = strdup(environ[myenvc]);
 
+  myenvbase = myenvc;
+
   if (myenvc > (int)(sizeof(myenvp) / sizeof(myenvp[0]) - 32))
   {
     serverLogJob(SERVER_LOGLEVEL_ERROR, job, "Too many environment variables to transform job.");
@@ -134,6 +602,10 @@ serverTransformJob(
   if (format && asprintf(myenvp + myenvc, "OUTPUT_TYPE=%s", format) > 0)
     myenvc ++;
 
+#ifndef _WIN32
+  myenvp[myenvc ++] = strdup("SERVER_PROGRESS_FD=3");
+#endif /* !_WIN32 */
+
   for (attr = ippFirstAttribute(job->printer->dev_attrs); attr && myenvc < (int)(sizeof(myenvp) / sizeof(myenvp[0]) - 1); attr = ippNextAttribute(job->printer->dev_attrs))
   {
    /*
@@ -292,7 +764,7 @@ serverTransformJob(
   status = _spawnvpe(_P_WAIT, command, myargv, myenvp);
 
 #else
-  if (mode == SERVER_TRANSFORM_TO_CLIENT)
+  if (mode == SERVER_TRANSFORM_TO_CACHE || mode == SERVER_TRANSFORM_TO_CLIENT)
   {
     if (pipe(mystdout))
     {
@@ -325,72 +797,197 @@ serverTransformJob(
     goto transform_failure;
   }
 
-  posix_spawn_file_actions_init(&actions);
-  posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY | O_BINARY, 0);
-  if (mystdout[1] < 0)
-    posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY | O_BINARY, 0);
-  else
-    posix_spawn_file_actions_adddup2(&actions, mystdout[1], 1);
-
-  if (mystderr[1] < 0)
-    posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY | O_BINARY, 0);
-  else
-    posix_spawn_file_actions_adddup2(&actions, mystderr[1], 2);
-
-  if (posix_spawn(&pid, command, &actions, NULL, myargv, myenvp))
+  if (pipe(myprogress))
   {
-    serverLogJob(SERVER_LOGLEVEL_ERROR, job, "Unable to start job processing command: %s", strerror(errno));
-
-    posix_spawn_file_actions_destroy(&actions);
-
+    serverLogJob(SERVER_LOGLEVEL_ERROR, job, "Unable to create pipe for progress messages: %s", strerror(errno));
     goto transform_failure;
   }
 
-  job->transform_pid = pid;
-
-  serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Started job processing command, pid=%d", pid);
+  fcntl(myprogress[0], F_SETFD, FD_CLOEXEC);
 
- /*
-  * Free memory used for command...
-  */
+  if (streaming)
+  {
+   /*
+    * Send the document data to the command as it is received...
+    */
 
-  posix_spawn_file_actions_destroy(&actions);
+    if (pipe(mystdin))
+    {
+      serverLogJob(SERVER_LOGLEVEL_ERROR, job, "Unable to create pipe for stdin: %s", strerror(errno));
+      goto transform_failure;
+    }
 
-  while (myenvc > 0)
-    free(myenvp[-- myenvc]);
+    fcntl(mystdin[1], F_SETFD, FD_CLOEXEC);
 
- /*
-  * Read from the stdout and stderr pipes until EOF...
-  */
+    if ((stream.infd = open(job->filename, O_RDONLY | O_BINARY)) < 0)
+    {
+      serverLogJob(SERVER_LOGLEVEL_ERROR, job, "Unable to open print file \"%s\": %s", job->filename, strerror(errno));
+      goto transform_failure;
+    }
+  }
 
-  close(mystdout[1]);
-  close(mystderr[1]);
+  if (!streaming && (worker = worker_get(command)) != NULL && worker_send(worker, job->filename, myenvp + myenvbase, mystdout[1], mystderr[1], myprogress[1]))
+  {
+   /*
+    * The worker has gone away since its last job, so run the command
+    * directly...
+    */
 
-  endptr = line;
+    serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Unable to send job to transform worker %d: %s", worker->pid, strerror(errno));
 
-  pollcount = 0;
-  polldata[pollcount].fd     = mystderr[0];
-  polldata[pollcount].events = POLLIN;
-  pollcount ++;
+    worker_put(worker, 0);
+    worker = NULL;
+  }
 
-  if (mystdout[0] >= 0)
+  if (worker)
   {
-    polldata[pollcount].fd     = mystdout[0];
-    polldata[pollcount].events = POLLIN;
-    pollcount ++;
+    pid = worker->pid;
   }
-
-  while (poll(polldata, (nfds_t)pollcount, -1) > 0)
+  else
   {
-    if (polldata[0].revents & POLLIN)
-    {
-      if ((bytes = read(mystderr[0], endptr, sizeof(line) - (size_t)(endptr - line) - 1)) > 0)
-      {
-	endptr += bytes;
-	*endptr = '\0';
+    posix_spawn_file_actions_init(&actions);
+    if (mystdin[0] < 0)
+      posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY | O_BINARY, 0);
+    else
+      posix_spawn_file_actions_adddup2(&actions, mystdin[0], 0);
 
-	while ((ptr = strchr(line, '\n')) != NULL)
-	{
+    if (mystdout[1] < 0)
+      posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY | O_BINARY, 0);
+    else
+      posix_spawn_file_actions_adddup2(&actions, mystdout[1], 1);
+
+    if (mystderr[1] < 0)
+      posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY | O_BINARY, 0);
+    else
+      posix_spawn_file_actions_adddup2(&actions, mystderr[1], 2);
+
+    posix_spawn_file_actions_adddup2(&actions, myprogress[1], 3);
+
+    if (posix_spawn(&pid, command, &actions, NULL, myargv, myenvp))
+    {
+      serverLogJob(SERVER_LOGLEVEL_ERROR, job, "Unable to start job processing command: %s", strerror(errno));
+
+      posix_spawn_file_actions_destroy(&actions);
+
+      goto transform_failure;
+    }
+
+    posix_spawn_file_actions_destroy(&actions);
+  }
+
+  _cupsRWLockWrite(&job->rwlock);
+
+  if (mode != SERVER_TRANSFORM_TO_CACHE)
+  {
+    job->transform_pid    = worker ? 0 : pid;
+    job->transform_worker = worker;
+  }
+  else
+  {
+    job->prerender_pid    = worker ? 0 : pid;
+    job->prerender_worker = worker;
+    job->prerender_format = format;
+  }
+
+  _cupsRWUnlock(&job->rwlock);
+
+  serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Started job processing command, pid=%d", pid);
+
+  if (streaming)
+  {
+   /*
+    * Stop the command if the document data was aborted while it started...
+    */
+
+    _cupsMutexLock(&stream_mutex);
+    if (job->stream_aborted)
+      kill(pid, SIGTERM);
+    _cupsMutexUnlock(&stream_mutex);
+  }
+
+  if (streaming)
+  {
+    close(mystdin[0]);
+
+    stream.job   = job;
+    stream.outfd = mystdin[1];
+    stream.stop  = 0;
+
+    if ((streamthread = _cupsThreadCreate((_cups_thread_func_t)stream_job, &stream)) == 0)
+    {
+      serverLogJob(SERVER_LOGLEVEL_ERROR, job, "Unable to create streaming thread: %s", strerror(errno));
+
+      close(stream.infd);
+      close(stream.outfd);
+    }
+  }
+
+ /*
+  * Free memory used for command...
+  */
+
+  while (myenvc > 0)
+    free(myenvp[-- myenvc]);
+
+ /*
+  * Read from the stdout and stderr pipes until EOF...
+  */
+
+  close(mystdout[1]);
+  close(mystderr[1]);
+  close(myprogress[1]);
+
+  endptr = line;
+
+  polldata[0].fd     = mystderr[0];
+  polldata[0].events = POLLIN;
+  polldata[1].fd     = myprogress[0];
+  polldata[1].events = POLLIN;
+  polldata[2].fd     = mystdout[0];
+  polldata[2].events = POLLIN;
+
+  pollcount = mystdout[0] >= 0 ? 3 : 2;
+
+  while (polldata[0].fd >= 0 || polldata[1].fd >= 0 || (pollcount > 2 && polldata[2].fd >= 0))
+  {
+    if (mode == SERVER_TRANSFORM_TO_CACHE && !killed && (job->cancel || job->state >= IPP_JSTATE_CANCELED))
+    {
+     /*
+      * Stop transforming ahead once the job is canceled or finished...
+      */
+
+      serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Job is no longer fetchable, stopping command.");
+
+      if (worker)
+      {
+        _cupsRWLockWrite(&job->rwlock);
+        worker_cancel(worker);
+        _cupsRWUnlock(&job->rwlock);
+      }
+      else
+        kill(pid, SIGTERM);
+
+      killed = 1;
+    }
+
+    if (poll(polldata, (nfds_t)pollcount, mode == SERVER_TRANSFORM_TO_CACHE ? 1000 : -1) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      serverLogJob(SERVER_LOGLEVEL_ERROR, job, "Unable to poll job processing command: %s", strerror(errno));
+      break;
+    }
+
+    if (polldata[0].revents & (POLLIN | POLLHUP | POLLERR))
+    {
+      if ((bytes = read(mystderr[0], endptr, sizeof(line) - (size_t)(endptr - line) - 1)) > 0)
+      {
+	endptr += bytes;
+	*endptr = '\0';
+
+	while ((ptr = strchr(line, '\n')) != NULL)
+	{
 	  *ptr++ = '\0';
 
 	  if (!strncmp(line, "STATE:", 6))
@@ -407,7 +1004,7 @@ serverTransformJob(
 	    * Process job/printer attribute update.
 	    */
 
-	    process_attr_message(job, line, mode);
+	    process_attr_message(job, line, mode, cacheattrs);
 	  }
 	  else
 	    serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "%s: %s", command, line);
@@ -418,19 +1015,74 @@ serverTransformJob(
 	  endptr -= bytes;
 	  *endptr = '\0';
 	}
+
+        if (endptr >= (line + sizeof(line) - 1))
+        {
+         /*
+          * Log overlong lines in pieces so they don't stop us from reading...
+          */
+
+	  serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "%s: %s", command, line);
+	  endptr = line;
+        }
+      }
+      else if (!bytes || errno != EINTR)
+        polldata[0].fd = -1;		/* End of stderr */
+    }
+
+    if (polldata[1].revents & (POLLIN | POLLHUP | POLLERR))
+    {
+      if ((bytes = read(myprogress[0], progress + progused, sizeof(progress) - progused)) > 0)
+      {
+       /*
+        * Process complete progress messages, ignoring everything after a bad
+        * one since we can't find the next message...
+        */
+
+        progused += (size_t)bytes;
+
+        if (progerror)
+          progused = 0;
+        else if (!process_progress(job, progress, &progused, sizeof(progress), mode, cacheattrs))
+          progerror = 1;
       }
+      else if (!bytes || errno != EINTR)
+        polldata[1].fd = -1;		/* End of progress messages */
     }
-    else if (pollcount > 1 && polldata[1].revents & POLLIN)
+
+    if (pollcount > 2 && (polldata[2].revents & (POLLIN | POLLHUP | POLLERR)))
     {
       if ((bytes = read(mystdout[0], data, sizeof(data))) > 0)
       {
-	httpWrite2(client->http, data, (size_t)bytes);
+	if (client)
+	  httpWrite2(client->http, data, (size_t)bytes);
 	total += (size_t)bytes;
+
+        if (cachefd >= 0 && write(cachefd, data, (size_t)bytes) != bytes)
+        {
+          serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Unable to write transform cache file \"%s\": %s", tempfile, strerror(errno));
+
+          close(cachefd);
+          cachefd = -1;
+
+          render_finish(render, 0, NULL);
+          render = NULL;
+        }
+        else if (cachefd >= 0)
+        {
+         /*
+          * Let anyone following this output know there is more...
+          */
+
+          _cupsMutexLock(&TransformCacheMutex);
+          render->written += (size_t)bytes;
+          _cupsCondBroadcast(&render_cond);
+          _cupsMutexUnlock(&TransformCacheMutex);
+        }
       }
+      else if (!bytes || errno != EINTR)
+        polldata[2].fd = -1;		/* End of output */
     }
-
-    if (polldata[0].revents & POLLHUP)
-      break;
   }
 
   if (mystdout[0] >= 0)
@@ -441,6 +1093,21 @@ serverTransformJob(
   }
 
   close(mystderr[0]);
+  close(myprogress[0]);
+
+  if (streamthread)
+  {
+   /*
+    * The command is done, so stop sending it document data...
+    */
+
+    _cupsMutexLock(&stream_mutex);
+    stream.stop = 1;
+    _cupsCondBroadcast(&stream_cond);
+    _cupsMutexUnlock(&stream_mutex);
+
+    _cupsThreadWait(streamthread);
+  }
 
   if (endptr > line)
   {
@@ -455,13 +1122,49 @@ serverTransformJob(
   * Wait for child to complete...
   */
 
+  if (worker)
+  {
+    status = worker_status(worker);
+  }
+  else
+  {
 #  ifdef HAVE_WAITPID
-  while (waitpid(pid, &status, 0) < 0);
+    while (waitpid(pid, &status, 0) < 0);
 #  else
-  while (wait(&status) < 0);
+    while (wait(&status) < 0);
 #  endif /* HAVE_WAITPID */
+  }
+
+  _cupsRWLockWrite(&job->rwlock);
+
+  if (mode != SERVER_TRANSFORM_TO_CACHE)
+  {
+    job->transform_pid    = 0;
+    job->transform_worker = NULL;
+  }
+  else
+  {
+    job->prerender_pid    = 0;
+    job->prerender_worker = NULL;
+    job->prerender_format = NULL;
+  }
+
+  if (worker)
+    canceled = worker->canceled;
+
+  _cupsRWUnlock(&job->rwlock);
 
-  job->transform_pid = 0;
+  if (cachefd >= 0)
+  {
+   /*
+    * Only keep complete output in the cache...
+    */
+
+    if (render_finish(render, !close(cachefd) && !status && total > 0, cacheattrs))
+      cache_trim();
+  }
+
+  ippDelete(cacheattrs);
 #endif /* _WIN32 */
 
   end = time_seconds();
@@ -474,11 +1177,20 @@ serverTransformJob(
 #else
   if (status)
   {
-    if (WIFEXITED(status))
+    if (worker && status < 0)
+      serverLogJob(SERVER_LOGLEVEL_ERROR, job, "Transform worker %d stopped unexpectedly.", worker->pid);
+    else if (worker && canceled)
+      serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Transform worker %d canceled the job.", worker->pid);
+    else if (worker)
+      serverLogJob(SERVER_LOGLEVEL_ERROR, job, "Transform command exited with status %d.", status);
+    else if (WIFEXITED(status))
       serverLogJob(SERVER_LOGLEVEL_ERROR, job, "Transform command exited with status %d.", WEXITSTATUS(status));
     else if (WIFSIGNALED(status) && WTERMSIG(status) != SIGTERM)
       serverLogJob(SERVER_LOGLEVEL_ERROR, job, "Transform command crashed on signal %d.", WTERMSIG(status));
   }
+
+  if (worker)
+    worker_put(worker, status >= 0);
 #endif /* _WIN32 */
 
   return (status);
@@ -490,6 +1202,13 @@ serverTransformJob(
   transform_failure:
 
   #ifndef _WIN32
+  if (mystdin[0] >= 0)
+    close(mystdin[0]);
+  if (mystdin[1] >= 0)
+    close(mystdin[1]);
+  if (stream.infd >= 0)
+    close(stream.infd);
+
   if (mystdout[0] >= 0)
     close(mystdout[0]);
   if (mystdout[1] >= 0)
@@ -499,6 +1218,19 @@ serverTransformJob(
     close(mystderr[0]);
   if (mystderr[1] >= 0)
     close(mystderr[1]);
+
+  if (myprogress[0] >= 0)
+    close(myprogress[0]);
+  if (myprogress[1] >= 0)
+    close(myprogress[1]);
+
+  if (cachefd >= 0)
+  {
+    close(cachefd);
+    render_finish(render, 0, NULL);
+  }
+
+  ippDelete(cacheattrs);
 #endif /* !_WIN32 */
 
   while (myenvc > 0)
@@ -508,6 +1240,27 @@ serverTransformJob(
 }
 
 
+/*
+ * 'serverWaitPrerender()' - Wait for a job's prerender thread to finish.
+ */
+
+void
+serverWaitPrerender(server_job_t *job)	/* I - Job */
+{
+#ifdef _WIN32
+  (void)job;
+
+#else
+  _cupsMutexLock(&prerender_mutex);
+
+  while (job->prerendering)
+    _cupsCondWait(&prerender_cond, &prerender_mutex, 1.0);
+
+  _cupsMutexUnlock(&prerender_mutex);
+#endif /* _WIN32 */
+}
+
+
 #ifdef _WIN32
 /*
  * 'asprintf()' - Format and allocate a string.
@@ -537,159 +1290,824 @@ asprintf(char       **s,		/* O - Allocated string or `NULL` on error */
 #endif /* _WIN32 */
 
 
+#ifndef _WIN32
 /*
- * 'process_attr_message()' - Process an ATTR: message from a command.
+ * 'cache_filename()' - Get the transform cache filename for a job.
+ *
+ * The cache is content-addressed: the filename is a SHA2-256 hash of the
+ * print file, the output format, and the job, document, and printer default
+ * attributes that are passed to the transform command.
  */
 
-static void
-process_attr_message(
-    server_job_t       *job,		/* I - Job */
-    char               *message,	/* I - Message */
-    server_transform_t mode)		/* I - Transform mode */
+static int				/* O - 1 on success, 0 if not cached */
+cache_filename(
+    server_job_t *job,			/* I - Job */
+    const char   *format,		/* I - Output format */
+    char         *filename,		/* I - Filename buffer */
+    size_t       filesize)		/* I - Size of filename buffer */
 {
-  int		i,			/* Looping var */
-		num_options = 0;	/* Number of name=value pairs */
-  cups_option_t	*options = NULL,	/* name=value pairs from message */
-		*option;		/* Current option */
-  ipp_attribute_t *attr;		/* Current attribute */
-
+  int			i,		/* Looping var */
+			fd;		/* Print file */
+  unsigned char		buffer[32800],	/* Read buffer */
+			digest[32];	/* SHA2-256 digest */
+  ssize_t		bytes;		/* Bytes read */
+  char			*data,		/* Key data */
+			*temp;		/* New key data buffer */
+  size_t		datalen,	/* Length of key data */
+			datasize,	/* Size of key data buffer */
+			len;		/* Length of current value */
+  ipp_t			*sources[4];	/* Attributes to hash */
+  ipp_attribute_t	*attr;		/* Current attribute */
+  const char		*name,		/* Attribute name */
+			*suffix;	/* Suffix on attribute name */
+  char			hexdigest[65],	/* Hex digest */
+			cachedir[1024];	/* Cache directory */
+  static const char * const skip[] =	/* Job attributes that don't affect output */
+  {
+    "date-time-at-",
+    "document-format-",
+    "job-hold-until",
+    "job-id",
+    "job-impressions",
+    "job-media-sheets",
+    "job-priority",
+    "job-printer-uri",
+    "job-uri",
+    "job-uuid",
+    "time-at-"
+  };
+
+
+  if (TransformCacheSize <= 0 || !job->filename)
+    return (0);
 
  /*
-  * Grab attributes from the message line...
+  * Hash the print file in chunks, chaining the digest of each chunk into the
+  * next...
   */
 
-  serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "%s", message);
-
-  num_options = cupsParseOptions(message + 5, num_options, &options);
-
-  serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "num_options=%d", num_options);
+  if ((fd = open(job->filename, O_RDONLY | O_BINARY)) < 0)
+    return (0);
 
- /*
-  * Loop through the options and record them in the printer or job objects...
-  */
+  memset(digest, 0, sizeof(digest));
 
-  for (i = num_options, option = options; i > 0; i --, option ++)
+  while ((bytes = read(fd, buffer + sizeof(digest), sizeof(buffer) - sizeof(digest))) > 0)
   {
-    serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "options[%d].name=\"%s\", .value=\"%s\"", num_options - i, option->name, option->value);
+    memcpy(buffer, digest, sizeof(digest));
 
-    if (!strcmp(option->name, "job-impressions"))
+    if (cupsHashData("sha2-256", buffer, (size_t)bytes + sizeof(digest), digest, sizeof(digest)) != (ssize_t)sizeof(digest))
     {
-     /*
-      * Update job-impressions attribute...
-      */
+      bytes = -1;
+      break;
+    }
+  }
 
-      serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Setting Job Status attribute \"%s\" to \"%s\".", option->name, option->value);
+  close(fd);
 
-      _cupsRWLockWrite(&job->rwlock);
+  if (bytes < 0)
+    return (0);
 
-      job->impressions = atoi(option->value);
+ /*
+  * Then hash the file digest with the output format and attributes...
+  */
 
-      _cupsRWUnlock(&job->rwlock);
-    }
-    else if (mode == SERVER_TRANSFORM_COMMAND && !strcmp(option->name, "job-impressions-completed"))
-    {
-     /*
-      * Update job-impressions-completed attribute...
-      */
+  sources[0] = job->doc_attrs;
+  sources[1] = job->attrs;
+  sources[2] = job->printer->dev_attrs;
+  sources[3] = job->printer->pinfo.attrs;
 
-      serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Setting Job Status attribute \"%s\" to \"%s\".", option->name, option->value);
+  datasize = 4096;
 
-      _cupsRWLockWrite(&job->rwlock);
+  if ((data = malloc(datasize)) == NULL)
+    return (0);
 
-      job->impcompleted = atoi(option->value);
+  snprintf(data, datasize, "%s\n%s\n", cupsHashString(digest, sizeof(digest), hexdigest, sizeof(hexdigest)), format);
+  datalen = strlen(data);
 
-      _cupsRWUnlock(&job->rwlock);
-    }
-    else if (!strcmp(option->name, "job-impressions-col") || !strcmp(option->name, "job-media-sheets") || !strcmp(option->name, "job-media-sheets-col") ||
-        (mode == SERVER_TRANSFORM_COMMAND && (!strcmp(option->name, "job-impressions-completed-col") || !strcmp(option->name, "job-media-sheets-completed") || !strcmp(option->name, "job-media-sheets-completed-col"))))
+  for (i = 0; i < 4; i ++)
+  {
+    for (attr = ippFirstAttribute(sources[i]); attr; attr = ippNextAttribute(sources[i]))
     {
-     /*
-      * Update Job Status attribute...
-      */
+      if ((name = ippGetName(attr)) == NULL)
+        continue;
 
-      serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Setting Job Status attribute \"%s\" to \"%s\".", option->name, option->value);
+      if (i == 1)
+      {
+        size_t j;			/* Looping var */
 
-      _cupsRWLockWrite(&job->rwlock);
+        for (j = 0; j < (sizeof(skip) / sizeof(skip[0])); j ++)
+        {
+          if (!strncmp(name, skip[j], strlen(skip[j])))
+            break;
+        }
 
-      if ((attr = ippFindAttribute(job->attrs, option->name, IPP_TAG_ZERO)) != NULL)
-        ippDeleteAttribute(job->attrs, attr);
+        if (j < (sizeof(skip) / sizeof(skip[0])) || ippFindAttribute(job->doc_attrs, name, IPP_TAG_ZERO))
+          continue;
+      }
+      else if (i > 1)
+      {
+        if (strncmp(name, "pwg-", 4) && ((suffix = strstr(name, "-default")) == NULL || suffix[8]))
+          continue;
 
-      cupsEncodeOption(job->attrs, IPP_TAG_JOB, option->name, option->value);
+        if (i == 3 && ippFindAttribute(job->printer->dev_attrs, name, IPP_TAG_ZERO))
+          continue;
+      }
 
-      _cupsRWUnlock(&job->rwlock);
-    }
-    else if (!strncmp(option->name, "marker-", 7) || !strcmp(option->name, "printer-alert") || !strcmp(option->name, "printer-supply") || !strcmp(option->name, "printer-supply-description"))
-    {
      /*
-      * Update Printer Status attribute...
+      * Add "name=value\n" to the key data...
       */
 
-      serverLogPrinter(SERVER_LOGLEVEL_DEBUG, job->printer, "Setting Printer Status attribute \"%s\" to \"%s\".", option->name, option->value);
+      len = strlen(name) + ippAttributeString(attr, NULL, 0) + 3;
 
-      _cupsRWLockWrite(&job->printer->rwlock);
+      if (datalen + len > datasize)
+      {
+        if ((temp = realloc(data, datasize + len + 4096)) == NULL)
+        {
+          free(data);
+          return (0);
+        }
+
+        data     = temp;
+        datasize += len + 4096;
+      }
 
-      if ((attr = ippFindAttribute(job->printer->pinfo.attrs, option->name, IPP_TAG_ZERO)) != NULL)
-        ippDeleteAttribute(job->printer->pinfo.attrs, attr);
+      snprintf(data + datalen, datasize - datalen, "%s=", name);
+      datalen += strlen(data + datalen);
+      datalen += ippAttributeString(attr, data + datalen, datasize - datalen);
+      data[datalen ++] = '\n';
+    }
+  }
 
-      cupsEncodeOption(job->printer->pinfo.attrs, IPP_TAG_PRINTER, option->name, option->value);
+  bytes = cupsHashData("sha2-256", data, datalen, digest, sizeof(digest));
 
-      _cupsRWUnlock(&job->printer->rwlock);
-    }
-    else
-    {
-     /*
-      * Something else that isn't currently supported...
-      */
+  free(data);
 
-      serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Ignoring attribute \"%s\" with value \"%s\".", option->name, option->value);
-    }
+  if (bytes != (ssize_t)sizeof(digest))
+    return (0);
+
+  snprintf(cachedir, sizeof(cachedir), "%s/cache", SpoolDirectory);
+
+  if (mkdir(cachedir, 0700) && errno != EEXIST)
+  {
+    serverLogJob(SERVER_LOGLEVEL_ERROR, job, "Unable to create transform cache directory \"%s\": %s", cachedir, strerror(errno));
+    return (0);
   }
 
-  cupsFreeOptions(num_options, options);
+  snprintf(filename, filesize, "%s/%s", cachedir, cupsHashString(digest, sizeof(digest), hexdigest, sizeof(hexdigest)));
+
+  return (1);
 }
 
 
 /*
- * 'process_state_message()' - Process a STATE: message from a command.
+ * 'cache_follow()' - Send transform output that another thread is writing.
  */
 
-static void
-process_state_message(
-    server_job_t *job,			/* I - Job */
-    char         *message)		/* I - Message */
+static int				/* O - 0 on success, non-zero on error */
+cache_follow(
+    server_client_t *client,		/* I - Client connection */
+    server_job_t    *job,		/* I - Job */
+    server_render_t *render,		/* I - Render in progress */
+    int             fd,			/* I - Temporary file */
+    size_t          *total)		/* IO - Total bytes sent */
 {
-  int		i;			/* Looping var */
-  server_preason_t preasons,		/* printer-state-reasons values */
-		pbit;			/* Current printer reason bit */
-  server_jreason_t jreasons,		/* job-state-reasons values */
-		jbit;			/* Current job reason bit */
-  char		*ptr,			/* Pointer into message */
-		*next;			/* Next keyword in message */
-  int		remove;			/* Non-zero if we are removing keywords */
+  int		status;			/* Render status */
+  size_t	avail;			/* Bytes available to send */
+  ssize_t	bytes;			/* Bytes read */
+  char		data[32768];		/* Data from file */
 
 
- /*
-  * Skip leading "STATE:" and any whitespace...
-  */
+  for (;;)
+  {
+   /*
+    * Wait for more output or the end of the transform...
+    */
 
-  for (message += 6; *message; message ++)
-    if (*message != ' ' && *message != '\t')
-      break;
+    _cupsMutexLock(&TransformCacheMutex);
 
- /*
-  * Support the following forms of message:
-  *
-  * "keyword[,keyword,...]" to set the job/printer-state-reasons value(s).
-  *
-  * "-keyword[,keyword,...]" to remove keywords.
-  *
-  * "+keyword[,keyword,...]" to add keywords.
-  *
-  * Keywords may or may not have a suffix (-report, -warning, -error) per
-  * RFC 8011.
-  */
+    while (render->status < 0 && render->written <= *total)
+      _cupsCondWait(&render_cond, &TransformCacheMutex, 10.0);
 
-  if (*message == '-')
+    avail  = render->written - *total;
+    status = render->status;
+
+    if (!avail && -- render->refs == 0)
+      free(render);
+
+    _cupsMutexUnlock(&TransformCacheMutex);
+
+    if (!avail)
+      return (status);
+
+   /*
+    * Copy what has been written so far...
+    */
+
+    while (avail > 0)
+    {
+      if ((bytes = read(fd, data, avail < sizeof(data) ? avail : sizeof(data))) <= 0)
+        break;
+
+      httpWrite2(client->http, data, (size_t)bytes);
+
+      *total += (size_t)bytes;
+      avail  -= (size_t)bytes;
+    }
+
+    if (avail > 0)
+    {
+      serverLogJob(SERVER_LOGLEVEL_ERROR, job, "Unable to read transform output \"%s\": %s", render->tempfile, strerror(errno));
+
+      _cupsMutexLock(&TransformCacheMutex);
+      if (-- render->refs == 0)
+        free(render);
+      _cupsMutexUnlock(&TransformCacheMutex);
+
+      return (-1);
+    }
+  }
+}
+
+
+/*
+ * 'cache_read_attrs()' - Read the job attributes saved with cached output.
+ *
+ * Note: TransformCacheMutex must be held.
+ */
+
+static ipp_t *				/* O - Job attributes or `NULL` if none */
+cache_read_attrs(const char *cachefile)	/* I - Cache filename */
+{
+  int	fd;				/* Attributes file */
+  char	filename[1024];			/* Attributes filename */
+  ipp_t	*attrs;				/* Job attributes */
+
+
+  snprintf(filename, sizeof(filename), "%s.ipp", cachefile);
+
+  if ((fd = open(filename, O_RDONLY | O_BINARY)) < 0)
+    return (NULL);
+
+  attrs = ippNew();
+
+  if (ippReadFile(fd, attrs) != IPP_STATE_DATA)
+  {
+    serverLog(SERVER_LOGLEVEL_ERROR, "Unable to read cached job attributes \"%s\".", filename);
+
+    ippDelete(attrs);
+    attrs = NULL;
+  }
+
+  close(fd);
+
+  return (attrs);
+}
+
+
+/*
+ * 'cache_trim()' - Remove the least recently used transform output until the
+ *                  cache fits in TransformCacheSize megabytes.
+ */
+
+static void
+cache_trim(void)
+{
+  char		cachedir[1024],		/* Cache directory */
+		filename[1024];		/* Cache filename */
+  cups_dir_t	*dir;			/* Directory pointer */
+  cups_dentry_t	*dent,			/* Directory entry */
+		*entry;			/* Copy of entry */
+  cups_array_t	*entries;		/* Entries, oldest first */
+  const char	*ext;			/* Extension on filename */
+  off_t		total = 0,		/* Total size of cache */
+		limit = (off_t)TransformCacheSize * 1024 * 1024;
+					/* Maximum size of cache */
+  time_t	stale = time(NULL) - 3600;
+					/* Stale temporary file time */
+
+
+  snprintf(cachedir, sizeof(cachedir), "%s/cache", SpoolDirectory);
+
+  _cupsMutexLock(&TransformCacheMutex);
+
+  if ((dir = cupsDirOpen(cachedir)) == NULL)
+  {
+    _cupsMutexUnlock(&TransformCacheMutex);
+    return;
+  }
+
+  entries = cupsArrayNew((cups_array_func_t)compare_cache, NULL);
+
+  while ((dent = cupsDirRead(dir)) != NULL)
+  {
+    if ((ext = strchr(dent->filename, '.')) != NULL)
+    {
+     /*
+      * Remove temporary files left behind by a crash, keeping the job
+      * attributes (removed with their output below)...
+      */
+
+      if (strcmp(ext, ".ipp") && dent->fileinfo.st_mtime < stale)
+      {
+        snprintf(filename, sizeof(filename), "%s/%s", cachedir, dent->filename);
+        unlink(filename);
+      }
+      continue;
+    }
+
+    if ((entry = malloc(sizeof(cups_dentry_t))) == NULL)
+      break;
+
+    memcpy(entry, dent, sizeof(cups_dentry_t));
+    cupsArrayAdd(entries, entry);
+
+    total += dent->fileinfo.st_size;
+  }
+
+  cupsDirClose(dir);
+
+  for (entry = (cups_dentry_t *)cupsArrayFirst(entries); entry; entry = (cups_dentry_t *)cupsArrayNext(entries))
+  {
+    if (total > limit)
+    {
+      serverLog(SERVER_LOGLEVEL_DEBUG, "Removing cached transform output \"%s\".", entry->filename);
+
+      snprintf(filename, sizeof(filename), "%s/%s", cachedir, entry->filename);
+      unlink(filename);
+
+      snprintf(filename, sizeof(filename), "%s/%s.ipp", cachedir, entry->filename);
+      unlink(filename);
+
+      total -= entry->fileinfo.st_size;
+    }
+
+    free(entry);
+  }
+
+  cupsArrayDelete(entries);
+
+  _cupsMutexUnlock(&TransformCacheMutex);
+}
+
+
+/*
+ * 'cache_write_attrs()' - Save the job attributes reported for cached output.
+ *
+ * Note: TransformCacheMutex must be held.
+ */
+
+static int				/* O - 1 on success, 0 on error */
+cache_write_attrs(const char *cachefile,/* I - Cache filename */
+                  ipp_t      *attrs)	/* I - Job attributes or `NULL` */
+{
+  int	fd;				/* Attributes file */
+  char	filename[1024];			/* Attributes filename */
+
+
+  snprintf(filename, sizeof(filename), "%s.ipp", cachefile);
+
+  if (!attrs || !ippFirstAttribute(attrs))
+  {
+    unlink(filename);
+    return (1);
+  }
+
+  if ((fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0600)) < 0)
+  {
+    serverLog(SERVER_LOGLEVEL_ERROR, "Unable to create cached job attributes \"%s\": %s", filename, strerror(errno));
+    return (0);
+  }
+
+  ippSetState(attrs, IPP_STATE_IDLE);
+
+  if (ippWriteFile(fd, attrs) != IPP_STATE_DATA)
+  {
+    serverLog(SERVER_LOGLEVEL_ERROR, "Unable to write cached job attributes \"%s\".", filename);
+
+    close(fd);
+    unlink(filename);
+    return (0);
+  }
+
+  close(fd);
+
+  return (1);
+}
+
+
+/*
+ * 'compare_cache()' - Compare two transform cache entries by last use.
+ */
+
+static int				/* O - Result of comparison */
+compare_cache(cups_dentry_t *a,		/* I - First entry */
+              cups_dentry_t *b)		/* I - Second entry */
+{
+  if (a->fileinfo.st_mtime < b->fileinfo.st_mtime)
+    return (-1);
+  else if (a->fileinfo.st_mtime > b->fileinfo.st_mtime)
+    return (1);
+  else
+    return (strcmp(a->filename, b->filename));
+}
+
+
+/*
+ * 'compare_renders()' - Compare two renders in progress.
+ */
+
+static int				/* O - Result of comparison */
+compare_renders(server_render_t *a,	/* I - First render */
+                server_render_t *b)	/* I - Second render */
+{
+  return (strcmp(a->cachefile, b->cachefile));
+}
+
+
+/*
+ * 'prerender_format()' - Choose the output format for a device.
+ *
+ * This uses the same order of preference as Fetch-Document.
+ */
+
+static int				/* O - Index of format or -1 for none */
+prerender_format(
+    ipp_attribute_t *supported,		/* I - document-format-supported */
+    const char      *format)		/* I - Document format */
+{
+  if (!supported || ippContainsString(supported, format))
+    return (-1);
+  else if (ippContainsString(supported, "image/urf"))
+    return (0);
+  else if (ippContainsString(supported, "image/pwg-raster"))
+    return (1);
+  else if (ippContainsString(supported, "application/vnd.hp-pcl"))
+    return (2);
+  else
+    return (-1);
+}
+
+
+/*
+ * 'prerender_job()' - Transform a fetchable job into the transform cache.
+ */
+
+static void *				/* O - Thread exit status */
+prerender_job(server_job_t *job)	/* I - Job */
+{
+  int			i,		/* Looping var */
+			needed[3];	/* Formats needed */
+  server_printer_t	*printer = job->printer;
+					/* Printer */
+  server_device_t	*device;	/* Current device */
+
+
+ /*
+  * Collect the formats that the registered devices will ask for...
+  */
+
+  memset(needed, 0, sizeof(needed));
+
+  _cupsRWLockRead(&printer->rwlock);
+
+  if ((i = prerender_format(ippFindAttribute(printer->dev_attrs, "document-format-supported", IPP_TAG_MIMETYPE), job->format)) >= 0)
+    needed[i] = 1;
+
+  for (device = (server_device_t *)cupsArrayFirst(printer->pinfo.devices); device; device = (server_device_t *)cupsArrayNext(printer->pinfo.devices))
+  {
+    _cupsRWLockRead(&device->rwlock);
+
+    if ((i = prerender_format(ippFindAttribute(device->attrs, "document-format-supported", IPP_TAG_MIMETYPE), job->format)) >= 0)
+      needed[i] = 1;
+
+    _cupsRWUnlock(&device->rwlock);
+  }
+
+  _cupsRWUnlock(&printer->rwlock);
+
+ /*
+  * Then transform into each of them until the job is no longer waiting to be
+  * fetched...
+  */
+
+  for (i = 0; i < 3; i ++)
+  {
+    if (!needed[i])
+      continue;
+
+    if (job->cancel || !(job->state_reasons & SERVER_JREASON_JOB_FETCHABLE))
+      break;
+
+    serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Transforming job to \"%s\" ahead of Fetch-Document.", prerender_formats[i]);
+
+    serverTransformJob(NULL, job, "ipptransform", prerender_formats[i], SERVER_TRANSFORM_TO_CACHE);
+  }
+
+  _cupsMutexLock(&prerender_mutex);
+
+  _cupsRWLockWrite(&job->rwlock);
+  job->prerendering = 0;
+  _cupsRWUnlock(&job->rwlock);
+
+  _cupsCondBroadcast(&prerender_cond);
+  _cupsMutexUnlock(&prerender_mutex);
+
+  return (NULL);
+}
+
+#endif /* !_WIN32 */
+
+
+/*
+ * 'process_attr_message()' - Process an ATTR: message from a command.
+ */
+
+static void
+process_attr_message(
+    server_job_t       *job,		/* I - Job */
+    char               *message,	/* I - Message */
+    server_transform_t mode,		/* I - Transform mode */
+    ipp_t              *cacheattrs)	/* I - Job attributes for the cache or `NULL` */
+{
+  int		i,			/* Looping var */
+		num_options = 0;	/* Number of name=value pairs */
+  cups_option_t	*options = NULL,	/* name=value pairs from message */
+		*option;		/* Current option */
+  ipp_t		*attrs;			/* Attributes from message */
+
+
+ /*
+  * Grab attributes from the message line...
+  */
+
+  serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "%s", message);
+
+  num_options = cupsParseOptions(message + 5, num_options, &options);
+  attrs       = ippNew();
+
+  for (i = num_options, option = options; i > 0; i --, option ++)
+    cupsEncodeOption(attrs, IPP_TAG_JOB, option->name, option->value);
+
+  cupsFreeOptions(num_options, options);
+
+  process_attrs(job, attrs, mode, cacheattrs);
+
+  ippDelete(attrs);
+}
+
+
+/*
+ * 'process_attrs()' - Record attributes reported by a command.
+ *
+ * Job attributes are also copied to "cacheattrs", if not `NULL`, so they can
+ * be replayed when the cached output is reused.  Printer attributes describe
+ * the printer at the time and are not cached.
+ */
+
+static void
+process_attrs(
+    server_job_t       *job,		/* I - Job */
+    ipp_t              *attrs,		/* I - Attributes from command */
+    server_transform_t mode,		/* I - Transform mode */
+    ipp_t              *cacheattrs)	/* I - Job attributes for the cache or `NULL` */
+{
+  ipp_attribute_t *attr,		/* Current attribute */
+		*existing;		/* Existing attribute */
+  const char	*name;			/* Attribute name */
+  char		value[1024];		/* Attribute value for logging */
+
+
+ /*
+  * Loop through the attributes and record them in the printer or job
+  * objects...
+  */
+
+  for (attr = ippFirstAttribute(attrs); attr; attr = ippNextAttribute(attrs))
+  {
+    if ((name = ippGetName(attr)) == NULL)
+      continue;
+
+    if (LogLevel == SERVER_LOGLEVEL_DEBUG)
+      ippAttributeString(attr, value, sizeof(value));
+    else
+      value[0] = '\0';
+
+    if (cacheattrs && !strncmp(name, "job-", 4))
+    {
+      if ((existing = ippFindAttribute(cacheattrs, name, IPP_TAG_ZERO)) != NULL)
+        ippDeleteAttribute(cacheattrs, existing);
+
+      ippCopyAttribute(cacheattrs, attr, 0);
+    }
+
+    if (!strcmp(name, "job-impressions"))
+    {
+     /*
+      * Update job-impressions attribute...
+      */
+
+      serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Setting Job Status attribute \"%s\" to \"%s\".", name, value);
+
+      _cupsRWLockWrite(&job->rwlock);
+
+      job->impressions = ippGetInteger(attr, 0);
+
+      _cupsRWUnlock(&job->rwlock);
+    }
+    else if (mode == SERVER_TRANSFORM_COMMAND && !strcmp(name, "job-impressions-completed"))
+    {
+     /*
+      * Update job-impressions-completed attribute...
+      */
+
+      serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Setting Job Status attribute \"%s\" to \"%s\".", name, value);
+
+      _cupsRWLockWrite(&job->rwlock);
+
+      job->impcompleted = ippGetInteger(attr, 0);
+
+      _cupsRWUnlock(&job->rwlock);
+
+      serverAddEventNoLock(job->printer, job, NULL, SERVER_EVENT_JOB_PROGRESS, NULL);
+    }
+    else if (!strcmp(name, "job-impressions-col") || !strcmp(name, "job-media-sheets") || !strcmp(name, "job-media-sheets-col") ||
+        (mode == SERVER_TRANSFORM_COMMAND && (!strcmp(name, "job-impressions-completed-col") || !strcmp(name, "job-media-sheets-completed") || !strcmp(name, "job-media-sheets-completed-col"))))
+    {
+     /*
+      * Update Job Status attribute...
+      */
+
+      serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Setting Job Status attribute \"%s\" to \"%s\".", name, value);
+
+      _cupsRWLockWrite(&job->rwlock);
+
+      if ((existing = ippFindAttribute(job->attrs, name, IPP_TAG_ZERO)) != NULL)
+        ippDeleteAttribute(job->attrs, existing);
+
+      existing = ippCopyAttribute(job->attrs, attr, 0);
+      ippSetGroupTag(job->attrs, &existing, IPP_TAG_JOB);
+
+      _cupsRWUnlock(&job->rwlock);
+    }
+    else if (!strncmp(name, "marker-", 7) || !strcmp(name, "printer-alert") || !strcmp(name, "printer-supply") || !strcmp(name, "printer-supply-description"))
+    {
+     /*
+      * Update Printer Status attribute...
+      */
+
+      serverLogPrinter(SERVER_LOGLEVEL_DEBUG, job->printer, "Setting Printer Status attribute \"%s\" to \"%s\".", name, value);
+
+      _cupsRWLockWrite(&job->printer->rwlock);
+
+      if ((existing = ippFindAttribute(job->printer->pinfo.attrs, name, IPP_TAG_ZERO)) != NULL)
+        ippDeleteAttribute(job->printer->pinfo.attrs, existing);
+
+      existing = ippCopyAttribute(job->printer->pinfo.attrs, attr, 0);
+      ippSetGroupTag(job->printer->pinfo.attrs, &existing, IPP_TAG_PRINTER);
+
+      _cupsRWUnlock(&job->printer->rwlock);
+    }
+    else if (!strcmp(name, "printer-state-reasons"))
+    {
+     /*
+      * Update printer-state-reasons the same way as a STATE: message...
+      */
+
+      char	message[1024];		/* STATE: message */
+
+      strlcpy(message, "STATE: ", sizeof(message));
+      ippAttributeString(attr, message + 7, sizeof(message) - 7);
+
+      process_state_message(job, message);
+    }
+    else
+    {
+     /*
+      * Something else that isn't currently supported...
+      */
+
+      serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Ignoring attribute \"%s\" with value \"%s\".", name, value);
+    }
+  }
+}
+
+
+#ifndef _WIN32
+/*
+ * 'process_progress()' - Process messages from a command's progress
+ *                        descriptor.
+ *
+ * Each message is a 32-bit big-endian length followed by an IPP message
+ * whose attributes are handled like those in an ATTR: message.  Complete
+ * messages are removed from the buffer.
+ */
+
+static int				/* O - 1 on success, 0 on bad message */
+process_progress(
+    server_job_t       *job,		/* I  - Job */
+    ipp_uchar_t        *buffer,		/* I  - Buffer */
+    size_t             *bufused,	/* IO - Bytes in buffer */
+    size_t             bufsize,		/* I  - Size of buffer */
+    server_transform_t mode,		/* I  - Transform mode */
+    ipp_t              *cacheattrs)	/* I  - Job attributes for the cache or `NULL` */
+{
+  ipp_uchar_t	*bufptr = buffer,	/* Pointer into buffer */
+		*bufend = buffer + *bufused;
+					/* End of buffer */
+  size_t	length;			/* Length of message */
+  server_message_t message;		/* Message being read */
+  ipp_t		*attrs;			/* Attributes from message */
+  int		ret = 1;		/* Return value */
+
+
+  while ((bufend - bufptr) >= 4)
+  {
+    length = ((size_t)bufptr[0] << 24) | ((size_t)bufptr[1] << 16) | ((size_t)bufptr[2] << 8) | (size_t)bufptr[3];
+
+    if (length < 8 || length > (bufsize - 4))
+    {
+      serverLogJob(SERVER_LOGLEVEL_ERROR, job, "Bad progress message length %lu.", (unsigned long)length);
+      ret = 0;
+      break;
+    }
+    else if ((size_t)(bufend - bufptr) < (length + 4))
+      break;
+
+    message.ptr = bufptr + 4;
+    message.end = bufptr + 4 + length;
+    attrs       = ippNew();
+
+    if (ippReadIO(&message, (ipp_iocb_t)read_message, 1, NULL, attrs) != IPP_STATE_DATA)
+    {
+      serverLogJob(SERVER_LOGLEVEL_ERROR, job, "Bad progress message: %s", cupsLastErrorString());
+      ippDelete(attrs);
+      ret = 0;
+      break;
+    }
+
+    process_attrs(job, attrs, mode, cacheattrs);
+
+    ippDelete(attrs);
+
+    bufptr += length + 4;
+  }
+
+  if (!ret)
+    *bufused = 0;
+  else if (bufptr > buffer)
+  {
+    *bufused = (size_t)(bufend - bufptr);
+
+    if (*bufused > 0)
+      memmove(buffer, bufptr, *bufused);
+  }
+
+  return (ret);
+}
+#endif /* !_WIN32 */
+
+
+/*
+ * 'process_state_message()' - Process a STATE: message from a command.
+ */
+
+static void
+process_state_message(
+    server_job_t *job,			/* I - Job */
+    char         *message)		/* I - Message */
+{
+  int		i;			/* Looping var */
+  server_preason_t preasons,		/* printer-state-reasons values */
+		pbit;			/* Current printer reason bit */
+  server_jreason_t jreasons,		/* job-state-reasons values */
+		jbit;			/* Current job reason bit */
+  char		*ptr,			/* Pointer into message */
+		*next;			/* Next keyword in message */
+  int		remove;			/* Non-zero if we are removing keywords */
+
+
+ /*
+  * Skip leading "STATE:" and any whitespace...
+  */
+
+  for (message += 6; *message; message ++)
+    if (*message != ' ' && *message != '\t')
+      break;
+
+ /*
+  * Support the following forms of message:
+  *
+  * "keyword[,keyword,...]" to set the job/printer-state-reasons value(s).
+  *
+  * "-keyword[,keyword,...]" to remove keywords.
+  *
+  * "+keyword[,keyword,...]" to add keywords.
+  *
+  * Keywords may or may not have a suffix (-report, -warning, -error) per
+  * RFC 8011.
+  */
+
+  if (*message == '-')
   {
     remove   = 1;
     jreasons = job->state_reasons;
@@ -755,6 +2173,154 @@ process_state_message(
 }
 
 
+#ifndef _WIN32
+/*
+ * 'read_message()' - Read data from a progress message.
+ */
+
+static ssize_t				/* O - Bytes read */
+read_message(
+    server_message_t *message,		/* I - Message */
+    ipp_uchar_t      *buffer,		/* I - Buffer */
+    size_t           bytes)		/* I - Number of bytes to read */
+{
+  if (bytes > (size_t)(message->end - message->ptr))
+    bytes = (size_t)(message->end - message->ptr);
+
+  memcpy(buffer, message->ptr, bytes);
+  message->ptr += bytes;
+
+  return ((ssize_t)bytes);
+}
+
+
+/*
+ * 'render_finish()' - Finish writing transform output to the cache.
+ *
+ * The job attributes reported by the command are saved before the output is
+ * made visible so that every cache hit can replay them.
+ */
+
+static int				/* O - 1 if the output was cached, 0 otherwise */
+render_finish(server_render_t *render,	/* I - Render in progress */
+              int             keep,	/* I - 1 to keep the output, 0 to discard */
+              ipp_t           *attrs)	/* I - Job attributes reported by the command or `NULL` */
+{
+  _cupsMutexLock(&TransformCacheMutex);
+
+  if (keep && !cache_write_attrs(render->cachefile, attrs))
+    keep = 0;
+
+  if (keep && rename(render->tempfile, render->cachefile))
+    keep = 0;
+
+  if (!keep)
+    unlink(render->tempfile);
+
+  render->status = !keep;
+
+  cupsArrayRemove(renders, render);
+  _cupsCondBroadcast(&render_cond);
+
+  if (-- render->refs == 0)
+    free(render);
+
+  _cupsMutexUnlock(&TransformCacheMutex);
+
+  return (keep);
+}
+
+
+/*
+ * 'stream_job()' - Send document data to a command as it is received.
+ *
+ * The print file is written by httpReadToFd(), which does not report its
+ * progress, so the end of the file is checked again every 100ms until the
+ * client has sent all of the document data.
+ */
+
+static void *				/* O - Thread exit status */
+stream_job(server_stream_t *stream)	/* I - Document data stream */
+{
+  ssize_t	bytes,			/* Bytes read */
+		written;		/* Bytes written */
+  char		buffer[32768],		/* Copy buffer */
+		*bufptr;		/* Pointer into buffer */
+  int		done = 0,		/* All data received? */
+		stop = 0;		/* Stop sending? */
+  sigset_t	mask;			/* Signal mask */
+
+
+ /*
+  * A command that exits early causes write errors rather than SIGPIPE...
+  */
+
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+  while (!stop)
+  {
+    if ((bytes = read(stream->infd, buffer, sizeof(buffer))) > 0)
+    {
+      for (bufptr = buffer; bytes > 0; bufptr += written, bytes -= written)
+      {
+        if ((written = write(stream->outfd, bufptr, (size_t)bytes)) < 0)
+        {
+          if (errno == EINTR)
+          {
+            written = 0;
+            continue;
+          }
+
+          serverLogJob(SERVER_LOGLEVEL_DEBUG, stream->job, "Unable to send document data to command: %s", strerror(errno));
+          stop = 1;
+          break;
+        }
+      }
+
+      if (!stop)
+      {
+        _cupsMutexLock(&stream_mutex);
+        stop = stream->stop || stream->job->stream_aborted;
+        _cupsMutexUnlock(&stream_mutex);
+      }
+      continue;
+    }
+    else if (bytes < 0 && errno != EINTR)
+    {
+      serverLogJob(SERVER_LOGLEVEL_ERROR, stream->job, "Unable to read print file: %s", strerror(errno));
+      break;
+    }
+    else if (bytes < 0 || !done)
+    {
+     /*
+      * Wait for more data, then read until the end of the file one last time
+      * once all of it has been received...
+      */
+
+      _cupsMutexLock(&stream_mutex);
+
+      if (stream->job->streaming && !stream->stop)
+        _cupsCondWait(&stream_cond, &stream_mutex, 0.1);
+
+      done = !stream->job->streaming;
+      stop = stream->stop || stream->job->stream_aborted;
+
+      _cupsMutexUnlock(&stream_mutex);
+    }
+    else
+      break;
+  }
+
+  close(stream->infd);
+  close(stream->outfd);
+
+  return (NULL);
+}
+#endif /* !_WIN32 */
+
+
 /*
  * 'time_seconds()' - Return the current time in fractional seconds.
  */
@@ -779,3 +2345,328 @@ time_seconds(void)
   return ((double)curtime.tv_sec + 0.000001 * curtime.tv_usec);
 #endif /* _WIN32 */
 }
+
+
+#ifndef _WIN32
+/*
+ * 'worker_cancel()' - Cancel the current job of a transform worker.
+ *
+ * The worker stops the job and stays in the pool.  The caller must hold the
+ * job's write lock.
+ */
+
+static void
+worker_cancel(server_worker_t *worker)	/* I - Worker */
+{
+  if (worker->cancelfd >= 0 && !worker->canceled)
+  {
+    if (send(worker->cancelfd, "", 1, MSG_NOSIGNAL) < 0)
+      serverLog(SERVER_LOGLEVEL_DEBUG, "Unable to cancel job on transform worker %d: %s", worker->pid, strerror(errno));
+
+    worker->canceled = 1;
+  }
+}
+
+
+/*
+ * 'worker_get()' - Get an idle transform worker for a command.
+ *
+ * A new worker is started when none are idle and the pool is not full.
+ * `NULL` is returned when the command should be run directly.
+ */
+
+static server_worker_t *		/* O - Worker or `NULL` */
+worker_get(const char *command)		/* I - Command to run */
+{
+  server_worker_t	*worker;	/* Current worker */
+  const char		*name;		/* Command name */
+  int			sock[2];	/* Request socket pair */
+  posix_spawn_file_actions_t actions;	/* Spawn file actions */
+  char			*myargv[3];	/* Command-line arguments */
+
+
+ /*
+  * Only ipptransform supports the worker protocol...
+  */
+
+  if (TransformWorkers <= 0 || (name = strrchr(command, '/')) == NULL || strcmp(name + 1, "ipptransform"))
+    return (NULL);
+
+  _cupsMutexLock(&workers_mutex);
+
+  for (worker = (server_worker_t *)cupsArrayFirst(idle_workers); worker; worker = (server_worker_t *)cupsArrayNext(idle_workers))
+  {
+    if (!strcmp(worker->command, command))
+    {
+      cupsArrayRemove(idle_workers, worker);
+      _cupsMutexUnlock(&workers_mutex);
+
+      return (worker);
+    }
+  }
+
+  if (num_workers >= TransformWorkers)
+  {
+    _cupsMutexUnlock(&workers_mutex);
+    return (NULL);
+  }
+
+  num_workers ++;
+
+  _cupsMutexUnlock(&workers_mutex);
+
+ /*
+  * Start a new worker with a socket for requests on stdin...
+  */
+
+  if ((worker = calloc(1, sizeof(server_worker_t))) == NULL)
+    goto worker_failure;
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sock))
+  {
+    serverLog(SERVER_LOGLEVEL_ERROR, "Unable to create transform worker socket: %s", strerror(errno));
+    goto worker_failure;
+  }
+
+  fcntl(sock[0], F_SETFD, FD_CLOEXEC);
+  fcntl(sock[1], F_SETFD, FD_CLOEXEC);
+
+  myargv[0] = (char *)command;
+  myargv[1] = (char *)"--server";
+  myargv[2] = NULL;
+
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, sock[1], 0);
+  posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY | O_BINARY, 0);
+  posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY | O_BINARY, 0);
+
+  if (posix_spawn(&worker->pid, command, &actions, NULL, myargv, environ))
+  {
+    serverLog(SERVER_LOGLEVEL_ERROR, "Unable to start transform worker \"%s\": %s", command, strerror(errno));
+
+    posix_spawn_file_actions_destroy(&actions);
+    close(sock[0]);
+    close(sock[1]);
+    goto worker_failure;
+  }
+
+  posix_spawn_file_actions_destroy(&actions);
+  close(sock[1]);
+
+  worker->command  = strdup(command);
+  worker->fd       = sock[0];
+  worker->cancelfd = -1;
+
+  serverLog(SERVER_LOGLEVEL_DEBUG, "Started transform worker \"%s\", pid=%d", command, worker->pid);
+
+  return (worker);
+
+ /*
+  * This is where we go for hard failures...
+  */
+
+  worker_failure:
+
+  free(worker);
+
+  _cupsMutexLock(&workers_mutex);
+  num_workers --;
+  _cupsMutexUnlock(&workers_mutex);
+
+  return (NULL);
+}
+
+
+/*
+ * 'worker_put()' - Return a transform worker to the pool or stop it.
+ */
+
+static void
+worker_put(server_worker_t *worker,	/* I - Worker */
+           int             keep)	/* I - 1 to keep the worker, 0 to stop it */
+{
+  int	status;				/* Exit status */
+
+
+  if (worker->cancelfd >= 0)
+  {
+    close(worker->cancelfd);
+    worker->cancelfd = -1;
+  }
+
+  worker->jobs ++;
+
+  if (keep && (TransformWorkerJobs <= 0 || worker->jobs < TransformWorkerJobs))
+  {
+    _cupsMutexLock(&workers_mutex);
+
+    if (!idle_workers)
+      idle_workers = cupsArrayNew(NULL, NULL);
+
+    cupsArrayAdd(idle_workers, worker);
+
+    _cupsMutexUnlock(&workers_mutex);
+    return;
+  }
+
+ /*
+  * Closing the socket tells the worker to exit, then we reap it...
+  */
+
+  serverLog(SERVER_LOGLEVEL_DEBUG, "Stopping transform worker %d after %d jobs.", worker->pid, worker->jobs);
+
+  close(worker->fd);
+
+  if (!keep)
+    kill(worker->pid, SIGTERM);
+
+#  ifdef HAVE_WAITPID
+  while (waitpid(worker->pid, &status, 0) < 0 && errno == EINTR);
+#  else
+  while (wait(&status) < 0 && errno == EINTR);
+#  endif /* HAVE_WAITPID */
+
+  free(worker->command);
+  free(worker);
+
+  _cupsMutexLock(&workers_mutex);
+  num_workers --;
+  _cupsMutexUnlock(&workers_mutex);
+}
+
+
+/*
+ * 'worker_send()' - Send a job to a transform worker.
+ *
+ * The request is the length of the strings that follow with the stdout,
+ * stderr, progress, and cancel descriptors attached, then the filename and
+ * environment strings, each terminated by a nul character.  Writing to the
+ * other end of the cancel socket asks the worker to stop the job.
+ */
+
+static int				/* O - 0 on success, -1 on error */
+worker_send(server_worker_t *worker,	/* I - Worker */
+            const char      *filename,	/* I - Print file */
+            char            **envp,	/* I - Job environment variables */
+            int             outfd,	/* I - stdout for job */
+            int             errfd,	/* I - stderr for job */
+            int             progfd)	/* I - Progress descriptor for job */
+{
+  int		i,			/* Looping var */
+		length,			/* Length of request strings */
+		cancel[2];		/* Cancel socket pair */
+  char		*request,		/* Request strings */
+		*ptr;			/* Pointer into request */
+  size_t	len;			/* Length of string */
+  ssize_t	bytes;			/* Bytes sent */
+  struct iovec	iov;			/* Request length */
+  struct msghdr	msg;			/* Request message */
+  struct cmsghdr *cmsg;			/* Control message */
+  union
+  {
+    struct cmsghdr hdr;			/* Control message header */
+    char	buf[CMSG_SPACE(4 * sizeof(int))];
+					/* Control message buffer */
+  }		control;		/* Control message with descriptors */
+
+
+ /*
+  * Build the request strings...
+  */
+
+  for (i = 0, len = strlen(filename) + 1; envp[i]; i ++)
+    len += strlen(envp[i]) + 1;
+
+  if ((request = malloc(len)) == NULL)
+    return (-1);
+
+  strlcpy(request, filename, len);
+
+  for (i = 0, ptr = request + strlen(filename) + 1; envp[i]; i ++, ptr += strlen(ptr) + 1)
+    strlcpy(ptr, envp[i], len - (size_t)(ptr - request));
+
+  length = (int)len;
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, cancel))
+  {
+    free(request);
+    return (-1);
+  }
+
+  fcntl(cancel[0], F_SETFD, FD_CLOEXEC);
+  fcntl(cancel[1], F_SETFD, FD_CLOEXEC);
+
+ /*
+  * Send the length with the descriptors, then the strings...
+  */
+
+  memset(&msg, 0, sizeof(msg));
+  memset(&control, 0, sizeof(control));
+
+  iov.iov_base       = &length;
+  iov.iov_len        = sizeof(length);
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  cmsg             = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type  = SCM_RIGHTS;
+  cmsg->cmsg_len   = CMSG_LEN(4 * sizeof(int));
+
+  memcpy(CMSG_DATA(cmsg), &outfd, sizeof(int));
+  memcpy(CMSG_DATA(cmsg) + sizeof(int), &errfd, sizeof(int));
+  memcpy(CMSG_DATA(cmsg) + 2 * sizeof(int), &progfd, sizeof(int));
+  memcpy(CMSG_DATA(cmsg) + 3 * sizeof(int), cancel + 1, sizeof(int));
+
+  if (sendmsg(worker->fd, &msg, MSG_NOSIGNAL) != (ssize_t)sizeof(length))
+  {
+    close(cancel[0]);
+    close(cancel[1]);
+    free(request);
+    return (-1);
+  }
+
+  close(cancel[1]);
+
+  worker->cancelfd = cancel[0];
+  worker->canceled = 0;
+
+  for (ptr = request; len > 0; ptr += bytes, len -= (size_t)bytes)
+  {
+    if ((bytes = send(worker->fd, ptr, len, MSG_NOSIGNAL)) < 0)
+    {
+      if (errno == EINTR)
+      {
+        bytes = 0;
+        continue;
+      }
+
+      free(request);
+      return (-1);
+    }
+  }
+
+  free(request);
+
+  return (0);
+}
+
+
+/*
+ * 'worker_status()' - Get the exit status of a job from a transform worker.
+ */
+
+static int				/* O - Exit status or -1 if the worker stopped */
+worker_status(server_worker_t *worker)	/* I - Worker */
+{
+  int		status;			/* Exit status */
+  ssize_t	bytes;			/* Bytes read */
+
+
+  while ((bytes = recv(worker->fd, &status, sizeof(status), MSG_WAITALL)) < 0 && errno == EINTR);
+
+  return (bytes == (ssize_t)sizeof(status) ? status : -1);
+}
+#endif /* !_WIN32 */
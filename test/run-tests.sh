@@ -3,7 +3,7 @@
 # Integration test script for ippsample.
 #
 # Copyright © 2018 by The Printer Working Group.
-# Copyright © 2018 by Apple Inc.
+# Copyright © 2018 by Apple Inc.
 #
 # Licensed under Apache License v2.0.  See the file "LICENSE" for more
 # information.
@@ -13,4 +13,115 @@
 #   test/run-tests.sh
 #
 
-echo "Coming soon!"
+# Verify we have been run from the correct location...
+if test ! -d test; then
+        echo "Usage: test/run-tests.sh"
+        exit 1
+fi
+
+if test ! -x server/ippserver -o ! -x tools/ipptool; then
+        echo "You must build ippserver and ipptool before running this script."
+        exit 1
+fi
+
+# Use a private spool and state directory...
+tmpdir="${TMPDIR:-/tmp}/ippsample-tests.$$"
+port=`expr 10000 + $$ % 10000`
+uri="ipp://localhost:$port/ipp/print"
+pid=""
+
+rm -rf "$tmpdir"
+mkdir -p "$tmpdir/spool" "$tmpdir/state" || exit 1
+
+trap 'test "x$pid" != x && kill -9 $pid 2>/dev/null; rm -rf "$tmpdir"' 0
+
+# Start the server and wait for it to accept requests...
+start_server() {
+        server/ippserver --no-dns-sd -vvv -k -d "$tmpdir/spool" --state "$tmpdir/state" -n localhost -p $port -f application/pdf test-printer >>"$tmpdir/server.log" 2>&1 &
+        pid=$!
+
+        for try in 1 2 3 4 5 6 7 8 9 10; do
+                if tools/ipptool -q $uri examples/get-printer-attributes.test 2>/dev/null; then
+                        return 0
+                fi
+                sleep 1
+        done
+
+        echo "FAIL (server did not start)"
+        cat "$tmpdir/server.log"
+        exit 1
+}
+
+# Journal round-trip: create a job and printer/job subscriptions, crash the
+# server, and make sure they are all restored from the journals...
+echo "Running journal round-trip test..."
+
+start_server
+
+if ! tools/ipptool -t -f examples/document-letter.pdf $uri test/journal-create.test; then
+        echo "FAIL (unable to create job and subscriptions)"
+        cat "$tmpdir/server.log"
+        exit 1
+fi
+
+# Give the server time to sync the journals, then stop it without saving state
+sleep 2
+kill -9 $pid
+wait $pid 2>/dev/null
+pid=""
+
+start_server
+
+if ! tools/ipptool -t $uri test/journal-verify.test; then
+        echo "FAIL (job and subscriptions not restored)"
+        cat "$tmpdir/server.log"
+        exit 1
+fi
+
+# Notification wakeups: an event must complete only the Get-Notifications
+# requests waiting on subscriptions for that event...
+echo "Running notification wakeup test..."
+
+if ! tools/ipptool -q -d event=printer-state-changed -d subid=3 $uri test/notify-create.test || ! tools/ipptool -q -d event=printer-config-changed -d subid=4 $uri test/notify-create.test; then
+        echo "FAIL (unable to create subscriptions)"
+        exit 1
+fi
+
+tools/ipptool -q -d subid=3 $uri test/notify-wait.test &
+statewait=$!
+tools/ipptool -q -d subid=4 $uri test/notify-wait.test &
+configwait=$!
+
+sleep 1
+tools/ipptool -q $uri examples/pause-printer.test
+
+for try in 1 2 3 4 5; do
+        kill -0 $statewait 2>/dev/null || break
+        sleep 1
+done
+
+if kill -0 $statewait 2>/dev/null; then
+        echo "FAIL (Get-Notifications not completed by printer-state-changed event)"
+        kill $statewait $configwait
+        exit 1
+fi
+
+if ! wait $statewait; then
+        echo "FAIL (Get-Notifications did not return the printer-state-changed event)"
+        kill $configwait
+        exit 1
+fi
+
+if ! kill -0 $configwait 2>/dev/null; then
+        echo "FAIL (Get-Notifications for another subscription was completed)"
+        exit 1
+fi
+
+kill $configwait
+tools/ipptool -q $uri examples/resume-printer.test
+
+kill $pid
+wait $pid 2>/dev/null
+pid=""
+
+echo "PASS"
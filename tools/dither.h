@@ -66,3 +66,191 @@ const unsigned char threshold[64][64] =
   {  26, 130,  14, 159,  53,  87,  29, 124,  82,  57,  18, 148,  82,  57,  18, 148,  98,  45,  98,  45,  87,  53, 138,  22,  53,  87, 124,  29,  37, 110, 165,  12, 142,  21,  98,  45,  69,  69,  24, 135,   3, 209, 132,  25, 181,   8,  82,  57,  27, 127, 113,  35,  82,  57, 177,   9,  57,  82, 213,   2,  25, 132,   6, 187 },
   {  37, 109,  61,  78,   8, 179,  61,  78,  20, 143,  66,  72,  22, 138,  66,  72,  24, 135,   4, 200, 175,   9,  72,  66,   1, 227, 151,  17,  72,  66,  29, 124,  68,  70,  24, 135, 181,   8,  98,  45,  98,  45,  98,  45,  68,  70,  18, 148,  70,  68,  17, 151, 222,   1,  70,  68,  18, 148, 112,  35,  98,  45,  78,  61 }
 };
+
+
+/*
+ * Vectorized dithering, if available...
+ */
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && defined(__GNUC__)
+#  include <immintrin.h>
+#  define XFORM_DITHER_SSE2	1
+#  ifdef __x86_64__
+#    define XFORM_DITHER_AVX2	1	/* Selected at run-time */
+#  endif /* __x86_64__ */
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#  include <arm_neon.h>
+#  define XFORM_DITHER_NEON	1
+#endif /* (__x86_64__ || __i386__) && __SSE2__ && __GNUC__ */
+
+
+typedef size_t (*xform_dither_cb_t)(unsigned char *, const unsigned char *, const unsigned char *, size_t, unsigned char);
+
+
+#ifdef XFORM_DITHER_AVX2
+/*
+ * 'dither_avx2()' - Dither 32 pixels at a time using AVX2 instructions.
+ *
+ * Each pixel is compared against its threshold and the results are packed
+ * into bytes by masking with the bit values and summing groups of 8.
+ */
+
+__attribute__((target("avx2")))
+static size_t				/* O - Number of pixels dithered */
+dither_avx2(
+    unsigned char       *outptr,	/* I - Output buffer */
+    const unsigned char *line,		/* I - Pixels */
+    const unsigned char *thresholds,	/* I - Thresholds, starting at column 0 */
+    size_t              count,		/* I - Number of pixels */
+    unsigned char       invert)		/* I - 0 to set bits for pixels <= threshold, 255 for pixels > threshold */
+{
+  size_t	i;			/* Looping var */
+  __m256i	pixels,			/* Pixels */
+		bits;			/* Packed bits */
+  const __m256i	weights = _mm256_set1_epi64x((long long)0x0102040810204080ULL),
+		flip = _mm256_set1_epi8((char)invert),
+		zero = _mm256_setzero_si256();
+
+
+  for (i = 0; (i + 32) <= count; i += 32, outptr += 4)
+  {
+    pixels = _mm256_loadu_si256((const __m256i *)(line + i));
+    bits   = _mm256_cmpeq_epi8(_mm256_min_epu8(pixels, _mm256_loadu_si256((const __m256i *)(thresholds + (i & 63)))), pixels);
+    bits   = _mm256_sad_epu8(_mm256_and_si256(_mm256_xor_si256(bits, flip), weights), zero);
+
+    outptr[0] = (unsigned char)_mm256_extract_epi16(bits, 0);
+    outptr[1] = (unsigned char)_mm256_extract_epi16(bits, 4);
+    outptr[2] = (unsigned char)_mm256_extract_epi16(bits, 8);
+    outptr[3] = (unsigned char)_mm256_extract_epi16(bits, 12);
+  }
+
+  return (i);
+}
+#endif /* XFORM_DITHER_AVX2 */
+
+
+/*
+ * 'dither_bits()' - Dither a run of 8-bit grayscale pixels to 1-bit.
+ *
+ * Bits are set for pixels that are less than or equal to the threshold, or
+ * greater than the threshold when "invert" is 255.  The vectorized function,
+ * if any, handles whole groups of pixels and the rest are dithered here.
+ *
+ * The "thresholds" array holds 96 values: the threshold row rotated to start
+ * at the first pixel, then repeated for the vectorized loads that cross the
+ * end of the row.
+ */
+
+static unsigned char *			/* O - End of output */
+dither_bits(
+    xform_dither_cb_t   cb,		/* I - Vectorized function or `NULL` */
+    unsigned char       *outptr,	/* I - Output buffer */
+    const unsigned char *line,		/* I - Pixels */
+    const unsigned char *thresholds,	/* I - Thresholds, starting at column 0 */
+    size_t              count,		/* I - Number of pixels */
+    unsigned char       invert)		/* I - 0 for black, 255 for white */
+{
+  size_t	x;			/* Current column */
+  unsigned char	bit,			/* Current bit */
+		byte;			/* Current byte */
+
+
+  if (cb)
+  {
+    x      = (*cb)(outptr, line, thresholds, count, invert);
+    outptr += x / 8;
+  }
+  else
+    x = 0;
+
+  for (bit = 128, byte = 0; x < count; x ++)
+  {
+    if ((line[x] <= thresholds[x & 63]) != (invert != 0))
+      byte |= bit;
+
+    if (bit == 1)
+    {
+      *outptr++ = byte;
+      byte      = 0;
+      bit       = 128;
+    }
+    else
+      bit >>= 1;
+  }
+
+  if (bit != 128)
+    *outptr++ = byte;
+
+  return (outptr);
+}
+
+
+#ifdef XFORM_DITHER_NEON
+/*
+ * 'dither_neon()' - Dither 16 pixels at a time using NEON instructions.
+ */
+
+static size_t				/* O - Number of pixels dithered */
+dither_neon(
+    unsigned char       *outptr,	/* I - Output buffer */
+    const unsigned char *line,		/* I - Pixels */
+    const unsigned char *thresholds,	/* I - Thresholds, starting at column 0 */
+    size_t              count,		/* I - Number of pixels */
+    unsigned char       invert)		/* I - 0 to set bits for pixels <= threshold, 255 for pixels > threshold */
+{
+  size_t	i;			/* Looping var */
+  uint8x16_t	bits;			/* Packed bits */
+  static const unsigned char weights[16] = { 128, 64, 32, 16, 8, 4, 2, 1, 128, 64, 32, 16, 8, 4, 2, 1 };
+					/* Bit values */
+  const uint8x16_t wvec = vld1q_u8(weights),
+		flip = vdupq_n_u8(invert);
+
+
+  for (i = 0; (i + 16) <= count; i += 16, outptr += 2)
+  {
+    bits = vcleq_u8(vld1q_u8(line + i), vld1q_u8(thresholds + (i & 63)));
+    bits = vandq_u8(veorq_u8(bits, flip), wvec);
+
+    outptr[0] = vaddv_u8(vget_low_u8(bits));
+    outptr[1] = vaddv_u8(vget_high_u8(bits));
+  }
+
+  return (i);
+}
+#endif /* XFORM_DITHER_NEON */
+
+
+#ifdef XFORM_DITHER_SSE2
+/*
+ * 'dither_sse2()' - Dither 16 pixels at a time using SSE2 instructions.
+ */
+
+static size_t				/* O - Number of pixels dithered */
+dither_sse2(
+    unsigned char       *outptr,	/* I - Output buffer */
+    const unsigned char *line,		/* I - Pixels */
+    const unsigned char *thresholds,	/* I - Thresholds, starting at column 0 */
+    size_t              count,		/* I - Number of pixels */
+    unsigned char       invert)		/* I - 0 to set bits for pixels <= threshold, 255 for pixels > threshold */
+{
+  size_t	i;			/* Looping var */
+  __m128i	pixels,			/* Pixels */
+		bits;			/* Packed bits */
+  const __m128i	weights = _mm_set1_epi64x((long long)0x0102040810204080ULL),
+		flip = _mm_set1_epi8((char)invert),
+		zero = _mm_setzero_si128();
+
+
+  for (i = 0; (i + 16) <= count; i += 16, outptr += 2)
+  {
+    pixels = _mm_loadu_si128((const __m128i *)(line + i));
+    bits   = _mm_cmpeq_epi8(_mm_min_epu8(pixels, _mm_loadu_si128((const __m128i *)(thresholds + (i & 63)))), pixels);
+    bits   = _mm_sad_epu8(_mm_and_si128(_mm_xor_si128(bits, flip), weights), zero);
+
+    outptr[0] = (unsigned char)_mm_cvtsi128_si32(bits);
+    outptr[1] = (unsigned char)_mm_extract_epi16(bits, 4);
+  }
+
+  return (i);
+}
+#endif /* XFORM_DITHER_SSE2 */
@@ -9,11 +9,18 @@
  */
 
 #include <cups/cups.h>
-#include <cups/raster.h>
+#include <cups/raster-private.h>
 #include <cups/array-private.h>
 #include <cups/string-private.h>
 #include <cups/thread-private.h>
 
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <limits.h>
+#  include <poll.h>
+#  include <signal.h>
+#endif /* !_WIN32 */
+
 #ifdef HAVE_COREGRAPHICS
 #  include <CoreGraphics/CoreGraphics.h>
 #  include <ImageIO/ImageIO.h>
@@ -35,6 +42,7 @@ static inline fz_matrix make_matrix(float a, float b, float c, float d, float e,
  */
 
 #define XFORM_MAX_RASTER	16777216
+#define XFORM_MAX_THREADS	8
 
 #define XFORM_RED_MASK		0x000000ff
 #define XFORM_GREEN_MASK	0x0000ff00
@@ -48,8 +56,23 @@ static inline fz_matrix make_matrix(float a, float b, float c, float d, float e,
  * Local types...
  */
 
+
 typedef ssize_t (*xform_write_cb_t)(void *, const unsigned char *, size_t);
 
+typedef struct xform_message_s		/**** Progress message being written ****/
+{
+  ipp_uchar_t	*ptr,			/* Current position in message */
+		*end;			/* End of message buffer */
+} xform_message_t;
+
+typedef struct xform_monitor_s		/**** IPP printer monitor ****/
+{
+  char			device_uri[1024];/* Device URI */
+  _cups_mutex_t		mutex;		/* Mutex for stop flag */
+  _cups_cond_t		cond;		/* Condition for stop flag */
+  int			stop;		/* Non-zero to stop monitoring */
+} xform_monitor_t;
+
 typedef struct xform_raster_s xform_raster_t;
 
 struct xform_raster_s
@@ -77,6 +100,7 @@ struct xform_raster_s
   unsigned char		*comp_buffer;	/* Compression buffer */
 
   unsigned char		dither[64][64];	/* Dither array */
+  xform_dither_cb_t	dither_pixels;	/* Vectorized dither function, if any */
 
   /* Callbacks */
   void			(*end_job)(xform_raster_t *, xform_write_cb_t, void *);
@@ -86,11 +110,74 @@ struct xform_raster_s
   void			(*write_line)(xform_raster_t *, unsigned, const unsigned char *, xform_write_cb_t, void *);
 };
 
+#ifdef HAVE_MUPDF
+typedef struct xform_cache_s		/**** Encoded page cache ****/
+{
+  xform_write_cb_t	cb;		/* Output callback */
+  void			*ctx;		/* Output context */
+  int			fd;		/* Cache file or -1 for none */
+  int			capture,	/* Copy output to the cache? */
+			error;		/* Error writing the cache? */
+  off_t			length,		/* Bytes written to the cache */
+			*offsets;	/* Offset of each page in the cache */
+} xform_cache_t;
+
+typedef struct xform_page_s		/**** Recorded page ****/
+{
+  fz_display_list	*list;		/* Display list or NULL if not recorded */
+  fz_matrix		transform;	/* Transform for page image */
+} xform_page_t;
+
+typedef struct xform_render_s xform_render_t;
+
+typedef struct xform_worker_s		/**** Rendering thread ****/
+{
+  xform_render_t	*render;	/* Renderer */
+  unsigned		index;		/* Worker number */
+  _cups_thread_t	thread;		/* Thread */
+  fz_context		*context;	/* Cloned MuPDF context */
+  fz_pixmap		*pixmap;	/* Pixmap for band */
+  fz_device		*device;	/* Draw device for band */
+  int			ready,		/* Band rendered and waiting to be written? */
+			error;		/* Error rendering band? */
+} xform_worker_t;
+
+struct xform_render_s			/**** Multi-threaded renderer ****/
+{
+  _cups_mutex_t		mutex;		/* Mutex for worker state */
+  _cups_cond_t		cond;		/* Condition for worker state changes */
+  _cups_mutex_t		doc_mutex;	/* Mutex for document and page lists */
+  fz_document		*document;	/* Document to print */
+  const char		*informat;	/* Input format */
+  const char		*print_scaling;	/* print-scaling value */
+  xform_raster_t	*ras;		/* Raster information */
+  unsigned		first,		/* First page in document */
+			pages,		/* Number of pages */
+			num_bands,	/* Number of bands per page */
+			num_jobs;	/* Number of bands for all copies */
+  xform_page_t		*page_lists;	/* Recorded pages */
+  double		yscale;		/* Vertical scaling factor */
+  fz_matrix		back_transform;	/* Transform for back side */
+  unsigned		num_workers;	/* Number of workers */
+  xform_worker_t	workers[XFORM_MAX_THREADS];
+					/* Workers */
+  int			cancel;		/* Stop rendering? */
+};
+#endif /* HAVE_MUPDF */
+
 
 /*
  * Local globals...
  */
 
+static int	CancelFD = -1;		/* Cancel descriptor from ippserver */
+#ifdef HAVE_MUPDF
+static fz_context	*FitzContext = NULL;
+					/* MuPDF context shared by requests */
+static _cups_mutex_t FitzLocks[FZ_LOCK_MAX];
+					/* Locks for MuPDF contexts */
+#endif /* HAVE_MUPDF */
+static int	ProgressFD = -1;	/* Progress message descriptor */
 static int	Verbosity = 0;		/* Log level */
 
 
@@ -98,11 +185,21 @@ static int	Verbosity = 0;		/* Log level */
  * Local functions...
  */
 
+#ifdef HAVE_MUPDF
+static int	cache_copy_page(xform_cache_t *cache, unsigned page);
+static ssize_t	cache_write(xform_cache_t *cache, const unsigned char *buffer, size_t bytes);
+#endif /* HAVE_MUPDF */
+static unsigned char *dither_line(xform_raster_t *ras, unsigned y, const unsigned char *line, unsigned char invert);
 #ifdef HAVE_MUPDF
 static void	invert_gray(unsigned char *row, size_t num_pixels);
 #endif /* HAVE_MUPDF */
 static int	load_env_options(cups_option_t **options);
-static void	*monitor_ipp(const char *device_uri);
+static void	*monitor_ipp(xform_monitor_t *monitor);
+#ifdef HAVE_MUPDF
+static void	mupdf_lock(void *user, int lock);
+static fz_context *mupdf_new_context(size_t max_store);
+static void	mupdf_unlock(void *user, int lock);
+#endif /* HAVE_MUPDF */
 #ifdef HAVE_COREGRAPHICS
 static void	pack_rgba(unsigned char *row, size_t num_pixels);
 static void	pack_rgba16(unsigned char *row, size_t num_pixels);
@@ -120,8 +217,21 @@ static void	raster_init(xform_raster_t *ras);
 static void	raster_start_job(xform_raster_t *ras, xform_write_cb_t cb, void *ctx);
 static void	raster_start_page(xform_raster_t *ras, unsigned page, xform_write_cb_t cb, void *ctx);
 static void	raster_write_line(xform_raster_t *ras, unsigned y, const unsigned char *line, xform_write_cb_t cb, void *ctx);
+#ifdef HAVE_MUPDF
+static void	*render_bands(xform_worker_t *worker);
+static fz_display_list *render_page(xform_render_t *render, fz_context *context, unsigned page, fz_matrix *image_transform);
+#endif /* HAVE_MUPDF */
+static void	report_attrs(ipp_t *attrs);
+#ifndef _WIN32
+static int	serve_requests(void);
+#endif /* !_WIN32 */
+static int	transform_file(const char *filename, const char *content_type, const char *device_uri, const char *output_type, const char *resolutions, const char *sheet_back, const char *types, int num_options, cups_option_t *options);
 static void	usage(int status) _CUPS_NORETURN;
 static ssize_t	write_fd(int *fd, const unsigned char *buffer, size_t bytes);
+#ifndef _WIN32
+static ssize_t	write_message(xform_message_t *message, ipp_uchar_t *buffer, size_t bytes);
+#endif /* !_WIN32 */
+static int	xform_canceled(void);
 static int	xform_document(const char *filename, const char *informat, const char *outformat, const char *resolutions, const char *sheet_back, const char *types, int num_options, cups_option_t *options, xform_write_cb_t cb, void *ctx);
 static int	xform_setup(xform_raster_t *ras, const char *outformat, const char *resolutions, const char *types, const char *sheet_back, int color, unsigned pages, int num_options, cups_option_t *options);
 
@@ -145,14 +255,9 @@ main(int  argc,				/* I - Number of command-line args */
 		*opt;			/* Option character */
   int		num_options;		/* Number of options */
   cups_option_t	*options;		/* Options */
-  int		fd = 1;			/* Output file/socket */
-  http_t	*http = NULL;		/* Output HTTP connection */
-  void		*write_ptr = &fd;	/* Pointer to file/socket/HTTP connection */
-  char		resource[1024];		/* URI resource path */
-  xform_write_cb_t write_cb = (xform_write_cb_t)write_fd;
-					/* Write callback */
-  int		status = 0;		/* Exit status */
-  _cups_thread_t monitor = 0;		/* Monitoring thread ID */
+#ifndef _WIN32
+  int		server = 0;		/* Run as a transform server? */
+#endif /* !_WIN32 */
 
 
  /*
@@ -183,6 +288,12 @@ main(int  argc,				/* I - Number of command-line args */
       {
         usage(0);
       }
+#ifndef _WIN32
+      else if (!strcmp(argv[i], "--server"))
+      {
+        server = 1;
+      }
+#endif /* !_WIN32 */
       else if (!strcmp(argv[i], "--version"))
       {
         puts(CUPS_SVERSION);
@@ -307,6 +418,15 @@ main(int  argc,				/* I - Number of command-line args */
     }
   }
 
+#ifndef _WIN32
+  if (server)
+  {
+    cupsFreeOptions(num_options, options);
+
+    return (serve_requests());
+  }
+#endif /* !_WIN32 */
+
  /*
   * Check that we have everything we need...
   */
@@ -354,216 +474,98 @@ main(int  argc,				/* I - Number of command-line args */
   if (!types)
     types = "sgray_8";
 
- /*
-  * If the device URI is specified, open the connection...
-  */
+  return (transform_file(filename, content_type, device_uri, output_type, resolutions, sheet_back, types, num_options, options));
+}
 
-  if (device_uri)
-  {
-    char	scheme[32],		/* URI scheme */
-		userpass[256],		/* URI user:pass */
-		host[256],		/* URI host */
-		service[32];		/* Service port */
-    int		port;			/* URI port number */
-    http_addrlist_t *list;		/* Address list for socket */
 
-    if (httpSeparateURI(HTTP_URI_CODING_ALL, device_uri, scheme, sizeof(scheme), userpass, sizeof(userpass), host, sizeof(host), &port, resource, sizeof(resource)) < HTTP_URI_STATUS_OK)
-    {
-      fprintf(stderr, "ERROR: Invalid device URI \"%s\".\n", device_uri);
-      usage(1);
-    }
+#ifdef HAVE_MUPDF
+/*
+ * 'cache_copy_page()' - Write a cached page to the output.
+ */
 
-    if (strcmp(scheme, "socket") && strcmp(scheme, "ipp") && strcmp(scheme, "ipps"))
-    {
-      fprintf(stderr, "ERROR: Unsupported device URI scheme \"%s\".\n", scheme);
-      usage(1);
-    }
+static int				/* O - 0 on success, -1 on error */
+cache_copy_page(xform_cache_t *cache,	/* I - Page cache */
+                unsigned      page)	/* I - Page number */
+{
+  off_t		offset = cache->offsets[page - 1],
+					/* Current offset in cache */
+		end = cache->offsets[page];
+					/* End of page in cache */
+  ssize_t	bytes;			/* Bytes read */
+  unsigned char	buffer[65536];		/* Copy buffer */
 
-    snprintf(service, sizeof(service), "%d", port);
-    if ((list = httpAddrGetList(host, AF_UNSPEC, service)) == NULL)
-    {
-      fprintf(stderr, "ERROR: Unable to lookup device URI host \"%s\": %s\n", host, cupsLastErrorString());
-      return (1);
-    }
 
-    if (!strcmp(scheme, "socket"))
+  while (offset < end)
+  {
+    if ((bytes = pread(cache->fd, buffer, (end - offset) > (off_t)sizeof(buffer) ? sizeof(buffer) : (size_t)(end - offset), offset)) <= 0)
     {
-     /*
-      * AppSocket connection...
-      */
+      if (bytes < 0 && (errno == EINTR || errno == EAGAIN))
+        continue;
 
-      if (!httpAddrConnect2(list, &fd, 30000, NULL))
-      {
-	fprintf(stderr, "ERROR: Unable to connect to \"%s\" on port %d: %s\n", host, port, cupsLastErrorString());
-	return (1);
-      }
+      return (-1);
     }
-    else
-    {
-      http_encryption_t encryption;	/* Encryption mode */
-      ipp_t		*request,	/* IPP request */
-			*response;	/* IPP response */
-      ipp_attribute_t	*attr;		/* operations-supported */
-      int		create_job = 0;	/* Support for Create-Job/Send-Document? */
-      int		gzip;		/* gzip compression supported? */
-      const char	*job_name;	/* Title of job */
-      const char	*media;		/* Value of "media" option */
-      const char	*sides;		/* Value of "sides" option */
-      static const char * const pattrs[] =
-      {					/* requested-attributes */
-        "compression-supported",
-        "operations-supported"
-      };
-
-     /*
-      * Connect to the IPP/IPPS printer...
-      */
-
-      if (port == 443 || !strcmp(scheme, "ipps"))
-        encryption = HTTP_ENCRYPTION_ALWAYS;
-      else
-        encryption = HTTP_ENCRYPTION_IF_REQUESTED;
-
-      if ((http = httpConnect2(host, port, list, AF_UNSPEC, encryption, 1, 30000, NULL)) == NULL)
-      {
-	fprintf(stderr, "ERROR: Unable to connect to \"%s\" on port %d: %s\n", host, port, cupsLastErrorString());
-	return (1);
-      }
-
-     /*
-      * See if it supports Create-Job + Send-Document...
-      */
-
-      request = ippNewRequest(IPP_OP_GET_PRINTER_ATTRIBUTES);
-      ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, device_uri);
-      ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser());
-      ippAddStrings(request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "requested-attributes", (int)(sizeof(pattrs) / sizeof(pattrs[0])), NULL, pattrs);
-
-      response = cupsDoRequest(http, request, resource);
-      if (cupsLastError() > IPP_STATUS_OK_EVENTS_COMPLETE)
-      {
-        fprintf(stderr, "ERROR: Unable to get printer capabilities: %s\n", cupsLastErrorString());
-	return (1);
-      }
-
-      if ((attr = ippFindAttribute(response, "operations-supported", IPP_TAG_ENUM)) == NULL)
-      {
-        fputs("ERROR: Unable to get list of supported operations from printer.\n", stderr);
-	return (1);
-      }
-
-      create_job = ippContainsInteger(attr, IPP_OP_CREATE_JOB) && ippContainsInteger(attr, IPP_OP_SEND_DOCUMENT);
-      gzip       = ippContainsString(ippFindAttribute(response, "compression-supported", IPP_TAG_KEYWORD), "gzip");
-
-      ippDelete(response);
-
-     /*
-      * Create the job and start printing...
-      */
-
-      if ((job_name = getenv("IPP_JOB_NAME")) == NULL)
-      {
-	if ((job_name = strrchr(filename, '/')) != NULL)
-	  job_name ++;
-	else
-	  job_name = filename;
-      }
-
-      if (create_job)
-      {
-        int		job_id = 0;	/* Job ID */
-
-        request = ippNewRequest(IPP_OP_CREATE_JOB);
-	ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, device_uri);
-	ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser());
-	ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "job-name", NULL, job_name);
-
-        response = cupsDoRequest(http, request, resource);
-        if ((attr = ippFindAttribute(response, "job-id", IPP_TAG_INTEGER)) != NULL)
-	  job_id = ippGetInteger(attr, 0);
-        ippDelete(response);
-
-	if (cupsLastError() > IPP_STATUS_OK_EVENTS_COMPLETE)
-	{
-	  fprintf(stderr, "ERROR: Unable to create print job: %s\n", cupsLastErrorString());
-	  return (1);
-	}
-	else if (job_id <= 0)
-	{
-          fputs("ERROR: No job-id for created print job.\n", stderr);
-	  return (1);
-	}
-
-        request = ippNewRequest(IPP_OP_SEND_DOCUMENT);
-	ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, device_uri);
-	ippAddInteger(request, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "job-id", job_id);
-	ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser());
-	ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_MIMETYPE, "document-format", NULL, output_type);
-	if (gzip)
-	  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "compression", NULL, "gzip");
-        ippAddBoolean(request, IPP_TAG_OPERATION, "last-document", 1);
-      }
-      else
-      {
-        request = ippNewRequest(IPP_OP_PRINT_JOB);
-	ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, device_uri);
-	ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser());
-	ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_MIMETYPE, "document-format", NULL, output_type);
-	if (gzip)
-	  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "compression", NULL, "gzip");
-      }
-
-      if ((media = cupsGetOption("media", num_options, options)) != NULL)
-        ippAddString(request, IPP_TAG_JOB, IPP_TAG_KEYWORD, "media", NULL, media);
 
-      if ((sides = cupsGetOption("sides", num_options, options)) != NULL)
-        ippAddString(request, IPP_TAG_JOB, IPP_TAG_KEYWORD, "sides", NULL, sides);
+    if ((*cache->cb)(cache->ctx, buffer, (size_t)bytes) < 0)
+      return (-1);
 
-      if (cupsSendRequest(http, request, resource, 0) != HTTP_STATUS_CONTINUE)
-      {
-        fprintf(stderr, "ERROR: Unable to send print data: %s\n", cupsLastErrorString());
-	return (1);
-      }
+    offset += bytes;
+  }
 
-      ippDelete(request);
+  return (0);
+}
 
-      if (gzip)
-        httpSetField(http, HTTP_FIELD_CONTENT_ENCODING, "gzip");
 
-      write_cb  = (xform_write_cb_t)httpWrite2;
-      write_ptr = http;
+/*
+ * 'cache_write()' - Write output data, copying it to the page cache.
+ */
 
-      monitor = _cupsThreadCreate((_cups_thread_func_t)monitor_ipp, (void *)device_uri);
+static ssize_t				/* O - Number of bytes written or -1 on error */
+cache_write(xform_cache_t       *cache,	/* I - Page cache */
+            const unsigned char *buffer,/* I - Buffer */
+            size_t              bytes)	/* I - Number of bytes to write */
+{
+  if (cache->capture && !cache->error)
+  {
+    if (write_fd(&cache->fd, buffer, bytes) < 0)
+    {
+      fprintf(stderr, "DEBUG: Unable to write page cache: %s\n", strerror(errno));
+      cache->error = 1;
     }
-
-    httpAddrFreeList(list);
+    else
+      cache->length += (off_t)bytes;
   }
 
- /*
-  * Do transform...
-  */
+  return ((*cache->cb)(cache->ctx, buffer, bytes));
+}
+#endif /* HAVE_MUPDF */
 
-  status = xform_document(filename, content_type, output_type, resolutions, sheet_back, types, num_options, options, write_cb, write_ptr);
 
-  if (http)
-  {
-    ippDelete(cupsGetResponse(http, resource));
+/*
+ * 'dither_line()' - Dither a line of 8-bit grayscale pixels to 1-bit.
+ *
+ * Bits are set for pixels that are less than or equal to the threshold, or
+ * greater than the threshold when "invert" is 255.  The threshold row is
+ * rotated so that the vectorized functions can load it starting at column 0.
+ */
 
-    if (cupsLastError() > IPP_STATUS_OK_EVENTS_COMPLETE)
-    {
-      fprintf(stderr, "ERROR: Unable to send print data: %s\n", cupsLastErrorString());
-      status = 1;
-    }
+static unsigned char *			/* O - End of output */
+dither_line(
+    xform_raster_t      *ras,		/* I - Raster information */
+    unsigned            y,		/* I - Line number */
+    const unsigned char *line,		/* I - Pixels on line */
+    unsigned char       invert)		/* I - 0 for black, 255 for white */
+{
+  size_t	x;			/* Current column */
+  const unsigned char *ditherline;	/* Pointer into dither table */
+  unsigned char	thresholds[96];		/* Rotated thresholds */
 
-    httpClose(http);
-  }
-  else if (fd != 1)
-    close(fd);
 
-  if (monitor)
-    _cupsThreadCancel(monitor);
+  ditherline = ras->dither[y & 63];
 
-  return (status);
+  for (x = 0; x < sizeof(thresholds); x ++)
+    thresholds[x] = ditherline[(ras->left + x) & 63];
+
+  return (dither_bits(ras->dither_pixels, ras->out_buffer, line, thresholds, ras->right - ras->left, invert));
 }
 
 
@@ -655,15 +657,22 @@ load_env_options(
 
 /*
  * 'monitor_ipp()' - Monitor IPP printer status.
+ *
+ * The monitor runs until its stop flag is set and then closes its connection,
+ * so it can be joined when a job finishes in "--server" mode.
  */
 
 static void *				/* O - Thread exit status */
-monitor_ipp(const char *device_uri)	/* I - Device URI */
+monitor_ipp(xform_monitor_t *monitor)	/* I - Monitor */
 {
   int		i;			/* Looping var */
+  const char	*device_uri = monitor->device_uri;
+					/* Device URI */
+  int		stop;			/* Stop monitoring? */
   http_t	*http;			/* HTTP connection */
   ipp_t		*request,		/* IPP request */
-		*response;		/* IPP response */
+		*response,		/* IPP response */
+		*changes;		/* Changed attributes */
   ipp_attribute_t *attr;		/* IPP response attribute */
   char		scheme[32],		/* URI scheme */
 		userpass[256],		/* URI user:pass */
@@ -697,14 +706,30 @@ monitor_ipp(const char *device_uri)	/* I - Device URI */
   else
     encryption = HTTP_ENCRYPTION_IF_REQUESTED;
 
+  memset(pvalues, 0, sizeof(pvalues));
+
   while ((http = httpConnect2(host, port, NULL, AF_UNSPEC, encryption, 1, 30000, NULL)) == NULL)
   {
     fprintf(stderr, "ERROR: Unable to connect to \"%s\" on port %d: %s\n", host, port, cupsLastErrorString());
-    sleep(30);
+
+    _cupsMutexLock(&monitor->mutex);
+    if (!monitor->stop)
+      _cupsCondWait(&monitor->cond, &monitor->mutex, 30.0);
+    stop = monitor->stop;
+    _cupsMutexUnlock(&monitor->mutex);
+
+    if (stop)
+      return (NULL);
   }
 
  /*
-  * Report printer state changes until we are canceled...
+  * Don't let a stalled printer keep the monitor from stopping...
+  */
+
+  httpSetTimeout(http, 30.0, NULL, NULL);
+
+ /*
+  * Report printer state changes until we are stopped...
   */
 
   for (;;)
@@ -724,6 +749,8 @@ monitor_ipp(const char *device_uri)	/* I - Device URI */
     * Report any differences...
     */
 
+    changes = ippNew();
+
     for (attr = ippFirstAttribute(response); attr; attr = ippNextAttribute(response))
     {
       const char *name = ippGetName(attr);
@@ -744,32 +771,94 @@ monitor_ipp(const char *device_uri)	/* I - Device URI */
 
       if (strcmp(value, pvalues[i]))
       {
-        if (!strcmp(name, "printer-state-reasons"))
-	  fprintf(stderr, "STATE: %s\n", value);
-	else
-	  fprintf(stderr, "ATTR: %s='%s'\n", name, value);
+        ippCopyAttribute(changes, attr, 0);
 
         strlcpy(pvalues[i], value, sizeof(pvalues[i]));
       }
     }
 
+    if (ippFirstAttribute(changes))
+      report_attrs(changes);
+
+    ippDelete(changes);
     ippDelete(response);
 
    /*
     * Sleep until the next update...
     */
 
-    sleep((unsigned)delay);
+    _cupsMutexLock(&monitor->mutex);
+    if (!monitor->stop)
+      _cupsCondWait(&monitor->cond, &monitor->mutex, delay);
+    stop = monitor->stop;
+    _cupsMutexUnlock(&monitor->mutex);
+
+    if (stop)
+      break;
 
     next_delay = (delay + prev_delay) % 12;
     prev_delay = next_delay < delay ? 0 : delay;
     delay      = next_delay;
   }
 
+  httpClose(http);
+
   return (NULL);
 }
 
 
+#ifdef HAVE_MUPDF
+/*
+ * 'mupdf_lock()' - Lock a MuPDF resource.
+ */
+
+static void
+mupdf_lock(void *user,			/* I - Array of locks */
+           int  lock)			/* I - Lock number */
+{
+  _cupsMutexLock((_cups_mutex_t *)user + lock);
+}
+
+
+/*
+ * 'mupdf_new_context()' - Create a MuPDF context for transforming documents.
+ */
+
+static fz_context *			/* O - New context or `NULL` on error */
+mupdf_new_context(size_t max_store)	/* I - Maximum size of resource store */
+{
+  int			i;		/* Looping var */
+  fz_context		*context;	/* MuPDF context */
+  fz_locks_context	locks;		/* MuPDF locking callbacks */
+
+
+  for (i = 0; i < FZ_LOCK_MAX; i ++)
+    _cupsMutexInit(FitzLocks + i);
+
+  locks.user   = FitzLocks;
+  locks.lock   = mupdf_lock;
+  locks.unlock = mupdf_unlock;
+
+  if ((context = fz_new_context(NULL, &locks, max_store)) != NULL)
+    fz_register_document_handlers(context);
+
+  return (context);
+}
+
+
+/*
+ * 'mupdf_unlock()' - Unlock a MuPDF resource.
+ */
+
+static void
+mupdf_unlock(void *user,		/* I - Array of locks */
+             int  lock)			/* I - Lock number */
+{
+  _cupsMutexUnlock((_cups_mutex_t *)user + lock);
+}
+#endif /* HAVE_MUPDF */
+
+
 #ifdef HAVE_COREGRAPHICS
 /*
  * 'pack_rgba()' - Pack RGBX scanlines into RGB scanlines.
@@ -1113,15 +1202,10 @@ pcl_write_line(
     xform_write_cb_t    cb,		/* I - Write callback */
     void                *ctx)		/* I - Write context */
 {
-  unsigned	x;			/* Column number */
-  unsigned char	bit,			/* Current bit */
-		byte,			/* Current byte */
-		*outptr,		/* Pointer into output buffer */
+  unsigned char	*outptr,		/* Pointer into output buffer */
 		*outend,		/* End of output buffer */
-		*start,			/* Start of sequence */
 		*compptr;		/* Pointer into compression buffer */
   unsigned	count;			/* Count of bytes for output */
-  const unsigned char	*ditherline;	/* Pointer into dither table */
 
 
   if (line[0] == 255 && !memcmp(line, line + 1, ras->right - ras->left - 1))
@@ -1138,89 +1222,44 @@ pcl_write_line(
   * Dither the line into the output buffer...
   */
 
-  y &= 63;
-  ditherline = ras->dither[y];
-
-  for (x = ras->left, bit = 128, byte = 0, outptr = ras->out_buffer; x < ras->right; x ++, line ++)
-  {
-    if (*line <= ditherline[x & 63])
-      byte |= bit;
-
-    if (bit == 1)
-    {
-      *outptr++ = byte;
-      byte      = 0;
-      bit       = 128;
-    }
-    else
-      bit >>= 1;
-  }
-
-  if (bit != 128)
-    *outptr++ = byte;
+  outend = dither_line(ras, y, line, 0);
 
  /*
   * Apply compression...
   */
 
   compptr = ras->comp_buffer;
-  outend  = outptr;
   outptr  = ras->out_buffer;
 
   while (outptr < outend)
   {
-    if ((outptr + 1) >= outend)
-    {
-     /*
-      * Single byte on the end...
-      */
-
-      *compptr++ = 0x00;
-      *compptr++ = *outptr++;
-    }
-    else if (outptr[0] == outptr[1])
+    if ((count = (unsigned)_cupsRasterRepeatLength(outptr, outend, 1, 127)) > 1)
     {
      /*
       * Repeated sequence...
       */
 
-      outptr ++;
-      count = 2;
-
-      while (outptr < (outend - 1) &&
-	     outptr[0] == outptr[1] &&
-	     count < 127)
-      {
-	outptr ++;
-	count ++;
-      }
-
       *compptr++ = (unsigned char)(257 - count);
-      *compptr++ = *outptr++;
+      *compptr++ = *outptr;
     }
     else
     {
      /*
-      * Non-repeated sequence...
+      * Non-repeated sequence, with the last byte on the line sent as a
+      * separate sequence...
       */
 
-      start = outptr;
-      outptr ++;
-      count = 1;
-
-      while (outptr < (outend - 1) &&
-	     outptr[0] != outptr[1] &&
-	     count < 127)
-      {
-	outptr ++;
-	count ++;
-      }
+      count = (unsigned)_cupsRasterLiteralLength(outptr, outend, 1, 127);
+      if (count > 1 && (outptr + count) >= outend)
+        count --;
 
       *compptr++ = (unsigned char)(count - 1);
 
-      memcpy(compptr, start, count);
+      memcpy(compptr, outptr, count);
       compptr += count;
     }
+
+    outptr += count;
   }
 
  /*
@@ -1360,52 +1399,7 @@ raster_write_line(
     * Dither the line into the output buffer...
     */
 
-    unsigned		x;		/* Column number */
-    unsigned char	bit,		/* Current bit */
-			byte,		/* Current byte */
-			*outptr;	/* Pointer into output buffer */
-    const unsigned char	*ditherline;	/* Pointer into dither table */
-
-    y &= 63;
-    ditherline = ras->dither[y];
-
-    if (ras->header.cupsColorSpace == CUPS_CSPACE_SW)
-    {
-      for (x = ras->left, bit = 128, byte = 0, outptr = ras->out_buffer; x < ras->right; x ++, line ++)
-      {
-	if (*line > ditherline[x & 63])
-	  byte |= bit;
-
-	if (bit == 1)
-	{
-	  *outptr++ = byte;
-	  byte      = 0;
-	  bit       = 128;
-	}
-	else
-	  bit >>= 1;
-      }
-    }
-    else
-    {
-      for (x = ras->left, bit = 128, byte = 0, outptr = ras->out_buffer; x < ras->right; x ++, line ++)
-      {
-	if (*line <= ditherline[x & 63])
-	  byte |= bit;
-
-	if (bit == 1)
-	{
-	  *outptr++ = byte;
-	  byte      = 0;
-	  bit       = 128;
-	}
-	else
-	  bit >>= 1;
-      }
-    }
-
-    if (bit != 128)
-      *outptr++ = byte;
+    dither_line(ras, y, line, ras->header.cupsColorSpace == CUPS_CSPACE_SW ? 255 : 0);
 
     cupsRasterWritePixels(ras->ras, ras->out_buffer, ras->header.cupsBytesPerLine);
   }
@@ -1414,181 +1408,1083 @@ raster_write_line(
 }
 
 
+#ifdef HAVE_MUPDF
 /*
- * 'usage()' - Show program usage.
+ * 'render_bands()' - Render bands of raster data on a worker thread.
+ *
+ * Worker N renders bands N, N + num_workers, N + 2 * num_workers, and so
+ * forth.  Each band is held in the worker's pixmap until the main thread has
+ * written it, which keeps the output in page order.  Workers wait for more
+ * bands until the main thread cancels rendering.
  */
 
-static void
-usage(int status)			/* I - Exit status */
+static void *				/* O - Thread exit status */
+render_bands(xform_worker_t *worker)	/* I - Worker */
 {
-  puts("Usage: ipptransform [options] filename\n");
-  puts("Options:");
-  puts("  --help");
-  puts("  -d device-uri");
-  puts("  -f output-filename");
-  puts("  -i input/format");
-  puts("  -m output/format");
-  puts("  -o \"name=value [... name=value]\"");
-  puts("  -r resolution[,...,resolution]");
-  puts("  -s {flipped|manual-tumble|normal|rotated}");
-  puts("  -t type[,...,type]");
-  puts("  -v\n");
-  puts("Device URIs: socket://address[:port], ipp://address[:port]/resource, ipps://address[:port]/resource");
-  puts("Input Formats: application/pdf, image/jpeg");
-  puts("Output Formats: application/vnd.hp-pcl, image/pwg-raster, image/urf");
-  puts("Options: copies, media, media-col, page-ranges, print-color-mode, print-quality, print-scaling, printer-resolution, sides");
-  puts("Resolutions: NNNdpi or NNNxNNNdpi");
-#ifdef HAVE_COREGRAPHICS
-  puts("Types: adobe-rgb_8, adobe-rgb_16, black_1, black_8, cmyk_8, sgray_1, sgray_8, srgb_8");
-#elif defined(HAVE_FZ_CMM_ENGINE_LCMS)
-  puts("Types: adobe-rgb_8, black_1, black_8, cmyk_8, sgray_1, sgray_8, srgb_8");
-#else
-  puts("Types: black_1, black_8, cmyk_8, sgray_1, sgray_8, srgb_8");
-#endif /* HAVE_COREGRAPHICS */
-
-  exit(status);
-}
+  xform_render_t	*render = worker->render;
+					/* Renderer */
+  fz_context		*context = worker->context;
+					/* MuPDF context */
+  fz_display_list	*list;		/* Display list for page */
+  fz_matrix		image_transform,/* Transform for page image */
+			transform;	/* Transform for band */
+  unsigned		job,		/* Current band number */
+			page,		/* Current page */
+			y;		/* First line in band */
+  int			cancel,		/* Stop rendering? */
+			error;		/* Error rendering band? */
+
+
+  for (job = worker->index;; job += render->num_workers)
+  {
+   /*
+    * Wait for the previous band to be written and for this band to be
+    * needed...
+    */
 
+    _cupsMutexLock(&render->mutex);
+    while ((worker->ready || job >= render->num_jobs) && !render->cancel)
+      _cupsCondWait(&render->cond, &render->mutex, 0.0);
+    cancel = render->cancel;
+    _cupsMutexUnlock(&render->mutex);
 
-/*
- * 'write_fd()' - Write to a file/socket.
- */
+    if (cancel)
+      break;
 
-static ssize_t				/* O - Number of bytes written or -1 on error */
-write_fd(int                 *fd,	/* I - File descriptor */
-         const unsigned char *buffer,	/* I - Buffer */
-         size_t              bytes)	/* I - Number of bytes to write */
-{
-  ssize_t	temp,			/* Temporary byte count */
-		total = 0;		/* Total bytes written */
+    page  = (job / render->num_bands) % render->pages + 1;
+    y     = (job % render->num_bands) * render->ras->band_height;
+    error = 0;
 
+    if (Verbosity > 1)
+      fprintf(stderr, "DEBUG: Drawing page %u band from %u to %u.\n", page, y, y + render->ras->band_height);
 
-  while (bytes > 0)
-  {
-    if ((temp = write(*fd, buffer, bytes)) < 0)
+    if ((list = render_page(render, context, page, &image_transform)) == NULL)
     {
-      if (errno == EINTR || errno == EAGAIN)
-        continue;
-      else
-        return (-1);
+      error = 1;
     }
+    else
+    {
+      fz_try(context)
+      {
+        fz_clear_pixmap_with_value(context, worker->pixmap, 0xff);
 
-    total  += temp;
-    bytes  -= (size_t)temp;
-    buffer += temp;
-  }
+        transform = fz_identity;
 
-  return (total);
-}
+#  if FZ_VERSION_MAJOR > 1 || FZ_VERSION_MINOR > 14
+	transform = fz_pre_translate(transform, 0.0, -1.0 * y / render->yscale);
 
+	if (!(page & 1) && render->ras->header.Duplex)
+	  transform = fz_concat(transform, render->back_transform);
 
+	transform = fz_concat(transform, image_transform);
 
-#ifdef HAVE_COREGRAPHICS
-/*
- * 'xform_document()' - Transform a file for printing.
- */
+        fz_run_display_list(context, list, worker->device, transform, fz_infinite_rect, NULL);
+#  else
+	fz_pre_translate(&transform, 0.0, -1.0 * y / render->yscale);
 
-static int				/* O - 0 on success, 1 on error */
-xform_document(
-    const char       *filename,		/* I - File to transform */
-    const char       *informat,		/* I - Input document (MIME media type */
-    const char       *outformat,	/* I - Output format (MIME media type) */
-    const char       *resolutions,	/* I - Supported resolutions */
-    const char       *sheet_back,	/* I - Back side transform */
-    const char       *types,		/* I - Supported types */
-    int              num_options,	/* I - Number of options */
-    cups_option_t    *options,		/* I - Options */
-    xform_write_cb_t cb,		/* I - Write callback */
-    void             *ctx)		/* I - Write context */
-{
-  CFURLRef		url;		/* CFURL object for PDF filename */
-  CGPDFDocumentRef	document = NULL;/* Input document */
-  CGPDFPageRef		pdf_page;	/* Page in PDF file */
-  CGImageSourceRef	src;		/* Image reader */
-  CGImageRef		image = NULL;	/* Image */
-  xform_raster_t	ras;		/* Raster info */
-  size_t		max_raster;	/* Maximum raster memory to use */
-  const char		*max_raster_env;/* IPPTRANSFORM_MAX_RASTER env var */
-  size_t		bpc;		/* Bits per color */
-  CGColorSpaceRef	cs;		/* Quartz color space */
-  CGContextRef		context;	/* Quartz bitmap context */
-  CGBitmapInfo		info;		/* Bitmap flags */
-  size_t		band_size;	/* Size of band line */
-  double		xscale, yscale;	/* Scaling factor */
-  CGAffineTransform 	transform,	/* Transform for page */
-			back_transform;	/* Transform for back side */
-  CGRect		dest;		/* Destination rectangle */
-  unsigned		pages = 1;	/* Number of pages */
-  int			color = 1;	/* Does the PDF have color? */
-  const char		*page_ranges;	/* "page-ranges" option */
-  unsigned		first = 1,	/* First page of range */
-			last = 1;	/* Last page of range */
-  const char		*print_scaling;	/* print-scaling option */
-  size_t		image_width,	/* Image width */
-			image_height;	/* Image height */
-  int			image_rotation;	/* Image rotation */
-  double		image_xscale,	/* Image scaling */
-			image_yscale;
-  unsigned		copy;		/* Current copy */
-  unsigned		page;		/* Current page */
-  unsigned		media_sheets = 0,
-			impressions = 0;/* Page/sheet counters */
+	if (!(page & 1) && render->ras->header.Duplex)
+	  fz_concat(&transform, &transform, &render->back_transform);
 
+	fz_concat(&transform, &transform, &image_transform);
 
- /*
-  * Open the file...
-  */
+        fz_run_display_list(context, list, worker->device, &transform, &fz_infinite_rect, NULL);
+#  endif /* FZ_VERSION_MAJOR > 1 || FZ_VERSION_MINOR > 14 */
+      }
+      fz_catch(context)
+      {
+        fprintf(stderr, "ERROR: Unable to render page %u: %s\n", page, fz_caught_message(context));
+        error = 1;
+      }
 
-  if ((url = CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8 *)filename, (CFIndex)strlen(filename), false)) == NULL)
-  {
-    fputs("ERROR: Unable to create CFURL for file.\n", stderr);
-    return (1);
-  }
+      fz_drop_display_list(context, list);
+    }
 
-  if (!strcmp(informat, "application/pdf"))
-  {
    /*
-    * Open the PDF...
+    * Hand the band to the main thread...
     */
 
-    document = CGPDFDocumentCreateWithURL(url);
-    CFRelease(url);
+    _cupsMutexLock(&render->mutex);
+    worker->ready = 1;
+    worker->error = error;
+    _cupsCondBroadcast(&render->cond);
+    _cupsMutexUnlock(&render->mutex);
+  }
 
-    if (!document)
-    {
-      fputs("ERROR: Unable to create CFPDFDocument for file.\n", stderr);
-      return (1);
-    }
+  return (NULL);
+}
 
-    if (CGPDFDocumentIsEncrypted(document))
-    {
-     /*
-      * Only support encrypted PDFs with a blank password...
-      */
 
-      if (!CGPDFDocumentUnlockWithPassword(document, ""))
-      {
-	fputs("ERROR: Document is encrypted and cannot be unlocked.\n", stderr);
-	CGPDFDocumentRelease(document);
-	return (1);
-      }
-    }
+/*
+ * 'render_page()' - Get the display list for a page, recording it as needed.
+ *
+ * Pages are only interpreted by one thread at a time since MuPDF documents are
+ * not thread-safe.  The recorded display list can be drawn by any number of
+ * threads.
+ */
 
-    if (!CGPDFDocumentAllowsPrinting(document))
-    {
-      fputs("ERROR: Document does not allow printing.\n", stderr);
-      CGPDFDocumentRelease(document);
-      return (1);
-    }
+static fz_display_list *		/* O - Display list (caller must drop) or NULL on error */
+render_page(
+    xform_render_t *render,		/* I - Renderer */
+    fz_context     *context,		/* I - MuPDF context for thread */
+    unsigned       page,		/* I - Page number */
+    fz_matrix      *image_transform)	/* O - Transform for page image */
+{
+  xform_page_t		*p = render->page_lists + page - 1;
+					/* Recorded page */
+  xform_raster_t	*ras = render->ras;
+					/* Raster information */
+  fz_display_list	*list = NULL;	/* Display list */
+  fz_page		*pdf_page = NULL;/* Page in PDF file */
+  fz_rect		image_box;	/* Bounding box of content */
 
-   /*
-    * Check page ranges...
-    */
 
-    if ((page_ranges = cupsGetOption("page-ranges", num_options, options)) != NULL)
+  _cupsMutexLock(&render->doc_mutex);
+
+  if (!p->list)
+  {
+    fz_var(pdf_page);
+
+    fz_try(context)
     {
-      if (sscanf(page_ranges, "%u-%u", &first, &last) != 2 || first > last)
-      {
+      pdf_page = fz_load_page(context, render->document, (int)(page + render->first - 2));
+
+#  if FZ_VERSION_MAJOR > 1 || FZ_VERSION_MINOR > 14
+      image_box = fz_bound_page(context, pdf_page);
+#  else
+      fz_bound_page(context, pdf_page, &image_box);
+#  endif /* FZ_VERSION_MAJOR > 1 || FZ_VERSION_MINOR > 14 */
+
+      fprintf(stderr, "DEBUG: image_box=[%g %g %g %g]\n", image_box.x0, image_box.y0, image_box.x1, image_box.y1);
+
+      float image_width = image_box.x1 - image_box.x0;
+      float image_height = image_box.y1 - image_box.y0;
+      int image_rotation = 0;
+      int is_image = strcmp(render->informat, "application/pdf") != 0;
+      float image_xscale, image_yscale;
+
+      if ((image_height < image_width && ras->header.cupsWidth < ras->header.cupsHeight) ||
+	   (image_width < image_height && ras->header.cupsHeight < ras->header.cupsWidth))
+      {
+       /*
+	* Rotate image/page 90 degrees...
+	*/
+
+	image_rotation = 90;
+      }
+
+      if ((!strcmp(render->print_scaling, "auto") && ras->borderless && is_image) || !strcmp(render->print_scaling, "fill"))
+      {
+       /*
+	* Scale to fill...
+	*/
+
+	if (image_rotation)
+	{
+	  image_xscale = ras->header.cupsPageSize[0] / (double)image_height;
+	  image_yscale = ras->header.cupsPageSize[1] / (double)image_width;
+	}
+	else
+	{
+	  image_xscale = ras->header.cupsPageSize[0] / (double)image_width;
+	  image_yscale = ras->header.cupsPageSize[1] / (double)image_height;
+	}
+
+	if (image_xscale < image_yscale)
+	  image_xscale = image_yscale;
+	else
+	  image_yscale = image_xscale;
+
+      }
+      else if ((!strcmp(render->print_scaling, "auto") && (is_image || (image_rotation == 0 && (image_width > ras->header.cupsPageSize[0] || image_height > ras->header.cupsPageSize[1])) || (image_rotation == 90 && (image_height > ras->header.cupsPageSize[1] || image_width > ras->header.cupsPageSize[1])))) || !strcmp(render->print_scaling, "fit"))
+      {
+       /*
+	* Scale to fit...
+	*/
+
+	if (image_rotation)
+	{
+	  image_xscale = ras->header.cupsPageSize[0] / (double)image_height;
+	  image_yscale = ras->header.cupsPageSize[1] / (double)image_width;
+	}
+	else
+	{
+	  image_xscale = ras->header.cupsPageSize[0] / (double)image_width;
+	  image_yscale = ras->header.cupsPageSize[1] / (double)image_height;
+	}
+
+	if (image_xscale > image_yscale)
+	  image_xscale = image_yscale;
+	else
+	  image_yscale = image_xscale;
+      }
+      else
+      {
+       /*
+        * Do not scale...
+	*/
+
+        image_xscale = image_yscale = 1.0;
+      }
+
+      if (image_rotation)
+      {
+	p->transform = make_matrix(image_xscale, 0, 0, image_yscale, 0.5 * (ras->header.cupsPageSize[0] - image_xscale * image_height), 0.5 * (ras->header.cupsPageSize[1] - image_yscale * image_width));
+      }
+      else
+      {
+	p->transform = make_matrix(image_xscale, 0, 0, image_yscale, 0.5 * (ras->header.cupsPageSize[0] - image_xscale * image_width), 0.5 * (ras->header.cupsPageSize[1] - image_yscale * image_height));
+      }
+
+      if (Verbosity > 1)
+        fprintf(stderr, "DEBUG: Recording page %u/%u, image_transform=[%g %g %g %g %g %g]\n", page, render->pages, p->transform.a, p->transform.b, p->transform.c, p->transform.d, p->transform.e, p->transform.f);
+
+      p->list = fz_new_display_list_from_page(context, pdf_page);
+    }
+    fz_always(context)
+    {
+      fz_drop_page(context, pdf_page);
+    }
+    fz_catch(context)
+    {
+      fprintf(stderr, "ERROR: Unable to load page %u: %s\n", page, fz_caught_message(context));
+    }
+  }
+
+  if (p->list)
+  {
+    list             = fz_keep_display_list(context, p->list);
+    *image_transform = p->transform;
+  }
+
+  _cupsMutexUnlock(&render->doc_mutex);
+
+  return (list);
+}
+#endif /* HAVE_MUPDF */
+
+
+/*
+ * 'report_attrs()' - Report job and printer attributes to ippserver.
+ *
+ * When ippserver provides a progress descriptor the attributes are sent as a
+ * single length-prefixed IPP message.  Otherwise they are written to stderr as
+ * "STATE:" and "ATTR:" lines.
+ */
+
+static void
+report_attrs(ipp_t *attrs)		/* I - Attributes to report */
+{
+  ipp_attribute_t *attr;		/* Current attribute */
+  const char	*name;			/* Attribute name */
+  char		value[1024];		/* Attribute value */
+
+
+#ifndef _WIN32
+  if (ProgressFD >= 0 && (ippLength(attrs) + 4) <= PIPE_BUF)
+  {
+   /*
+    * Messages no larger than PIPE_BUF are written atomically, so the monitor
+    * thread and the main thread can both report without a lock...
+    */
+
+    ipp_uchar_t	buffer[PIPE_BUF];	/* Message buffer */
+    xform_message_t message;		/* Message being written */
+    size_t	length;			/* Length of message */
+
+    message.ptr = buffer + 4;
+    message.end = buffer + sizeof(buffer);
+
+    ippSetState(attrs, IPP_STATE_IDLE);
+
+    if (ippWriteIO(&message, (ipp_iocb_t)write_message, 1, NULL, attrs) == IPP_STATE_DATA)
+    {
+      length    = (size_t)(message.ptr - buffer - 4);
+      buffer[0] = (ipp_uchar_t)(length >> 24);
+      buffer[1] = (ipp_uchar_t)(length >> 16);
+      buffer[2] = (ipp_uchar_t)(length >> 8);
+      buffer[3] = (ipp_uchar_t)length;
+
+      if (write(ProgressFD, buffer, length + 4) == (ssize_t)(length + 4))
+        return;
+    }
+  }
+#endif /* !_WIN32 */
+
+  for (attr = ippFirstAttribute(attrs); attr; attr = ippNextAttribute(attrs))
+  {
+    if ((name = ippGetName(attr)) == NULL)
+      continue;
+
+    ippAttributeString(attr, value, sizeof(value));
+
+    if (!strcmp(name, "printer-state-reasons"))
+      fprintf(stderr, "STATE: %s\n", value);
+    else if (ippGetValueTag(attr) == IPP_TAG_INTEGER)
+      fprintf(stderr, "ATTR: %s=%s\n", name, value);
+    else
+      fprintf(stderr, "ATTR: %s='%s'\n", name, value);
+  }
+}
+
+
+#ifndef _WIN32
+/*
+ * 'serve_requests()' - Transform files for ippserver until it disconnects.
+ *
+ * ippserver starts this process with "--server" and a UNIX domain socket as
+ * stdin.  Each request is a length with the job's stdout, stderr, progress,
+ * and cancel descriptors attached, followed by the filename and the job's
+ * environment strings separated by nul characters.  The exit status of each
+ * transform is sent back over the same socket.  ippserver cancels a job by
+ * writing to the cancel descriptor.
+ */
+
+static int				/* O - Exit status */
+serve_requests(void)
+{
+  int		i,			/* Looping var */
+		max_fd,			/* Maximum file descriptor */
+		null_fd,		/* /dev/null */
+		fds[4],			/* stdout, stderr, progress, and cancel for request */
+		length,			/* Length of request */
+		status;			/* Transform status */
+  char		*request = NULL,	/* Request buffer */
+		*temp,			/* New request buffer */
+		*ptr,			/* Pointer into request */
+		*end,			/* End of request */
+		*value;			/* Value of environment string */
+  size_t	reqsize = 0;		/* Size of request buffer */
+  ssize_t	bytes;			/* Bytes read */
+  struct iovec	iov;			/* Request length */
+  struct msghdr	msg;			/* Request message */
+  struct cmsghdr *cmsg;			/* Control message */
+  union
+  {
+    struct cmsghdr hdr;			/* Control message header */
+    char	buf[CMSG_SPACE(4 * sizeof(int))];
+					/* Control message buffer */
+  }		control;		/* Control message with descriptors */
+  cups_array_t	*names;			/* Environment variables from last request */
+  const char	*content_type,		/* Source content type */
+		*output_type,		/* Destination content type */
+		*resolutions,		/* pwg-raster-document-resolution-supported */
+		*sheet_back,		/* pwg-raster-document-sheet-back */
+		*types,			/* pwg-raster-document-type-supported */
+		*opt;			/* SERVER_LOGLEVEL value */
+  int		num_options;		/* Number of options */
+  cups_option_t	*options;		/* Options */
+
+
+ /*
+  * Close any descriptors we inherited from ippserver so that its clients,
+  * spool files, and other jobs' pipes are not held open by this process...
+  */
+
+  if ((max_fd = (int)sysconf(_SC_OPEN_MAX)) < 0 || max_fd > 65536)
+    max_fd = 65536;
+
+  for (i = 3; i < max_fd; i ++)
+    close(i);
+
+  if ((i = open("/dev/null", O_RDWR)) < 0)
+    return (1);
+
+ /*
+  * Keep /dev/null above the job's stdout, stderr, and progress descriptors...
+  */
+
+  null_fd = fcntl(i, F_DUPFD, 4);
+  close(i);
+
+  if (null_fd < 0)
+    return (1);
+
+  dup2(null_fd, 1);
+  dup2(null_fd, 2);
+  dup2(null_fd, 3);
+
+ /*
+  * A failed write to a job's output should only fail that job...
+  */
+
+  signal(SIGPIPE, SIG_IGN);
+
+#ifdef HAVE_MUPDF
+ /*
+  * Keep one MuPDF context, with its resource store and font cache, for all
+  * requests and give each transform a clone of it...
+  */
+
+  if ((FitzContext = mupdf_new_context(FZ_STORE_DEFAULT)) == NULL)
+  {
+    close(null_fd);
+    return (1);
+  }
+#endif /* HAVE_MUPDF */
+
+  names = cupsArrayNew3(NULL, NULL, NULL, 0, (cups_acopy_func_t)_cupsStrAlloc, (cups_afree_func_t)_cupsStrFree);
+
+  for (;;)
+  {
+   /*
+    * Read the next request...
+    */
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+
+    iov.iov_base       = &length;
+    iov.iov_len        = sizeof(length);
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    if (recvmsg(0, &msg, 0) != (ssize_t)sizeof(length))
+      break;
+
+    fds[0] = fds[1] = fds[2] = fds[3] = -1;
+
+    if ((cmsg = CMSG_FIRSTHDR(&msg)) != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(sizeof(fds)))
+      memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    if (fds[0] < 0 || fds[1] < 0 || fds[2] < 0 || fds[3] < 0 || length < 2 || length > 1048576)
+      break;
+
+    if ((size_t)length > reqsize)
+    {
+      if ((temp = realloc(request, (size_t)length)) == NULL)
+        break;
+
+      request = temp;
+      reqsize = (size_t)length;
+    }
+
+    for (ptr = request, end = request + length; ptr < end; ptr += bytes)
+    {
+      if ((bytes = read(0, ptr, (size_t)(end - ptr))) < 0 && errno == EINTR)
+        bytes = 0;
+      else if (bytes <= 0)
+        break;
+    }
+
+    if (ptr < end || end[-1])
+      break;
+
+    dup2(fds[0], 1);
+    dup2(fds[1], 2);
+    dup2(fds[2], 3);
+    close(fds[0]);
+    close(fds[1]);
+    close(fds[2]);
+
+    CancelFD = fds[3];
+
+   /*
+    * Replace the environment variables from the last request...
+    */
+
+    for (opt = (const char *)cupsArrayFirst(names); opt; opt = (const char *)cupsArrayNext(names))
+      unsetenv(opt);
+
+    cupsArrayClear(names);
+
+    for (ptr = request + strlen(request) + 1; ptr < end; ptr += strlen(ptr) + 1)
+    {
+      if ((value = strchr(ptr, '=')) == NULL)
+        continue;
+
+      *value++ = '\0';
+
+      setenv(ptr, value, 1);
+      cupsArrayAdd(names, ptr);
+    }
+
+    Verbosity = 0;
+
+    if ((opt = getenv("SERVER_LOGLEVEL")) != NULL)
+    {
+      if (!strcmp(opt, "debug"))
+	Verbosity = 2;
+      else if (!strcmp(opt, "info"))
+	Verbosity = 1;
+    }
+
+   /*
+    * Transform the file...
+    */
+
+    num_options  = load_env_options(&options);
+    content_type = getenv("CONTENT_TYPE");
+    output_type  = getenv("OUTPUT_TYPE");
+
+    if ((resolutions = getenv("IPP_PWG_RASTER_DOCUMENT_RESOLUTION_SUPPORTED")) == NULL)
+      resolutions = "300dpi";
+    if ((sheet_back = getenv("IPP_PWG_RASTER_DOCUMENT_SHEET_BACK")) == NULL)
+      sheet_back = "normal";
+    if ((types = getenv("IPP_PWG_RASTER_DOCUMENT_TYPE_SUPPORTED")) == NULL)
+      types = "sgray_8";
+
+    if (!content_type || (strcmp(content_type, "application/pdf") && strcmp(content_type, "image/jpeg")))
+    {
+      fprintf(stderr, "ERROR: Unsupported format \"%s\" for \"%s\".\n", content_type ? content_type : "(null)", request);
+      status = 1;
+    }
+    else if (!output_type || (strcmp(output_type, "application/vnd.hp-pcl") && strcmp(output_type, "image/pwg-raster") && strcmp(output_type, "image/urf")))
+    {
+      fprintf(stderr, "ERROR: Unsupported output format \"%s\".\n", output_type ? output_type : "(null)");
+      status = 1;
+    }
+    else
+      status = transform_file(request, content_type, getenv("DEVICE_URI"), output_type, resolutions, sheet_back, types, num_options, options);
+
+    cupsFreeOptions(num_options, options);
+
+   /*
+    * Close the job's stdout, stderr, progress, and cancel descriptors, then
+    * send the exit status...
+    */
+
+    fflush(stdout);
+    fflush(stderr);
+
+    close(CancelFD);
+    CancelFD = -1;
+
+    dup2(null_fd, 1);
+    dup2(null_fd, 2);
+    dup2(null_fd, 3);
+
+    if (write(0, &status, sizeof(status)) != (ssize_t)sizeof(status))
+      break;
+  }
+
+  cupsArrayDelete(names);
+  free(request);
+  close(null_fd);
+
+#ifdef HAVE_MUPDF
+  fz_drop_context(FitzContext);
+  FitzContext = NULL;
+#endif /* HAVE_MUPDF */
+
+  return (0);
+}
+#endif /* !_WIN32 */
+
+
+/*
+ * 'transform_file()' - Transform a file and send it to the output device.
+ */
+
+static int				/* O - 0 on success, 1 on error */
+transform_file(
+    const char    *filename,		/* I - File to transform */
+    const char    *content_type,	/* I - Source content type */
+    const char    *device_uri,		/* I - Destination URI or `NULL` for stdout */
+    const char    *output_type,		/* I - Destination content type */
+    const char    *resolutions,		/* I - pwg-raster-document-resolution-supported */
+    const char    *sheet_back,		/* I - pwg-raster-document-sheet-back */
+    const char    *types,		/* I - pwg-raster-document-type-supported */
+    int           num_options,		/* I - Number of options */
+    cups_option_t *options)		/* I - Options */
+{
+  int		fd = 1;			/* Output file/socket */
+  http_t	*http = NULL;		/* Output HTTP connection */
+  void		*write_ptr = &fd;	/* Pointer to file/socket/HTTP connection */
+  char		resource[1024];		/* URI resource path */
+  xform_write_cb_t write_cb = (xform_write_cb_t)write_fd;
+					/* Write callback */
+  int		status = 0;		/* Exit status */
+  _cups_thread_t monitor = 0;		/* Monitoring thread ID */
+  xform_monitor_t monitor_data;		/* Monitoring thread data */
+#ifndef _WIN32
+  const char	*progress_fd;		/* SERVER_PROGRESS_FD env var */
+#endif /* !_WIN32 */
+
+
+#ifndef _WIN32
+ /*
+  * See if ippserver gave us a descriptor for progress messages...
+  */
+
+  ProgressFD = -1;
+
+  if ((progress_fd = getenv("SERVER_PROGRESS_FD")) != NULL && (ProgressFD = atoi(progress_fd)) > 2 && fcntl(ProgressFD, F_GETFD) < 0)
+    ProgressFD = -1;
+#endif /* !_WIN32 */
+
+ /*
+  * If the device URI is specified, open the connection...
+  */
+
+  if (device_uri)
+  {
+    char	scheme[32],		/* URI scheme */
+		userpass[256],		/* URI user:pass */
+		host[256],		/* URI host */
+		service[32];		/* Service port */
+    int		port;			/* URI port number */
+    http_addrlist_t *list;		/* Address list for socket */
+
+    if (httpSeparateURI(HTTP_URI_CODING_ALL, device_uri, scheme, sizeof(scheme), userpass, sizeof(userpass), host, sizeof(host), &port, resource, sizeof(resource)) < HTTP_URI_STATUS_OK)
+    {
+      fprintf(stderr, "ERROR: Invalid device URI \"%s\".\n", device_uri);
+      return (1);
+    }
+
+    if (strcmp(scheme, "socket") && strcmp(scheme, "ipp") && strcmp(scheme, "ipps"))
+    {
+      fprintf(stderr, "ERROR: Unsupported device URI scheme \"%s\".\n", scheme);
+      return (1);
+    }
+
+    snprintf(service, sizeof(service), "%d", port);
+    if ((list = httpAddrGetList(host, AF_UNSPEC, service)) == NULL)
+    {
+      fprintf(stderr, "ERROR: Unable to lookup device URI host \"%s\": %s\n", host, cupsLastErrorString());
+      return (1);
+    }
+
+    if (!strcmp(scheme, "socket"))
+    {
+     /*
+      * AppSocket connection...
+      */
+
+      if (!httpAddrConnect2(list, &fd, 30000, NULL))
+      {
+	fprintf(stderr, "ERROR: Unable to connect to \"%s\" on port %d: %s\n", host, port, cupsLastErrorString());
+	httpAddrFreeList(list);
+	return (1);
+      }
+    }
+    else
+    {
+      http_encryption_t encryption;	/* Encryption mode */
+      ipp_t		*request,	/* IPP request */
+			*response;	/* IPP response */
+      ipp_attribute_t	*attr;		/* operations-supported */
+      int		create_job = 0;	/* Support for Create-Job/Send-Document? */
+      int		gzip;		/* gzip compression supported? */
+      const char	*job_name;	/* Title of job */
+      const char	*media;		/* Value of "media" option */
+      const char	*sides;		/* Value of "sides" option */
+      static const char * const pattrs[] =
+      {					/* requested-attributes */
+        "compression-supported",
+        "operations-supported"
+      };
+
+     /*
+      * Connect to the IPP/IPPS printer...
+      */
+
+      if (port == 443 || !strcmp(scheme, "ipps"))
+        encryption = HTTP_ENCRYPTION_ALWAYS;
+      else
+        encryption = HTTP_ENCRYPTION_IF_REQUESTED;
+
+      if ((http = httpConnect2(host, port, list, AF_UNSPEC, encryption, 1, 30000, NULL)) == NULL)
+      {
+	fprintf(stderr, "ERROR: Unable to connect to \"%s\" on port %d: %s\n", host, port, cupsLastErrorString());
+	httpAddrFreeList(list);
+	return (1);
+      }
+
+     /*
+      * See if it supports Create-Job + Send-Document...
+      */
+
+      request = ippNewRequest(IPP_OP_GET_PRINTER_ATTRIBUTES);
+      ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, device_uri);
+      ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser());
+      ippAddStrings(request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "requested-attributes", (int)(sizeof(pattrs) / sizeof(pattrs[0])), NULL, pattrs);
+
+      response = cupsDoRequest(http, request, resource);
+      if (cupsLastError() > IPP_STATUS_OK_EVENTS_COMPLETE)
+      {
+        fprintf(stderr, "ERROR: Unable to get printer capabilities: %s\n", cupsLastErrorString());
+	ippDelete(response);
+	httpClose(http);
+	httpAddrFreeList(list);
+	return (1);
+      }
+
+      if ((attr = ippFindAttribute(response, "operations-supported", IPP_TAG_ENUM)) == NULL)
+      {
+        fputs("ERROR: Unable to get list of supported operations from printer.\n", stderr);
+	ippDelete(response);
+	httpClose(http);
+	httpAddrFreeList(list);
+	return (1);
+      }
+
+      create_job = ippContainsInteger(attr, IPP_OP_CREATE_JOB) && ippContainsInteger(attr, IPP_OP_SEND_DOCUMENT);
+      gzip       = ippContainsString(ippFindAttribute(response, "compression-supported", IPP_TAG_KEYWORD), "gzip");
+
+      ippDelete(response);
+
+     /*
+      * Create the job and start printing...
+      */
+
+      if ((job_name = getenv("IPP_JOB_NAME")) == NULL)
+      {
+	if ((job_name = strrchr(filename, '/')) != NULL)
+	  job_name ++;
+	else
+	  job_name = filename;
+      }
+
+      if (create_job)
+      {
+        int		job_id = 0;	/* Job ID */
+
+        request = ippNewRequest(IPP_OP_CREATE_JOB);
+	ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, device_uri);
+	ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser());
+	ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "job-name", NULL, job_name);
+
+        response = cupsDoRequest(http, request, resource);
+        if ((attr = ippFindAttribute(response, "job-id", IPP_TAG_INTEGER)) != NULL)
+	  job_id = ippGetInteger(attr, 0);
+        ippDelete(response);
+
+	if (cupsLastError() > IPP_STATUS_OK_EVENTS_COMPLETE)
+	{
+	  fprintf(stderr, "ERROR: Unable to create print job: %s\n", cupsLastErrorString());
+	  httpClose(http);
+	  httpAddrFreeList(list);
+	  return (1);
+	}
+	else if (job_id <= 0)
+	{
+          fputs("ERROR: No job-id for created print job.\n", stderr);
+	  httpClose(http);
+	  httpAddrFreeList(list);
+	  return (1);
+	}
+
+        request = ippNewRequest(IPP_OP_SEND_DOCUMENT);
+	ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, device_uri);
+	ippAddInteger(request, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "job-id", job_id);
+	ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser());
+	ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_MIMETYPE, "document-format", NULL, output_type);
+	if (gzip)
+	  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "compression", NULL, "gzip");
+        ippAddBoolean(request, IPP_TAG_OPERATION, "last-document", 1);
+      }
+      else
+      {
+        request = ippNewRequest(IPP_OP_PRINT_JOB);
+	ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, device_uri);
+	ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser());
+	ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_MIMETYPE, "document-format", NULL, output_type);
+	if (gzip)
+	  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "compression", NULL, "gzip");
+      }
+
+      if ((media = cupsGetOption("media", num_options, options)) != NULL)
+        ippAddString(request, IPP_TAG_JOB, IPP_TAG_KEYWORD, "media", NULL, media);
+
+      if ((sides = cupsGetOption("sides", num_options, options)) != NULL)
+        ippAddString(request, IPP_TAG_JOB, IPP_TAG_KEYWORD, "sides", NULL, sides);
+
+      if (cupsSendRequest(http, request, resource, 0) != HTTP_STATUS_CONTINUE)
+      {
+        fprintf(stderr, "ERROR: Unable to send print data: %s\n", cupsLastErrorString());
+	ippDelete(request);
+	httpClose(http);
+	httpAddrFreeList(list);
+	return (1);
+      }
+
+      ippDelete(request);
+
+      if (gzip)
+        httpSetField(http, HTTP_FIELD_CONTENT_ENCODING, "gzip");
+
+      write_cb  = (xform_write_cb_t)httpWrite2;
+      write_ptr = http;
+
+      strlcpy(monitor_data.device_uri, device_uri, sizeof(monitor_data.device_uri));
+      _cupsMutexInit(&monitor_data.mutex);
+      _cupsCondInit(&monitor_data.cond);
+      monitor_data.stop = 0;
+
+      monitor = _cupsThreadCreate((_cups_thread_func_t)monitor_ipp, &monitor_data);
+    }
+
+    httpAddrFreeList(list);
+  }
+
+ /*
+  * Do transform...
+  */
+
+  status = xform_document(filename, content_type, output_type, resolutions, sheet_back, types, num_options, options, write_cb, write_ptr);
+
+  if (http)
+  {
+    ippDelete(cupsGetResponse(http, resource));
+
+    if (cupsLastError() > IPP_STATUS_OK_EVENTS_COMPLETE)
+    {
+      fprintf(stderr, "ERROR: Unable to send print data: %s\n", cupsLastErrorString());
+      status = 1;
+    }
+
+    httpClose(http);
+  }
+  else if (fd != 1)
+    close(fd);
+
+  if (monitor)
+  {
+   /*
+    * Stop the monitor and wait for it to close its connection...
+    */
+
+    _cupsMutexLock(&monitor_data.mutex);
+    monitor_data.stop = 1;
+    _cupsCondBroadcast(&monitor_data.cond);
+    _cupsMutexUnlock(&monitor_data.mutex);
+
+    _cupsThreadWait(monitor);
+  }
+
+  return (status);
+}
+
+
+/*
+ * 'usage()' - Show program usage.
+ */
+
+static void
+usage(int status)			/* I - Exit status */
+{
+  puts("Usage: ipptransform [options] filename\n");
+  puts("Options:");
+  puts("  --help");
+#ifndef _WIN32
+  puts("  --server");
+#endif /* !_WIN32 */
+  puts("  -d device-uri");
+  puts("  -f output-filename");
+  puts("  -i input/format");
+  puts("  -m output/format");
+  puts("  -o \"name=value [... name=value]\"");
+  puts("  -r resolution[,...,resolution]");
+  puts("  -s {flipped|manual-tumble|normal|rotated}");
+  puts("  -t type[,...,type]");
+  puts("  -v\n");
+  puts("Device URIs: socket://address[:port], ipp://address[:port]/resource, ipps://address[:port]/resource");
+  puts("Input Formats: application/pdf, image/jpeg");
+  puts("Output Formats: application/vnd.hp-pcl, image/pwg-raster, image/urf");
+  puts("Options: copies, media, media-col, page-ranges, print-color-mode, print-quality, print-scaling, printer-resolution, sides");
+  puts("Resolutions: NNNdpi or NNNxNNNdpi");
+#ifdef HAVE_COREGRAPHICS
+  puts("Types: adobe-rgb_8, adobe-rgb_16, black_1, black_8, cmyk_8, sgray_1, sgray_8, srgb_8");
+#elif defined(HAVE_FZ_CMM_ENGINE_LCMS)
+  puts("Types: adobe-rgb_8, black_1, black_8, cmyk_8, sgray_1, sgray_8, srgb_8");
+#else
+  puts("Types: black_1, black_8, cmyk_8, sgray_1, sgray_8, srgb_8");
+#endif /* HAVE_COREGRAPHICS */
+
+  exit(status);
+}
+
+
+/*
+ * 'write_fd()' - Write to a file/socket.
+ */
+
+static ssize_t				/* O - Number of bytes written or -1 on error */
+write_fd(int                 *fd,	/* I - File descriptor */
+         const unsigned char *buffer,	/* I - Buffer */
+         size_t              bytes)	/* I - Number of bytes to write */
+{
+  ssize_t	temp,			/* Temporary byte count */
+		total = 0;		/* Total bytes written */
+
+
+  while (bytes > 0)
+  {
+    if ((temp = write(*fd, buffer, bytes)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+      else
+        return (-1);
+    }
+
+    total  += temp;
+    bytes  -= (size_t)temp;
+    buffer += temp;
+  }
+
+  return (total);
+}
+
+
+#ifndef _WIN32
+/*
+ * 'write_message()' - Write data to a progress message.
+ */
+
+static ssize_t				/* O - Number of bytes written or -1 on error */
+write_message(
+    xform_message_t *message,		/* I - Message */
+    ipp_uchar_t     *buffer,		/* I - Buffer */
+    size_t          bytes)		/* I - Number of bytes to write */
+{
+  if (bytes > (size_t)(message->end - message->ptr))
+    return (-1);
+
+  memcpy(message->ptr, buffer, bytes);
+  message->ptr += bytes;
+
+  return ((ssize_t)bytes);
+}
+#endif /* !_WIN32 */
+
+
+
+/*
+ * 'xform_canceled()' - Check whether ippserver canceled the current job.
+ */
+
+static int				/* O - 1 if canceled, 0 otherwise */
+xform_canceled(void)
+{
+#ifdef _WIN32
+  return (0);
+
+#else
+  struct pollfd	pfd;			/* Cancel descriptor */
+
+
+  if (CancelFD < 0)
+    return (0);
+
+  pfd.fd     = CancelFD;
+  pfd.events = POLLIN;
+
+  return (poll(&pfd, 1, 0) > 0);
+#endif /* _WIN32 */
+}
+
+
+#ifdef HAVE_COREGRAPHICS
+/*
+ * 'xform_document()' - Transform a file for printing.
+ */
+
+static int				/* O - 0 on success, 1 on error */
+xform_document(
+    const char       *filename,		/* I - File to transform */
+    const char       *informat,		/* I - Input document (MIME media type */
+    const char       *outformat,	/* I - Output format (MIME media type) */
+    const char       *resolutions,	/* I - Supported resolutions */
+    const char       *sheet_back,	/* I - Back side transform */
+    const char       *types,		/* I - Supported types */
+    int              num_options,	/* I - Number of options */
+    cups_option_t    *options,		/* I - Options */
+    xform_write_cb_t cb,		/* I - Write callback */
+    void             *ctx)		/* I - Write context */
+{
+  CFURLRef		url;		/* CFURL object for PDF filename */
+  CGPDFDocumentRef	document = NULL;/* Input document */
+  CGPDFPageRef		pdf_page;	/* Page in PDF file */
+  CGImageSourceRef	src;		/* Image reader */
+  CGImageRef		image = NULL;	/* Image */
+  xform_raster_t	ras;		/* Raster info */
+  size_t		max_raster;	/* Maximum raster memory to use */
+  const char		*max_raster_env;/* IPPTRANSFORM_MAX_RASTER env var */
+  size_t		bpc;		/* Bits per color */
+  CGColorSpaceRef	cs;		/* Quartz color space */
+  CGContextRef		context;	/* Quartz bitmap context */
+  CGBitmapInfo		info;		/* Bitmap flags */
+  size_t		band_size;	/* Size of band line */
+  double		xscale, yscale;	/* Scaling factor */
+  CGAffineTransform 	transform,	/* Transform for page */
+			back_transform;	/* Transform for back side */
+  CGRect		dest;		/* Destination rectangle */
+  unsigned		pages = 1;	/* Number of pages */
+  int			color = 1;	/* Does the PDF have color? */
+  int			status = 0;	/* Exit status */
+  ipp_t			*attrs;		/* Progress attributes */
+  const char		*page_ranges;	/* "page-ranges" option */
+  unsigned		first = 1,	/* First page of range */
+			last = 1;	/* Last page of range */
+  const char		*print_scaling;	/* print-scaling option */
+  size_t		image_width,	/* Image width */
+			image_height;	/* Image height */
+  int			image_rotation;	/* Image rotation */
+  double		image_xscale,	/* Image scaling */
+			image_yscale;
+  unsigned		copy;		/* Current copy */
+  unsigned		page;		/* Current page */
+  unsigned		media_sheets = 0,
+			impressions = 0;/* Page/sheet counters */
+
+
+ /*
+  * Open the file...
+  */
+
+  if ((url = CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8 *)filename, (CFIndex)strlen(filename), false)) == NULL)
+  {
+    fputs("ERROR: Unable to create CFURL for file.\n", stderr);
+    return (1);
+  }
+
+  if (!strcmp(informat, "application/pdf"))
+  {
+   /*
+    * Open the PDF...
+    */
+
+    document = CGPDFDocumentCreateWithURL(url);
+    CFRelease(url);
+
+    if (!document)
+    {
+      fputs("ERROR: Unable to create CFPDFDocument for file.\n", stderr);
+      return (1);
+    }
+
+    if (CGPDFDocumentIsEncrypted(document))
+    {
+     /*
+      * Only support encrypted PDFs with a blank password...
+      */
+
+      if (!CGPDFDocumentUnlockWithPassword(document, ""))
+      {
+	fputs("ERROR: Document is encrypted and cannot be unlocked.\n", stderr);
+	CGPDFDocumentRelease(document);
+	return (1);
+      }
+    }
+
+    if (!CGPDFDocumentAllowsPrinting(document))
+    {
+      fputs("ERROR: Document does not allow printing.\n", stderr);
+      CGPDFDocumentRelease(document);
+      return (1);
+    }
+
+   /*
+    * Check page ranges...
+    */
+
+    if ((page_ranges = cupsGetOption("page-ranges", num_options, options)) != NULL)
+    {
+      if (sscanf(page_ranges, "%u-%u", &first, &last) != 2 || first > last)
+      {
 	fprintf(stderr, "ERROR: Bad \"page-ranges\" value '%s'.\n", page_ranges);
 	CGPDFDocumentRelease(document);
 	return (1);
@@ -1748,13 +2644,18 @@ xform_document(
   * Start the conversion...
   */
 
-  fprintf(stderr, "ATTR: job-impressions=%d\n", pages);
-  fprintf(stderr, "ATTR: job-pages=%d\n", pages);
+  attrs = ippNew();
+
+  ippAddInteger(attrs, IPP_TAG_JOB, IPP_TAG_INTEGER, "job-impressions", (int)pages);
+  ippAddInteger(attrs, IPP_TAG_JOB, IPP_TAG_INTEGER, "job-pages", (int)pages);
 
   if (ras.header.Duplex)
-    fprintf(stderr, "ATTR: job-media-sheets=%d\n", (pages + 1) / 2);
+    ippAddInteger(attrs, IPP_TAG_JOB, IPP_TAG_INTEGER, "job-media-sheets", (int)((pages + 1) / 2));
   else
-    fprintf(stderr, "ATTR: job-media-sheets=%d\n", pages);
+    ippAddInteger(attrs, IPP_TAG_JOB, IPP_TAG_INTEGER, "job-media-sheets", (int)pages);
+
+  report_attrs(attrs);
+  ippDelete(attrs);
 
   if (Verbosity > 1)
     fprintf(stderr, "DEBUG: cupsPageSize=[%g %g]\n", ras.header.cupsPageSize[0], ras.header.cupsPageSize[1]);
@@ -1797,7 +2698,7 @@ xform_document(
     * Draw all of the pages...
     */
 
-    for (copy = 0; copy < ras.copies; copy ++)
+    for (copy = 0; copy < ras.copies && !status; copy ++)
     {
       for (page = 1; page <= pages; page ++)
       {
@@ -1806,6 +2707,13 @@ xform_document(
 			band_endy = 0;	/* End line of band */
 	unsigned char	*lineptr;	/* Pointer to line */
 
+	if (xform_canceled())
+	{
+	  fputs("INFO: Job canceled.\n", stderr);
+	  status = 1;
+	  break;
+	}
+
 	pdf_page  = CGPDFDocumentGetPage(document, page + first - 1);
 	transform = CGPDFPageGetDrawingTransform(pdf_page, kCGPDFCropBox,dest, 0, true);
 
@@ -1869,15 +2777,18 @@ xform_document(
 	(*(ras.end_page))(&ras, page, cb, ctx);
 
 	impressions ++;
-	fprintf(stderr, "ATTR: job-impressions-completed=%u\n", impressions);
+	attrs = ippNew();
+	ippAddInteger(attrs, IPP_TAG_JOB, IPP_TAG_INTEGER, "job-impressions-completed", (int)impressions);
 	if (!ras.header.Duplex || !(page & 1))
 	{
 	  media_sheets ++;
-	  fprintf(stderr, "ATTR: job-media-sheets-completed=%u\n", media_sheets);
+	  ippAddInteger(attrs, IPP_TAG_JOB, IPP_TAG_INTEGER, "job-media-sheets-completed", (int)media_sheets);
 	}
+	report_attrs(attrs);
+	ippDelete(attrs);
       }
 
-      if (ras.copies > 1 && (pages & 1) && ras.header.Duplex)
+      if (!status && ras.copies > 1 && (pages & 1) && ras.header.Duplex)
       {
        /*
 	* Duplex printing, add a blank back side image...
@@ -1898,12 +2809,15 @@ xform_document(
 	(*(ras.end_page))(&ras, page, cb, ctx);
 
 	impressions ++;
-	fprintf(stderr, "ATTR: job-impressions-completed=%u\n", impressions);
+	attrs = ippNew();
+	ippAddInteger(attrs, IPP_TAG_JOB, IPP_TAG_INTEGER, "job-impressions-completed", (int)impressions);
 	if (!ras.header.Duplex || !(page & 1))
 	{
 	  media_sheets ++;
-	  fprintf(stderr, "ATTR: job-media-sheets-completed=%u\n", media_sheets);
+	  ippAddInteger(attrs, IPP_TAG_JOB, IPP_TAG_INTEGER, "job-media-sheets-completed", (int)media_sheets);
 	}
+	report_attrs(attrs);
+	ippDelete(attrs);
       }
     }
 
@@ -2005,6 +2919,13 @@ xform_document(
 			band_endy = 0;	/* End line of band */
       unsigned char	*lineptr;	/* Pointer to line */
 
+      if (xform_canceled())
+      {
+	fputs("INFO: Job canceled.\n", stderr);
+	status = 1;
+	break;
+      }
+
       if (Verbosity > 1)
 	fprintf(stderr, "DEBUG: Printing copy %d/%d, transform=[%g %g %g %g %g %g]\n", copy + 1, ras.copies, transform.a, transform.b, transform.c, transform.d, transform.tx, transform.ty);
 
@@ -2065,9 +2986,13 @@ xform_document(
       (*(ras.end_page))(&ras, 1, cb, ctx);
 
       impressions ++;
-      fprintf(stderr, "ATTR: job-impressions-completed=%u\n", impressions);
       media_sheets ++;
-      fprintf(stderr, "ATTR: job-media-sheets-completed=%u\n", media_sheets);
+
+      attrs = ippNew();
+      ippAddInteger(attrs, IPP_TAG_JOB, IPP_TAG_INTEGER, "job-impressions-completed", (int)impressions);
+      ippAddInteger(attrs, IPP_TAG_JOB, IPP_TAG_INTEGER, "job-media-sheets-completed", (int)media_sheets);
+      report_attrs(attrs);
+      ippDelete(attrs);
     }
 
     CFRelease(image);
@@ -2084,13 +3009,17 @@ xform_document(
   free(ras.band_buffer);
   ras.band_buffer = NULL;
 
-  return (0);
+  return (status);
 }
 
 
 #else
 /*
  * 'xform_document()' - Transform a file for printing.
+ *
+ * Bands are rendered by a pool of worker threads, each with its own MuPDF
+ * context, pixmap, and draw device.  Pages are recorded into display lists
+ * once and the main thread writes the rendered bands in order.
  */
 
 static int				/* O - 0 on success, 1 on error */
@@ -2108,28 +3037,38 @@ xform_document(
 {
   fz_context		*context;	/* MuPDF context */
   fz_document		*document;	/* Document to print */
-  fz_page		*pdf_page;	/* Page in PDF file */
-  fz_pixmap		*pixmap;	/* Pixmap for band */
-  fz_device		*device;	/* Device for rendering */
   fz_colorspace		*cs;		/* Quartz color space */
   xform_raster_t	ras;		/* Raster info */
+  xform_render_t	render;		/* Renderer */
+  xform_worker_t	*worker;	/* Current worker */
+  xform_cache_t		cache;		/* Encoded page cache */
+  char			cachefile[1024];/* Page cache filename */
   size_t		max_raster;	/* Maximum raster memory to use */
   const char		*max_raster_env;/* IPPTRANSFORM_MAX_RASTER env var */
+  const char		*threads_env;	/* IPPTRANSFORM_THREADS env var */
+  unsigned		num_workers;	/* Number of rendering threads */
   unsigned		pages = 1;	/* Number of pages */
   int			color = 1;	/* Color PDF? */
+  int			status = 0;	/* Exit status */
+  ipp_t			*attrs;		/* Progress attributes */
   const char		*page_ranges;	/* "page-ranges" option */
   unsigned		first, last;	/* First and last page of range */
   const char		*print_scaling;	/* print-scaling option */
-  unsigned		copy;		/* Current copy */
-  unsigned		page;		/* Current page */
+  unsigned		i,		/* Looping var */
+			job,		/* Current band number */
+			copy,		/* Current copy */
+			page,		/* Current page */
+			band,		/* Current band on page */
+			y,		/* Current line */
+			band_starty,	/* Start line of band */
+			band_endy;	/* End line of band */
+  unsigned char		*lineptr,	/* Pointer to line */
+			*blank;		/* Blank line for duplex padding */
   unsigned		media_sheets = 0,
 			impressions = 0;/* Page/sheet counters */
   size_t		band_size;	/* Size of band line */
   double		xscale, yscale;	/* Scaling factor */
-  fz_rect		image_box;	/* Bounding box of content */
   fz_matrix	 	base_transform,	/* Base transform */
-			image_transform,/* Transform for content ("page image") */
-			transform,	/* Transform for page */
 			back_transform;	/* Transform for back side */
 
 
@@ -2137,14 +3076,17 @@ xform_document(
   * Open the PDF file...
   */
 
-  if ((context = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED)) == NULL)
+  if (FitzContext)
+    context = fz_clone_context(FitzContext);
+  else
+    context = mupdf_new_context(FZ_STORE_UNLIMITED);
+
+  if (!context)
   {
     fputs("ERROR: Unable to create context.\n", stderr);
     return (1);
   }
 
-  fz_register_document_handlers(context);
-
   fz_try(context) document = fz_open_document(context, filename);
   fz_catch(context)
   {
@@ -2288,31 +3230,28 @@ xform_document(
   band_size = (size_t)ras.header.cupsWidth * ras.band_bpp;
   fprintf(stderr, "DEBUG: ras.header.cupsWidth=%u, ras.band_bpp=%u, band_size=%ld\n", ras.header.cupsWidth, ras.band_bpp, (long)band_size);
 
-  if ((ras.band_height = (unsigned)(max_raster / band_size)) < 1)
+ /*
+  * Figure out how many rendering threads to use.  The band memory is split
+  * between the threads so the total stays within the raster memory limit...
+  */
+
+  if ((threads_env = getenv("IPPTRANSFORM_THREADS")) != NULL && atoi(threads_env) > 0)
+    num_workers = (unsigned)atoi(threads_env);
+#ifdef _SC_NPROCESSORS_ONLN
+  else if (sysconf(_SC_NPROCESSORS_ONLN) > 0)
+    num_workers = (unsigned)sysconf(_SC_NPROCESSORS_ONLN);
+#endif /* _SC_NPROCESSORS_ONLN */
+  else
+    num_workers = 1;
+
+  if (num_workers > XFORM_MAX_THREADS)
+    num_workers = XFORM_MAX_THREADS;
+
+  if ((ras.band_height = (unsigned)(max_raster / num_workers / band_size)) < 1)
     ras.band_height = 1;
   else if (ras.band_height > ras.header.cupsHeight)
     ras.band_height = ras.header.cupsHeight;
 
-#  if HAVE_FZ_NEW_PIXMAP_5_ARG
-  pixmap = fz_new_pixmap(context, cs, (int)ras.header.cupsWidth, (int)ras.band_height, 0);
-#  else
-  pixmap = fz_new_pixmap(context, cs, (int)ras.header.cupsWidth, (int)ras.band_height, NULL, 0);
-
-  fprintf(stderr, "pixmap->w       = %d\n", pixmap->w);
-  fprintf(stderr, "pixmap->h       = %d\n", pixmap->h);
-  fprintf(stderr, "pixmap->alpha   = %d\n", pixmap->alpha);
-  fprintf(stderr, "pixmap->flags   = %d\n", pixmap->flags);
-  fprintf(stderr, "pixmap->xres    = %d\n", pixmap->xres);
-  fprintf(stderr, "pixmap->yres    = %d\n", pixmap->yres);
-  fprintf(stderr, "pixmap->stride  = %ld\n", (long)pixmap->stride);
-  fprintf(stderr, "pixmap->samples = %p\n", pixmap->samples);
-
-  pixmap->flags &= ~FZ_PIXMAP_FLAG_INTERPOLATE;
-#  endif /* HAVE_FZ_NEW_PIXMAP_5_ARG */
-
-  pixmap->xres = (int)ras.header.HWResolution[0];
-  pixmap->yres = (int)ras.header.HWResolution[1];
-
   xscale = ras.header.HWResolution[0] / 72.0;
   yscale = ras.header.HWResolution[1] / 72.0;
 
@@ -2328,15 +3267,8 @@ xform_document(
   if (Verbosity > 1)
     fprintf(stderr, "DEBUG: Band height=%u, page height=%u\n", ras.band_height, ras.header.cupsHeight);
 
-#  if FZ_VERSION_MAJOR > 1 || FZ_VERSION_MINOR > 14
-  device = fz_new_draw_device(context, base_transform, pixmap);
-#  else
-  device = fz_new_draw_device(context, &base_transform, pixmap);
-#  endif /* FZ_VERSION_MAJOR > 1 || FZ_VERSION_MINOR > 14 */
-
   /* Don't anti-alias or interpolate when creating raster data */
   fz_set_aa_level(context, 0);
-  fz_enable_device_hints(context, device, FZ_DONT_INTERPOLATE_IMAGES);
 
  /*
   * Setup the back page transform, if any...
@@ -2375,212 +3307,352 @@ xform_document(
       print_scaling = "auto";
 
  /*
-  * Draw all of the pages...
+  * Setup the renderer...
   */
 
-  (*(ras.start_job))(&ras, cb, ctx);
+  memset(&render, 0, sizeof(render));
+  memset(&cache, 0, sizeof(cache));
 
-  for (copy = 0; copy < ras.copies; copy ++)
+  cache.fd = -1;
+
+  _cupsMutexInit(&render.mutex);
+  _cupsCondInit(&render.cond);
+  _cupsMutexInit(&render.doc_mutex);
+
+  render.document       = document;
+  render.informat       = informat;
+  render.print_scaling  = print_scaling;
+  render.ras            = &ras;
+  render.first          = first;
+  render.pages          = pages;
+  render.num_bands      = (ras.header.cupsHeight + ras.band_height - 1) / ras.band_height;
+  render.page_lists     = calloc(pages, sizeof(xform_page_t));
+  render.yscale         = yscale;
+  render.back_transform = back_transform;
+
+ /*
+  * Additional copies are identical to the first, so save the encoded pages of
+  * the first copy in a temporary file and replay them for the other copies
+  * instead of rendering and encoding them again...
+  */
+
+  if (ras.copies > 1)
   {
-    for (page = 1; page <= pages; page ++)
+    if ((cache.offsets = calloc(pages + 1, sizeof(off_t))) != NULL && (cache.fd = cupsTempFd(cachefile, sizeof(cachefile))) >= 0)
     {
-      unsigned		y,		/* Current line */
-			band_starty = 0,/* Start line of band */
-			band_endy = 0;	/* End line of band */
-      unsigned char	*lineptr;	/* Pointer to line */
+      unlink(cachefile);
 
-      pdf_page = fz_load_page(context, document, (int)(page + first - 2));
+      cache.cb      = cb;
+      cache.ctx     = ctx;
+      cache.capture = 1;
 
-#  if FZ_VERSION_MAJOR > 1 || FZ_VERSION_MINOR > 14
-      image_box = fz_bound_page(context, pdf_page);
-#  else
-      fz_bound_page(context, pdf_page, &image_box);
-#  endif /* FZ_VERSION_MAJOR > 1 || FZ_VERSION_MINOR > 14 */
+      cb  = (xform_write_cb_t)cache_write;
+      ctx = &cache;
+    }
+    else
+      fprintf(stderr, "DEBUG: Unable to create page cache, rendering all copies: %s\n", strerror(errno));
+  }
 
-      fprintf(stderr, "DEBUG: image_box=[%g %g %g %g]\n", image_box.x0, image_box.y0, image_box.x1, image_box.y1);
+  render.num_jobs = (cache.fd >= 0 ? 1 : ras.copies) * pages * render.num_bands;
 
-      float image_width = image_box.x1 - image_box.x0;
-      float image_height = image_box.y1 - image_box.y0;
-      int image_rotation = 0;
-      int is_image = strcmp(informat, "application/pdf") != 0;
-      float image_xscale, image_yscale;
+  if (num_workers > render.num_jobs)
+    num_workers = render.num_jobs;
 
-      if ((image_height < image_width && ras.header.cupsWidth < ras.header.cupsHeight) ||
-	   (image_width < image_height && ras.header.cupsHeight < ras.header.cupsWidth))
-      {
-       /*
-	* Rotate image/page 90 degrees...
-	*/
+  blank = malloc(band_size);
 
-	image_rotation = 90;
-      }
+  if (!render.page_lists || !blank)
+  {
+    fputs("ERROR: Unable to allocate memory for pages.\n", stderr);
+    status = 1;
+    goto finish_render;
+  }
 
-      if ((!strcmp(print_scaling, "auto") && ras.borderless && is_image) || !strcmp(print_scaling, "fill"))
-      {
-       /*
-	* Scale to fill...
-	*/
+  for (i = 0; i < num_workers; i ++)
+  {
+    worker = render.workers + i;
 
-	if (image_rotation)
-	{
-	  image_xscale = ras.header.cupsPageSize[0] / (double)image_height;
-	  image_yscale = ras.header.cupsPageSize[1] / (double)image_width;
-	}
-	else
-	{
-	  image_xscale = ras.header.cupsPageSize[0] / (double)image_width;
-	  image_yscale = ras.header.cupsPageSize[1] / (double)image_height;
-	}
+    worker->render = &render;
+    worker->index  = i;
 
-	if (image_xscale < image_yscale)
-	  image_xscale = image_yscale;
-	else
-	  image_yscale = image_xscale;
+    if ((worker->context = fz_clone_context(context)) == NULL)
+    {
+      fputs("ERROR: Unable to create context.\n", stderr);
+      status = 1;
+      goto finish_render;
+    }
 
-      }
-      else if ((!strcmp(print_scaling, "auto") && (is_image || (image_rotation == 0 && (image_width > ras.header.cupsPageSize[0] || image_height > ras.header.cupsPageSize[1])) || (image_rotation == 90 && (image_height > ras.header.cupsPageSize[1] || image_width > ras.header.cupsPageSize[1])))) || !strcmp(print_scaling, "fit"))
-      {
-       /*
-	* Scale to fit...
-	*/
+    fz_set_aa_level(worker->context, 0);
 
-	if (image_rotation)
-	{
-	  image_xscale = ras.header.cupsPageSize[0] / (double)image_height;
-	  image_yscale = ras.header.cupsPageSize[1] / (double)image_width;
-	}
-	else
-	{
-	  image_xscale = ras.header.cupsPageSize[0] / (double)image_width;
-	  image_yscale = ras.header.cupsPageSize[1] / (double)image_height;
-	}
+#  if HAVE_FZ_NEW_PIXMAP_5_ARG
+    worker->pixmap = fz_new_pixmap(worker->context, cs, (int)ras.header.cupsWidth, (int)ras.band_height, 0);
+#  else
+    worker->pixmap = fz_new_pixmap(worker->context, cs, (int)ras.header.cupsWidth, (int)ras.band_height, NULL, 0);
 
-	if (image_xscale > image_yscale)
-	  image_xscale = image_yscale;
-	else
-	  image_yscale = image_xscale;
-      }
-      else
-      {
-       /*
-        * Do not scale...
-	*/
+    if (i == 0)
+    {
+      fprintf(stderr, "pixmap->w       = %d\n", worker->pixmap->w);
+      fprintf(stderr, "pixmap->h       = %d\n", worker->pixmap->h);
+      fprintf(stderr, "pixmap->alpha   = %d\n", worker->pixmap->alpha);
+      fprintf(stderr, "pixmap->flags   = %d\n", worker->pixmap->flags);
+      fprintf(stderr, "pixmap->xres    = %d\n", worker->pixmap->xres);
+      fprintf(stderr, "pixmap->yres    = %d\n", worker->pixmap->yres);
+      fprintf(stderr, "pixmap->stride  = %ld\n", (long)worker->pixmap->stride);
+      fprintf(stderr, "pixmap->samples = %p\n", worker->pixmap->samples);
+    }
 
-        image_xscale = image_yscale = 1.0;
-      }
+    worker->pixmap->flags &= ~FZ_PIXMAP_FLAG_INTERPOLATE;
+#  endif /* HAVE_FZ_NEW_PIXMAP_5_ARG */
 
-      if (image_rotation)
-      {
-	image_transform = make_matrix(image_xscale, 0, 0, image_yscale, 0.5 * (ras.header.cupsPageSize[0] - image_xscale * image_height), 0.5 * (ras.header.cupsPageSize[1] - image_yscale * image_width));
-      }
-      else
-      {
-	image_transform = make_matrix(image_xscale, 0, 0, image_yscale, 0.5 * (ras.header.cupsPageSize[0] - image_xscale * image_width), 0.5 * (ras.header.cupsPageSize[1] - image_yscale * image_height));
-      }
+    worker->pixmap->xres = (int)ras.header.HWResolution[0];
+    worker->pixmap->yres = (int)ras.header.HWResolution[1];
 
-      if (Verbosity > 1)
-        fprintf(stderr, "DEBUG: Printing copy %d/%d, page %d/%d, image_transform=[%g %g %g %g %g %g]\n", copy + 1, ras.copies, page, pages, image_transform.a, image_transform.b, image_transform.c, image_transform.d, image_transform.e, image_transform.f);
+#  if FZ_VERSION_MAJOR > 1 || FZ_VERSION_MINOR > 14
+    worker->device = fz_new_draw_device(worker->context, base_transform, worker->pixmap);
+#  else
+    worker->device = fz_new_draw_device(worker->context, &base_transform, worker->pixmap);
+#  endif /* FZ_VERSION_MAJOR > 1 || FZ_VERSION_MINOR > 14 */
 
-      (*(ras.start_page))(&ras, page, cb, ctx);
+    fz_enable_device_hints(worker->context, worker->device, FZ_DONT_INTERPOLATE_IMAGES);
+  }
 
-      for (y = ras.top; y < ras.bottom; y ++)
-      {
-	if (y >= band_endy)
-	{
-	 /*
-	  * Draw the next band of raster data...
-	  */
+  render.num_workers = num_workers;
 
-	  band_starty = y;
-	  band_endy   = y + ras.band_height;
-	  if (band_endy > ras.bottom)
-	    band_endy = ras.bottom;
+  if (Verbosity)
+    fprintf(stderr, "DEBUG: Rendering %u bands with %u threads.\n", render.num_jobs, num_workers);
 
-	  if (Verbosity > 1)
-	    fprintf(stderr, "DEBUG: Drawing band from %u to %u.\n", band_starty, band_endy);
+  for (i = 0; i < num_workers; i ++)
+  {
+    worker = render.workers + i;
 
-          fz_clear_pixmap_with_value(context, pixmap, 0xff);
-          fputs("DEBUG: Band cleared...\n", stderr);
+    if ((worker->thread = _cupsThreadCreate((_cups_thread_func_t)render_bands, worker)) == 0)
+    {
+      fputs("ERROR: Unable to create rendering thread.\n", stderr);
+      status = 1;
+      goto finish_render;
+    }
+  }
 
-          transform = fz_identity;
+ /*
+  * Write all of the pages...
+  */
 
-#  if FZ_VERSION_MAJOR > 1 || FZ_VERSION_MINOR > 14
-	  transform = fz_pre_translate(transform, 0.0, -1.0 * y / yscale);
+  (*(ras.start_job))(&ras, cb, ctx);
 
-	  if (!(page & 1) && ras.header.Duplex)
-	    transform = fz_concat(transform, back_transform);
+  for (job = 0; job < render.num_jobs; job ++)
+  {
+    worker = render.workers + job % num_workers;
+    band   = job % render.num_bands;
+    page   = (job / render.num_bands) % pages + 1;
+    copy   = job / render.num_bands / pages;
 
-	  transform = fz_concat(transform, image_transform);
+   /*
+    * Wait for the band to be rendered...
+    */
 
-#  else
-	  fz_pre_translate(&transform, 0.0, -1.0 * y / yscale);
+    _cupsMutexLock(&render.mutex);
+    while (!worker->ready)
+      _cupsCondWait(&render.cond, &render.mutex, 0.0);
+    _cupsMutexUnlock(&render.mutex);
 
-	  if (!(page & 1) && ras.header.Duplex)
-	    fz_concat(&transform, &transform, &back_transform);
+    if (worker->error)
+    {
+      status = 1;
+      break;
+    }
 
-	  fz_concat(&transform, &transform, &image_transform);
-#  endif /* FZ_VERSION_MAJOR > 1 || FZ_VERSION_MINOR > 14 */
+    if (xform_canceled())
+    {
+      fputs("INFO: Job canceled.\n", stderr);
+      status = 1;
+      break;
+    }
 
-          fprintf(stderr, "DEBUG: Page transform=[%g %g %g %g %g %g]\n", transform.a, transform.b, transform.c, transform.d, transform.e, transform.f);
+    if (band == 0)
+    {
+      if (Verbosity > 1)
+        fprintf(stderr, "DEBUG: Printing copy %u/%u, page %u/%u.\n", copy + 1, ras.copies, page, pages);
 
-#  if FZ_VERSION_MAJOR > 1 || FZ_VERSION_MINOR > 14
-          fz_run_page(context, pdf_page, device, transform, NULL);
-#  else
-          fz_run_page(context, pdf_page, device, &transform, NULL);
-#  endif /* FZ_VERSION_MAJOR > 1 || FZ_VERSION_MINOR > 14 */
+      if (cache.capture)
+      {
+       /*
+        * Remember where the page starts in the cache, skipping the Apple
+        * raster file header that is written with the first page header...
+        */
 
-          fputs("DEBUG: Band rendered...\n", stderr);
-	}
+        cache.offsets[page - 1] = cache.length;
+        if (page == 1 && !strcmp(ras.format, "image/urf"))
+          cache.offsets[0] += 8;
+      }
 
-       /*
-	* Prepare and write a line...
-	*/
+      (*(ras.start_page))(&ras, page, cb, ctx);
+    }
 
-	lineptr = pixmap->samples + (y - band_starty) * band_size + ras.left * ras.band_bpp;
+   /*
+    * Prepare and write the lines in the band...
+    */
 
-        if (ras.header.cupsColorSpace == CUPS_CSPACE_K && ras.header.cupsBitsPerPixel >= 8)
-          invert_gray(lineptr, ras.right - ras.left);
+    band_starty = band * ras.band_height;
+    band_endy   = band_starty + ras.band_height;
+    if (band_endy > ras.bottom)
+      band_endy = ras.bottom;
 
-	(*(ras.write_line))(&ras, y, lineptr, cb, ctx);
-      }
+    for (y = band_starty < ras.top ? ras.top : band_starty; y < band_endy; y ++)
+    {
+      lineptr = worker->pixmap->samples + (y - band_starty) * band_size + ras.left * ras.band_bpp;
 
-      (*(ras.end_page))(&ras, page, cb, ctx);
+      if (ras.header.cupsColorSpace == CUPS_CSPACE_K && ras.header.cupsBitsPerPixel >= 8)
+        invert_gray(lineptr, ras.right - ras.left);
 
-      impressions ++;
-      fprintf(stderr, "ATTR: job-impressions-completed=%u\n", impressions);
-      if (!ras.header.Duplex || !(page & 1))
+      (*(ras.write_line))(&ras, y, lineptr, cb, ctx);
+    }
+
+   /*
+    * Let the worker render its next band...
+    */
+
+    _cupsMutexLock(&render.mutex);
+    worker->ready = 0;
+    _cupsCondBroadcast(&render.cond);
+    _cupsMutexUnlock(&render.mutex);
+
+    if (band < (render.num_bands - 1))
+      continue;
+
+   /*
+    * Finish the page...
+    */
+
+    (*(ras.end_page))(&ras, page, cb, ctx);
+
+    if ((copy + 1) * pages * render.num_bands >= render.num_jobs)
+    {
+     /*
+      * Free the display list once the last copy of the page is rendered...
+      */
+
+      _cupsMutexLock(&render.doc_mutex);
+      if (render.page_lists[page - 1].list)
       {
-        media_sheets ++;
-	fprintf(stderr, "ATTR: job-media-sheets-completed=%u\n", media_sheets);
+	fz_drop_display_list(context, render.page_lists[page - 1].list);
+	render.page_lists[page - 1].list = NULL;
       }
+      _cupsMutexUnlock(&render.doc_mutex);
+    }
+
+    impressions ++;
+    attrs = ippNew();
+    ippAddInteger(attrs, IPP_TAG_JOB, IPP_TAG_INTEGER, "job-impressions-completed", (int)impressions);
+    if (!ras.header.Duplex || !(page & 1))
+    {
+      media_sheets ++;
+      ippAddInteger(attrs, IPP_TAG_JOB, IPP_TAG_INTEGER, "job-media-sheets-completed", (int)media_sheets);
     }
+    report_attrs(attrs);
+    ippDelete(attrs);
 
-    if (ras.copies > 1 && (pages & 1) && ras.header.Duplex)
+    if (page == pages && ras.copies > 1 && (pages & 1) && ras.header.Duplex)
     {
      /*
       * Duplex printing, add a blank back side image...
       */
 
-      unsigned		y;		/* Current line */
-
       if (Verbosity > 1)
         fprintf(stderr, "DEBUG: Printing blank page %u for duplex.\n", pages + 1);
 
-      memset(pixmap->samples, ras.header.cupsBitsPerPixel == 32 ? 0 : 255, ras.header.cupsBytesPerLine);
+      memset(blank, ras.header.cupsBitsPerPixel == 32 ? 0 : 255, band_size);
 
-      (*(ras.start_page))(&ras, page, cb, ctx);
+      if (ras.header.cupsColorSpace == CUPS_CSPACE_K && ras.header.cupsBitsPerPixel >= 8)
+        invert_gray(blank, band_size);
+
+      (*(ras.start_page))(&ras, pages + 1, cb, ctx);
 
       for (y = ras.top; y < ras.bottom; y ++)
-	(*(ras.write_line))(&ras, y, pixmap->samples, cb, ctx);
+	(*(ras.write_line))(&ras, y, blank, cb, ctx);
 
-      (*(ras.end_page))(&ras, page, cb, ctx);
+      (*(ras.end_page))(&ras, pages + 1, cb, ctx);
 
       impressions ++;
-      fprintf(stderr, "ATTR: job-impressions-completed=%u\n", impressions);
-      if (!ras.header.Duplex || !(page & 1))
+      media_sheets ++;
+      attrs = ippNew();
+      ippAddInteger(attrs, IPP_TAG_JOB, IPP_TAG_INTEGER, "job-impressions-completed", (int)impressions);
+      ippAddInteger(attrs, IPP_TAG_JOB, IPP_TAG_INTEGER, "job-media-sheets-completed", (int)media_sheets);
+      report_attrs(attrs);
+      ippDelete(attrs);
+    }
+
+    if (page < pages || !cache.capture)
+      continue;
+
+   /*
+    * The first copy is done, stop saving pages...
+    */
+
+    cache.offsets[pages] = cache.length;
+    cache.capture        = 0;
+
+    if (cache.error)
+    {
+     /*
+      * Unable to save all of the pages, render the remaining copies...
+      */
+
+      _cupsMutexLock(&render.mutex);
+      render.num_jobs = ras.copies * pages * render.num_bands;
+      _cupsCondBroadcast(&render.cond);
+      _cupsMutexUnlock(&render.mutex);
+      continue;
+    }
+
+   /*
+    * Write the remaining copies from the cache...
+    */
+
+    for (copy = 1; copy < ras.copies && !status; copy ++)
+    {
+      for (page = 1; page <= pages; page ++)
+      {
+	if (Verbosity > 1)
+	  fprintf(stderr, "DEBUG: Printing copy %u/%u, page %u/%u from cache.\n", copy + 1, ras.copies, page, pages);
+
+	if (xform_canceled())
+	{
+	  fputs("INFO: Job canceled.\n", stderr);
+	  status = 1;
+	  break;
+	}
+
+	if (cache_copy_page(&cache, page))
+	{
+	  fprintf(stderr, "ERROR: Unable to copy page from cache: %s\n", strerror(errno));
+	  status = 1;
+	  break;
+	}
+
+	impressions ++;
+	attrs = ippNew();
+	ippAddInteger(attrs, IPP_TAG_JOB, IPP_TAG_INTEGER, "job-impressions-completed", (int)impressions);
+	if (!ras.header.Duplex || !(page & 1))
+	{
+	  media_sheets ++;
+	  ippAddInteger(attrs, IPP_TAG_JOB, IPP_TAG_INTEGER, "job-media-sheets-completed", (int)media_sheets);
+	}
+	report_attrs(attrs);
+	ippDelete(attrs);
+      }
+
+      if (!status && (pages & 1) && ras.header.Duplex)
       {
-        media_sheets ++;
-	fprintf(stderr, "ATTR: job-media-sheets-completed=%u\n", media_sheets);
+       /*
+        * The cached last page includes the blank back side...
+        */
+
+	impressions ++;
+	media_sheets ++;
+	attrs = ippNew();
+	ippAddInteger(attrs, IPP_TAG_JOB, IPP_TAG_INTEGER, "job-impressions-completed", (int)impressions);
+	ippAddInteger(attrs, IPP_TAG_JOB, IPP_TAG_INTEGER, "job-media-sheets-completed", (int)media_sheets);
+	report_attrs(attrs);
+	ippDelete(attrs);
       }
     }
   }
@@ -2591,12 +3663,46 @@ xform_document(
   * Clean up...
   */
 
-  fz_drop_device(context, device);
-  fz_drop_pixmap(context, pixmap);
+  finish_render:
+
+  _cupsMutexLock(&render.mutex);
+  render.cancel = 1;
+  _cupsCondBroadcast(&render.cond);
+  _cupsMutexUnlock(&render.mutex);
+
+  for (i = 0; i < XFORM_MAX_THREADS; i ++)
+  {
+    worker = render.workers + i;
+
+    if (worker->thread)
+      _cupsThreadWait(worker->thread);
+
+    if (worker->device)
+      fz_drop_device(worker->context, worker->device);
+    if (worker->pixmap)
+      fz_drop_pixmap(worker->context, worker->pixmap);
+    if (worker->context)
+      fz_drop_context(worker->context);
+  }
+
+  if (render.page_lists)
+  {
+    for (i = 0; i < pages; i ++)
+      fz_drop_display_list(context, render.page_lists[i].list);
+
+    free(render.page_lists);
+  }
+
+  free(blank);
+
+  if (cache.fd >= 0)
+    close(cache.fd);
+  free(cache.offsets);
+
   fz_drop_document(context, document);
   fz_drop_context(context);
 
-  return (1);
+  return (status);
 }
 #endif /* HAVE_COREGRAPHICS */
 
@@ -2965,6 +4071,17 @@ xform_setup(xform_raster_t *ras,	/* I - Raster information */
       memset(ras->dither, 127, sizeof(ras->dither));
     else
       memcpy(ras->dither, threshold, sizeof(ras->dither));
+
+#ifdef XFORM_DITHER_AVX2
+    if (__builtin_cpu_supports("avx2"))
+      ras->dither_pixels = dither_avx2;
+    else
+#endif /* XFORM_DITHER_AVX2 */
+#ifdef XFORM_DITHER_SSE2
+    ras->dither_pixels = dither_sse2;
+#elif defined(XFORM_DITHER_NEON)
+    ras->dither_pixels = dither_neon;
+#endif /* XFORM_DITHER_SSE2 */
   }
 
   ras->header.cupsInteger[CUPS_RASTER_PWG_TotalPageCount]      = ras->copies * pages;
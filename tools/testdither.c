@@ -0,0 +1,137 @@
+/*
+ * Dither unit test program for ipptransform.
+ *
+ * Copyright © 2020 by the IEEE-ISTO Printer Working Group.
+ *
+ * Licensed under Apache License v2.0.  See the file "LICENSE" for more
+ * information.
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include <cups/string-private.h>
+#include "dither.h"
+
+
+/*
+ * Local functions...
+ */
+
+static int	do_dither_test(const char *name, xform_dither_cb_t cb);
+
+
+/*
+ * 'main()' - Test the vectorized dither functions against the scalar code.
+ */
+
+int					/* O - Exit status */
+main(void)
+{
+  int	errors = 0;			/* Number of errors */
+
+
+#ifdef XFORM_DITHER_SSE2
+  errors += do_dither_test("dither_sse2", dither_sse2);
+#endif /* XFORM_DITHER_SSE2 */
+
+#ifdef XFORM_DITHER_AVX2
+  if (__builtin_cpu_supports("avx2"))
+    errors += do_dither_test("dither_avx2", dither_avx2);
+  else
+    puts("dither_avx2: SKIP (no AVX2)");
+#endif /* XFORM_DITHER_AVX2 */
+
+#ifdef XFORM_DITHER_NEON
+  errors += do_dither_test("dither_neon", dither_neon);
+#endif /* XFORM_DITHER_NEON */
+
+#if !defined(XFORM_DITHER_SSE2) && !defined(XFORM_DITHER_NEON)
+  puts("dither_bits: SKIP (no vectorized dither functions)");
+#endif /* !XFORM_DITHER_SSE2 && !XFORM_DITHER_NEON */
+
+  return (errors);
+}
+
+
+/*
+ * 'do_dither_test()' - Compare a vectorized dither function with the scalar
+ *                      code for every dither row, column offset, and run
+ *                      length up to 256 pixels.
+ */
+
+static int				/* O - Number of errors */
+do_dither_test(const char        *name,	/* I - Function name */
+               xform_dither_cb_t cb)	/* I - Vectorized function */
+{
+  int		y,			/* Dither row */
+		left,			/* Left column */
+		inv;			/* Invert output? */
+  size_t	x,			/* Looping var */
+		count;			/* Number of pixels */
+  unsigned char	line[256],		/* Pixels */
+		thresholds[96],		/* Rotated thresholds */
+		expected[32],		/* Scalar output */
+		actual[32],		/* Vectorized output */
+		*expend,		/* End of scalar output */
+		*actend;		/* End of vectorized output */
+  unsigned	seed = 1;		/* Pixel generator state */
+
+
+  printf("%s: ", name);
+  fflush(stdout);
+
+  for (y = 0; y < 64; y ++)
+  {
+   /*
+    * Use random pixels plus the values on either side of each threshold...
+    */
+
+    for (x = 0; x < sizeof(line); x ++)
+    {
+      seed = seed * 1103515245 + 12345;
+
+      switch ((seed >> 16) & 3)
+      {
+        case 0 :
+            line[x] = threshold[y][x & 63];
+            break;
+        case 1 :
+            line[x] = (unsigned char)(threshold[y][x & 63] + 1);
+            break;
+        default :
+            line[x] = (unsigned char)(seed >> 24);
+            break;
+      }
+    }
+
+    for (left = 0; left < 64; left ++)
+    {
+      for (x = 0; x < sizeof(thresholds); x ++)
+        thresholds[x] = threshold[y][(left + x) & 63];
+
+      for (inv = 0; inv < 2; inv ++)
+      {
+        for (count = 0; count <= sizeof(line); count ++)
+        {
+          memset(expected, 0xaa, sizeof(expected));
+          memset(actual, 0x55, sizeof(actual));
+
+          expend = dither_bits(NULL, expected, line, thresholds, count, inv ? 255 : 0);
+          actend = dither_bits(cb, actual, line, thresholds, count, inv ? 255 : 0);
+
+          if ((expend - expected) != (actend - actual) || memcmp(expected, actual, (size_t)(expend - expected)))
+          {
+            printf("FAIL (y=%d, left=%d, count=%u, invert=%d)\n", y, left, (unsigned)count, inv ? 255 : 0);
+            return (1);
+          }
+        }
+      }
+    }
+  }
+
+  puts("PASS");
+
+  return (0);
+}
@@ -145,6 +145,15 @@ typedef unsigned long useconds_t;
 /* #undef HAVE_POSIX_SPAWN */
 
 
+/*
+ * Do we have fallocate, posix_fadvise, and splice?
+ */
+
+/* #undef HAVE_FALLOCATE */
+/* #undef HAVE_POSIX_FADVISE */
+/* #undef HAVE_SPLICE */
+
+
 /*
  * Do we have ZLIB?
  */
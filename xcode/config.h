@@ -55,6 +55,15 @@
 #define HAVE_POSIX_SPAWN 1
 
 
+/*
+ * Do we have fallocate, posix_fadvise, and splice?
+ */
+
+/* #undef HAVE_FALLOCATE */
+/* #undef HAVE_POSIX_FADVISE */
+/* #undef HAVE_SPLICE */
+
+
 /*
  * Do we have ZLIB?
  */